@@ -17,9 +17,41 @@ static long getlength (const unsigned char *s);
 static int trackReset (TrackT * track);
 
 static int playerCallback (void *data, unsigned int msec);
+static int playerRun (PlayerT * player, uint64 sampleTime);
 static int playerReset (PlayerT * player);
 static void playerUpdateTempo (PlayerT * player);
 
+/*
+ * playerTickSample
+ *
+ * The player sample time of 'tick' in the current tempo segment.
+ */
+static uint64 playerTickSample (PlayerT * player, unsigned int tick) {
+	double offset = ((double) tick - player->startTicks) * player->samplesPerTick;
+
+	if (offset < 0 && -offset > player->startSample)
+		return 0;
+	return player->startSample + (sint64) (offset + 0.5);
+}
+
+/*
+ * playerQueueEvent
+ */
+static void playerQueueEvent (PlayerT * player, TrackT * track, MidiEventT * event) {
+	uint64 frame = playerTickSample (player, track->ticks) + player->frameBase;
+	U8 p1 = event->param1 & 0x7f;
+	U8 p2 = event->param2 & 0x7f;
+
+	if (event->type == PITCH_BEND)			/* 14 bit value in param1 */
+		p2 = (event->param1 >> 7) & 0x7f;
+	if (synthQueueEvent (player->synth, frame, event->type, event->channel, p1, p2) != OK) {
+		/* queue full: better now than never */
+		player->playbackCallback (player->playbackUserdata, event);
+	}
+	if (event->type == NOTE_ON && event->param2 != 0)
+		player->channelIsplaying[event->channel] = TRUE;
+}
+
 /*
  * trackSendEvents
  */
@@ -54,6 +86,11 @@ static void trackSendEvents (TrackT * track, Synthesizer * synth, PlayerT * play
 		} else if (seeking && track->ticks != ticks
 							 && (event->type == NOTE_ON || event->type == NOTE_OFF)) {
 			/* skip on/off messages */
+		} else if (player->queueEvents && !seeking
+							 && player->playbackCallback == synthHandleMidiEvent
+							 && event->type >= NOTE_OFF && event->type <= PITCH_BEND) {
+			/* driven by playerAdvance: hand the synth the exact frame */
+			playerQueueEvent (player, track, event);
 		} else {
 			if (player->playbackCallback) {
 				player->playbackCallback (player->playbackUserdata, event);
@@ -68,6 +105,12 @@ static void trackSendEvents (TrackT * track, Synthesizer * synth, PlayerT * play
 			/* memorize the tempo change value coming from the MIDI file */
 			atomic_int_set (&player->miditempo, event->param1);
 			playerUpdateTempo (player);
+			if (player->queueEvents && !seeking) {
+				/* the new tempo segment starts at the tempo event, not at the
+				 * end of the span, or the following events would be late */
+				player->startSample = playerTickSample (player, track->ticks);
+				player->startTicks = track->ticks;
+			}
 		}
 
     track->cur = track->cur->next;
@@ -122,8 +165,10 @@ PlayerT *newPlayer (Synthesizer * synth) {
 	/* tempo multiplier */
 	player->multempo = 1.0F;
 
+	player->sampleRate = (U32) synth->sampleRate;
 	player->deltatime = 4.0;
-	player->curMsec = 0;
+	player->samplesPerTick = 4.0 * player->sampleRate / 1000.0;
+	player->curSample = 0;
 	player->curTicks = 0;
 	player->lastCallbackTicks = -1;
 	atomic_int_set (&player->seekTicks, -1);
@@ -237,6 +282,7 @@ int playerReset (PlayerT * player) {
 	player->division = 0;
 	player->miditempo = 500000;
 	player->deltatime = 4.0;
+	player->samplesPerTick = 4.0 * player->sampleRate / 1000.0;
 	return 0;
 }
 
@@ -441,7 +487,7 @@ void playerAdvancefile (PlayerT * player) {
 	}
 }
 
-void playerPlaylistLoad (PlayerT * player, unsigned int msec) {
+void playerPlaylistLoad (PlayerT * player, uint64 sampleTime) {
 	playlistItem *currentPlayitem;
 	int i;
 
@@ -461,8 +507,8 @@ void playerPlaylistLoad (PlayerT * player, unsigned int msec) {
 
 	/* Successfully loaded midi file */
 
-	player->beginMsec = msec;
-	player->startMsec = msec;
+	player->beginSample = sampleTime;
+	player->startSample = sampleTime;
 	player->startTicks = 0;
 	player->curTicks = 0;
 
@@ -475,15 +521,46 @@ void playerPlaylistLoad (PlayerT * player, unsigned int msec) {
 
 /*
  * playerCallback
+ *
+ * System timer entry point; the timer's msec are turned into sample time.
  */
 int playerCallback (void *data, unsigned int msec) {
+	PlayerT *player = (PlayerT *) data;
+
+	return playerRun (player, (uint64) msec * player->sampleRate / 1000);
+}
+
+/*
+ * playerAdvance
+ *
+ * Runs the player to the end of the next 'nFrames'.  The channel events in
+ * there are queued on the synth at their own frame (see synthQueueEvent),
+ * so this has to be called right before those frames are rendered.
+ */
+int playerAdvance (PlayerT * player, U32 nFrames) {
+	int status;
+
+	/* maps player sample time to synth frames; wraps harmlessly */
+	player->frameBase = synthGetFrameTime (player->synth) - player->curSample;
+	player->queueEvents = 1;
+	status = playerRun (player, player->curSample + nFrames);
+	player->queueEvents = 0;
+	return status;
+}
+
+/*
+ * playerRun
+ *
+ * Sends everything that is due at 'sampleTime'.  The tick position is
+ * worked out from the samples passed since the last tempo change, so it
+ * doesn't depend on how often or how regularly the player is run.
+ */
+static int playerRun (PlayerT * player, uint64 sampleTime) {
 	int i;
 	int loadnextfile;
 	int status = PLAYER_DONE;
 	midiEventT muteEvent;
-	PlayerT *player;
 	Synthesizer *synth;
-	player = (PlayerT *) data;
 	synth = player->synth;
 
 	loadnextfile = player->currentfile == NULL ? 1 : 0;
@@ -505,25 +582,23 @@ int playerCallback (void *data, unsigned int msec) {
 		return 1;
 	}
 	do {
-		float deltatime;
 		int seekTicks;
 
 		if (loadnextfile) {
 			loadnextfile = 0;
-			playerPlaylistLoad (player, msec);
+			playerPlaylistLoad (player, sampleTime);
 
 			if (player->currentfile == NULL) {
 				return 0;
 			}
 		}
 
-		player->curMsec = msec;
-		deltatime = atomicFloatGet (&player->deltatime);
+		player->curSample = sampleTime;
 		player->curTicks = (player->startTicks
 												 +
 												 (int) ((double)
-																(player->curMsec - player->startMsec)
-																/ deltatime + 0.5));	/* 0.5 to average overall error when casting */
+																(player->curSample - player->startSample)
+																/ player->samplesPerTick + 0.5));	/* 0.5 to average overall error when casting */
 
 		seekTicks = atomicIntGet (&player->seekTicks);
 		if (seekTicks >= 0) {
@@ -546,15 +621,19 @@ int playerCallback (void *data, unsigned int msec) {
 		if (seekTicks >= 0) {
 			player->startTicks = seekTicks;	/* tick position of last tempo value (which is now) */
 			player->curTicks = seekTicks;
-			player->beginMsec = msec;	/* only used to calculate the duration of playing */
-			player->startMsec = msec;	/* should be the (synth)-time of the last tempo change */
+			player->beginSample = sampleTime;	/* only used to calculate the duration of playing */
+			player->startSample = sampleTime;	/* should be the (synth)-time of the last tempo change */
 			atomic_int_set (&player->seekTicks, -1);	/* clear seekTicks */
 		}
 
 		if (status == PLAYER_DONE) {
 
 			if (player->resetSynthBetweenSongs) {
-				synthSystemReset (player->synth);
+				/* playerAdvance runs on the renderer, the timer on a thread of its own */
+				if (player->queueEvents)
+					synthHandleEvent (player->synth, MIDI_SYSTEM_RESET, 0, 0, 0);
+				else
+					synthSystemReset (player->synth);
 			}
 
 			loadnextfile = 1;
@@ -694,24 +773,25 @@ int playerSetLoop (PlayerT * player, int loop) {
  */
 static void playerUpdateTempo (PlayerT * player) {
 	int tempo;										/* tempo in micro seconds by quarter note */
-	float deltatime;
+	double usecPerTick;
 
 	if (atomicIntGet (&player->syncMode)) {
 		/* take internal tempo from MIDI file */
 		tempo = atomicIntGet (&player->miditempo);
-		/* compute deltattime (in ms) from current tempo and apply tempo multiplier */
-		deltatime = (float) tempo / (float) player->division / (float) 1000.0;
-		deltatime /= atomicFloatGet (&player->multempo);	/* multiply tempo */
+		/* compute usec per tick from current tempo and apply tempo multiplier */
+		usecPerTick = (double) tempo / player->division;
+		usecPerTick /= atomicFloatGet (&player->multempo);	/* multiply tempo */
 	} else {
 		/* take  external tempo */
 		tempo = atomicIntGet (&player->exttempo);
-		/* compute deltattime (in ms) from current tempo */
-		deltatime = (float) tempo / (float) player->division / (float) 1000.0;
+		/* compute usec per tick from current tempo */
+		usecPerTick = (double) tempo / player->division;
 	}
 
-	atomicFloatSet (&player->deltatime, deltatime);
+	atomicFloatSet (&player->deltatime, (float) (usecPerTick / 1000.0));
+	player->samplesPerTick = usecPerTick * player->sampleRate / 1000000.0;
 
-	player->startMsec = player->curMsec;
+	player->startSample = player->curSample;
 	player->startTicks = player->curTicks;
 
 
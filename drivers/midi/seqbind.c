@@ -11,6 +11,11 @@ struct _SeqbindT {
     SampleimerT *sampleTimer;
     seqIdT clientId;
     void* noteContainer;
+    /* sample timer mode: the sequencer runs one block ahead of the synth */
+    unsigned int lookaheadMsec;
+    uint64 blockFrame;        /* synth frame at the last timer callback */
+    /* system timer mode: the sequencer runs on its own thread */
+    synthCmdQueueT *cmdQueue;
 };
 typedef struct _SeqbindT seqbindT;
 
@@ -90,6 +95,8 @@ seqIdT sequencerRegistersynth(sequencerT *seq, Synthesizer *synth) {
 
     /* set up the sample timer */
     if(!sequencerGetUseSystemTimer(seq)) {
+        seqbind->lookaheadMsec = (unsigned int) ceil(BUFSIZE * 1000.0 / synth->sampleRate);
+
         seqbind->sampleTimer =
             new_Sampleimer(synth, seqbindTimerCallback, (void *) seqbind);
 
@@ -98,6 +105,15 @@ seqIdT sequencerRegistersynth(sequencerT *seq, Synthesizer *synth) {
             FREE(seqbind);
             return FAILED;
         }
+    } else {
+        /* owned by the synth, it goes away with it */
+        seqbind->cmdQueue = synthNewCmdQueue(synth);
+
+        if(seqbind->cmdQueue == NULL) {
+            LOG(ERR, "sequencer: The synth has no command queue left\n");
+            FREE(seqbind);
+            return FAILED;
+        }
     }
 
     seqbind->noteContainer = newNoteContainer();
@@ -120,13 +136,45 @@ seqIdT sequencerRegistersynth(sequencerT *seq, Synthesizer *synth) {
     return seqbind->clientId;
 }
 
-/* Callback for sample timer */
+/* Callback for sample timer, at the start of every block.  The sequencer
+ * is run a block ahead, so everything due inside the block about to be
+ * rendered reaches seqsynthCallback in time to be queued for its frame. */
 int seqbindTimerCallback(void *data, unsigned int msec) {
     seqbindT *seqbind = (seqbindT *) data;
-    sequencerProcess(seqbind->seq, msec);
+    seqbind->blockFrame = seqbind->synth->blockFrame;
+    sequencerProcess(seqbind->seq, msec + seqbind->lookaheadMsec);
     return 1;
 }
 
+/* Sends a channel message to the synth.  With the sample timer it is
+ * queued for the frame of the event's own timestamp; 'now' is the
+ * sequencer tick at the end of the lookahead.  With the system timer it
+ * goes through the binding's command queue. */
+static void seqbindSend(seqbindT *seqbind, sequencerT *seq, unsigned int now, eventT *evt,
+                        U8 type, int chan, int p1, int p2) {
+    Synthesizer *synth = seqbind->synth;
+    double rate = synth->sampleRate;
+    uint64 ahead = (uint64)(seqbind->lookaheadMsec * rate / 1000.0);
+    uint64 frame;
+    double late;
+
+    if(seqbind->sampleTimer == NULL) {
+        /* not on the audio thread: hand it over */
+        if(synthCmdQueuePush(seqbind->cmdQueue, 0, type, chan, p1, p2) != OK)
+            LOG(WARN, "sequencer: Command queue full, event dropped\n");
+        return;
+    }
+
+    /* how far the event lies before the end of the lookahead, in frames */
+    late = ((double) now - eventGetTime(evt)) * rate / sequencerGetTimeScale(seq);
+    if(late < 0)
+        late = 0;
+    frame = seqbind->blockFrame + (late < ahead ? ahead - (uint64)late : 0);
+
+    if(synthQueueEvent(synth, frame, type, chan, p1, p2) != OK)
+        synthHandleEvent(synth, type, chan, p1, p2);
+}
+
 /* Callback for midi events */
 void seqsynthCallback(unsigned int time, eventT *evt, sequencerT *seq, void *data) {
     Synthesizer synth = seqbind->synth;
@@ -135,7 +183,7 @@ void seqsynthCallback(unsigned int time, eventT *evt, sequencerT *seq, void *dat
     switch(eventGetType(evt))
     {
     case SEQ_NOTEON:
-        synthNoteon(synth, eventGetChannel(evt), eventGetKey(evt), eventGetVelocity(evt));
+        seqbindSend(seqbind, seq, time, evt, NOTE_ON, eventGetChannel(evt), eventGetKey(evt), eventGetVelocity(evt));
         break;
 
     case SEQ_NOTEOFF:
@@ -145,7 +193,7 @@ void seqsynthCallback(unsigned int time, eventT *evt, sequencerT *seq, void *dat
         {
             noteContainerRemove(seqbind->noteContainer, id);
         }
-        synthNoteoff(synth, eventGetChannel(evt), eventGetKey(evt));
+        seqbindSend(seqbind, seq, time, evt, NOTE_OFF, eventGetChannel(evt), eventGetKey(evt), 0);
     }
     break;
 
@@ -174,10 +222,13 @@ void seqsynthCallback(unsigned int time, eventT *evt, sequencerT *seq, void *dat
             // Note not playing, all good.
         }
 
+        /* the note's own time, the sequencer clock is ahead in sample timer mode */
+        unsigned int at = eventGetTime(evt) + dur;
+
         eventNoteoff(evt, chan, key);
         eventSetId(evt, id);
 
-        res = sequencerSendAt(seq, evt, dur, 0);
+        res = sequencerSendAt(seq, evt, at, 1);
         if(res == FAILED)
         {
             err:
@@ -185,7 +236,9 @@ void seqsynthCallback(unsigned int time, eventT *evt, sequencerT *seq, void *dat
             return;
         }
 
-        synthNoteon(synth, chan, key, vel);
+        /* sequencerSendAt stamped evt with the note-off time */
+        eventSetTime(evt, at - dur);
+        seqbindSend(seqbind, seq, time, evt, NOTE_ON, chan, key, vel);
     }
     break;
 
@@ -204,7 +257,7 @@ void seqsynthCallback(unsigned int time, eventT *evt, sequencerT *seq, void *dat
         break;
 
     case SEQ_PROGRAMCHANGE:
-        synthProgramChange(synth, eventGetChannel(evt), eventGetProgram(evt));
+        seqbindSend(seqbind, seq, time, evt, PROGRAM_CHANGE, eventGetChannel(evt), eventGetProgram(evt), 0);
         break;
 
     case SEQ_PROGRAMSELECT:
@@ -216,7 +269,8 @@ void seqsynthCallback(unsigned int time, eventT *evt, sequencerT *seq, void *dat
         break;
 
     case SEQ_PITCHBEND:
-        synthPitchBend(synth, eventGetChannel(evt), eventGetPitch(evt));
+        seqbindSend(seqbind, seq, time, evt, PITCH_BEND, eventGetChannel(evt),
+                    eventGetPitch(evt) & 0x7f, (eventGetPitch(evt) >> 7) & 0x7f);
         break;
 
     case SEQ_PITCHWHEELSENS:
@@ -224,46 +278,44 @@ void seqsynthCallback(unsigned int time, eventT *evt, sequencerT *seq, void *dat
         break;
 
     case SEQ_CONTROLCHANGE:
-        synthCc(synth, eventGetChannel(evt), eventGetControl(evt), eventGetValue(evt));
+        seqbindSend(seqbind, seq, time, evt, CONTROL_CHANGE, eventGetChannel(evt), eventGetControl(evt), eventGetValue(evt));
         break;
 
     case SEQ_MODULATION:
-        synthCc(synth, eventGetChannel(evt), MODULATION_MSB, eventGetValue(evt));
+        seqbindSend(seqbind, seq, time, evt, CONTROL_CHANGE, eventGetChannel(evt), MODULATION_MSB, eventGetValue(evt));
         break;
 
     case SEQ_SUSTAIN:
-        synthCc(synth, eventGetChannel(evt), SUSTAIN_SWITCH, eventGetValue(evt));
+        seqbindSend(seqbind, seq, time, evt, CONTROL_CHANGE, eventGetChannel(evt), SUSTAIN_SWITCH, eventGetValue(evt));
         break;
 
     case SEQ_PAN:
-        synthCc(synth, eventGetChannel(evt), PAN_MSB, eventGetValue(evt));
+        seqbindSend(seqbind, seq, time, evt, CONTROL_CHANGE, eventGetChannel(evt), PAN_MSB, eventGetValue(evt));
         break;
 
     case SEQ_VOLUME:
-        synthCc(synth, eventGetChannel(evt), VOLUME_MSB, eventGetValue(evt));
+        seqbindSend(seqbind, seq, time, evt, CONTROL_CHANGE, eventGetChannel(evt), VOLUME_MSB, eventGetValue(evt));
         break;
 
     case SEQ_REVERBSEND:
-        synthCc(synth, eventGetChannel(evt), EFFECTS_DEPTH1, eventGetValue(evt));
+        seqbindSend(seqbind, seq, time, evt, CONTROL_CHANGE, eventGetChannel(evt), EFFECTS_DEPTH1, eventGetValue(evt));
         break;
 
     case SEQ_CHORUSSEND:
-        synthCc(synth, eventGetChannel(evt), EFFECTS_DEPTH3, eventGetValue(evt));
+        seqbindSend(seqbind, seq, time, evt, CONTROL_CHANGE, eventGetChannel(evt), EFFECTS_DEPTH3, eventGetValue(evt));
         break;
 
     case SEQ_CHANNELPRESSURE:
-        synthChannelPressure(synth, eventGetChannel(evt), eventGetValue(evt));
+        seqbindSend(seqbind, seq, time, evt, CHANNEL_PRESSURE, eventGetChannel(evt), eventGetValue(evt), 0);
         break;
 
     case SEQ_KEYPRESSURE:
-        synthKeyPressure(synth,
-                                 eventGetChannel(evt),
-                                 eventGetKey(evt),
-                                 eventGetValue(evt));
+        seqbindSend(seqbind, seq, time, evt, KEY_PRESSURE,
+                    eventGetChannel(evt), eventGetKey(evt), eventGetValue(evt));
         break;
 
     case SEQ_SYSTEMRESET:
-        synthSystemReset(synth);
+        seqbindSend(seqbind, seq, time, evt, MIDI_SYSTEM_RESET, 0, 0, 0);
         break;
 
     case SEQ_UNREGISTERING: /* free ourselves */
@@ -0,0 +1,174 @@
+/* batchCheck
+ *
+ * Regression check for the batched voice path: two synths get the same
+ * voices, one is rendered voice by voice with voiceWrite (which mixes with
+ * voiceMix), the other through voiceBatchBegin / voiceBatchWrite /
+ * voiceBatchFlush, and every block's dry, reverb and chorus buffers have
+ * to match bit for bit.  The voices differ in pan, filter and sends, some
+ * blocks are split into spans, some voices are released and a few run off
+ * the end of an unlooped sample inside a span.  `make check` builds it
+ * against a float-bus and a S16-bus library and runs both.
+ *
+ *   batchCheck [nVoices] [blocks] [interpMethod]
+ *
+ * Exits non-zero at the first block that differs.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include "synth.h"
+#include "voice.h"
+
+#define SAMPLE_RATE 44100
+#define TABLE_LEN   4410   /* exactly 10 periods of 100 Hz at 44.1 kHz */
+#define SHORT_LEN   1000   /* the unlooped sample, ends within a few blocks */
+#define PAD         8      /* guard points for the 4th/7th order interpolators */
+#define MAX_VOICES  256
+
+static S16 pcm[TABLE_LEN + 2 * PAD];
+
+typedef struct {
+	Synthesizer *synth;
+	Voice *voice[MAX_VOICES];
+	busT left[BUFSIZE], right[BUFSIZE];
+	busT reverb[BUFSIZE], chorus[BUFSIZE];
+} checkSideT;
+
+/*
+ * checkStart
+ *
+ * The same voices, in the same order, on either side.
+ */
+static int checkStart (checkSideT * side, Sample * looped, Sample * unlooped, int nVoices, int interp) {
+	Voice *voice;
+	int i;
+
+	side->synth = newSynth ();
+	if (side->synth == NULL)
+		return FAILED;
+	synthSetInterpMethod (side->synth, -1, interp);
+
+	for (i = 0; i < nVoices; i++) {
+		voice = synthAllocVoice (side->synth, i % 5 == 4 ? unlooped : looped,
+		                         i % 16, 36 + (i * 7) % 48, 64 + (i * 13) % 64);
+		if (voice == NULL)
+			return FAILED;
+		voice->gen[GEN_SAMPLEMODE].val = i % 5 == 4 ? UNLOOPED : LOOP_DURING_RELEASE;
+		voice->gen[GEN_PAN].val = (i * 97) % 1001 - 500;
+		voice->gen[GEN_FILTERFC].val = i % 3 ? 4000 + (i * 331) % 9000 : 13500;
+		voice->gen[GEN_FILTERQ].val = (i * 37) % 240;
+		voice->gen[GEN_REVERBSEND].val = i % 2 ? (i * 53) % 1000 : 0;
+		voice->gen[GEN_CHORUSSEND].val = i % 4 ? 0 : (i * 71) % 1000;
+		synthStartVoice (side->synth, voice);
+		side->voice[i] = voice;
+	}
+	return OK;
+}
+
+/*
+ * checkSpan
+ *
+ * Frames [start, start + n) of the block, one way or the other.
+ */
+static void checkSpan (checkSideT * side, int nVoices, int batched, int start, int n) {
+	voiceBatchT batch;
+	Voice *voice;
+	int i;
+
+	if (batched)
+		voiceBatchBegin (&batch, start, n);
+	for (i = 0; i < nVoices; i++) {
+		voice = side->voice[i];
+		if (!_PLAYING (voice))
+			continue;
+		if (batched)
+			voiceBatchWrite (&batch, voice, side->left, side->right, side->reverb, side->chorus);
+		else
+			voiceWrite (voice, start, n, side->left, side->right, side->reverb, side->chorus);
+	}
+	if (batched)
+		voiceBatchFlush (&batch);
+}
+
+int main (int argc, char *argv[]) {
+	int nVoices = argc > 1 ? atoi (argv[1]) : 61;
+	int blocks = argc > 2 ? atoi (argv[2]) : 2000;
+	int interp = argc > 3 ? atoi (argv[3]) : INTERP_4THORDER;
+	static checkSideT side[2];
+	Sample looped, unlooped;
+	int i, b, s, split, nPlaying;
+
+	if (nVoices < 1 || nVoices > MAX_VOICES) {
+		fprintf (stderr, "batchCheck: 1 to %d voices\n", MAX_VOICES);
+		return 2;
+	}
+
+	for (i = 0; i < TABLE_LEN + 2 * PAD; i++)
+		pcm[i] = (S16) (32767.0 * sin (2.0 * M_PI * (i - PAD) / (TABLE_LEN / 10)));
+
+	MEMSET (&looped, 0, sizeof (Sample));
+	looped.origPitch = 43;
+	looped.pcmDataP = pcm;
+	looped.startIdx = PAD;
+	looped.endIdx = PAD + TABLE_LEN;
+	looped.loopStartIdx = PAD;
+	looped.loopEndIdx = PAD + TABLE_LEN;
+	unlooped = looped;
+	unlooped.endIdx = PAD + SHORT_LEN;
+	unlooped.loopEndIdx = PAD + SHORT_LEN;
+
+	synthSettings.synthPolyphony.val = nVoices;
+	synthSettings.synthSampleRate.val = SAMPLE_RATE;
+	synthSettings.synthRenderThreads.val = 0;
+	for (s = 0; s < 2; s++) {
+		if (checkStart (&side[s], &looped, &unlooped, nVoices, interp) != OK) {
+			fprintf (stderr, "batchCheck: couldn't set up the voices\n");
+			return 2;
+		}
+	}
+
+	for (b = 0; b < blocks; b++) {
+		/* every third block in two spans, at a different frame each time */
+		split = b % 3 == 1 ? 1 + (b * 17) % (BUFSIZE - 1) : BUFSIZE;
+
+		for (s = 0; s < 2; s++) {
+			MEMSET (side[s].left, 0, sizeof (side[s].left));
+			MEMSET (side[s].right, 0, sizeof (side[s].right));
+			MEMSET (side[s].reverb, 0, sizeof (side[s].reverb));
+			MEMSET (side[s].chorus, 0, sizeof (side[s].chorus));
+
+			checkSpan (&side[s], nVoices, s, 0, split);
+			/* a release inside the block, as a queued note-off would */
+			if (b % 50 == 25)
+				voiceNoteoff (side[s].voice[(b / 50) % nVoices]);
+			if (split < BUFSIZE)
+				checkSpan (&side[s], nVoices, s, split, BUFSIZE - split);
+		}
+
+		if (memcmp (side[0].left, side[1].left, sizeof (side[0].left))
+				|| memcmp (side[0].right, side[1].right, sizeof (side[0].right))
+				|| memcmp (side[0].reverb, side[1].reverb, sizeof (side[0].reverb))
+				|| memcmp (side[0].chorus, side[1].chorus, sizeof (side[0].chorus))) {
+			printf ("batchCheck: block %d differs (split at %d)\n", b, split);
+			return 1;
+		}
+	}
+
+	for (i = 0, nPlaying = 0; i < nVoices; i++)
+		nPlaying += _PLAYING (side[0].voice[i]) != 0;
+
+#if defined(WITH_S16_BUS)
+	printf ("bus:              S16\n");
+#else
+	printf ("bus:              float\n");
+#endif
+	printf ("block size:       %d\n", BUFSIZE);
+	printf ("voices:           %d (%d still playing)\n", nVoices, nPlaying);
+	printf ("blocks:           %d, identical\n", blocks);
+
+	for (s = 0; s < 2; s++)
+		deleteSynth (side[s].synth);
+	return 0;
+}
@@ -0,0 +1,108 @@
+/* busBench
+ *
+ * Renders a stack of looping synthetic voices through the mix bus and
+ * reports what a voice costs per output sample, plus how much of the
+ * output had to be clipped.  The library's bus type is chosen at build
+ * time, so `make bench` builds this twice (float bus and WITH_S16_BUS)
+ * and runs both back to back.  The control-rate block size is a build
+ * option too (`make bench block=128`).
+ *
+ *   busBench [nVoices] [seconds] [interpMethod] [renderThreads]
+ *
+ * renderThreads > 0 renders the voices through the render pool (see
+ * render_pool.h); the output is the same for any thread count.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <math.h>
+
+#include "synth.h"
+#include "voice.h"
+
+#define SAMPLE_RATE 44100
+#define TABLE_LEN   4410   /* exactly 10 periods of 100 Hz at 44.1 kHz */
+#define PAD         8      /* guard points for the 4th/7th order interpolators */
+#define CHUNK       512
+
+static S16 pcm[TABLE_LEN + 2 * PAD];
+
+static double nowSec (void) {
+	struct timespec ts;
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main (int argc, char *argv[]) {
+	int nVoices = argc > 1 ? atoi (argv[1]) : 64;
+	double seconds = argc > 2 ? atof (argv[2]) : 10.0;
+	int interp = argc > 3 ? atoi (argv[3]) : INTERP_4THORDER;
+	int threads = argc > 4 ? atoi (argv[4]) : 0;
+	S16 left[CHUNK], right[CHUNK];
+	Synthesizer *synth;
+	Sample sample;
+	Voice *voice;
+	long frames, total, clipped = 0;
+	int i, nStarted, peak = 0;
+	double t0, elapsed;
+
+	for (i = 0; i < TABLE_LEN + 2 * PAD; i++)
+		pcm[i] = (S16) (32767.0 * sin (2.0 * M_PI * (i - PAD) / (TABLE_LEN / 10)));
+
+	MEMSET (&sample, 0, sizeof (Sample));
+	sample.origPitch = 43;         /* ~100 Hz, close enough for a benchmark */
+	sample.pcmDataP = pcm;
+	sample.startIdx = PAD;
+	sample.endIdx = PAD + TABLE_LEN;
+	sample.loopStartIdx = PAD;
+	sample.loopEndIdx = PAD + TABLE_LEN;
+
+	synthSettings.synthPolyphony.val = nVoices;
+	synthSettings.synthSampleRate.val = SAMPLE_RATE;
+	synthSettings.synthRenderThreads.val = threads;
+	synth = newSynth ();
+	if (synth == NULL) {
+		fprintf (stderr, "busBench: couldn't create synth\n");
+		return 1;
+	}
+	synthSetInterpMethod (synth, -1, interp);
+
+	/* Full velocity, spread over a few octaves so the voices don't phase-lock. */
+	for (nStarted = 0; nStarted < nVoices; nStarted++) {
+		voice = synthAllocVoice (synth, &sample, nStarted % 16, 36 + (nStarted * 7) % 48, 127);
+		if (voice == NULL)
+			break;
+		voice->gen[GEN_SAMPLEMODE].val = LOOP_DURING_RELEASE;
+		synthStartVoice (synth, voice);
+	}
+
+	total = (long) (seconds * SAMPLE_RATE);
+	t0 = nowSec ();
+	for (frames = 0; frames < total; frames += CHUNK) {
+		synthWriteS16 (synth, CHUNK, left, 0, 1, right, 0, 1);
+		for (i = 0; i < CHUNK; i++) {
+			if (abs (left[i]) > peak)
+				peak = abs (left[i]);
+			if (left[i] == 32767 || left[i] == -32768)
+				clipped++;
+		}
+	}
+	elapsed = nowSec () - t0;
+
+#if defined(WITH_S16_BUS)
+	printf ("bus:              S16\n");
+#else
+	printf ("bus:              float\n");
+#endif
+	printf ("block size:       %d\n", BUFSIZE);
+	printf ("voices:           %d\n", nStarted);
+	printf ("render threads:   %d\n", threads);
+	printf ("rendered:         %.1f s audio in %.3f s (%.1fx realtime)\n",
+					(double) frames / SAMPLE_RATE, elapsed, frames / (elapsed * SAMPLE_RATE));
+	printf ("per voice-sample: %.2f ns\n", elapsed * 1e9 / ((double) frames * nStarted));
+	printf ("peak:             %d\n", peak);
+	printf ("clipped samples:  %ld (%.3f%%)\n", clipped, 100.0 * clipped / frames);
+
+	deleteSynth (synth);
+	return 0;
+}
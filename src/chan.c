@@ -27,6 +27,11 @@ struct _Channel* newChannel (Synthesizer* synthP, int chanNum) {
 	chanP->synth = synthP;
 	chanP->channum = chanNum;
 	chanP->presetP = NULL;
+	chanP->presetIndexP = NULL;
+	chanP->fxBus = 0;
+	MEMSET (chanP->modPending, 0, sizeof (chanP->modPending));
+	MEMSET (chanP->keyPressurePending, 0, sizeof (chanP->keyPressurePending));
+	chanP->modAllPending = chanP->modAnyPending = 0;
 
 	channelInit (chanP);
 	channelInitCtrl (chanP, 0);
@@ -39,6 +44,7 @@ void channelInit (Channel * chanP) {
 	chanP->banknum = 0;
 	chanP->sfontnum = 0;
   chanP->presetP = &chanP->synth->soundfontP->bankA[chanP->banknum].presetA[chanP->prognum];
+	chanP->presetIndexP = NULL;  // rebuilt on the next note-on
 	chanP->interpMethod = INTERP_DEFAULT;
 	chanP->tuning = NULL;
 	chanP->nrpnSelect = 0;
@@ -166,7 +172,8 @@ void channelCc (Channel * chanP, int ccId, int value) {
 
 	case ALL_CTRL_OFF:
 		channelInitCtrl (chanP, 1);
-		synthModulateVoicesAll (chanP->synth, chanP->channum);
+		chanP->modAllPending = chanP->modAnyPending = 1;
+		chanP->synth->modPending = 1;
 		break;
 
 	case DATA_ENTRY_MSB:
@@ -234,7 +241,7 @@ void channelCc (Channel * chanP, int ccId, int value) {
 		break;
 
 	default:
-		synthModulateVoices (chanP->synth, chanP->channum, 1, ccId);  // 1 = isCc (what's cc?)
+		channelModulateLater (chanP, 1, ccId);  // 1 = isCc (what's cc?)
 	}
 }
 
@@ -243,7 +250,7 @@ void channelCc (Channel * chanP, int ccId, int value) {
  */
 void channelPressure (Channel * chanP, int val) {
 	chanP->channelPressure = val;
-	synthModulateVoices (chanP->synth, chanP->channum, 0, MOD_CHANNELPRESSURE);
+	channelModulateLater (chanP, 0, MOD_CHANNELPRESSURE);
 }
 
 /*
@@ -251,7 +258,7 @@ void channelPressure (Channel * chanP, int val) {
  */
 void channelPitchBend (Channel * chanP, int val) {
 	chanP->pitchBend = val;
-	synthModulateVoices (chanP->synth, chanP->channum, 0, MOD_PITCHWHEEL);
+	channelModulateLater (chanP, 0, MOD_PITCHWHEEL);
 }
 
 /*
@@ -259,6 +266,30 @@ void channelPitchBend (Channel * chanP, int val) {
  */
 void channelPitchWheelSens (Channel * chanP, int val) {
 	chanP->pitchWheelSensitivity = val;
-	synthModulateVoices (chanP->synth, chanP->channum, 0, MOD_PITCHWHEELSENS);
+	channelModulateLater (chanP, 0, MOD_PITCHWHEELSENS);
+}
+
+/*
+ * channelModulateLater
+ *
+ * Notes that controller 'ctrl' changed.  A burst of changes to the same
+ * controller within a span costs one modulation per voice, not one per
+ * message.
+ */
+void channelModulateLater (Channel * chanP, int isCc, int ctrl) {
+	int src = (isCc ? 128 : 0) + (ctrl & 0x7f);
+
+	chanP->modPending[src >> 5] |= 1u << (src & 31);
+	chanP->modAnyPending = 1;
+	chanP->synth->modPending = 1;
+}
+
+/*
+ * channelKeyPressureLater
+ */
+void channelKeyPressureLater (Channel * chanP, int key) {
+	chanP->keyPressurePending[(key & 0x7f) >> 5] |= 1u << (key & 31);
+	chanP->modAnyPending = 1;
+	chanP->synth->modPending = 1;
 }
 
@@ -54,88 +54,64 @@
  * filter (sinc function).  To make it work with a small number of
  * samples, the sinc function is windowed (Hamming window).
  *
+ * The delay line is a power of two long and mirrored behind itself, so the
+ * INTERPOLATION_SAMPLES taps of any read position are contiguous.  They are
+ * padded to one vector of CHORUS_TAPS with zero coefficients, which makes
+ * the interpolation one vector multiply.
+ *
+ * The LFO is evaluated twice per block and chorus voice, at the block's
+ * start and end; in between the delay moves linearly.  Even at
+ * MAX_SPEED_HZ a 256 frame block is a tiny fraction of the LFO period.
+ *
+ * A quiet send is not processed: after the last audible input has left
+ * the delay line, the line is cleared and the chorus idles until the
+ * input comes back.
  */
 
 #include "chorus.h"
 #include "soundfont.h"
 
-/* Length of one delay line in samples:
- * Set through MAX_SAMPLES_LN2.
- * For example:
- * MAX_SAMPLES_LN2=12
- * => MAX_SAMPLES=pow(2,12)=4096
- * => MAX_SAMPLES_ANDMASK=4095
- */
-#define MAX_SAMPLES_LN2 12
-
-#define MAX_SAMPLES (1 << (MAX_SAMPLES_LN2-1))
-#define MAX_SAMPLES_ANDMASK (MAX_SAMPLES-1)
-
+/* a quarter of a 16 bit LSB at the output */
+#define CHORUS_NOISE_FLOOR (0.25f * BUS_NORM)
 
-/* Interpolate how many steps between samples? Must be power of two
-   For example: 8 => use a resolution of 256 steps between any two
-   samples
-*/
-#define INTERPOLATION_SUBSAMPLES_LN2 8
-#define INTERPOLATION_SUBSAMPLES (1 << (INTERPOLATION_SUBSAMPLES_LN2-1))
-#define INTERPOLATION_SUBSAMPLES_ANDMASK (INTERPOLATION_SUBSAMPLES-1)
+/* Longest delay, in samples.  The block is written into the line before
+ * any of it is read, so the oldest sample read must not be overwritten by
+ * the same block. */
+#define CHORUS_MAX_DELAY (MAX_SAMPLES - BUFSIZE - INTERPOLATION_SAMPLES)
 
-/* Use how many samples for interpolation? Must be odd.  '7' sounds
-   relatively clean, when listening to the modulated delay signal
-   alone.  For a demo on aliasing try '1' With '3', the aliasing is
-   still quite pronounced for some input frequencies
-*/
-#define INTERPOLATION_SAMPLES 5
-
-/* Private data for SKEL file */
-
-
-void chorusTriangle (int *buf, int len, int depth);
-void chorusSine (int *buf, int len, int depth);
+typedef float chorusTapsT __attribute__ ((vector_size (CHORUS_TAPS * sizeof (float)), aligned (sizeof (float))));
 
 // MB: I was wrong to get worked up about this. newChorus() is only called at synth creation time.
-Chorus *newChorus (S16 sampleRate) {
+Chorus *newChorus (realT sampleRate) {
 	Chorus *chorus = NEW (Chorus);
 	if (chorus == NULL) 
 		return NULL;
 	MEMSET (chorus, 0, sizeof (Chorus));
 	chorus->sampleRate = sampleRate;
-  // Currently makes a 5 x 128 (640) array.
+
 	/* Lookup table for the SI function (impulse response of an ideal low pass) */
-	/* i: Offset in terms of whole samples */
-	for (int i = 0; i < INTERPOLATION_SAMPLES; ++i) {
-		/* ii: Offset in terms of fractional samples ('subsamples') */
-		for (int ii = 0; ii < INTERPOLATION_SUBSAMPLES; +ii) {
+	/* ii: Offset in terms of fractional samples ('subsamples') */
+	for (int ii = 0; ii < INTERPOLATION_SUBSAMPLES; ++ii) {
+		/* i: Offset in terms of whole samples, tap i reads i samples back */
+		for (int i = 0; i < INTERPOLATION_SAMPLES; ++i) {
+			float *coeff = &chorus->sincTable[ii][INTERPOLATION_SAMPLES - 1 - i];
 			/* Move the origin into the center of the table */
-                           // i - 5/2 + ii/128
 			double iShifted =    ((double) i - ((double) INTERPOLATION_SAMPLES) / 2.
 													+ (double) ii / (double) INTERPOLATION_SUBSAMPLES);
 			if (fabs (iShifted) < 0.000001) {
 				/* sinc(0) cannot be calculated straightforward (limit needed
 				   for 0/0) */
-				chorus->sincTable[i][ii] = (S16) 1.;
+				*coeff = 1.f;
 			} else {
-        // sine is a 0-1 function being scaled down even further.
-        // So when you multiply it by a cosine function also with 0-1 range,
-        // you're going to get a very small number for lots of these.
-        // That means we're going to have to figure out how to handle possible 
-        // fixed point arithmetic *overflow*.
-        // TODO: understand what the hell is going on here. Accomplish tonight's goal first.
-				chorus->sincTable[i][ii] = (S16) sin (iShifted * M_PI) / (M_PI * iShifted);
-				/* Hamming window */
-				chorus->sincTable[i][ii] *=
-					(S16) 0.5 *(1.0 + cos (2.0 * M_PI * iShifted / (S16) INTERPOLATION_SAMPLES));
-			};
-		};
-	};
-
-	/* allocate lookup tables */
-	chorus->lookupTab = ARRAY (int, (int) (chorus->sampleRate / MIN_SPEED_HZ));
-	if (chorus->lookupTab == NULL) 
-		goto errorRecovery;
+				*coeff = (float) (sin (iShifted * M_PI) / (M_PI * iShifted)
+				                  /* Hamming window */
+				                  * 0.5 * (1.0 + cos (2.0 * M_PI * iShifted / (double) INTERPOLATION_SAMPLES)));
+			}
+		}
+	}
 
 	/* allocate sample buffer */
-	chorus->chorusbuf = ARRAY (S16, MAX_SAMPLES);
+	chorus->chorusbuf = ARRAY (float, 2 * MAX_SAMPLES + CHORUS_TAPS);
 	if (chorus->chorusbuf == NULL) 
 		goto errorRecovery;
 
@@ -151,16 +127,17 @@ errorRecovery:
 
 
 int chorusInit (Chorus * chorus) {
-	int i;
-
-  memset(chorus->chorusbuf, 0, sizeof(chorus->chorusbuf[0] * MAX_SAMPLES));
+	MEMSET (chorus->chorusbuf, 0, (2 * MAX_SAMPLES + CHORUS_TAPS) * sizeof (float));
+	chorus->counter = 0;
+	chorus->quietFrames = 0;
+	chorus->idle = 1;
 
 	/* initialize the chorus with the default settings */
-  chorus->numberBlocks = CHORUS_DEFAULT_N;
-  chorus->level = CHORUS_DEFAULT_N;
-  chorus->speed_Hz = CHORUS_DEFAULT_SPEED;
-  chorus->depthMs = CHORUS_DEFAULT_DEPTH;
-  chorus->type = CHORUS_MOD_SINE;
+	chorus->newNumberBlocks = CHORUS_DEFAULT_N;
+	chorus->newLevel = CHORUS_DEFAULT_LEVEL;
+	chorus->newSpeed_Hz = CHORUS_DEFAULT_SPEED;
+	chorus->newDepthMs = CHORUS_DEFAULT_DEPTH;
+	chorus->newType = CHORUS_DEFAULT_TYPE;
 
 	return chorusUpdate (chorus);
 }
@@ -174,13 +151,52 @@ void deleteChorus (Chorus * chorus) {
 		FREE (chorus->chorusbuf);
 	}
 
-	if (chorus->lookupTab != NULL) {
-		FREE (chorus->lookupTab);
-	}
-
 	FREE (chorus);
 }
 
+/*
+ * chorusSetXxx: store the new value; chorusUpdate takes it over.
+ */
+void chorusSetNr (Chorus * chorus, S32 nr) {
+	chorus->newNumberBlocks = nr;
+}
+
+S32 chorusGetNr (Chorus * chorus) {
+	return chorus->numberBlocks;
+}
+
+void chorusSetLevel (Chorus * chorus, realT level) {
+	chorus->newLevel = level;
+}
+
+realT chorusGetLevel (Chorus * chorus) {
+	return chorus->level;
+}
+
+void chorusSetSpeed_Hz (Chorus * chorus, realT speed_Hz) {
+	chorus->newSpeed_Hz = speed_Hz;
+}
+
+realT chorusGetSpeed_Hz (Chorus * chorus) {
+	return chorus->speed_Hz;
+}
+
+void chorusSetDepthMs (Chorus * chorus, realT depthMs) {
+	chorus->newDepthMs = depthMs;
+}
+
+realT chorusGetDepthMs (Chorus * chorus) {
+	return chorus->depthMs;
+}
+
+void chorusSetType (Chorus * chorus, S32 type) {
+	chorus->newType = type;
+}
+
+S32 chorusGetType (Chorus * chorus) {
+	return chorus->type;
+}
+
 
 #define clip_(dst_, min_, max_) \
   if (dst_ < min_) dst_ = min_; \
@@ -189,41 +205,31 @@ void deleteChorus (Chorus * chorus) {
 /* chorusUpdate():
  * Calculates the internal chorus parameters using the settings from chorusSetXxx. */
 int chorusUpdate (Chorus * chorus) {
-  clip_(chorus->newNumberBlocks, 0, MAX_CHORUS);
-  clip_(chorus->newSpeed_Hz, MIN_SPEED_HZ, MAX_SPEED_HZ);
-	if (chorus->newDepthMs < 0.0) chorus->newDepthMs = 0.0;
+	int modulationDepthSamples;
 
-	/* Depth: Check for too high value through modulationDepthSamples. */
-  clip_(chorus->newLevel, 0, 10);
-
-	/* The modulating LFO goes through a full period every x samples: */
-	chorus->modulationPeriodSamples = chorus->sampleRate / chorus->newSpeed_Hz;
+	clip_(chorus->newNumberBlocks, 0, MAX_CHORUS);
+	clip_(chorus->newSpeed_Hz, MIN_SPEED_HZ, MAX_SPEED_HZ);
+	if (chorus->newDepthMs < 0.0) chorus->newDepthMs = 0.0;
+	clip_(chorus->newLevel, 0, 10);
+	if (chorus->newType != CHORUS_MOD_SINE && chorus->newType != CHORUS_MOD_TRIANGLE)
+		chorus->newType = CHORUS_MOD_SINE;
 
 	/* The variation in delay time is x: */
-	int modulationDepthSamples = (int) (chorus->newDepthMs / 1000.0 * chorus->sampleRate);
+	modulationDepthSamples = (int) (chorus->newDepthMs / 1000.0 * chorus->sampleRate);
 
-	if (modulationDepthSamples > MAX_SAMPLES) 
-		modulationDepthSamples = MAX_SAMPLES;
+	/* Depth: Check for too high value */
+	if (modulationDepthSamples > CHORUS_MAX_DELAY) 
+		modulationDepthSamples = CHORUS_MAX_DELAY;
+	chorus->depthSubsamples = (realT) modulationDepthSamples * INTERPOLATION_SUBSAMPLES;
 
-	/* initialize LFO table */
-	if (chorus->type == CHORUS_MOD_SINE) {
-		chorusSine (chorus->lookupTab, chorus->modulationPeriodSamples,
-											 modulationDepthSamples);
-	} else if (chorus->type == CHORUS_MOD_TRIANGLE) {
-		chorusTriangle (chorus->lookupTab, chorus->modulationPeriodSamples, modulationDepthSamples);
-	} else {
-		chorus->type = CHORUS_MOD_SINE;
-		chorusSine (chorus->lookupTab, chorus->modulationPeriodSamples,
-											 modulationDepthSamples);
-	};
+	/* The modulating LFO goes through a full period every
+	 * sampleRate / speed samples */
+	chorus->phaseIncr = (double) BUFSIZE * chorus->newSpeed_Hz / chorus->sampleRate;
 
-	for (int i = 0; i < chorus->numberBlocks; i++) 
+	for (int i = 0; i < chorus->newNumberBlocks; i++) 
 		/* Set the phase of the chorus blocks equally spaced */
-		chorus->phase[i] = (int) ((double) chorus->modulationPeriodSamples
-															* (double) i / (double) chorus->numberBlocks);
+		chorus->phase[i] = (double) i / (double) chorus->newNumberBlocks;
 
-	/* Start of the circular buffer */
-	chorus->counter = 0;
 	chorus->type = chorus->newType;
 	chorus->depthMs = chorus->newDepthMs;
 	chorus->level = chorus->newLevel;
@@ -232,161 +238,126 @@ int chorusUpdate (Chorus * chorus) {
 	return OK;
 }
 
-void chorusProcessmix (Chorus *chorus, S16 *in, S16 *leftOut, S16 *rightOut) {
-	int sampleIndex;
-	int i;
-	S16 dIn, dOut;
-
-	for (sampleIndex = 0; sampleIndex < BUFSIZE; sampleIndex++) {
-		dIn = in[sampleIndex];
-		dOut = 0.0f;
-
-		/* Write the current sample into the circular buffer */
-		chorus->chorusbuf[chorus->counter] = dIn;
-
-		for (i = 0; i < chorus->numberBlocks; i++) {
-			int ii;
-			/* Calculate the delay in subsamples for the delay line of chorus block nr. */
-
-			/* The value in the lookup table is so, that this expression
-			 * will always be positive.  It will always include a number of
-			 * full periods of MAX_SAMPLES*INTERPOLATION_SUBSAMPLES to
-			 * remain positive at all times. */
-			int posSubsamples = (INTERPOLATION_SUBSAMPLES * chorus->counter
-														- chorus->lookupTab[chorus->phase[i]]);
-
-			int posSamples = posSubsamples / INTERPOLATION_SUBSAMPLES;
-
-			/* modulo divide by INTERPOLATION_SUBSAMPLES */
-			posSubsamples &= INTERPOLATION_SUBSAMPLES_ANDMASK;
-
-			for (ii = 0; ii < INTERPOLATION_SAMPLES; ii++) {
-				/* Add the delayed signal to the chorus sum dOut Note: The
-				 * delay in the delay line moves backwards for increasing
-				 * delay!*/
-
-				/* The & in chorusbuf[...] is equivalent to a division modulo
-				   MAX_SAMPLES, only faster. */
-				dOut += chorus->chorusbuf[posSamples & MAX_SAMPLES_ANDMASK]
-					* chorus->sincTable[ii][posSubsamples];
-
-				posSamples--;
-			};
-			/* Cycle the phase of the modulating LFO */
-			chorus->phase[i]++;
-			chorus->phase[i] %= (chorus->modulationPeriodSamples);
-		}														/* foreach chorus block */
-
-		dOut *= chorus->level;
-
-		/* Add the chorus sum dOut to output */
-		leftOut[sampleIndex] += dOut;
-		rightOut[sampleIndex] += dOut;
-
-		/* Move forward in circular buffer */
-		chorus->counter++;
-		chorus->counter %= MAX_SAMPLES;
-	}															/* foreach sample */
+/*
+ * chorusLfo
+ *
+ * The delay, in subsamples, at LFO phase 'phase' (0..1).
+ */
+static realT chorusLfo (Chorus * chorus, double phase) {
+	if (phase >= 1.0)
+		phase -= 1.0;
+	if (chorus->type == CHORUS_MOD_TRIANGLE)
+		return (phase < 0.5 ? 2.0 * phase : 2.0 - 2.0 * phase) * chorus->depthSubsamples;
+	return (1.0 + sin (phase * 2.0 * M_PI)) * 0.5 * chorus->depthSubsamples;
 }
 
-/* Duplication of code ... (replaces sample data instead of mixing) */
-void chorusProcessreplace (Chorus * chorus, S16 * in, S16 * leftOut, S16 * rightOut) {
-	int sampleIndex;
-	int i;
-	S16 dIn, dOut;
-
-	for (sampleIndex = 0; sampleIndex < BUFSIZE; sampleIndex++) {
-
-		dIn = in[sampleIndex];
-		dOut = 0.0f;
-
-		/* Write the current sample into the circular buffer */
-		chorus->chorusbuf[chorus->counter] = dIn;
-
-		for (i = 0; i < chorus->numberBlocks; i++) {
-			int ii;
-			/* Calculate the delay in subsamples for the delay line of chorus block nr. */
-			/* The value in the lookup table is so, that this expression
-			 * will always be positive.  It will always include a number of
-			 * full periods of MAX_SAMPLES*INTERPOLATION_SUBSAMPLES to
-			 * remain positive at all times. */
-			int posSubsamples = (INTERPOLATION_SUBSAMPLES * chorus->counter
-														- chorus->lookupTab[chorus->phase[i]]);
-
-			int posSamples = posSubsamples / INTERPOLATION_SUBSAMPLES;
+/*
+ * chorusRun
+ *
+ * Runs one block through the chorus into chorus->out.  Returns 0 without
+ * doing anything if the chorus idles and the input is still quiet.
+ */
+static int chorusRun (Chorus * chorus, busT * in) {
+	float *buf = chorus->chorusbuf;
+	float peak = 0, x, delay, delayIncr;
+	int i, k, pos, idx, frac;
+	chorusTapsT taps;
+
+	for (k = 0; k < BUFSIZE; k++) {
+		x = in[k] < 0 ? -in[k] : in[k];
+		if (x > peak)
+			peak = x;
+	}
+	if (peak < CHORUS_NOISE_FLOOR) {
+		chorus->quietFrames += BUFSIZE;
+		/* nothing audible left in the delay line? */
+		if (chorus->idle || chorus->quietFrames >= MAX_SAMPLES) {
+			if (!chorus->idle) {
+				MEMSET (buf, 0, (2 * MAX_SAMPLES + CHORUS_TAPS) * sizeof (float));
+				chorus->idle = 1;
+			}
+			/* keep the LFO running */
+			for (i = 0; i < chorus->numberBlocks; i++) {
+				chorus->phase[i] += chorus->phaseIncr;
+				if (chorus->phase[i] >= 1.0)
+					chorus->phase[i] -= 1.0;
+			}
+			return 0;
+		}
+	} else {
+		chorus->quietFrames = 0;
+		chorus->idle = 0;
+	}
 
-			/* modulo divide by INTERPOLATION_SUBSAMPLES */
-			posSubsamples &= INTERPOLATION_SUBSAMPLES_ANDMASK;
+	/* Write the block into the circular buffer and its mirror */
+	for (k = 0; k < BUFSIZE; k++) {
+		idx = (chorus->counter + k) & MAX_SAMPLES_ANDMASK;
+		buf[idx] = buf[idx + MAX_SAMPLES] = in[k];
+	}
 
-			for (ii = 0; ii < INTERPOLATION_SAMPLES; ii++) {
-				/* Add the delayed signal to the chorus sum dOut Note: The
-				 * delay in the delay line moves backwards for increasing
-				 * delay!*/
+	MEMSET (chorus->out, 0, sizeof (chorus->out));
+	for (i = 0; i < chorus->numberBlocks; i++) {
+		/* delay at the start of this block and of the next one */
+		delay = chorusLfo (chorus, chorus->phase[i]);
+		delayIncr = (chorusLfo (chorus, chorus->phase[i] + chorus->phaseIncr) - delay) / BUFSIZE;
+		chorus->phase[i] += chorus->phaseIncr;
+		if (chorus->phase[i] >= 1.0)
+			chorus->phase[i] -= 1.0;
+
+		for (k = 0; k < BUFSIZE; k++) {
+			/* Note: The delay in the delay line moves backwards for
+			 * increasing delay! */
+			pos = ((chorus->counter + k) << (INTERPOLATION_SUBSAMPLES_LN2 - 1)) - (int) delay;
+			frac = pos & INTERPOLATION_SUBSAMPLES_ANDMASK;
+			/* the oldest tap, in the mirrored half of the line */
+			idx = ((pos >> (INTERPOLATION_SUBSAMPLES_LN2 - 1)) & MAX_SAMPLES_ANDMASK)
+				+ MAX_SAMPLES - (INTERPOLATION_SAMPLES - 1);
+			taps = *(const chorusTapsT *) &buf[idx]
+				* *(const chorusTapsT *) chorus->sincTable[frac];
+			chorus->out[k] += taps[0] + taps[1] + taps[2] + taps[3]
+				+ taps[4] + taps[5] + taps[6] + taps[7];
+			delay += delayIncr;
+		}
+	}
 
-				/* The & in chorusbuf[...] is equivalent to a division modulo
-				   MAX_SAMPLES, only faster. */
-				dOut += chorus->chorusbuf[posSamples & MAX_SAMPLES_ANDMASK]
-					* chorus->sincTable[ii][posSubsamples];
+	/* Move forward in circular buffer */
+	chorus->counter = (chorus->counter + BUFSIZE) & MAX_SAMPLES_ANDMASK;
+	return 1;
+}
 
-				posSamples--;
-			};
-			/* Cycle the phase of the modulating LFO */
-			chorus->phase[i]++;
-			chorus->phase[i] %= (chorus->modulationPeriodSamples);
-		}														/* foreach chorus block */
+void chorusProcessmix (Chorus *chorus, busT *in, busT *leftOut, busT *rightOut) {
+	int k;
+	float level = chorus->level;
 
-		dOut *= chorus->level;
+	if (!chorusRun (chorus, in))
+		return;
 
-		/* Store the chorus sum dOut to output */
-		leftOut[sampleIndex] = dOut;
-		rightOut[sampleIndex] = dOut;
+	/* Add the chorus sum to output */
+	for (k = 0; k < BUFSIZE; k++) {
+		leftOut[k] += chorus->out[k] * level;
+		rightOut[k] += chorus->out[k] * level;
+	}
+}
 
-		/* Move forward in circular buffer */
-		chorus->counter++;
-		chorus->counter %= MAX_SAMPLES;
+void chorusProcessreplace (Chorus * chorus, busT * in, busT * leftOut, busT * rightOut) {
+	int k;
+	float level = chorus->level;
 
-	}															/* foreach sample */
-}
+	if (!chorusRun (chorus, in)) {
+		MEMSET (leftOut, 0, BUFSIZE * sizeof (busT));
+		MEMSET (rightOut, 0, BUFSIZE * sizeof (busT));
+		return;
+	}
 
-// MB SLOW!! Computing sine in a loop, wow!
-/* Purpose:
- *
- * Calculates a modulation waveform (sine) Its value ( modulo
- * MAXSAMPLES) varies between 0 and depth*INTERPOLATION_SUBSAMPLES.
- * The waveform data will be used modulo MAXSAMPLES only.  
- *
- * Since MAXSAMPLES is substracted from the waveform
- * a couple of times here, the resulting (current position in
- * buffer)-(waveform sample) will always be positive.
- */
-void chorusSine (int *buf, int periodLen, int depth) {
-	double val;
-	for (int i = 0; i < periodLen; i++) {
-		val = sin ((double) i / (double) periodLen * 2.0 * M_PI);
-		buf[i] = (int) ((1.0 + val) 
-                    * (double) depth 
-                    / 2.0 * (double) INTERPOLATION_SUBSAMPLES
-                   );
-		buf[i] -= 3 * MAX_SAMPLES * INTERPOLATION_SUBSAMPLES;
+	/* Store the chorus sum to output */
+	for (k = 0; k < BUFSIZE; k++) {
+		leftOut[k] = chorus->out[k] * level;
+		rightOut[k] = chorus->out[k] * level;
 	}
 }
 
-/* Purpose:
- * Calculates a modulation waveform (triangle)
- * See chorusSine for comments.
- */
-void chorusTriangle (int *buf, int len, int depth) {
-	int i = 0;
-	int ii = len - 1;
-	double val;
-	double val2;
-
-	while (i <= ii) {
-		val = i * 2.0 / len * (double) depth *(double) INTERPOLATION_SUBSAMPLES;
-		val2 = (int) (val + 0.5) - 3 * MAX_SAMPLES * INTERPOLATION_SUBSAMPLES;
-		buf[i++] = (int) val2;
-		buf[ii--] = (int) val2;   // triangle is symmetric, so populate end too.
-	}
+int chorusIdle (Chorus * chorus) {
+	return chorus->idle;
 }
 
 void chorusReset (Chorus * chorus) {
@@ -1,63 +1,71 @@
 #include "fluidbean.h"
 #include "synth.h"
 #include "voice.h"
+#include "dsp_simd.h"
+#include "tables.h"
 #include <math.h>
 
-/* Interpolation (find a value between two samples of the original waveform) */
-/* Linear interpolation table (2 coefficients centered on 1st) */
-static realT interpCoeffLinear[INTERP_MAX][2];
-/* 4th order (cubic) interpolation table (4 coefficients centered on 2nd) */
-static realT interpCoeff[INTERP_MAX][4];
-/* 7th order interpolation (7 coefficients centered on 3rd) */
-static realT sincTable7[INTERP_MAX][7];
+/* Interpolation (find a value between two samples of the original waveform).
+ * The coefficient tables are generated at build time, see tables.h. */
 
-#define SINC_INTERP_ORDER 7			/* 7th order constant */
-
-/* Initializes interpolation tables */
 void dspFloatConfig (void) {
-	int i, i2;
-	double x, v;
-	double iShifted;
+	/* picks the kernels for this CPU */
+	dspSimdConfig ();
+}
 
-	/* Initialize the coefficients for the interpolation. The math comes
-	 * from a mail, posted by Olli Niemitalo to the music-dsp mailing
-	 * list (I found it in the music-dsp archives
-	 * http://www.smartelectronix.com/musicdsp/).  */
+/* Culled voices (see voiceCalcBlockParams): moves the playback pointer and
+ * the amplitude ramp on by dspCount frames, as the interpolators would,
+ * without touching the sample data.  Returns the frames covered, fewer
+ * than dspCount if the sample ended. */
+int dspFloatSkip (Voice * voice) {
+	Phase dspPhase = voice->phase;
+	Phase dspPhaseIncr;
+	Phase endPhase;
+	U32 dspCount = voice->dspCount;
+	U32 endIndex, loopLen, excess;
+	uint64 frames;
+	int looping;
 
-	for (i = 0; i < INTERP_MAX; i++) {
-		x = (double) i / (double) INTERP_MAX;
+	phaseSetFloat (dspPhaseIncr, voice->phaseIncr);
 
-		interpCoeff[i][0] = (realT) (x * (-0.5 + x * (1 - 0.5 * x)));
-		interpCoeff[i][1] = (realT) (1.0 + x * x * (1.5 * x - 2.5));
-		interpCoeff[i][2] = (realT) (x * (0.5 + x * (2.0 - 1.5 * x)));
-		interpCoeff[i][3] = (realT) (0.5 * x * x * (x - 1.0));
+	looping = _SAMPLEMODE (voice) == LOOP_DURING_RELEASE
+		|| (_SAMPLEMODE (voice) == LOOP_UNTIL_RELEASE
+				&& voice->volenvSection < VOICE_ENVRELEASE);
+	loopLen = voice->loopend - voice->loopstart;
+	if (loopLen == 0)
+		looping = 0;
 
-		interpCoeffLinear[i][0] = (realT) (1.0 - x);
-		interpCoeffLinear[i][1] = (realT) x;
-	}
+	endIndex = looping ? voice->loopend - 1 : voice->end;
 
-	/* i: Offset in terms of whole samples */ 
-	for (i = 0; i < SINC_INTERP_ORDER; i++) {	/* i2: Offset in terms of fractional samples ('subsamples') */  // to 7
-		for (i2 = 0; i2 < INTERP_MAX; i2++) {  // to 256
-			/* center on middle of table */
-			iShifted = (double) i - ((double) SINC_INTERP_ORDER / 2.0)
-				+ (double) i2 / (double) INTERP_MAX;
-
-			/* sinc(0) cannot be calculated straightforward (limit needed for 0/0) */
-			if (fabs (iShifted) > 0.000001) {
-				v = (realT) sin (iShifted * M_PI) / (M_PI * iShifted);
-				/* Hamming window */
-				v *= (realT) 0.5 * (1.0 + cos (2.0 * M_PI * iShifted / (realT) SINC_INTERP_ORDER));
-			} else
-				v = 1.0;
-
-			sincTable7[INTERP_MAX - i2 - 1][i] = v;
+	if (!looping) {
+		/* frames until the pointer passes the last sample */
+		if (phaseIndex (dspPhase) > endIndex)
+			frames = 0;
+		else if (dspPhaseIncr == 0)
+			frames = dspCount;
+		else {
+			phaseSetInt (endPhase, endIndex + 1);
+			frames = (endPhase - dspPhase + dspPhaseIncr - 1) / dspPhaseIncr;
+		}
+		if (frames > dspCount)
+			frames = dspCount;
+		dspPhase += frames * dspPhaseIncr;
+	} else {
+		frames = dspCount;
+		dspPhase += frames * dspPhaseIncr;
+		/* back into the loop, however often it went round */
+		if (phaseIndex (dspPhase) > endIndex) {
+			excess = phaseIndex (dspPhase) - voice->loopend;
+			phaseSubInt (dspPhase, (excess / loopLen + 1) * loopLen);
+			voice->hasLooped = 1;
 		}
 	}
-}
 
-// When they say "centering", it looks like they're building a hamming window LUT.
+	voice->phase = dspPhase;
+	voice->amp += voice->ampIncr * frames;
 
+	return (int) frames;
+}
 
 /* No interpolation. Just take the sample, which is closest to
  * the playback pointer. Questionable quality, but very efficient. */
@@ -65,10 +73,11 @@ int dspFloatInterpolateNone (Voice * voice) {
 	Phase dspPhase = voice->phase;
 	Phase dspPhaseIncr;
 	short int *dspData = voice->sampleP->pcmDataP;
-	S16 *dspBuf = voice->dspBuf;
+	busT *dspBuf = voice->dspBuf;
 	realT dspAmp = voice->amp;
 	realT dspAmpIncr = voice->ampIncr;
 	U32 dspI = 0;
+	U32 dspCount = voice->dspCount;	/* frames to render, at most BUFSIZE */
 	U32 dspPhaseIndex;
 	U32 endIndex;
 	int looping;
@@ -87,7 +96,7 @@ int dspFloatInterpolateNone (Voice * voice) {
 		dspPhaseIndex = phaseIndexRound (dspPhase);	/* round to nearest point */
 
 		/* interpolate sequence of sample points */
-		for (; dspI < BUFSIZE && dspPhaseIndex <= endIndex; dspI++) {
+		for (; dspI < dspCount && dspPhaseIndex <= endIndex; dspI++) {
 			dspBuf[dspI] = dspAmp * dspData[dspPhaseIndex];
 
 			/* increment phase and amplitude */
@@ -107,7 +116,7 @@ int dspFloatInterpolateNone (Voice * voice) {
 		}
 
 		/* break out if filled buffer */
-		if (dspI >= BUFSIZE)
+		if (dspI >= dspCount)
 			break;
 	}
 
@@ -118,21 +127,22 @@ int dspFloatInterpolateNone (Voice * voice) {
 }
 
 /* Straight line interpolation.
- * Returns number of samples processed (usually BUFSIZE but could be
+ * Returns number of samples processed (usually dspCount but could be
  * smaller if end of sample occurs).
  */
 int dspFloatInterpolateLinear (Voice * voice) {
 	Phase dspPhase = voice->phase;
 	Phase dspPhaseIncr;
 	short int *dspData = voice->sampleP->pcmDataP;
-	S16 *dspBuf = voice->dspBuf;
+	busT *dspBuf = voice->dspBuf;
 	realT dspAmp = voice->amp;
 	realT dspAmpIncr = voice->ampIncr;
 	U32 dspI = 0;
+	U32 dspCount = voice->dspCount;	/* frames to render, at most BUFSIZE */
 	U32 dspPhaseIndex;
 	U32 endIndex;
 	short int point;
-	realT *coeffs;
+	const realT *coeffs;
 	int looping;
 
 	/* Convert playback "speed" floating point value to phase index/fract */
@@ -155,8 +165,13 @@ int dspFloatInterpolateLinear (Voice * voice) {
 	while (1) {
 		dspPhaseIndex = phaseIndex (dspPhase);
 
-		/* interpolate the sequence of sample points */
-		for (; dspI < BUFSIZE && dspPhaseIndex <= endIndex; dspI++) {
+		/* the bulk of the buffer goes through the vectorised kernel (dsp_simd.c) */
+		dspI += dspKernels.linear (dspData, dspBuf + dspI, dspCount - dspI, endIndex,
+		                        &dspPhase, dspPhaseIncr, &dspAmp, dspAmpIncr);
+		dspPhaseIndex = phaseIndex (dspPhase);
+
+		/* interpolate the rest of the sequence of sample points */
+		for (; dspI < dspCount && dspPhaseIndex <= endIndex; dspI++) {
 			coeffs = interpCoeffLinear[phaseFractToTablerow (dspPhase)];
 			dspBuf[dspI] = dspAmp * (coeffs[0] * dspData[dspPhaseIndex]
 																	+ coeffs[1] * dspData[dspPhaseIndex +
@@ -169,13 +184,13 @@ int dspFloatInterpolateLinear (Voice * voice) {
 		}
 
 		/* break out if buffer filled */
-		if (dspI >= BUFSIZE)
+		if (dspI >= dspCount)
 			break;
 
 		endIndex++;								/* we're now interpolating the last point */
 
 		/* interpolate within last point */
-		for (; dspPhaseIndex <= endIndex && dspI < BUFSIZE; dspI++) {
+		for (; dspPhaseIndex <= endIndex && dspI < dspCount; dspI++) {
 			coeffs = interpCoeffLinear[phaseFractToTablerow (dspPhase)];
 			dspBuf[dspI] = dspAmp * (coeffs[0] * dspData[dspPhaseIndex]
 																	+ coeffs[1] * point);
@@ -196,7 +211,7 @@ int dspFloatInterpolateLinear (Voice * voice) {
 		}
 
 		/* break out if filled buffer */
-		if (dspI >= BUFSIZE)
+		if (dspI >= dspCount)
 			break;
 
 		endIndex--;								/* set end back to second to last sample point */
@@ -209,21 +224,22 @@ int dspFloatInterpolateLinear (Voice * voice) {
 }
 
 /* 4th order (cubic) interpolation.
- * Returns number of samples processed (usually BUFSIZE but could be
+ * Returns number of samples processed (usually dspCount but could be
  * smaller if end of sample occurs).
  */
 int dspFloatInterpolate_4thOrder (Voice * voice) {
 	Phase dspPhase = voice->phase;
 	Phase dspPhaseIncr;
 	short int *dspData = voice->sampleP->pcmDataP;
-	S16 *dspBuf = voice->dspBuf;
+	busT *dspBuf = voice->dspBuf;
 	realT dspAmp = voice->amp;
 	realT dspAmpIncr = voice->ampIncr;
 	U32 dspI = 0;
+	U32 dspCount = voice->dspCount;	/* frames to render, at most BUFSIZE */
 	U32 dspPhaseIndex;
 	U32 startIndex, endIndex;
 	short int startPoint, endPoint1, endPoint2;
-	realT *coeffs;
+	const realT *coeffs;
 	int looping;
 
 	/* Convert playback "speed" floating point value to phase index/fract */
@@ -258,7 +274,7 @@ int dspFloatInterpolate_4thOrder (Voice * voice) {
 		dspPhaseIndex = phaseIndex (dspPhase);
 
 		/* interpolate first sample point (start or loop start) if needed */
-		for (; dspPhaseIndex == startIndex && dspI < BUFSIZE; dspI++) {
+		for (; dspPhaseIndex == startIndex && dspI < dspCount; dspI++) {
 			coeffs = interpCoeff[phaseFractToTablerow (dspPhase)];
 			dspBuf[dspI] = dspAmp * (coeffs[0] * startPoint
 																	+ coeffs[1] * dspData[dspPhaseIndex]
@@ -272,8 +288,13 @@ int dspFloatInterpolate_4thOrder (Voice * voice) {
 			dspAmp += dspAmpIncr;
 		}
 
-		/* interpolate the sequence of sample points */
-		for (; dspI < BUFSIZE && dspPhaseIndex <= endIndex; dspI++) {
+		/* the bulk of the buffer goes through the vectorised kernel (dsp_simd.c) */
+		dspI += dspKernels.order4 (dspData, dspBuf + dspI, dspCount - dspI, endIndex,
+		                        &dspPhase, dspPhaseIncr, &dspAmp, dspAmpIncr);
+		dspPhaseIndex = phaseIndex (dspPhase);
+
+		/* interpolate the rest of the sequence of sample points */
+		for (; dspI < dspCount && dspPhaseIndex <= endIndex; dspI++) {
 			coeffs = interpCoeff[phaseFractToTablerow (dspPhase)];
 			dspBuf[dspI] = dspAmp * (coeffs[0] * dspData[dspPhaseIndex - 1]
 																	+ coeffs[1] * dspData[dspPhaseIndex]
@@ -288,13 +309,13 @@ int dspFloatInterpolate_4thOrder (Voice * voice) {
 		}
 
 		/* break out if buffer filled */
-		if (dspI >= BUFSIZE)
+		if (dspI >= dspCount)
 			break;
 
 		endIndex++;								/* we're now interpolating the 2nd to last point */
 
 		/* interpolate within 2nd to last point */
-		for (; dspPhaseIndex <= endIndex && dspI < BUFSIZE; dspI++) {
+		for (; dspPhaseIndex <= endIndex && dspI < dspCount; dspI++) {
 			coeffs = interpCoeff[phaseFractToTablerow (dspPhase)];
 			dspBuf[dspI] = dspAmp * (coeffs[0] * dspData[dspPhaseIndex - 1]
 																	+ coeffs[1] * dspData[dspPhaseIndex]
@@ -310,7 +331,7 @@ int dspFloatInterpolate_4thOrder (Voice * voice) {
 		endIndex++;								/* we're now interpolating the last point */
 
 		/* interpolate within the last point */
-		for (; dspPhaseIndex <= endIndex && dspI < BUFSIZE; dspI++) {
+		for (; dspPhaseIndex <= endIndex && dspI < dspCount; dspI++) {
 			coeffs = interpCoeff[phaseFractToTablerow (dspPhase)];
 			dspBuf[dspI] = dspAmp * (coeffs[0] * dspData[dspPhaseIndex - 1]
 																	+ coeffs[1] * dspData[dspPhaseIndex]
@@ -338,7 +359,7 @@ int dspFloatInterpolate_4thOrder (Voice * voice) {
 		}
 
 		/* break out if filled buffer */
-		if (dspI >= BUFSIZE)
+		if (dspI >= dspCount)
 			break;
 
 		endIndex -= 2;							/* set end back to third to last sample point */
@@ -351,22 +372,23 @@ int dspFloatInterpolate_4thOrder (Voice * voice) {
 }
 
 /* 7th order interpolation.
- * Returns number of samples processed (usually BUFSIZE but could be
+ * Returns number of samples processed (usually dspCount but could be
  * smaller if end of sample occurs).
  */
 int dspFloatInterpolate_7thOrder (Voice * voice) {
 	Phase dspPhase = voice->phase;
 	Phase dspPhaseIncr;
 	short int *dspData = voice->sampleP->pcmDataP;
-	S16 *dspBuf = voice->dspBuf;
+	busT *dspBuf = voice->dspBuf;
 	realT dspAmp = voice->amp;
 	realT dspAmpIncr = voice->ampIncr;
 	U32 dspI = 0;
+	U32 dspCount = voice->dspCount;	/* frames to render, at most BUFSIZE */
 	U32 dspPhaseIndex;
 	U32 startIndex, endIndex;
 	short int startPoints[3];
 	short int endPoints[3];
-	realT *coeffs;
+	const realT *coeffs;
 	int looping;
 
 	/* Convert playback "speed" floating point value to phase index/fract */
@@ -411,7 +433,7 @@ int dspFloatInterpolate_7thOrder (Voice * voice) {
 		dspPhaseIndex = phaseIndex (dspPhase);
 
 		/* interpolate first sample point (start or loop start) if needed */
-		for (; dspPhaseIndex == startIndex && dspI < BUFSIZE; dspI++) {
+		for (; dspPhaseIndex == startIndex && dspI < dspCount; dspI++) {
 			coeffs = sincTable7[phaseFractToTablerow (dspPhase)];
 
 			dspBuf[dspI] = dspAmp * (coeffs[0] * (realT) startPoints[2]
@@ -440,7 +462,7 @@ int dspFloatInterpolate_7thOrder (Voice * voice) {
 		startIndex++;
 
 		/* interpolate 2nd to first sample point (start or loop start) if needed */
-		for (; dspPhaseIndex == startIndex && dspI < BUFSIZE; dspI++) {
+		for (; dspPhaseIndex == startIndex && dspI < dspCount; dspI++) {
 			coeffs = sincTable7[phaseFractToTablerow (dspPhase)];
 
 			dspBuf[dspI] = dspAmp * (coeffs[0] * (realT) startPoints[1]
@@ -471,7 +493,7 @@ int dspFloatInterpolate_7thOrder (Voice * voice) {
 		startIndex++;
 
 		/* interpolate 3rd to first sample point (start or loop start) if needed */
-		for (; dspPhaseIndex == startIndex && dspI < BUFSIZE; dspI++) {
+		for (; dspPhaseIndex == startIndex && dspI < dspCount; dspI++) {
 			coeffs = sincTable7[phaseFractToTablerow (dspPhase)];
 
 			dspBuf[dspI] = dspAmp * (coeffs[0] * (realT) startPoints[0]
@@ -504,8 +526,13 @@ int dspFloatInterpolate_7thOrder (Voice * voice) {
 		startIndex -= 2;						/* set back to original start index */
 
 
-		/* interpolate the sequence of sample points */
-		for (; dspI < BUFSIZE && dspPhaseIndex <= endIndex; dspI++) {
+		/* the bulk of the buffer goes through the vectorised kernel (dsp_simd.c) */
+		dspI += dspKernels.order7 (dspData, dspBuf + dspI, dspCount - dspI, endIndex,
+		                        &dspPhase, dspPhaseIncr, &dspAmp, dspAmpIncr);
+		dspPhaseIndex = phaseIndex (dspPhase);
+
+		/* interpolate the rest of the sequence of sample points */
+		for (; dspI < dspCount && dspPhaseIndex <= endIndex; dspI++) {
 			coeffs = sincTable7[phaseFractToTablerow (dspPhase)];
 
 			dspBuf[dspI] = dspAmp
@@ -524,13 +551,13 @@ int dspFloatInterpolate_7thOrder (Voice * voice) {
 		}
 
 		/* break out if buffer filled */
-		if (dspI >= BUFSIZE)
+		if (dspI >= dspCount)
 			break;
 
 		endIndex++;								/* we're now interpolating the 3rd to last point */
 
 		/* interpolate within 3rd to last point */
-		for (; dspPhaseIndex <= endIndex && dspI < BUFSIZE; dspI++) {
+		for (; dspPhaseIndex <= endIndex && dspI < dspCount; dspI++) {
 			coeffs = sincTable7[phaseFractToTablerow (dspPhase)];
 
 			dspBuf[dspI] = dspAmp
@@ -551,7 +578,7 @@ int dspFloatInterpolate_7thOrder (Voice * voice) {
 		endIndex++;								/* we're now interpolating the 2nd to last point */
 
 		/* interpolate within 2nd to last point */
-		for (; dspPhaseIndex <= endIndex && dspI < BUFSIZE; dspI++) {
+		for (; dspPhaseIndex <= endIndex && dspI < dspCount; dspI++) {
 			coeffs = sincTable7[phaseFractToTablerow (dspPhase)];
 
 			dspBuf[dspI] = dspAmp
@@ -572,7 +599,7 @@ int dspFloatInterpolate_7thOrder (Voice * voice) {
 		endIndex++;								/* we're now interpolating the last point */
 
 		/* interpolate within last point */
-		for (; dspPhaseIndex <= endIndex && dspI < BUFSIZE; dspI++) {
+		for (; dspPhaseIndex <= endIndex && dspI < dspCount; dspI++) {
 			coeffs = sincTable7[phaseFractToTablerow (dspPhase)];
 
 			dspBuf[dspI] = dspAmp
@@ -607,7 +634,7 @@ int dspFloatInterpolate_7thOrder (Voice * voice) {
 		}
 
 		/* break out if filled buffer */
-		if (dspI >= BUFSIZE)
+		if (dspI >= dspCount)
 			break;
 
 		endIndex -= 3;							/* set end back to 4th to last sample point */
@@ -0,0 +1,499 @@
+#include "fluidbean.h"
+#include "dsp_simd.h"
+#include "tables.h"
+
+/* Vectorised interpolation kernels, see dsp_simd.h.
+ *
+ * The scalar kernels are the reference: they do exactly what the loops in
+ * dsp_float.c do, on the same realT tables.  The vector kernels work on
+ * float copies of the tables, padded and aligned so that one table row is
+ * one (or two) vector loads, and render 4 (SSE2, NEON) or 8 (AVX2) frames
+ * per iteration.  The playing pointer stays a 64 bit Phase; only the per
+ * frame index and table row are pulled out of it, the rest is vector math.
+ *
+ * The x86 kernels are compiled with target attributes and picked at run
+ * time, so the library itself doesn't need to be built with -mavx2.
+ */
+
+#if !defined(WITH_S16_BUS) && (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define DSP_SIMD_X86 1
+#include <immintrin.h>
+#define TARGET_SSE2 __attribute__ ((target ("sse2")))
+#define TARGET_AVX2 __attribute__ ((target ("avx2,fma")))
+#endif
+
+#if !defined(WITH_S16_BUS) && defined(__aarch64__) && defined(__ARM_NEON)
+#define DSP_SIMD_NEON 1
+#include <arm_neon.h>
+#endif
+
+#define ALIGNED(_n) __attribute__ ((aligned (_n)))
+
+/* The interpolation tables, double and float copies, come from tables.h. */
+
+/***************************************************************
+ *
+ *                    SCALAR (REFERENCE)
+ */
+
+static U32 dspInterpLinearScalar (const S16 *data, busT *buf, U32 n, U32 endIndex,
+                                  Phase *phase, Phase dspPhaseIncr, realT *amp, realT ampIncr) {
+	Phase dspPhase = *phase;
+	realT dspAmp = *amp;
+	U32 dspI, dspPhaseIndex;
+	const realT *coeffs;
+
+	for (dspI = 0; dspI < n; dspI++) {
+		dspPhaseIndex = phaseIndex (dspPhase);
+		if (dspPhaseIndex > endIndex)
+			break;
+		coeffs = interpCoeffLinear[phaseFractToTablerow (dspPhase)];
+		buf[dspI] = dspAmp * (coeffs[0] * data[dspPhaseIndex]
+		                      + coeffs[1] * data[dspPhaseIndex + 1]);
+		phaseIncr (dspPhase, dspPhaseIncr);
+		dspAmp += ampIncr;
+	}
+
+	*phase = dspPhase;
+	*amp = dspAmp;
+	return dspI;
+}
+
+static U32 dspInterp4thScalar (const S16 *data, busT *buf, U32 n, U32 endIndex,
+                               Phase *phase, Phase dspPhaseIncr, realT *amp, realT ampIncr) {
+	Phase dspPhase = *phase;
+	realT dspAmp = *amp;
+	U32 dspI, dspPhaseIndex;
+	const realT *coeffs;
+
+	for (dspI = 0; dspI < n; dspI++) {
+		dspPhaseIndex = phaseIndex (dspPhase);
+		if (dspPhaseIndex > endIndex)
+			break;
+		coeffs = interpCoeff[phaseFractToTablerow (dspPhase)];
+		buf[dspI] = dspAmp * (coeffs[0] * data[dspPhaseIndex - 1]
+		                      + coeffs[1] * data[dspPhaseIndex]
+		                      + coeffs[2] * data[dspPhaseIndex + 1]
+		                      + coeffs[3] * data[dspPhaseIndex + 2]);
+		phaseIncr (dspPhase, dspPhaseIncr);
+		dspAmp += ampIncr;
+	}
+
+	*phase = dspPhase;
+	*amp = dspAmp;
+	return dspI;
+}
+
+static U32 dspInterp7thScalar (const S16 *data, busT *buf, U32 n, U32 endIndex,
+                               Phase *phase, Phase dspPhaseIncr, realT *amp, realT ampIncr) {
+	Phase dspPhase = *phase;
+	realT dspAmp = *amp;
+	U32 dspI, dspPhaseIndex;
+	const realT *coeffs;
+
+	for (dspI = 0; dspI < n; dspI++) {
+		dspPhaseIndex = phaseIndex (dspPhase);
+		if (dspPhaseIndex > endIndex)
+			break;
+		coeffs = sincTable7[phaseFractToTablerow (dspPhase)];
+		buf[dspI] = dspAmp * (coeffs[0] * (realT) data[dspPhaseIndex - 3]
+		                      + coeffs[1] * (realT) data[dspPhaseIndex - 2]
+		                      + coeffs[2] * (realT) data[dspPhaseIndex - 1]
+		                      + coeffs[3] * (realT) data[dspPhaseIndex]
+		                      + coeffs[4] * (realT) data[dspPhaseIndex + 1]
+		                      + coeffs[5] * (realT) data[dspPhaseIndex + 2]
+		                      + coeffs[6] * (realT) data[dspPhaseIndex + 3]);
+		phaseIncr (dspPhase, dspPhaseIncr);
+		dspAmp += ampIncr;
+	}
+
+	*phase = dspPhase;
+	*amp = dspAmp;
+	return dspI;
+}
+
+/* Can the next '_lanes' frames all be rendered without passing endIndex? */
+#define groupFits_(_i, _n, _lanes, _phase, _incr, _endIndex) \
+	((_i) + (_lanes) <= (_n) \
+	 && phaseIndex ((_phase) + ((Phase) ((_lanes) - 1)) * (_incr)) <= (_endIndex))
+
+/***************************************************************
+ *
+ *                          SSE2
+ */
+#ifdef DSP_SIMD_X86
+
+/* 4 consecutive S16 points -> 4 floats */
+#define sse2LoadS16x4_(_p) \
+	_mm_cvtepi32_ps (_mm_srai_epi32 (_mm_unpacklo_epi16 (_mm_loadl_epi64 ((const __m128i *) (_p)), \
+	                                                     _mm_loadl_epi64 ((const __m128i *) (_p))), 16))
+
+TARGET_SSE2
+static __m128 sse2AmpRamp (realT amp, realT ampIncr) {
+	return _mm_setr_ps ((float) amp, (float) (amp + ampIncr),
+	                    (float) (amp + 2 * ampIncr), (float) (amp + 3 * ampIncr));
+}
+
+/* 2 consecutive S16 points of a frame, as the low 32 bits of a vector */
+#define sse2LoadS16x2_(_p) \
+	_mm_cvtsi32_si128 (*(const int *) (_p))
+
+TARGET_SSE2
+static U32 dspInterpLinearSse2 (const S16 *data, busT *buf, U32 n, U32 endIndex,
+                                Phase *phase, Phase dspPhaseIncr, realT *amp, realT ampIncr) {
+	Phase p = *phase;
+	U32 i = 0, k;
+	__m128i t[4], t01, t23;
+	__m128d c[4];
+	__m128 prod01, prod23;
+	__m128 vAmp = sse2AmpRamp (*amp, ampIncr);
+	__m128 vAmpStep = _mm_set1_ps ((float) (4 * ampIncr));
+
+	while (groupFits_ (i, n, 4, p, dspPhaseIncr, endIndex)) {
+		for (k = 0; k < 4; k++) {
+			t[k] = sse2LoadS16x2_ (data + phaseIndex (p));
+			c[k] = _mm_load_sd ((const double *) interpCoeffLinearF[phaseFractToTablerow (p)]);
+			phaseIncr (p, dspPhaseIncr);
+		}
+		/* [x0 y0 x1 y1] for frames 0,1 and 2,3 */
+		t01 = _mm_unpacklo_epi32 (t[0], t[1]);
+		t23 = _mm_unpacklo_epi32 (t[2], t[3]);
+		prod01 = _mm_mul_ps (_mm_castpd_ps (_mm_unpacklo_pd (c[0], c[1])),
+		                     _mm_cvtepi32_ps (_mm_srai_epi32 (_mm_unpacklo_epi16 (t01, t01), 16)));
+		prod23 = _mm_mul_ps (_mm_castpd_ps (_mm_unpacklo_pd (c[2], c[3])),
+		                     _mm_cvtepi32_ps (_mm_srai_epi32 (_mm_unpacklo_epi16 (t23, t23), 16)));
+		/* even + odd lanes = one output per frame */
+		_mm_storeu_ps (buf + i, _mm_mul_ps (vAmp,
+		               _mm_add_ps (_mm_shuffle_ps (prod01, prod23, _MM_SHUFFLE (2, 0, 2, 0)),
+		                           _mm_shuffle_ps (prod01, prod23, _MM_SHUFFLE (3, 1, 3, 1)))));
+		vAmp = _mm_add_ps (vAmp, vAmpStep);
+		i += 4;
+	}
+
+	*phase = p;
+	*amp += i * ampIncr;
+	return i;
+}
+
+TARGET_SSE2
+static U32 dspInterp4thSse2 (const S16 *data, busT *buf, U32 n, U32 endIndex,
+                             Phase *phase, Phase dspPhaseIncr, realT *amp, realT ampIncr) {
+	Phase p = *phase;
+	U32 i = 0, k, row;
+	__m128 v[4];
+	__m128 vAmp = sse2AmpRamp (*amp, ampIncr);
+	__m128 vAmpStep = _mm_set1_ps ((float) (4 * ampIncr));
+
+	while (groupFits_ (i, n, 4, p, dspPhaseIncr, endIndex)) {
+		for (k = 0; k < 4; k++) {
+			row = phaseFractToTablerow (p);
+			v[k] = _mm_mul_ps (_mm_load_ps (interpCoeffF[row]), sse2LoadS16x4_ (data + phaseIndex (p) - 1));
+			phaseIncr (p, dspPhaseIncr);
+		}
+		/* frames in rows -> taps in rows, then the horizontal sums are vertical adds */
+		_MM_TRANSPOSE4_PS (v[0], v[1], v[2], v[3]);
+		_mm_storeu_ps (buf + i, _mm_mul_ps (vAmp,
+		               _mm_add_ps (_mm_add_ps (v[0], v[1]), _mm_add_ps (v[2], v[3]))));
+		vAmp = _mm_add_ps (vAmp, vAmpStep);
+		i += 4;
+	}
+
+	*phase = p;
+	*amp += i * ampIncr;
+	return i;
+}
+
+TARGET_SSE2
+static U32 dspInterp7thSse2 (const S16 *data, busT *buf, U32 n, U32 endIndex,
+                             Phase *phase, Phase dspPhaseIncr, realT *amp, realT ampIncr) {
+	Phase p = *phase;
+	U32 i = 0, k;
+	const float *c;
+	__m128i t;
+	__m128 v[4];
+	__m128 vAmp = sse2AmpRamp (*amp, ampIncr);
+	__m128 vAmpStep = _mm_set1_ps ((float) (4 * ampIncr));
+
+	while (groupFits_ (i, n, 4, p, dspPhaseIncr, endIndex)) {
+		for (k = 0; k < 4; k++) {
+			c = sincTable7F[phaseFractToTablerow (p)];
+			/* 8 points from index - 3; the 8th coefficient is 0 */
+			t = _mm_loadu_si128 ((const __m128i *) (data + phaseIndex (p) - 3));
+			v[k] = _mm_add_ps (_mm_mul_ps (_mm_load_ps (c),
+			                              _mm_cvtepi32_ps (_mm_srai_epi32 (_mm_unpacklo_epi16 (t, t), 16))),
+			                   _mm_mul_ps (_mm_load_ps (c + 4),
+			                              _mm_cvtepi32_ps (_mm_srai_epi32 (_mm_unpackhi_epi16 (t, t), 16))));
+			phaseIncr (p, dspPhaseIncr);
+		}
+		/* horizontal sums of 4 frames at once */
+		_MM_TRANSPOSE4_PS (v[0], v[1], v[2], v[3]);
+		_mm_storeu_ps (buf + i, _mm_mul_ps (vAmp,
+		               _mm_add_ps (_mm_add_ps (v[0], v[1]), _mm_add_ps (v[2], v[3]))));
+		vAmp = _mm_add_ps (vAmp, vAmpStep);
+		i += 4;
+	}
+
+	*phase = p;
+	*amp += i * ampIncr;
+	return i;
+}
+
+/***************************************************************
+ *
+ *                          AVX2
+ */
+
+/* Pulls index (+ offset) and table row (* row length) of 8 frames out of the
+ * playing pointer and advances it. */
+#define avx2Frames_(_p, _incr, _idx, _row, _offset, _rowLen) \
+{ \
+	int _k; \
+	for (_k = 0; _k < 8; _k++) { \
+		(_idx)[_k] = (S32) phaseIndex (_p) + (_offset); \
+		(_row)[_k] = (S32) phaseFractToTablerow (_p) * (_rowLen); \
+		phaseIncr (_p, _incr); \
+	} \
+}
+
+/* Gathers the S16 points at data[idx] of 8 frames as floats. Reads 32 bits
+ * per point and sign-extends the low half. */
+#define avx2GatherS16_(_data, _vIdx) \
+	_mm256_cvtepi32_ps (_mm256_srai_epi32 (_mm256_slli_epi32 ( \
+		_mm256_i32gather_epi32 ((const int *) (_data), (_vIdx), 2), 16), 16))
+
+TARGET_AVX2
+static __m256 avx2AmpRamp (realT amp, realT ampIncr) {
+	return _mm256_add_ps (_mm256_set1_ps ((float) amp),
+	                      _mm256_mul_ps (_mm256_set1_ps ((float) ampIncr),
+	                                     _mm256_setr_ps (0, 1, 2, 3, 4, 5, 6, 7)));
+}
+
+TARGET_AVX2
+static U32 dspInterpLinearAvx2 (const S16 *data, busT *buf, U32 n, U32 endIndex,
+                                Phase *phase, Phase dspPhaseIncr, realT *amp, realT ampIncr) {
+	Phase p = *phase;
+	U32 i = 0;
+	S32 idx[8] ALIGNED (32), row[8] ALIGNED (32);
+	__m256i vIdx, vRow;
+	__m256 t0, t1, c1;
+	__m256 vAmp = avx2AmpRamp (*amp, ampIncr);
+	__m256 vAmpStep = _mm256_set1_ps ((float) (8 * ampIncr));
+
+	while (groupFits_ (i, n, 8, p, dspPhaseIncr, endIndex)) {
+		avx2Frames_ (p, dspPhaseIncr, idx, row, 0, 2);
+		vIdx = _mm256_load_si256 ((const __m256i *) idx);
+		vRow = _mm256_load_si256 ((const __m256i *) row);
+		t0 = avx2GatherS16_ (data, vIdx);
+		t1 = avx2GatherS16_ (data, _mm256_add_epi32 (vIdx, _mm256_set1_epi32 (1)));
+		c1 = _mm256_i32gather_ps (&interpCoeffLinearF[0][1], vRow, 4);
+		_mm256_storeu_ps (buf + i, _mm256_mul_ps (vAmp, _mm256_fmadd_ps (c1, _mm256_sub_ps (t1, t0), t0)));
+		vAmp = _mm256_add_ps (vAmp, vAmpStep);
+		i += 8;
+	}
+
+	*phase = p;
+	*amp += i * ampIncr;
+	return i;
+}
+
+/* Sums each of 8 vectors horizontally, results in frame order. */
+TARGET_AVX2
+static __m256 avx2HorizontalSums (__m256 v0, __m256 v1, __m256 v2, __m256 v3,
+                                  __m256 v4, __m256 v5, __m256 v6, __m256 v7) {
+	__m256 h0123 = _mm256_hadd_ps (_mm256_hadd_ps (v0, v1), _mm256_hadd_ps (v2, v3));
+	__m256 h4567 = _mm256_hadd_ps (_mm256_hadd_ps (v4, v5), _mm256_hadd_ps (v6, v7));
+	return _mm256_add_ps (_mm256_permute2f128_ps (h0123, h4567, 0x20),
+	                      _mm256_permute2f128_ps (h0123, h4567, 0x31));
+}
+
+TARGET_AVX2
+static U32 dspInterp4thAvx2 (const S16 *data, busT *buf, U32 n, U32 endIndex,
+                             Phase *phase, Phase dspPhaseIncr, realT *amp, realT ampIncr) {
+	Phase p = *phase;
+	Phase q;
+	U32 i = 0, k;
+	__m256 v[4];
+	__m256 vAmp = avx2AmpRamp (*amp, ampIncr);
+	__m256 vAmpStep = _mm256_set1_ps ((float) (8 * ampIncr));
+
+	while (groupFits_ (i, n, 8, p, dspPhaseIncr, endIndex)) {
+		/* frames k and k + 4 share a vector, one per 128 bit lane */
+		for (k = 0; k < 4; k++) {
+			q = p + 4 * dspPhaseIncr;
+			v[k] = _mm256_mul_ps (
+				_mm256_insertf128_ps (_mm256_castps128_ps256 (_mm_load_ps (interpCoeffF[phaseFractToTablerow (p)])),
+				                      _mm_load_ps (interpCoeffF[phaseFractToTablerow (q)]), 1),
+				_mm256_cvtepi32_ps (_mm256_cvtepi16_epi32 (
+					_mm_unpacklo_epi64 (_mm_loadl_epi64 ((const __m128i *) (data + phaseIndex (p) - 1)),
+					                    _mm_loadl_epi64 ((const __m128i *) (data + phaseIndex (q) - 1))))));
+			phaseIncr (p, dspPhaseIncr);
+		}
+		/* lane 0: frames 0..3, lane 1: frames 4..7 */
+		_mm256_storeu_ps (buf + i, _mm256_mul_ps (vAmp,
+		                  _mm256_hadd_ps (_mm256_hadd_ps (v[0], v[1]), _mm256_hadd_ps (v[2], v[3]))));
+		p += 4 * dspPhaseIncr;
+		vAmp = _mm256_add_ps (vAmp, vAmpStep);
+		i += 8;
+	}
+
+	*phase = p;
+	*amp += i * ampIncr;
+	return i;
+}
+
+TARGET_AVX2
+static U32 dspInterp7thAvx2 (const S16 *data, busT *buf, U32 n, U32 endIndex,
+                             Phase *phase, Phase dspPhaseIncr, realT *amp, realT ampIncr) {
+	Phase p = *phase;
+	U32 i = 0, k;
+	__m256 v[8];
+	__m256 vAmp = avx2AmpRamp (*amp, ampIncr);
+	__m256 vAmpStep = _mm256_set1_ps ((float) (8 * ampIncr));
+
+	while (groupFits_ (i, n, 8, p, dspPhaseIncr, endIndex)) {
+		for (k = 0; k < 8; k++) {
+			/* 8 points from index - 3; the 8th coefficient is 0 */
+			v[k] = _mm256_mul_ps (_mm256_load_ps (sincTable7F[phaseFractToTablerow (p)]),
+			                      _mm256_cvtepi32_ps (_mm256_cvtepi16_epi32 (
+			                        _mm_loadu_si128 ((const __m128i *) (data + phaseIndex (p) - 3)))));
+			phaseIncr (p, dspPhaseIncr);
+		}
+		_mm256_storeu_ps (buf + i, _mm256_mul_ps (vAmp,
+		                  avx2HorizontalSums (v[0], v[1], v[2], v[3], v[4], v[5], v[6], v[7])));
+		vAmp = _mm256_add_ps (vAmp, vAmpStep);
+		i += 8;
+	}
+
+	*phase = p;
+	*amp += i * ampIncr;
+	return i;
+}
+
+#endif /* DSP_SIMD_X86 */
+
+/***************************************************************
+ *
+ *                          NEON
+ */
+#ifdef DSP_SIMD_NEON
+
+static float32x4_t neonAmpRamp (realT amp, realT ampIncr) {
+	float a[4] = { (float) amp, (float) (amp + ampIncr),
+	               (float) (amp + 2 * ampIncr), (float) (amp + 3 * ampIncr) };
+	return vld1q_f32 (a);
+}
+
+static U32 dspInterp4thNeon (const S16 *data, busT *buf, U32 n, U32 endIndex,
+                             Phase *phase, Phase dspPhaseIncr, realT *amp, realT ampIncr) {
+	Phase p = *phase;
+	U32 i = 0, k;
+	float32x4_t v[4];
+	float32x4_t vAmp = neonAmpRamp (*amp, ampIncr);
+	float32x4_t vAmpStep = vdupq_n_f32 ((float) (4 * ampIncr));
+
+	while (groupFits_ (i, n, 4, p, dspPhaseIncr, endIndex)) {
+		for (k = 0; k < 4; k++) {
+			v[k] = vmulq_f32 (vld1q_f32 (interpCoeffF[phaseFractToTablerow (p)]),
+			                  vcvtq_f32_s32 (vmovl_s16 (vld1_s16 (data + phaseIndex (p) - 1))));
+			phaseIncr (p, dspPhaseIncr);
+		}
+		/* pairwise adds leave the 4 horizontal sums in frame order */
+		vst1q_f32 (buf + i, vmulq_f32 (vAmp, vpaddq_f32 (vpaddq_f32 (v[0], v[1]),
+		                                                  vpaddq_f32 (v[2], v[3]))));
+		vAmp = vaddq_f32 (vAmp, vAmpStep);
+		i += 4;
+	}
+
+	*phase = p;
+	*amp += i * ampIncr;
+	return i;
+}
+
+static U32 dspInterp7thNeon (const S16 *data, busT *buf, U32 n, U32 endIndex,
+                             Phase *phase, Phase dspPhaseIncr, realT *amp, realT ampIncr) {
+	Phase p = *phase;
+	U32 i = 0, k;
+	const float *c;
+	int16x8_t t;
+	float32x4_t v[4];
+	float32x4_t vAmp = neonAmpRamp (*amp, ampIncr);
+	float32x4_t vAmpStep = vdupq_n_f32 ((float) (4 * ampIncr));
+
+	while (groupFits_ (i, n, 4, p, dspPhaseIncr, endIndex)) {
+		for (k = 0; k < 4; k++) {
+			c = sincTable7F[phaseFractToTablerow (p)];
+			t = vld1q_s16 (data + phaseIndex (p) - 3);
+			v[k] = vmlaq_f32 (vmulq_f32 (vld1q_f32 (c), vcvtq_f32_s32 (vmovl_s16 (vget_low_s16 (t)))),
+			                  vld1q_f32 (c + 4), vcvtq_f32_s32 (vmovl_s16 (vget_high_s16 (t))));
+			phaseIncr (p, dspPhaseIncr);
+		}
+		vst1q_f32 (buf + i, vmulq_f32 (vAmp, vpaddq_f32 (vpaddq_f32 (v[0], v[1]),
+		                                                  vpaddq_f32 (v[2], v[3]))));
+		vAmp = vaddq_f32 (vAmp, vAmpStep);
+		i += 4;
+	}
+
+	*phase = p;
+	*amp += i * ampIncr;
+	return i;
+}
+
+#endif /* DSP_SIMD_NEON */
+
+/***************************************************************
+ *
+ *                        DISPATCH
+ */
+
+static const dspKernelsT kernelSets[] = {
+	{ "scalar", dspInterpLinearScalar, dspInterp4thScalar, dspInterp7thScalar },
+#ifdef DSP_SIMD_X86
+	{ "sse2", dspInterpLinearSse2, dspInterp4thSse2, dspInterp7thSse2 },
+	{ "avx2", dspInterpLinearAvx2, dspInterp4thAvx2, dspInterp7thAvx2 },
+#endif
+#ifdef DSP_SIMD_NEON
+	{ "neon", dspInterpLinearScalar, dspInterp4thNeon, dspInterp7thNeon },
+#endif
+	{ NULL, NULL, NULL, NULL }
+};
+
+dspKernelsT dspKernels = { "scalar", dspInterpLinearScalar, dspInterp4thScalar, dspInterp7thScalar };
+
+static int cpuSupports (const char *name) {
+	if (!STRCMP (name, "scalar"))
+		return 1;
+#ifdef DSP_SIMD_X86
+	__builtin_cpu_init ();
+	if (!STRCMP (name, "sse2"))
+		return __builtin_cpu_supports ("sse2");
+	if (!STRCMP (name, "avx2"))
+		return __builtin_cpu_supports ("avx2") && __builtin_cpu_supports ("fma");
+#endif
+#ifdef DSP_SIMD_NEON
+	if (!STRCMP (name, "neon"))
+		return 1;
+#endif
+	return 0;
+}
+
+S32 dspSimdSelect (const char *name) {
+	const dspKernelsT *set;
+
+	for (set = kernelSets; set->name != NULL; set++) {
+		if (!STRCMP (set->name, name) && cpuSupports (name)) {
+			dspKernels = *set;
+			return OK;
+		}
+	}
+	return FAILED;
+}
+
+void dspSimdConfig (void) {
+	const dspKernelsT *set;
+
+	/* The table is in ascending order of speed; take the last one that works. */
+	for (set = kernelSets; set->name != NULL; set++) {
+		if (cpuSupports (set->name))
+			dspKernels = *set;
+	}
+}
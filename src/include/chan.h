@@ -17,7 +17,9 @@ typedef struct _Channel {
 	U8 prognum;
 	U8 bankMsb;
 	U8 interpMethod;
+	U8 fxBus;									/* synth->fxBus[] this channel sends to */
 	Preset *presetP;
+	struct _PresetIndex *presetIndexP;	/* zone index of presetP, owned by the synth */
 	struct _Synthesizer *synth;
 	S8 keyPressure[128];
 	S16 channelPressure;
@@ -35,6 +37,14 @@ typedef struct _Channel {
 	S32 gen[GEN_LAST];
 	// By default, the NRPN values are relative to the values of the generators set in the SoundFont. For example, if the NRPN specifies an attack of 100 msec then 100 msec will be added to the combined attack time of the sound font and the modulators.  However, it is useful to be able to specify the generator value absolutely, completely ignoring the generators of the sound font and the values of modulators. The genAbs field, is a boolean flag indicating whether the NRPN value is absolute or not. 
 	S8 genAbs[GEN_LAST];
+
+	/* Controller changes not yet applied to the voices; synthModulatePending
+	 * applies them once, with the latest values, before the next span is
+	 * rendered.  Sources are numbered as in voiceModIndexT. */
+	U32 modPending[8];
+	U32 keyPressurePending[4];		/* keys with new poly pressure */
+	U8 modAllPending;							/* all controllers were reset */
+	U8 modAnyPending;
 } Channel;
 
 Channel *newChannel (struct _Synthesizer * synth, S32 num);
@@ -46,6 +56,8 @@ void channelCc (Channel * chan, S32 ctrl, S32 val);
 void channelPressure (Channel * chan, S32 val);
 void channelPitchBend (Channel * chan, S32 val);
 void channelPitchWheelSens (Channel * chan, S32 val);
+void channelModulateLater (Channel * chan, S32 isCc, S32 ctrl);
+void channelKeyPressureLater (Channel * chan, S32 key);
 
 #define channelGetKeyPressure(chan, key) \
   ((chan)->keyPressure[key])
@@ -13,6 +13,7 @@ struct _Chorus;
 #define MAX_SPEED_HZ    5
 #define MAX_SAMPLES_LN2 12
 
+/* delay line length, a power of two */
 #define MAX_SAMPLES (1 << (MAX_SAMPLES_LN2-1))
 #define MAX_SAMPLES_ANDMASK (MAX_SAMPLES-1)
 
@@ -29,6 +30,9 @@ struct _Chorus;
    alone.  For a demo on aliasing try '1' With '3', the aliasing is
    still quite pronounced for some input frequencies */
 #define INTERPOLATION_SAMPLES 5
+/* taps per interpolation, padded to one vector; the extra ones are 0 */
+#define CHORUS_TAPS 8
+
 #define CHORUS_DEFAULT_N 3																/**< Default chorus voice count */
 #define CHORUS_DEFAULT_LEVEL 2.0f													/**< Default chorus level */
 #define CHORUS_DEFAULT_SPEED 0.3f													/**< Default chorus speed */
@@ -52,46 +56,52 @@ typedef struct _Chorus {
 	 */
 	int type;											/* current value */
 	int newType;									/* next value, if parameter check is OK */
-	S16 depthMs;				/* current value */
-	S16 newDepthMs;		/* next value, if parameter check is OK */
-	S16 level;						/* current value */
-	S16 newLevel;				/* next value, if parameter check is OK */
-	S16 speed_Hz;				/* current value */
-	S16 newSpeed_Hz;		/* next value, if parameter check is OK */
+	realT depthMs;				/* current value */
+	realT newDepthMs;		/* next value, if parameter check is OK */
+	realT level;						/* current value */
+	realT newLevel;				/* next value, if parameter check is OK */
+	realT speed_Hz;				/* current value */
+	realT newSpeed_Hz;		/* next value, if parameter check is OK */
 	int numberBlocks;						/* current value */
 	int newNumberBlocks;				/* next value, if parameter check is OK */
-	S16 *chorusbuf;
-	int counter;
-	long phase[MAX_CHORUS];
-	long modulationPeriodSamples;
-	int *lookupTab;
-	S16 sampleRate;
-  S16 **sincTable;
+	float *chorusbuf;							/* MAX_SAMPLES, mirrored behind itself, + CHORUS_TAPS */
+	int counter;									/* next write position */
+	double phase[MAX_CHORUS];			/* LFO phase at the block start, 0..1 */
+	double phaseIncr;							/* per block */
+	realT depthSubsamples;				/* delay modulation range */
+	realT sampleRate;
+	int quietFrames;							/* since the send went quiet */
+	int idle;											/* delay line is silent, processing skipped */
+	float out[BUFSIZE];
+	float sincTable[INTERPOLATION_SUBSAMPLES][CHORUS_TAPS];	/* [fraction][tap], oldest sample first */
 } Chorus;
 
 /* * chorus */
-Chorus *newChorus (S16 sampleRate);
+Chorus *newChorus (realT sampleRate);
 void deleteChorus (Chorus * chorus);
-void chorusProcessmix (Chorus * chorus, S16 * in,
-															S16 * leftOut,
-															S16 * rightOut);
-void chorusProcessreplace (Chorus * chorus, S16 * in,
-																	S16 * leftOut,
-																	S16 * rightOut);
+void chorusProcessmix (Chorus * chorus, busT * in,
+															busT * leftOut,
+															busT * rightOut);
+void chorusProcessreplace (Chorus * chorus, busT * in,
+																	busT * leftOut,
+																	busT * rightOut);
 S32 chorusInit (Chorus * chorus);
 void chorusReset (Chorus * chorus);
+/* True while the send is quiet and nothing is left in the delay line; the
+ * process functions then skip the work (replace writes silence). */
+S32 chorusIdle (Chorus * chorus);
 void chorusSetNr (Chorus * chorus, S32 nr);
-void chorusSetLevel (Chorus * chorus, S16 level);
+void chorusSetLevel (Chorus * chorus, realT level);
 void chorusSetSpeed_Hz (Chorus * chorus,
-																S16 speed_Hz);
+																realT speed_Hz);
 void chorusSetDepthMs (Chorus * chorus,
-																S16 depthMs);
+																realT depthMs);
 void chorusSetType (Chorus * chorus, S32 type);
 S32 chorusUpdate (Chorus * chorus);
 S32 chorusGetNr (Chorus * chorus);
-S16 chorusGetLevel (Chorus * chorus);
-S16 chorusGetSpeed_Hz (Chorus * chorus);
-S16 chorusGetDepthMs (Chorus * chorus);
+realT chorusGetLevel (Chorus * chorus);
+realT chorusGetSpeed_Hz (Chorus * chorus);
+realT chorusGetDepthMs (Chorus * chorus);
 S32 chorusGetType (Chorus * chorus);
 
 
@@ -22,56 +22,69 @@
 #define _CONV_H
 
 #include "fluidbean.h"
+#include "tables.h"
 #include <math.h>
 
 /*
- Attenuation range in centibels.
- Attenuation range is the dynamic range of the volume envelope generator
- from 0 to the end of attack segment.
- fluidsynth is a 24 bit synth, it could (should??) be 144 dB of attenuation.
- However the spec makes no distinction between 16 or 24 bit synths, so use
- 96 dB here.
-
- Note about usefulness of 24 bits:
- 1)Even fluidsynth is a 24 bit synth, this format is only relevant if
- the sample format coming from the soundfont is 24 bits and the audio sample format
- chosen by the application (audio.sample.format) is not 16 bits.
-
- 2)When the sample soundfont is 16 bits, the internal 24 bits number have
- 16 bits msb and lsb to 0. Consequently, at the DAC output, the dynamic range of
- this 24 bit sample is reduced to the the dynamic of a 16 bits sample (ie 90 db)
- even if this sample is produced by the audio driver using an audio sample format
- compatible for a 24 bit DAC.
-
- 3)When the audio sample format settings is 16 bits (audio.sample.format), the
- audio driver will make use of a 16 bit DAC, and the dynamic will be reduced to 96 dB
- even if the initial sample comes from a 24 bits soundfont.
+ * ct2hzReal
+ *
+ * Cents (6.875 Hz = -300 cents) to Hz, 1.0 outside 0 .. 14100 cents.  The
+ * table conversions are branch-free (clamp, index, select) so loops over
+ * them vectorise.
+ */
+static inline realT ct2hzReal (realT cents) {
+	realT c = cents < 0 ? 0 : cents;
+	S32 i;
+	realT hz;
 
- In both cases (2) or (3), the real dynamic range is only 96 dB.
+	c = c < 14099 ? c : 14099;
+	i = (S32) c + 300;
+	hz = ct2hzOctaveTab[i / 1200] * ct2hzTab[i % 1200];
+	/* some loony trying to make you deaf */
+	return (cents < 0 || cents >= 14100) ? (realT) 1.0 : hz;
+}
 
- Other consideration for NOISE_FLOOR related to case (1),(2,3):
- - for case (1), NOISE_FLOOR should be the noise floor for 24 bits (i.e -138 dB).
- - for case (2) or (3), NOISE_FLOOR should be the noise floor for 16 bits (i.e -90 dB).
+/*
+ * ct2hz
  */
-#define PEAK_ATTENUATION  960.0f
-#define CENTS_HZ_SIZE     1200
-#define VEL_CB_SIZE       128
-#define CB_AMP_SIZE       961
-#define ATTEN_AMP_SIZE    1441
-#define PAN_SIZE          1002
+static inline realT ct2hz (realT cents) {
+	/* Filter fc limit: SF2.01 page 48 # 8: 20 Hz .. 20 kHz */
+	cents = cents < 1500 ? 1500 : cents;
+	cents = cents < 13500 ? cents : 13500;
+	return ct2hzReal (cents);
+}
 
-/* EMU 8k/10k don't follow spec in regards to volume attenuation.
- * This factor is used in the equation pow (10.0, cb / ATTEN_POWER_FACTOR).
- * By the standard this should be -200.0. */
-/* 07/11/2008 modified by S. Christian Collins for increased velocity sensitivity.  Now it equals the response of EMU10K1 programming.*/
-#define ATTEN_POWER_FACTOR  (-200.0)	/* was (-531.509) */
+/*
+ * cb2amp
+ *
+ * in: an attenuation in 'centibels' (1/10 dB), 0 is no attenuation
+ * out: a value between 1 and 0
+ *
+ * SF2.01 page 49 # 48 limits it to 144 dB.  96 dB is reasonable for 16 bit
+ * systems, 144 would make sense for 24 bit.  The table's extra last entry
+ * is the 0.0 for everything beyond.
+ */
+static inline realT cb2amp (realT cb) {
+	cb = cb < 0 ? 0 : cb;
+	cb = cb < CB_AMP_SIZE ? cb : CB_AMP_SIZE;
+	return cb2ampTab[(S32) cb];
+}
 
-void conversionConfig (void);
+/*
+ * atten2amp
+ *
+ * in: a value between 0 and 1440, 0 is no attenuation
+ * out: a value between 1 and 0
+ *
+ * Note: Volume attenuation is supposed to be centibels but EMU8k/10k don't
+ * follow this.  Thats the reason for separate cb2amp and atten2amp.
+ */
+static inline realT atten2amp (realT atten) {
+	atten = atten < 0 ? 0 : atten;
+	atten = atten < ATTEN_AMP_SIZE ? atten : ATTEN_AMP_SIZE;
+	return atten2ampTab[(S32) atten];
+}
 
-realT ct2hzReal (realT cents);
-realT ct2hz (realT cents);
-realT cb2amp (realT cb);
-realT atten2amp (realT atten);
 realT tc2sec (realT tc);
 realT tc2secDelay (realT tc);
 realT tc2secAttack (realT tc);
@@ -82,13 +95,4 @@ realT pan (realT c, S32 left);
 realT concave (realT val);
 realT convex (realT val);
 
-extern realT ct2hzTab[CENTS_HZ_SIZE];
-extern realT vel2cbTab[VEL_CB_SIZE];
-extern realT cb2ampTab[CB_AMP_SIZE];
-extern realT posbpTab[128];
-extern realT concaveTab[128];
-extern realT convexTab[128];
-extern realT panTab[PAN_SIZE];
-
-
 #endif /* _CONV_H */
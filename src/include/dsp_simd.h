@@ -0,0 +1,40 @@
+#ifndef _DSP_SIMD_H
+#define _DSP_SIMD_H
+
+#include "fluidbean.h"
+#include "phase.h"
+
+/* Interpolation kernels.
+ *
+ * A kernel renders the bulk of a voice buffer, i.e. the stretch where all
+ * interpolation taps lie inside the sample data and no start / end / loop
+ * wrap-around points are involved.  It writes at most 'n' frames to 'buf',
+ * stops before the phase index passes 'endIndex' and returns the number of
+ * frames written; phase and amp are advanced accordingly.  The scalar loops
+ * in dsp_float.c render whatever is left over.
+ *
+ * The vector kernels may read one sample point beyond the last tap they
+ * use.  That's always inside the 46 zero points that SF2 requires after
+ * every sample.
+ */
+typedef U32 (*dspKernelT) (const S16 *data, busT *buf, U32 n, U32 endIndex,
+                           Phase *phase, Phase phaseIncr,
+                           realT *amp, realT ampIncr);
+
+typedef struct {
+  const char *name;     // "scalar", "sse2", "avx2" or "neon"
+  dspKernelT linear;
+  dspKernelT order4;
+  dspKernelT order7;
+} dspKernelsT;
+
+extern dspKernelsT dspKernels;
+
+/* Picks the fastest kernels the CPU supports.  Called from dspFloatConfig. */
+void dspSimdConfig (void);
+
+/* Forces a kernel set by name (e.g. "scalar" to compare against the reference).
+ * Returns FAILED if the CPU doesn't support it. */
+S32 dspSimdSelect (const char *name);
+
+#endif /* _DSP_SIMD_H */
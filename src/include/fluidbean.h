@@ -177,7 +177,46 @@ typedef long long longLongT;
  *                      CONSTANTS
  */
 
-#define BUFSIZE                64   // a CONSTANT buffer size for max speed, eh??
+/* Control-rate block size.
+ *
+ * Envelopes, LFOs, modulators, filter coefficients and amplitude ramps are
+ * updated once per BUFSIZE frames, and the per-voice loops are compiled for
+ * this trip count.  A bigger block spreads the per-block voice update over
+ * more frames, which pays off for offline rendering and large polyphony;
+ * 64 keeps the envelope and LFO resolution the low-latency path has always
+ * had.  Pick it at build time (cmake -DBLOCK_SIZE=128).  It doesn't limit
+ * the audio period: synthWriteS16 cuts any length into blocks.
+ */
+#ifndef FLUIDBEAN_BLOCK_SIZE
+#define FLUIDBEAN_BLOCK_SIZE   64
+#endif
+#if FLUIDBEAN_BLOCK_SIZE != 32 && FLUIDBEAN_BLOCK_SIZE != 64 \
+	&& FLUIDBEAN_BLOCK_SIZE != 128 && FLUIDBEAN_BLOCK_SIZE != 256
+#error "FLUIDBEAN_BLOCK_SIZE must be 32, 64, 128 or 256"
+#endif
+#define BUFSIZE                FLUIDBEAN_BLOCK_SIZE   // a CONSTANT buffer size for max speed, eh??
+
+/* Mix bus sample type.
+ *
+ * Everything between the interpolated voice buffer and the output (voice
+ * buffer, left/right mix buffers, reverb/chorus sends and returns) is
+ * accumulated in busT.  The default float bus is normalised to +/-1.0 and
+ * only gets converted to S16 once, in synthWriteS16 / synthDitherS16.
+ * WITH_S16_BUS builds the old 16-bit accumulation buffers, which convert
+ * on every voice sample and saturate after a handful of loud voices; it
+ * is only kept around for comparison (see example/src/busBench.c).
+ *
+ * BUS_NORM scales 16-bit sample data onto the bus, BUS_TO_S16 scales the
+ * bus back to 16-bit output. */
+#if defined(WITH_S16_BUS)
+typedef S16 busT;
+#define BUS_NORM               1.0f
+#define BUS_TO_S16             1.0f
+#else
+typedef float busT;
+#define BUS_NORM               (1.0f / 32768.0f)
+#define BUS_TO_S16             32766.0f
+#endif
 
 #ifndef PI
 #define PI                          3.141592654
@@ -201,6 +240,8 @@ typedef long long longLongT;
 #define FTELL(_f)              ftell(_f)
 #define MEMCPY(_dst,_src,_n)   memcpy(_dst,_src,_n)
 #define MEMSET(_s,_c,_n)       memset(_s,_c,_n)
+#define MEMCMP(_s,_t,_n)       memcmp(_s,_t,_n)
+#define MEMMOVE(_dst,_src,_n)  memmove(_dst,_src,_n)
 #define STRLEN(_s)             strlen(_s)
 #define STRCMP(_s,_t)          strcmp(_s,_t)
 #define STRNCMP(_s,_t,_n)      strncmp(_s,_t,_n)
@@ -94,9 +94,15 @@ typedef struct _PlayerT {
     int startTicks;          /* the number of tempo ticks passed at the last tempo change */
     int curTicks;            /* the number of tempo ticks passed */
     int lastCallbackTicks;  /* the last tick number that was passed to player->tickCallback */
-    int beginMsec;           /* the time (msec) of the beginning of the file */
-    int startMsec;           /* the start time of the last tempo change */
-    int curMsec;             /* the current time */
+    /* The player runs on sample time: curSample only moves when the player is
+       advanced (playerAdvance() by the audio renderer, or playerCallback() with
+       the system timer's msec converted to samples), never with the wall clock. */
+    U32 sampleRate;          /* the synth's output rate */
+    uint64 beginSample;      /* the time (samples) of the beginning of the file */
+    uint64 startSample;      /* the start time of the last tempo change */
+    uint64 curSample;        /* the current time */
+    uint64 frameBase;        /* synth frame minus player sample time, set by playerAdvance() */
+    int queueEvents;         /* inside playerAdvance(): queue channel events on the synth */
     /* sync mode: indicates the tempo mode the player is driven by (see playerSetTempo()):
        1, the player is driven by internal tempo (Miditempo). This is the default.
        0, the player is driven by external tempo (exttempo)
@@ -111,6 +117,7 @@ typedef struct _PlayerT {
     /* multempo: tempo multiplier set by playerSetTempo() */
     float multempo;
     float deltatime;   /* milliseconds per Midi tick. depends on current tempo mode (see syncMode) */
+    double samplesPerTick; /* the same in samples, kept in double so long songs don't drift */
     unsigned int division;
 
     handleMidiEventFuncT playbackCallback; /* function fired on each Midi event as it is played */
@@ -121,6 +128,12 @@ typedef struct _PlayerT {
     int channelIsplaying[MAX_NUMBER_OF_CHANNELS]; /* flags indicating channels on which notes have played */
 } PlayerT;
 
+/* Moves the player 'nFrames' samples ahead.  Every channel event in that
+   stretch is queued on the synth for its exact frame (when the default
+   playback callback is in place), so call it right before rendering the
+   same nFrames.  Works for offline or faster-than-realtime playback. */
+int playerAdvance (PlayerT * player, U32 nFrames);
+
 S32 MidiSendEvent (struct _Synthesizer * synth, PlayerT * player,
 													 MidiEventT * evt);
 
@@ -6,8 +6,7 @@
 #include "chan.h"
 #include "voice.h"
 
-// Modulators
-#define NUM_MOD           64
+// Modulators (NUM_MOD per voice is in voice.h)
 void modClone (Modulator * mod, Modulator * src);
 int modTestIdentity (Modulator * mod1, Modulator * mod2);
 S32 modGetValue (Modulator * mod, Channel *chan, Voice * voice);
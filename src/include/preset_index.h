@@ -0,0 +1,84 @@
+struct _PresetIndex;
+
+#ifndef _PRESET_INDEX_H
+#define _PRESET_INDEX_H
+
+#include "fluidbean.h"
+#include "soundfont.h"
+
+struct _Voice;
+
+/* Note-on zone index.
+ *
+ * Every (preset zone, instrument zone) pair of a preset is flattened into a
+ * presetZoneT once, with the SF2 merging rules already applied: the
+ * instrument generators are resolved against the global instrument zone,
+ * the preset level amounts against the global preset zone, and identical
+ * modulators are kicked out of both modulator lists.  The key range is
+ * split per key and the velocity range into the bands between the zones'
+ * velocity limits, and every (key, band) cell lists the pairs that sound
+ * there, in preset/instrument zone order.  A note-on is then a cell lookup
+ * plus copying each listed pair into a voice.
+ *
+ * The soundfont is only read, so an index can be shared by any number of
+ * channels.  The synth keeps one per preset of its soundfont
+ * (synth->presetIndex), built when the font is set, off the audio thread;
+ * the renderer only looks them up.
+ */
+
+#define PRESET_INDEX_BUCKETS 64
+
+typedef struct {
+	Sample *sampleP;
+	U8 keylo;													/* intersection of the preset and instrument zone ranges */
+	U8 keyhi;
+	U8 vello;
+	U8 velhi;
+	U8 nInstGens;
+	U8 nPresetGens;
+	U8 nInstMods;
+	U8 nPresetMods;
+	Generator *instGenA;							/* replace the voice's generators */
+	Generator *presetGenA;						/* nonzero amounts, added to the voice's generators */
+	Modulator **instModA;							/* overwrite the voice's modulators */
+	Modulator **presetModA;						/* nonzero amounts, added to the voice's modulators */
+} presetZoneT;
+
+typedef struct {
+	U32 first;												/* into zoneList */
+	U32 n;
+} presetCellT;
+
+typedef struct _PresetIndex {
+	Preset *presetP;
+	S32 nZones;
+	presetZoneT *zoneA;
+	S32 nVelBands;
+	U8 velBand[128];									/* velocity -> band */
+	presetCellT *cellA;								/* [key * nVelBands + band] */
+	U32 *zoneList;										/* indices into zoneA */
+	struct _PresetIndex *next;				/* hash chain */
+} PresetIndex;
+
+#define presetIndexCell_(_idx, _key, _vel) \
+	(&(_idx)->cellA[(_key) * (_idx)->nVelBands + (_idx)->velBand[_vel]])
+
+PresetIndex *newPresetIndex (Preset * presetP);
+void deletePresetIndex (PresetIndex * indexP);
+
+/* Looks 'presetP' up in 'cache' (PRESET_INDEX_BUCKETS chains); NULL if
+ * it has no index there. */
+PresetIndex *presetIndexFind (PresetIndex ** cache, Preset * presetP);
+/* The same, but builds the index on a miss.  Returns NULL if that runs out
+ * of memory. */
+PresetIndex *presetIndexGet (PresetIndex ** cache, Preset * presetP);
+/* Builds the index of every preset of 'sfP' that has zones.  FAILED if
+ * that runs out of memory. */
+S32 presetIndexBuildAll (PresetIndex ** cache, Soundfont * sfP);
+/* Deletes every index in 'cache', e.g. when the soundfont changes. */
+void presetIndexClear (PresetIndex ** cache);
+
+/* Copies a zone pair's generators and modulators into a freshly allocated voice. */
+void presetZoneApply (const presetZoneT * zoneP, struct _Voice * voiceP);
+
+#endif /* _PRESET_INDEX_H */
@@ -0,0 +1,72 @@
+#ifndef _RENDER_OFFLINE_H
+#define _RENDER_OFFLINE_H
+
+#include <stdio.h>
+#include "fluidbean.h"
+#include "soundfont.h"
+
+struct _Synthesizer;
+
+/* Offline rendering.
+ *
+ * A standard MIDI file is parsed once into a single event list with an
+ * absolute sample frame for every event (the tempo map is applied up
+ * front), then the synth is run over it as fast as the CPU allows.
+ * Nothing here looks at a clock, so the result only depends on the song,
+ * the soundfont and the synth settings.
+ *
+ * renderBatch renders many songs at once, one synth per thread.  The
+ * soundfont is only read while rendering, so all synths share it.
+ */
+
+enum renderFormat {
+	RENDER_WAV,												/* 16 bit stereo RIFF/WAVE */
+	RENDER_RAW												/* 16 bit stereo, interleaved little endian, no header */
+};
+
+/* stop rendering this long after the last event even if something still rings */
+#define RENDER_MAX_TAIL_SECONDS 10
+
+typedef struct {
+	uint64 frame;											/* absolute output frame */
+	U32 tick;
+	U32 seq;													/* file order, keeps the sort stable */
+	U32 tempo;												/* MIDI_SET_TEMPO: usec per quarter note */
+	U8 type;
+	U8 chan;
+	U8 p1;
+	U8 p2;
+} midiSongEventT;
+
+typedef struct {
+	U32 sampleRate;
+	U32 division;
+	S32 nEvents;
+	midiSongEventT *event;						/* sorted by frame */
+	uint64 lastFrame;									/* frame of the last event (or end of track) */
+} midiSongT;
+
+/* Parses an SMF (format 0 or 1) for the given output rate.  Returns NULL if
+ * the data isn't a MIDI file. */
+midiSongT *newMidiSong (const U8 * data, U32 len, U32 sampleRate);
+midiSongT *midiSongLoad (const char *path, U32 sampleRate);
+void deleteMidiSong (midiSongT * song);
+
+/* Resets the synth and renders the whole song plus its release tail to
+ * 'out'.  The number of frames written goes to 'framesOut' (may be NULL). */
+S32 renderSong (struct _Synthesizer * synth, midiSongT * song, FILE * out,
+								S32 format, uint64 * framesOut);
+
+typedef struct {
+	const char *midiPath;
+	const char *outPath;
+	S32 format;
+	S32 status;												/* OK / FAILED, set by renderBatch */
+	uint64 frames;
+} renderJobT;
+
+/* Renders 'jobs' on 'nThreads' threads, each with its own synth created from
+ * the current synthSettings.  Returns OK if every job succeeded. */
+S32 renderBatch (Soundfont * sf, renderJobT * jobs, S32 nJobs, S32 nThreads);
+
+#endif /* _RENDER_OFFLINE_H */
@@ -0,0 +1,44 @@
+struct _renderPool;
+
+#ifndef _RENDER_POOL_H
+#define _RENDER_POOL_H
+
+#include "fluidbean.h"
+
+struct _Synthesizer;
+
+/* Parallel voice rendering.
+ *
+ * The active voices are cut into groups of RENDER_GROUP_VOICES, in
+ * synth->activeVoice order.  Every group is mixed into its own private
+ * left/right and per effect bus reverb/chorus block, and the blocks are summed into the synth
+ * buffers in group order once all of them are done.  Which thread renders
+ * a group doesn't affect the result, so the output is bit-identical for
+ * any number of threads (it differs from the unthreaded renderer only by
+ * float summation order).
+ *
+ * The audio thread publishes a block with a single atomic store, renders
+ * groups itself like any worker and then spins until the last group is
+ * done.  It never takes a lock.  Workers spin for a while after a block,
+ * then sleep on a semaphore; the audio thread only posts to workers that
+ * said they're going to sleep.
+ */
+
+#define RENDER_GROUP_VOICES 16
+
+typedef struct _renderPool renderPoolT;
+
+/* 'nThreads' counts the audio thread, so nThreads - 1 workers are started.
+ * 'nbuf' is synth->nbuf, 'nFxBuses' synth->nFxBuses (at most 32),
+ * 'maxVoices' is synth->nvoice. */
+renderPoolT *newRenderPool (S32 nThreads, S32 nbuf, S32 nFxBuses, S32 maxVoices);
+void deleteRenderPool (renderPoolT * pool);
+
+/* Renders frames [start, start + n) of synth->activeVoice and mixes the
+ * result into synth->leftBuf / rightBuf and the reverb / chorus sends of
+ * the effect buses, marking the buses it sent to as used.  Called once
+ * per span of the block. */
+void renderPoolWrite (renderPoolT * pool, struct _Synthesizer * synth,
+											S32 start, S32 n);
+
+#endif /* _RENDER_POOL_H */
@@ -35,39 +35,43 @@ typedef struct _fluidRevmodelT revmodelT;
 /*
  * reverb
  */
-revmodelT *newRevmodel (void);
+revmodelT *newRevmodel (realT sampleRate);
 void deleteRevmodel (revmodelT * rev);
 
-void revmodelProcessmix (revmodelT * rev, S16 * in,
-																S16 * leftOut,
-																S16 * rightOut);
+void revmodelProcessmix (revmodelT * rev, busT * in,
+																busT * leftOut,
+																busT * rightOut);
 
-void revmodelProcessreplace (revmodelT * rev, S16 * in,
-																		S16 * leftOut,
-																		S16 * rightOut);
+void revmodelProcessreplace (revmodelT * rev, busT * in,
+																		busT * leftOut,
+																		busT * rightOut);
 
 void revmodelReset (revmodelT * rev);
 
-void revmodelSetroomsize (revmodelT * rev, S16 value);
-void revmodelSetdamp (revmodelT * rev, S16 value);
-void revmodelSetlevel (revmodelT * rev, S16 value);
-void revmodelSetwidth (revmodelT * rev, S16 value);
-void revmodelSetmode (revmodelT * rev, S16 value);
+/* True while the tail has died away and the input stayed quiet; the
+ * process functions then skip the filters (replace writes silence). */
+int revmodelIdle (revmodelT * rev);
 
-S16 revmodelGetroomsize (revmodelT * rev);
-S16 revmodelGetdamp (revmodelT * rev);
-S16 revmodelGetlevel (revmodelT * rev);
-S16 revmodelGetwidth (revmodelT * rev);
+void revmodelSetroomsize (revmodelT * rev, realT value);
+void revmodelSetdamp (revmodelT * rev, realT value);
+void revmodelSetlevel (revmodelT * rev, realT value);
+void revmodelSetwidth (revmodelT * rev, realT value);
+void revmodelSetmode (revmodelT * rev, realT value);
+
+realT revmodelGetroomsize (revmodelT * rev);
+realT revmodelGetdamp (revmodelT * rev);
+realT revmodelGetlevel (revmodelT * rev);
+realT revmodelGetwidth (revmodelT * rev);
 
 /*
  * reverb preset
  */
 typedef struct _fluidRevmodelPresetsT {
 	S8 *name;
-	S16 roomsize;
-	S16 damp;
-	S16 width;
-	S16 level;
+	realT roomsize;
+	realT damp;
+	realT width;
+	realT level;
 } revmodelPresetsT;
 
 
@@ -0,0 +1,44 @@
+#ifndef _SF_CACHE_H
+#define _SF_CACHE_H
+
+#include "fluidbean.h"
+#include "soundfont.h"
+
+/* Shared soundfonts.
+ *
+ * One copy of every SF2 file the process loads, however many synths play
+ * it: the cache keys the fonts by a hash of the file's content, so two
+ * paths to the same bank share the preset tree and the mapped PCM as well.
+ * sfCacheAcquire hands out a reference, sfCacheRelease drops one.
+ *
+ * Releasing never blocks and never frees, so a render thread can do it.
+ * When the last reference goes the font is retired with the next epoch.
+ * sfCacheCollect unloads it once every reader has passed that epoch, so
+ * nothing a render thread picked up from the font during its block can
+ * be pulled away under it.  The readers are the render threads: each
+ * synth registers one and calls sfCacheQuiesce at the start of every
+ * block.  A registered reader that stops rendering holds the retired
+ * fonts back until it is unregistered.
+ *
+ * Acquire, collect and the reader registration take the cache lock and
+ * are for control threads.  Only fonts from sfCacheAcquire may be passed
+ * to sfCacheRef / sfCacheRelease.
+ */
+
+typedef struct _sfCacheReader {
+	uint64 epoch;											/* atomic: the epoch at the reader's last block */
+	struct _sfCacheReader *next;
+} sfCacheReaderT;
+
+/* NULL if the file can't be loaded */
+Soundfont *sfCacheAcquire (const char *path);
+void sfCacheRef (Soundfont * sfP);
+void sfCacheRelease (Soundfont * sfP);
+/* unloads the retired fonts all readers are done with */
+void sfCacheCollect (void);
+
+void sfCacheRegisterReader (sfCacheReaderT * readerP);
+void sfCacheUnregisterReader (sfCacheReaderT * readerP);
+void sfCacheQuiesce (sfCacheReaderT * readerP);
+
+#endif /* _SF_CACHE_H */
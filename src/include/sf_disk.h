@@ -0,0 +1,89 @@
+#ifndef _SF_DISK_H
+#define _SF_DISK_H
+
+#include "fluidbean.h"
+
+/* Disk streaming of SF2 samples.
+ *
+ * For sample sets bigger than the memory, sfLoadStreaming keeps only part
+ * of each PCM sample in memory: its head, the first headFrames, and its
+ * loop region.  Those are read when the font is loaded and stay.  The
+ * rest is read from the file as voices get to it, SF_DISK_CHUNK frames at
+ * a time, by an I/O thread with pread.
+ *
+ * Like a SF3 sample (sf_stream.h), a streamed sample has a slice of one
+ * anonymous mapping per font that only the parts read in take memory of,
+ * and its pcmDataP points there.  A voice holds the chunk it plays and the
+ * next one, its double buffer: moving into a chunk queues the one after
+ * it.  The chunks read for voices stay cached within a budget; when it is
+ * used up, the least recently held chunk no voice holds is given back.  A
+ * block the voice's chunks aren't in for yet is an underrun: the voice
+ * waits, silent.
+ *
+ * The render side calls (sfDiskReady, sfDiskRelease) are lock free, the
+ * others are for control threads.  The I/O thread is started with the
+ * first font and kept for the life of the process.
+ */
+
+#define SF_DISK_CHUNK 16384								/* frames */
+#define SF_DISK_BUDGET (32 << 20)					/* bytes of chunks read for voices */
+#define SF_DISK_NONE 0xffffffffu					/* a voice holding no chunk */
+
+typedef struct _sfDiskChunk {
+	S32 ready;												/* atomic: it can be played */
+	S32 state;												/* atomic: enum sfDiskState */
+	S32 users;												/* atomic: voices holding it */
+	uint64 lastUse;										/* atomic: sfDiskTick at the last hold */
+	U8 resident;											/* head or loop: read at load, never given back */
+	struct _sfDiskSample *sampleP;
+	struct _sfDiskChunk *queueNext;		/* the request stack */
+	struct _sfDiskChunk *cacheNext;		/* I/O thread: the evictable chunks */
+} sfDiskChunkT;
+
+typedef struct _sfDiskSample {
+	U32 fileStart;										/* the first frame in smpl */
+	U32 frames;
+	U32 headFrames;
+	U32 loopStart;										/* relative, loopEnd == loopStart if none */
+	U32 loopEnd;
+	S16 *pcmP;												/* its slice of the font's mapping */
+	sfDiskChunkT *chunkA;
+	U32 nChunks;
+	struct _sfDiskFont *fontP;
+} sfDiskSampleT;
+
+typedef struct _sfDiskFont {
+	sfDiskSampleT *sampleA;
+	U32 nSamples;
+	int fd;														/* the file, read with pread */
+	uint64 smplOffset;								/* of the smpl chunk's data in it */
+	void *mapP;												/* the samples' mapping */
+	size_t mapSize;
+	sfDiskChunkT *chunkA;							/* all samples' chunks */
+	struct _sfDiskFont *next;
+} sfDiskFontT;
+
+typedef struct {
+	uint64 reads;											/* chunks read for voices */
+	uint64 evictions;
+	uint64 underruns;									/* voice blocks that waited for a chunk */
+	uint64 residentBytes;							/* heads and loops */
+	uint64 cachedBytes;								/* chunks read for voices and still in memory */
+	uint64 budgetBytes;
+} sfDiskStatsT;
+
+/* Maps the slices of the font's samples (their pcmP) and reads their
+ * heads and loops.  The font takes the fd over, unless it fails. */
+S32 sfDiskAdd (sfDiskFontT * fontP);
+/* No voice may play the font any more. */
+void sfDiskRemove (sfDiskFontT * fontP);
+
+void sfDiskConfig (size_t budget);
+void sfDiskStats (sfDiskStatsT * statsP);
+
+/* render side: 'heldP' is the voice's, SF_DISK_NONE at first.  OK if frames
+ * [first, last] are in; a voice moving on holds and queues its chunks. */
+S32 sfDiskReady (sfDiskSampleT * s, U32 * heldP, U32 first, U32 last);
+void sfDiskRelease (sfDiskSampleT * s, U32 * heldP);
+
+#endif /* _SF_DISK_H */
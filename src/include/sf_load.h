@@ -0,0 +1,58 @@
+#ifndef _SF_LOAD_H
+#define _SF_LOAD_H
+
+#include "fluidbean.h"
+#include "soundfont.h"
+#include "sf_stream.h"
+#include "sf_disk.h"
+
+/* SF2 / SF3 file loader.
+ *
+ * The file is mmap'ed read only and its pdta chunk is parsed into the
+ * Soundfont / Bank / Preset / Zone / Generator / Modulator / Sample arrays
+ * of soundfont.h, all of them in one allocation.  The PCM isn't copied:
+ * every Sample's pcmDataP is the start of the mapped smpl chunk and its
+ * indices are the file's, so the pages are only read when a voice plays
+ * them, and processes playing the same file share them.
+ *
+ * Banks and presets are indexed by their MIDI numbers, the way the synth
+ * looks them up: bankA[bank].presetA[program], banks 0 to DRUM_INST_BANK.
+ * Slots the file doesn't fill have no zones.  Zones of the global
+ * instrument and all preset zones carry all GEN_LAST generators, indexed
+ * by type; the other instrument zones only those they set or modulate.
+ * A modulator hangs off the generator it modulates.
+ *
+ * The compressed samples of a SF3 are decoded as they are played, see
+ * sf_stream.h; their pcmDataP points at the decoded frames.  A font from
+ * sfLoadStreaming reads its PCM samples from the file as they are played
+ * instead, see sf_disk.h; their indices are relative to the sample then,
+ * like a SF3's.  ROM samples
+ * and modulators linked to other modulators are left out; zones using
+ * those samples never sound.
+ */
+
+/* What sfLoad allocates.  The Soundfont comes first, so sfUnload (and
+ * sf_cache.c) can get back to the rest from it. */
+typedef struct {
+	Soundfont sf;
+	void *mapP;
+	size_t mapSize;
+	void *ownerP;											/* the sf_cache.c entry, NULL if not shared */
+	sfStreamFontT stream;							/* the SF3 samples, none for a SF2 */
+	sfDiskFontT disk;									/* the streamed PCM samples, see sfLoadStreaming */
+} sfFileT;
+
+/* NULL if the file can't be read or isn't a SF2 / SF3 */
+Soundfont *sfLoad (const char *path);
+/* The same for a file mapped already.  The font takes the mapping over,
+ * unless it returns NULL. */
+Soundfont *sfLoadMap (void *mapP, size_t mapSize);
+/* For sample sets bigger than the memory: only the first headFrames of
+ * every PCM sample and its loop are kept in memory, the rest is read as
+ * voices play it; see sf_disk.h */
+Soundfont *sfLoadStreaming (const char *path, U32 headFrames);
+/* SF3: decodes every sample now, in parallel; see sfStreamDecodeAll */
+S32 sfDecodeAll (Soundfont * sfP, S32 nThreads);
+void sfUnload (Soundfont * sfP);
+
+#endif /* _SF_LOAD_H */
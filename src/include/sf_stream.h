@@ -0,0 +1,97 @@
+#ifndef _SF_STREAM_H
+#define _SF_STREAM_H
+
+#include "fluidbean.h"
+
+/* SF3 sample streaming.
+ *
+ * The Ogg Vorbis samples of a SF3 file are decoded on a background
+ * thread, not at load time.  Every compressed sample has a slice of one
+ * anonymous mapping per font, reserved for its decoded length but not
+ * backed until written, and the Sample's pcmDataP points at it from the
+ * start.  Two parts of a slice get decoded:
+ *
+ * - the head, the first prerollMs of the sample, as soon as the font is
+ *   added; it stays for the life of the font.
+ * - the rest, when a voice starts on the sample (sfStreamPin).  The whole
+ *   decoded samples are cached within a memory budget; when the budget
+ *   is used up, the least recently started sample no voice is playing
+ *   gives its pages back to the system (everything but the head).
+ *
+ * A voice asks sfStreamReady every block whether the frames it's about
+ * to play are decoded and waits, silent, until they are.  A sample with
+ * a head plays from it while the rest decodes, so the first note isn't
+ * late unless the decoder falls behind by more than prerollMs.
+ *
+ * sfStreamDecodeAll decodes a whole font up front instead, in parallel.
+ *
+ * The render side calls (pin, unpin, ready) are lock free.  The others
+ * are for control threads.  The decoder thread is started with the
+ * first font and is kept for the life of the process.
+ */
+
+#define SF_STREAM_BUDGET (64 << 20)				/* bytes of whole decoded samples */
+#define SF_STREAM_PREROLL_MS 50
+
+typedef struct _sfStreamSample {
+	const U8 *oggP;										/* the sample's Ogg Vorbis stream */
+	U32 oggSize;
+	U32 frames;												/* decoded length */
+	U32 rate;
+	S16 *pcmP;												/* its slice of the font's mapping */
+	U32 ready;												/* atomic: the frames that can be played */
+	S32 state;												/* atomic: enum sfStreamState */
+	S32 users;												/* atomic: voices pinning it */
+	uint64 lastUse;										/* atomic: sfStreamTick at the last pin */
+	U32 head;													/* decoder: frames kept when evicted */
+	struct _sfStreamSample *queueNext;	/* the request stack */
+	struct _sfStreamSample *cacheNext;	/* decoder: the cached samples */
+	struct _sfStreamFont *fontP;
+} sfStreamSampleT;
+
+typedef struct _sfStreamFont {
+	sfStreamSampleT *sampleA;
+	U32 nSamples;
+	U32 prerolled;										/* decoder: the next sample to preroll */
+	void *mapP;												/* the decoded samples' mapping */
+	size_t mapSize;
+	struct _sfStreamFont *next;
+} sfStreamFontT;
+
+typedef struct {
+	uint64 hits;											/* pins that found the sample decoded */
+	uint64 misses;										/* pins that had to wait for it, or start on the head */
+	uint64 evictions;
+	uint64 stalls;										/* voice blocks that waited for data */
+	uint64 cachedBytes;								/* of the cached samples past their heads */
+	uint64 budgetBytes;
+	uint64 headBytes;
+} sfStreamStatsT;
+
+/* The number of frames the Ogg stream [oggP, oggP + size) decodes to, 0 if
+ * it isn't one. */
+U32 sfStreamLength (const U8 * oggP, U32 size);
+
+/* Maps the slices of the font's samples (their pcmP) and queues the heads
+ * for decoding. */
+S32 sfStreamAdd (sfStreamFontT * fontP);
+/* Frees the decoded data.  No voice may play the font any more. */
+void sfStreamRemove (sfStreamFontT * fontP);
+/* Decodes all of the font's samples now, on nThreads threads (one per CPU
+ * if 0), and keeps them: no voice ever waits for them, none is evicted.
+ * For offline rendering and services that can pay for the memory.
+ * FAILED if a stream didn't decode to its end; the rest is silent. */
+S32 sfStreamDecodeAll (sfStreamFontT * fontP, S32 nThreads);
+
+/* The budget in bytes and the head length in ms; for fonts added later,
+ * the budget at once. */
+void sfStreamConfig (size_t budget, U32 prerollMs);
+void sfStreamStats (sfStreamStatsT * statsP);
+
+/* render side */
+void sfStreamPin (sfStreamSampleT * s);
+void sfStreamUnpin (sfStreamSampleT * s);
+/* OK if frames [0, lastIdx] are decoded */
+S32 sfStreamReady (sfStreamSampleT * s, U32 lastIdx);
+
+#endif /* _SF_STREAM_H */
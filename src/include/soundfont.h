@@ -6,7 +6,7 @@
 
 typedef struct _Sample {
   U8   origPitch;
-  U8   origPitchAdj;
+  signed char origPitchAdj;  // cents, may be negative
   U32  startIdx;      // I've yet to see a good reason for this if we have a pointer already.
   U32  endIdx;
   U32  loopStartIdx;
@@ -15,6 +15,8 @@ typedef struct _Sample {
   // TODO get rid of these, i don't like this
   S8 amplitudeThatReachesNoiseFloorIsValid;
   S32 amplitudeThatReachesNoiseFloor;
+  struct _sfStreamSample *streamP;  // SF3: decoded on demand into pcmDataP, see sf_stream.h
+  struct _sfDiskSample *diskP;      // streamed from the file into pcmDataP, see sf_disk.h
 } Sample;      // 20 bytes
 
 // Modulator adjusts any given generator. Don't need to tell it which generator since the gen in question owns it.
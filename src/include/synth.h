@@ -7,6 +7,9 @@ struct _Synthesizer;
 #include "voice.h"
 #include "rev.h"
 #include "soundfont.h"
+#include "render_pool.h"
+#include "preset_index.h"
+#include "sf_cache.h"
 /**
  * Synthesis interpolation method.
  */
@@ -42,6 +45,7 @@ enum synthAddMod
  */
 #define NUM_PROGRAMS      128
 #define DRUM_INST_BANK		128
+#define SYNTH_RETIRED_FONTS	4				/* replaced fonts waiting for their voices to end */
 
 #if defined(WITH_FLOAT)
 #define SAMPLE_FORMAT     SAMPLE_FLOAT
@@ -74,6 +78,10 @@ typedef struct _SynthSettings {
   Setting synthPolyphony;
   Setting synthNMidiChannels;
   Setting synthGain;
+  Setting synthRenderThreads;  // 0: render voices on the audio thread, n: see render_pool.h
+  Setting synthNFxBuses;       // reverb / chorus pairs, see synthFxBusT
+  Setting synthCullDb;         // voices quieter than this (dBFS) aren't rendered, see voiceCalcBlockParams
+  Setting synthVoiceBudget;    // most voices rendered per block, 0: no limit
 } SynthSettings;
 
 extern struct _SynthSettings synthSettings;
@@ -99,6 +107,115 @@ enum synthStatus {
 };
 
 
+/* Timestamped events
+ *
+ * An event is a MIDI channel message (type NOTE_ON, CONTROL_CHANGE, ...,
+ * see midi.h) that takes effect at an absolute output frame.
+ * synthOneBlock splits its block at every event that falls inside it, so
+ * voices start, stop and change on the exact frame while the block size
+ * stays the same.  Frames that are already rendered are late; those
+ * events are applied at the start of the next block.  The queue belongs to
+ * the thread that renders. */
+#define SYNTH_EVENT_QUEUE_SIZE 1024
+
+typedef struct {
+	uint64 frame;
+	U8 type;
+	U8 chan;
+	U8 p1;
+	U8 p2;														/* PITCH_BEND: the value is p1 | p2 << 7 */
+} synthEventT;
+
+/* Command queues
+ *
+ * The channel calls below (synthNoteon, synthCc, ..., synthSystemReset)
+ * may come from a MIDI or UI thread while another thread renders, so they
+ * don't touch the synth.  They push a synthEventT onto a preallocated
+ * single producer / single consumer ring, and synthOneBlock drains every
+ * ring at the start of the block.  Both ends are wait-free; when a ring is
+ * full the command is dropped and counted.
+ *
+ * The synth's own ring (cmdQueue[0]) takes those calls, so they must come
+ * from one control thread at a time.  Any other thread that sends events
+ * asks for a ring of its own with synthNewCmdQueue and uses
+ * synthCmdQueuePush.  A command's frame is an absolute frame as for
+ * synthQueueEvent; 0 means the next block.  The renderer itself (sample
+ * timers, playerAdvance, renderSong) calls synthHandleEvent and
+ * synthQueueEvent directly.
+ *
+ * The other calls that change the synth (synthSetGen / synthSetGen2,
+ * synthSetChannelFxBus, synthProgramSelect and the tuning calls) go the
+ * same way as the synthCmdType commands below.  Arguments that don't fit
+ * in p1 / p2, and a sysex that changes the synth (the MIDI tuning messages
+ * synthSysex applies, a MIDI_SYSEX command), are copied into one of the
+ * ring's preallocated payload slots, whose number goes in p1.  Those
+ * apply at the next block.  Their checks are made by the call, except
+ * that the tuning or preset must exist when it applies. */
+#define SYNTH_CMD_QUEUE_SIZE 1024					/* a power of two */
+#define SYNTH_MAX_CMD_QUEUES 4
+#define SYNTH_SYSEX_SLOTS 16
+#define SYNTH_SYSEX_MAX 516								/* a note tuning change of 127 keys */
+#define SYNTH_TUNING_NAME 32							/* longer tuning names are cut */
+
+/* below NOTE_OFF, so they can't be taken for a MIDI status byte */
+enum synthCmdType {
+	SYNTH_CMD_FX_BUS = 0x01,					/* p1: the bus */
+	SYNTH_CMD_SELECT_TUNING,					/* p1, p2: tuning bank and program */
+	SYNTH_CMD_RESET_TUNING,
+	/* from here on p1 is a payload slot */
+	SYNTH_CMD_SET_GEN = 0x40,
+	SYNTH_CMD_SET_GEN2,
+	SYNTH_CMD_PROGRAM_SELECT,
+	SYNTH_CMD_KEY_TUNING,							/* len: 128, or 0 for the default pitches */
+	SYNTH_CMD_OCTAVE_TUNING,
+	SYNTH_CMD_TUNE_NOTES							/* len: keys */
+};
+
+typedef struct {
+	S32 len;
+	union {
+		char data[SYNTH_SYSEX_MAX];			/* MIDI_SYSEX, without 0xF0 and 0xF7 */
+		struct {
+			U16 genId;
+			S16 value;
+			U8 absolute;
+		} gen;
+		struct {
+			U32 sfontId;
+			U32 bank;
+			U32 prog;
+		} program;
+		struct {
+			U8 bank;
+			U8 prog;
+			char name[SYNTH_TUNING_NAME];
+			U8 key[128];
+			double pitch[128];
+		} tuning;
+	} u;
+} synthSysexT;
+
+typedef struct {
+	synthEventT *cmd;
+	synthSysexT *sysex;								/* the payload slots */
+	U32 sysexHead;										/* atomic: slots freed, written by the renderer */
+	U32 sysexTail;										/* slots taken, producer only */
+	U32 head __attribute__ ((aligned (64)));	/* atomic: next to read, written by the renderer */
+	U32 tail __attribute__ ((aligned (64)));	/* atomic: next to write, written by the producer */
+	U32 maxDepth;											/* deepest the ring has been, seen by the producer */
+	U32 overflows;										/* commands dropped because the ring was full */
+} synthCmdQueueT;
+
+/* A font on its way to the renderer (synthSetSoundfont), with the zone
+ * indices of all its presets, built on the control thread.  The renderer
+ * swaps them for its own and hands the swap back on the done stack with
+ * the old indices, which the control thread frees. */
+typedef struct _synthFontSwap {
+	Soundfont *sfP;
+	PresetIndex *presetIndex[PRESET_INDEX_BUCKETS];
+	struct _synthFontSwap *next;			/* done stack */
+} synthFontSwapT;
+
 typedef struct _fluidBankOffsetT bankOffsetT;
 
 struct _fluidBankOffsetT {
@@ -107,6 +224,24 @@ struct _fluidBankOffsetT {
 };
 
 
+/* Effect buses.
+ *
+ * Every bus has its own reverb and chorus and its own mono sends, and every
+ * MIDI channel sends to one of them (channel->fxBus, bus 0 unless
+ * synthSetChannelFxBus says otherwise).  A bus is processed only if a voice
+ * sent to it in this block, or if its reverb / chorus is still ringing out;
+ * 'used' also tells the next block which sends have to be cleared.  All
+ * buses are mixed into the same outputs (leftBuf[0], or fxLeftBuf with
+ * doNotMixFxToOut).
+ */
+typedef struct {
+	revmodelT *reverb;
+	struct _Chorus *chorus;
+	busT *reverbBuf;										/* sends */
+	busT *chorusBuf;
+	S32 used;
+} synthFxBusT;
+
 /* * Synthesizer */
 typedef struct _Synthesizer {
 	/* settingsOldT settingsOld;  the old synthesizer settings */
@@ -121,20 +256,44 @@ typedef struct _Synthesizer {
 	S32 effectsChannels;							 /** the number of effects channels (= 2) */
 	U32 state;								 /** the synthesizer state */
 	U32 ticks;								 /** the number of audio samples since the start */
+	uint64 blockFrame;								 /** the absolute frame synthOneBlock renders next */
+	synthEventT *eventQueue;						 /** pending events, sorted by frame: [eventHead, eventTail) */
+	S32 eventHead;
+	S32 eventTail;
+	synthCmdQueueT *cmdQueue[SYNTH_MAX_CMD_QUEUES];	/** rings from the control threads; [0] takes the synth*() calls */
+	S32 nCmdQueues;										/** atomic: slots taken; a slot's ring is published after */
 	double gain;												/** master gain */
 	struct _Channel **channel;					/** the channels */
 	U8 numChannels;										/** the number of channels */
-	U8 nvoice;													/** the length of the synthesis process array */
-	struct _Voice **voice;							/** the synthesis processes */
-	U8 noteid;								/** the id is incremented for every new note. it's used for noteoff's  */
+	S32 nvoice;													/** the length of the synthesis process array */
+	struct _Voice **voice;							/** the synthesis processes (point into voicePool) */
+	struct _Voice *voicePool;					/** contiguous, cache line aligned voice storage */
+	void *voicePoolMem;									/** what was malloc'd for voicePool */
+	Generator *genPool;									/** GEN_LAST generators per voice (cold) */
+	Modulator *modPool;									/** NUM_MOD modulators per voice (cold) */
+	voiceModIndexT *modIndexPool;				/** one modulator dependency index per voice (cold) */
+	struct _Voice **activeVoice;				/** dense list of the voices started since they were last
+																				 * found idle; the only voices synthOneBlock visits */
+	S32 nActiveVoices;
+	voiceMgrT *voiceMgr;								/** free list, stealing order, per key / exclusive class lists */
+	S32 modPending;											/** some channel has controller changes to apply */
+	realT (*filterTab)[2];							/** FILTER_TAB_ROWS filter coefficients for sampleRate */
+	realT filterTabMaxCents;						/** cutoff where 0.45 * sampleRate is reached */
+	realT cullAmp;											/** voices whose dry output stays below this are culled */
+	S32 voiceBudget;										/** voices rendered per block at most, 0: all */
+	S32 nOverBudget;										/** voices flagged overBudget for this block */
+	struct _Voice **budgetScratch;			/** nvoice entries, for ranking the voices */
+	U32 cullStats[3];										/** last block: rendered, culled quiet, culled over budget */
+	renderPoolT *renderPool;						/** NULL unless synthRenderThreads > 0 */
+	U32 noteid;								/** the id is incremented for every new note. it's used for noteoff's  */
 	U32 storeid;
 	S32 nbuf;														/** How many audio buffers are used? (depends on nr of audio channels / groups)*/
-	S16 **leftBuf;
-	S16 **rightBuf;
-	S16 **fxLeftBuf;
-	S16 **fxRightBuf;
-	revmodelT *reverb;
-	struct _Chorus *chorus;
+	busT **leftBuf;
+	busT **rightBuf;
+	busT **fxLeftBuf;
+	busT **fxRightBuf;
+	synthFxBusT *fxBus;									/** the effect buses */
+	S32 nFxBuses;
 	S32 cur;													 /** the current sample in the audio buffers to be output */
 	S32 ditherIndex;							/* current index in random dither value buffer: synth_(writeS16|ditherS16) */
 	S8 outbuf[256];									 /** buffer for message output */
@@ -142,12 +301,81 @@ typedef struct _Synthesizer {
 	tuningT *curTuning;					/** current tuning in the iteration */
 	U32 minNoteLengthTicks;	/**< If note-offs are triggered just after a note-on, they will be delayed */
   Soundfont *soundfontP;  // I assume we're only ever going to use one soundfont at a time.
+	U8 soundfontCached;									/** soundfontP is a sf_cache.c reference the synth holds */
+	synthFontSwapT *nextFontSwapP;			/** atomic: from synthSetSoundfont, taken at the next block */
+	synthFontSwapT *doneFontSwapP;			/** atomic: taken swaps with the indices they replaced */
+	Soundfont *retiredSoundfontP[SYNTH_RETIRED_FONTS];	/** replaced cached fonts... */
+	U32 retiredNoteid[SYNTH_RETIRED_FONTS];	/** ...still played by the voices with lower ids */
+	S32 nRetiredSoundfonts;
+	sfCacheReaderT sfReader;						/** quiesced at every block, see sf_cache.h */
+	PresetIndex *presetIndex[PRESET_INDEX_BUCKETS];	/** note-on zone index of every preset of soundfontP; call
+																				 * synthUpdatePresets after changing soundfontP */
 } Synthesizer;
 
 
 Synthesizer *newSynth ();
+S32 deleteSynth (Synthesizer * synth);
 
 S32 synthOneBlock (Synthesizer * synth, S32 doNotMixFxToOut);
+S32 synthWriteS16 (Synthesizer * synth, S32 len, void *lout, S32 loff,
+																S32 lincr, void *rout, S32 roff, S32 rincr);
+/* planar float output of every group, see synth.c */
+S32 synthRenderGroups (Synthesizer * synth, S32 len, float **left, float **right,
+											 float **fxLeft, float **fxRight);
+S32 synthBorrowBlock (Synthesizer * synth, S32 doNotMixFxToOut,
+											busT *** left, busT *** right);
+struct _Voice *synthAllocVoice (Synthesizer * synth, Sample * sample,
+																						S32 chan, S32 key, S32 vel);
+void synthStartVoice (Synthesizer * synth, struct _Voice * voice);
+S32 synthSetInterpMethod (Synthesizer * synth, S32 chan, S32 interpMethod);
+
+/* channel messages, queued on cmdQueue[0] for the renderer */
+S32 synthNoteon (Synthesizer * synth, U8 chan, U8 key, U8 vel);
+S32 synthNoteoff (Synthesizer * synth, S32 chan, S32 key);
+S32 synthCc (Synthesizer * synth, S32 chan, S32 num, S32 val);
+S32 synthKeyPressure (Synthesizer * synth, S32 chan, S32 key, S32 val);
+S32 synthChannelPressure (Synthesizer * synth, S32 chan, S32 val);
+S32 synthPitchBend (Synthesizer * synth, S32 chan, S32 val);
+S32 synthProgramChange (Synthesizer * synth, S32 chan, S32 prognum);
+S32 synthSystemReset (Synthesizer * synth);
+/* applies a channel message now; renderer only */
+S32 synthHandleEvent (Synthesizer * synth, U8 type, U8 chan, U8 p1, U8 p2);
+
+/* sample-accurate timing; see synthEventT */
+uint64 synthGetFrameTime (Synthesizer * synth);
+S32 synthQueueEvent (Synthesizer * synth, uint64 frame, U8 type, U8 chan,
+										 U8 p1, U8 p2);
+S32 synthApplyEvents (Synthesizer * synth, uint64 frame);
+void synthClearEvents (Synthesizer * synth);
+
+/* control threads; see synthCmdQueueT */
+synthCmdQueueT *synthNewCmdQueue (Synthesizer * synth);
+S32 synthCmdQueuePush (synthCmdQueueT * queue, uint64 frame, U8 type, U8 chan,
+											 U8 p1, U8 p2);
+S32 synthCmdQueuePushSysex (synthCmdQueueT * queue, const char *data, S32 len);
+S32 synthGetCmdQueueStats (Synthesizer * synth, S32 num, U32 * depth,
+													 U32 * maxDepth, U32 * overflows);
+
+/* Voice culling: the threshold in dBFS (at most -20) and the most voices
+ * rendered per block (0 for no limit).  Culled voices keep playing
+ * silently, see voiceCalcBlockParams.  The stats are for the last block;
+ * any pointer may be NULL. */
+S32 synthSetCullThreshold (Synthesizer * synth, S32 db);
+S32 synthSetVoiceBudget (Synthesizer * synth, S32 budget);
+void synthGetCullStats (Synthesizer * synth, U32 * rendered, U32 * culledQuiet,
+												U32 * culledBudget);
+
+/* effects; the synth-wide calls set every bus */
+void synthSetReverb (Synthesizer * synth, double roomsize, double damping,
+										 double width, double level);
+void synthSetChorus (Synthesizer * synth, S32 nr, double level,
+										 double speed, double depthMs, S32 type);
+S32 synthSetBusReverb (Synthesizer * synth, S32 bus, double roomsize,
+											 double damping, double width, double level);
+S32 synthSetBusChorus (Synthesizer * synth, S32 bus, S32 nr, double level,
+											 double speed, double depthMs, S32 type);
+S32 synthSetChannelFxBus (Synthesizer * synth, S32 chan, S32 bus);
+S32 synthGetChannelFxBus (Synthesizer * synth, S32 chan);
 
 S32 synthAllNotesOff (Synthesizer * synth, S32 chan);
 S32 synthAllSoundsOff (Synthesizer * synth, S32 chan);
@@ -164,9 +392,19 @@ void synthSfunloadMacos9 (Synthesizer * synth);
 
 /** This function assures that every MIDI channels has a valid preset
  *  (NULL is okay). This function is called after a SoundFont is
- *  unloaded or reloaded. */
+ *  unloaded or reloaded.  It builds the zone index of every preset of
+ *  synth->soundfontP, so call it from a control thread. */
 void synthUpdatePresets (Synthesizer * synth);
 
+/* Hot swap: hands a font from sfCacheAcquire, and the reference, over to
+ * the synth.  It switches at its next block without a lock; the voices
+ * already playing finish on the old font, whose reference goes once they
+ * are all gone.  The zone indices of all its presets are built here, so
+ * the renderer doesn't allocate for the switch; the ones it replaced are
+ * freed by the next call (or deleteSynth).  If it fails the caller keeps
+ * the reference. */
+S32 synthSetSoundfont (Synthesizer * synth, Soundfont * sfP);
+
 
 S32 synthUpdateGain (Synthesizer * synth, S8 *name, double value);
 S32 synthUpdatePolyphony (Synthesizer * synth, S8 *name,
@@ -135,6 +135,11 @@ char* get_windows_error(void);
 #endif
 
 #define INLINE              inline
+#if defined(__GNUC__)
+#define FORCE_INLINE        inline __attribute__((always_inline))
+#else
+#define FORCE_INLINE        inline
+#endif
 
 #define VERSION_CHECK(major, minor, patch) ((major<<16)|(minor<<8)|(patch))
 
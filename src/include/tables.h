@@ -0,0 +1,88 @@
+#ifndef _TABLES_H
+#define _TABLES_H
+
+/* Lookup tables.
+ *
+ * None of these are computed at startup: src/tools/gentables.c prints them
+ * as initialised const arrays into the generated tables.c, so they live in
+ * read-only data, shared between all processes that map the library.
+ *
+ * The sizes below are shared with the generator, which includes this file
+ * with GENTABLES defined and has nothing else of the synth around; keep the
+ * macros free of anything but numbers.
+ */
+
+/*
+ Attenuation range in centibels.
+ Attenuation range is the dynamic range of the volume envelope generator
+ from 0 to the end of attack segment.
+ fluidsynth is a 24 bit synth, it could (should??) be 144 dB of attenuation.
+ However the spec makes no distinction between 16 or 24 bit synths, so use
+ 96 dB here.
+
+ Note about usefulness of 24 bits:
+ 1)Even fluidsynth is a 24 bit synth, this format is only relevant if
+ the sample format coming from the soundfont is 24 bits and the audio sample format
+ chosen by the application (audio.sample.format) is not 16 bits.
+
+ 2)When the sample soundfont is 16 bits, the internal 24 bits number have
+ 16 bits msb and lsb to 0. Consequently, at the DAC output, the dynamic range of
+ this 24 bit sample is reduced to the the dynamic of a 16 bits sample (ie 90 db)
+ even if this sample is produced by the audio driver using an audio sample format
+ compatible for a 24 bit DAC.
+
+ 3)When the audio sample format settings is 16 bits (audio.sample.format), the
+ audio driver will make use of a 16 bit DAC, and the dynamic will be reduced to 96 dB
+ even if the initial sample comes from a 24 bits soundfont.
+
+ In both cases (2) or (3), the real dynamic range is only 96 dB.
+
+ Other consideration for NOISE_FLOOR related to case (1),(2,3):
+ - for case (1), NOISE_FLOOR should be the noise floor for 24 bits (i.e -138 dB).
+ - for case (2) or (3), NOISE_FLOOR should be the noise floor for 16 bits (i.e -90 dB).
+ */
+#define PEAK_ATTENUATION  960.0f
+#define CENTS_HZ_SIZE     1200
+#define CENTS_HZ_OCTAVES  12			/* ct2hzReal covers 0 .. 14100 cents */
+#define VEL_CB_SIZE       128
+#define CB_AMP_SIZE       961
+#define ATTEN_AMP_SIZE    1441
+#define PAN_SIZE          1002
+
+/* EMU 8k/10k don't follow spec in regards to volume attenuation.
+ * This factor is used in the equation pow (10.0, cb / ATTEN_POWER_FACTOR).
+ * By the standard this should be -200.0. */
+/* 07/11/2008 modified by S. Christian Collins for increased velocity sensitivity.  Now it equals the response of EMU10K1 programming.*/
+#define ATTEN_POWER_FACTOR  (-200.0)	/* was (-531.509) */
+
+#define SINC_INTERP_ORDER 7			/* 7th order constant */
+
+#ifndef GENTABLES
+
+#include "fluidbean.h"
+#include "phase.h"
+
+/* conv.c: 2^(i/1200), and 6.875 Hz (the root of ct2hzReal) times 2^octave */
+extern const realT ct2hzTab[CENTS_HZ_SIZE];
+extern const realT ct2hzOctaveTab[CENTS_HZ_OCTAVES];
+/* centibels to amplitude; one extra 0.0 entry at the end for 'out of range' */
+extern const realT cb2ampTab[CB_AMP_SIZE + 1];
+extern const realT atten2ampTab[ATTEN_AMP_SIZE + 1];
+/* mod.c: SF2 concave / convex transforms */
+extern const realT concaveTab[128];
+extern const realT convexTab[128];
+extern const realT panTab[PAN_SIZE];
+
+/* dsp_float.c: interpolation coefficients.  The 'F' tables are float copies
+ * for the vector kernels in dsp_simd.c, 32 byte aligned, with the 7th order
+ * rows padded to 8. */
+extern const realT interpCoeffLinear[INTERP_MAX][2];		/* 2 coefficients centered on 1st */
+extern const realT interpCoeff[INTERP_MAX][4];				/* cubic, 4 coefficients centered on 2nd */
+extern const realT sincTable7[INTERP_MAX][SINC_INTERP_ORDER];	/* 7 coefficients centered on 3rd */
+extern const float interpCoeffLinearF[INTERP_MAX][2];
+extern const float interpCoeffF[INTERP_MAX][4];
+extern const float sincTable7F[INTERP_MAX][8];
+
+#endif /* GENTABLES */
+
+#endif /* _TABLES_H */
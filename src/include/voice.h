@@ -6,6 +6,7 @@ struct _Voice;
 #include "phase.h"
 #include "enums.h"
 #include "soundfont.h"
+#include "voice_mgr.h"
 
 enum voiceStatus {
 	VOICE_CLEAN,
@@ -14,6 +15,28 @@ enum voiceStatus {
 	VOICE_OFF
 };
 
+/* Modulators per voice */
+#define NUM_MOD           64
+
+/* Controller -> modulator -> generator dependencies of a voice.
+ *
+ * Built by voiceStart once the voice's modulators are final.  The
+ * modulators are grouped by destination generator; every (source
+ * controller, destination) pair is listed once, sorted by source, so a
+ * controller change recomputes each generator it reaches exactly once.
+ * A source is (cc ? 128 : 0) + controller number, as in modHasSource.
+ */
+typedef struct {
+	U32 srcMask[8];										/* 256 bits: some modulator reads this source */
+	U8 nDests;
+	U8 nEdges;
+	U8 dest[NUM_MOD];									/* destination generator of each group */
+	U8 destFirst[NUM_MOD + 1];				/* group d is byDest[destFirst[d] .. destFirst[d + 1]) */
+	U8 byDest[NUM_MOD];								/* indices into voice->mod */
+	U8 edgeSrc[2 * NUM_MOD];					/* sorted */
+	U8 edgeDest[2 * NUM_MOD];					/* group */
+} voiceModIndexT;
+
 /* envelope data */
 typedef struct _fluidEnvDataT {
 	U32 count;
@@ -35,28 +58,59 @@ enum voiceEnvelopeIndexT {
 	VOICE_ENVLAST
 };
 
-/* Voice */
+/* Where a voice is within the current block.  The synth may render a
+ * block in several spans (see synthEventT); the envelopes and LFOs still
+ * step once per block. */
+enum voiceBlockState {
+	VOICE_BLOCK_PENDING,					/* envelopes and LFOs not stepped for this block yet */
+	VOICE_BLOCK_RENDER,
+	VOICE_BLOCK_SILENT,						/* nothing to render for the rest of the block */
+	VOICE_BLOCK_CULLED						/* inaudible or over budget: only the playback
+																   pointer and amplitude move, see dspFloatSkip */
+};
+
+/* Filter coefficient table (synth->filterTab): sin and cos of the
+ * normalised cutoff, one row every FILTER_TAB_STEP cents from
+ * FILTER_TAB_MIN_CENTS to FILTER_TAB_MAX_CENTS (the SF2.01 page 48 #8
+ * limits), plus one for interpolating at the top.  The cutoff is clamped
+ * to that range, as ct2hz did before; 20 Hz is the lowest. */
+#define FILTER_TAB_MIN_CENTS 1500
+#define FILTER_TAB_MAX_CENTS 13500
+#define FILTER_TAB_STEP      4
+#define FILTER_TAB_ROWS      ((FILTER_TAB_MAX_CENTS - FILTER_TAB_MIN_CENTS) / FILTER_TAB_STEP + 2)
+
+/* Why a voice was culled in the current block (voice->culled) */
+enum voiceCull {
+	VOICE_CULL_NONE,
+	VOICE_CULL_QUIET,							/* below synth->cullAmp */
+	VOICE_CULL_BUDGET							/* beyond the synth's voice budget */
+};
+
+/* Voice
+ *
+ * The synth keeps all voices in one contiguous pool (see newSynth).  The
+ * fields are ordered by how often they're touched: everything voiceWrite
+ * and the dsp loops need on every block comes first, note-on / modulation
+ * bookkeeping comes last.  The generators (~1.5 KB a voice) and modulators
+ * live in separate pools and are only pointed to from here, so walking the
+ * playing voices once per block doesn't drag them through the cache. */
 typedef struct _Voice {
-	U32 id;							/* the id is incremented for every new noteon.
-																   it's used for noteoff's  */
+	/*------------------------- hot: every block -------------------------*/
 	U8 status;
 	U8 chan;						/* the channel number, quick access for channel messages */
-	U8 key;						/* the key, quick acces for noteoff */
-	U8 vel;						/* the velocity */
-  U8 nGens;
-  U8 nMods;
+	U8 active;						/* listed in synth->activeVoice */
+	U8 blockState;				/* enum voiceBlockState */
+	U8 paramsDirty;				/* modulated since the dsp parameters were calculated */
+	U8 overBudget;				/* set by the synth before the block: cull it */
+	U8 culled;						/* enum voiceCull, counted and cleared by the synth */
+	S32 interpMethod;
 	Channel *channel;
-  Modulator *mod;
-	Generator gen[GEN_LAST];
-	S32 hasLooped;								/* Flag that is set as soon as the first loop is completed. */
 	Sample *sampleP;
+	U32 diskChunk;							/* sf_disk.h: the first of the two chunks it holds */
 	S32 checkSampleSanityFlag;	/* Flag that initiates, that sample-related parameters
 																   have to be checked. */
+	S32 hasLooped;								/* Flag that is set as soon as the first loop is completed. */
 
-	/* basic parameters */
-	realT outputRate;			/* the sample rate of the synthesizer */
-
-	U32 startTime;
 	U32 ticks;
 	U32 noteoffTicks;		/* Delay note-off until this tick */
 
@@ -67,28 +121,29 @@ typedef struct _Voice {
 
 	realT phaseIncr;			/* the phase increment for the next 64 samples */
 	realT ampIncr;				/* amplitude increment value */
-	S16 *dspBuf;				/* buffer to store interpolated sample data to */
+	busT *dspBuf;				/* buffer to store interpolated sample data to */
+	S32 dspCount;					/* number of frames the dsp loop renders */
 
 	/* End temporary variables */
 
+	/* sample and loop start and end points (offset in sample memory).  */
+	S32 start;
+	S32 end;
+	S32 loopstart;
+	S32 loopend;									/* Note: first point following the loop (superimposed on loopstart) */
+
 	/* basic parameters */
 	realT pitch;						/* the pitch in midicents */
 	realT attenuation;			/* the attenuation in centibels */
 	realT minAttenuationCB;	/* Estimate on the smallest possible attenuation
 																		 * during the lifetime of the voice */
 	realT rootPitch;
-
-	/* sample and loop start and end points (offset in sample memory).  */
-	S32 start;
-	S32 end;
-	S32 loopstart;
-	S32 loopend;									/* Note: first point following the loop (superimposed on loopstart) */
+	realT outputRate;			/* the sample rate of the synthesizer */
 
 	/* master gain */
 	realT synthGain;
 
 	/* vol env */
-	envDataT volenvData[VOICE_ENVLAST];
 	U32 volenvCount;
 	S32 volenvSection;
 	realT volenvVal;
@@ -96,7 +151,6 @@ typedef struct _Voice {
 	realT amplitudeThatReachesNoiseFloorLoop;
 
 	/* mod env */
-	envDataT modenvData[VOICE_ENVLAST];
 	U32 modenvCount;
 	S32 modenvSection;
 	realT modenvVal;			/* the value of the modulation envelope */
@@ -119,7 +173,7 @@ typedef struct _Voice {
 
 	/* resonant filter */
 	realT fres;						/* the resonance frequency, in cents (not absolute cents) */
-	realT lastFres;				/* Current resonance frequency of the IIR filter */
+	realT lastFres;				/* Current resonance frequency of the IIR filter, in cents */
 	/* Serves as a flag: A deviation between fres and lastFres */
 	/* indicates, that the filter has to be recalculated. */
 	realT qLin;						/* the q-factor on a linear scale */
@@ -142,32 +196,87 @@ typedef struct _Voice {
 	realT a2_incr;
 	S32 filterCoeffIncrCount;
 
-	/* pan */
-	realT pan;
+	/* output gains */
 	realT ampLeft;
 	realT ampRight;
-
-	/* reverb */
-	realT reverbSend;
 	realT ampReverb;
-
-	/* chorus */
-	realT chorusSend;
 	realT ampChorus;
 
-	S32 interpMethod;
+	/* envelope segments; only the current one is read per block */
+	envDataT volenvData[VOICE_ENVLAST];
+	envDataT modenvData[VOICE_ENVLAST];
 
+	/*------------------ cold: note-on and modulation ------------------*/
+	U32 id;							/* the id is incremented for every new noteon.
+																   it's used for noteoff's  */
+	U8 key;						/* the key, quick acces for noteoff */
+	U8 vel;						/* the velocity */
+  U8 nGens;
+  U8 nMods;
+	U32 startTime;
+	realT pan;
+	realT reverbSend;
+	realT chorusSend;
+  Modulator *mod;					/* NUM_MOD entries in the synth's modulator pool */
+	voiceModIndexT *modIndex;			/* in the synth's modulator index pool */
+	Generator *gen;					/* GEN_LAST entries in the synth's generator pool */
+
+	/*------------------ voice manager, see voice_mgr.h ------------------*/
+	struct _voiceMgr *mgr;
+	sint64 prio;						/* stealing priority when last flushed; lowest goes first */
+	S32 heapIdx;						/* -1 unless started */
+	S32 keySlot;						/* chan * 128 + key, -1 if not listed */
+	S32 classSlot;					/* chan * 128 + exclusive class, -1 if not listed */
+	U8 prioDirty;						/* atomic: on the manager's dirty stack */
+	struct _Voice *keyPrev, *keyNext;
+	struct _Voice *classPrev, *classNext;
 } Voice;
 
 
-Voice *newVoice (realT outputRate);
-S32 deleteVoice (Voice * voice);
+void voiceConstruct (Voice * voice, Generator * gen, Modulator * mod,
+										 voiceModIndexT * modIndex, realT outputRate);
 
 void voiceStart (Voice * voice);
 
-S32 voiceWrite (Voice * voice,
-											 S16 * left, S16 * right,
-											 S16 * reverbBuf, S16 * chorusBuf);
+S32 voiceWrite (Voice * voice, S32 start, S32 n,
+											 busT * left, busT * right,
+											 busT * reverbBuf, busT * chorusBuf);
+
+/* Batched voiceWrite.
+ *
+ * The interpolation still runs per voice, into the voice's own lane of the
+ * batch.  Once VOICE_LANES voices are in (or on voiceBatchFlush) their
+ * filters run together, one voice per vector lane and the samples in time,
+ * and the lanes are mixed out; if all of them go to the same buffers, that
+ * is a single pass over each output.  A voice whose sample ends inside the
+ * span is mixed on its own right away, after the batch before it.  The
+ * voices are added to each output in the order they came in, so the output
+ * is the same as voiceWrite's.
+ *
+ * The batch is a few 10 kB, so there's one per render thread, on its stack.
+ */
+#define VOICE_LANES 8
+
+typedef realT voiceLanesT __attribute__ ((vector_size (VOICE_LANES * sizeof (realT)), aligned (sizeof (realT))));
+
+typedef struct {
+	S32 start;												/* span of the block */
+	S32 count;
+	S32 n;														/* lanes in use */
+	Voice *voice[VOICE_LANES];
+	busT *left[VOICE_LANES];					/* destinations, already offset by start */
+	busT *right[VOICE_LANES];
+	busT *reverb[VOICE_LANES];
+	busT *chorus[VOICE_LANES];
+	busT buf[VOICE_LANES][BUFSIZE];		/* interpolated samples, then filtered */
+	voiceLanesT lane[BUFSIZE];				/* the same, one frame per vector */
+} voiceBatchT;
+
+void voiceBatchBegin (voiceBatchT * batch, S32 start, S32 n);
+S32 voiceBatchWrite (voiceBatchT * batch, Voice * voice,
+										 busT * left, busT * right,
+										 busT * reverbBuf, busT * chorusBuf);
+void voiceBatchFlush (voiceBatchT * batch);
 
 S32 voiceInit (Voice * voice, Sample * sample,
 											Channel * channel, S32 key, S32 vel,
@@ -175,6 +284,9 @@ S32 voiceInit (Voice * voice, Sample * sample,
 
 S32 voiceModulate (Voice * voice, S32 cc, S32 ctrl);
 S32 voiceModulateAll (Voice * voice);
+/* Like voiceModulate for every source set in 'srcMask' (256 bits, numbered
+ * as in voiceModIndexT); each generator they reach is updated once. */
+S32 voiceModulateSources (Voice * voice, const U32 * srcMask);
 
 /** Set the NRPN value of a generator. */
 S32 voiceSetParam (Voice * voice, S32 gen, realT value, S32 abs);
@@ -239,5 +351,8 @@ S32 dspFloatInterpolateNone (Voice * voice);
 S32 dspFloatInterpolateLinear (Voice * voice);
 S32 dspFloatInterpolate_4thOrder (Voice * voice);
 S32 dspFloatInterpolate_7thOrder (Voice * voice);
+S32 dspFloatSkip (Voice * voice);
+
+void voiceFilterTabFill (realT (*tab)[2], realT outputRate, realT * maxCents);
 
 #endif /* _VOICE_H */
@@ -0,0 +1,67 @@
+struct _voiceMgr;
+
+#ifndef _VOICE_MGR_H
+#define _VOICE_MGR_H
+
+#include "fluidbean.h"
+
+struct _Voice;
+
+/* Voice manager.
+ *
+ * Bookkeeping that lets the synth find voices without walking the pool:
+ *
+ * - a free list of the voices that aren't in synth->activeVoice,
+ * - a min-heap of the started voices by stealing priority, so the voice
+ *   to kill is always on top,
+ * - a list of the started voices of every (channel, key) for note-offs,
+ *   and of every (channel, exclusive class).
+ *
+ * A voice's priority only changes with its status and its volume envelope
+ * section.  voice.c reports those changes with voiceMgrTouch, possibly from
+ * a render pool worker, so that only pushes the voice onto a lock-free
+ * dirty stack.  Everything else, including the heap updates in
+ * voiceMgrFlush, runs on the thread that renders: before a voice is stolen
+ * and after every block.
+ */
+
+typedef struct _voiceMgr {
+	S32 nvoice;
+	struct _Voice **freeVoice;				/* stack */
+	S32 nFree;
+	struct _Voice **heap;							/* started voices, lowest priority first */
+	S32 nHeap;
+	struct _Voice **dirty;						/* started voices whose priority changed */
+	S32 nDirty;												/* atomic */
+	S32 nSlots;												/* midi channels * 128 */
+	struct _Voice **keyList;					/* [chan * 128 + key] */
+	struct _Voice **classList;				/* [chan * 128 + exclusive class] */
+} voiceMgrT;
+
+voiceMgrT *newVoiceMgr (S32 nvoice, S32 midiChannels);
+void deleteVoiceMgr (voiceMgrT * mgr);
+/* Forgets all voices; the caller puts them back with voiceMgrFree. */
+void voiceMgrReset (voiceMgrT * mgr);
+
+/* free list */
+struct _Voice *voiceMgrAlloc (voiceMgrT * mgr);
+void voiceMgrFree (voiceMgrT * mgr, struct _Voice * voice);
+
+/* Enters a started voice into the heap and the key / exclusive class lists,
+ * and takes it out of all of them again. */
+void voiceMgrStart (voiceMgrT * mgr, struct _Voice * voice, S32 exclClass);
+void voiceMgrUnlink (voiceMgrT * mgr, struct _Voice * voice);
+void voiceMgrUnlinkClass (voiceMgrT * mgr, struct _Voice * voice);
+
+/* the voice's priority may have changed; safe on any render thread */
+void voiceMgrTouch (struct _Voice * voice);
+void voiceMgrFlush (voiceMgrT * mgr);
+
+/* The started voice with the lowest priority, NULL if there is none. */
+struct _Voice *voiceMgrVictim (voiceMgrT * mgr);
+
+/* Heads of the lists; follow voice->keyNext / voice->classNext. */
+#define voiceMgrKeyVoices(_m, _chan, _key)      ((_m)->keyList[(_chan) * 128 + (_key)])
+#define voiceMgrClassVoices(_m, _chan, _class)  ((_m)->classList[(_chan) * 128 + (_class)])
+
+#endif /* _VOICE_MGR_H */
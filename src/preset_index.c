@@ -0,0 +1,407 @@
+#include "fluidbean.h"
+#include "preset_index.h"
+#include "voice.h"
+#include "mod.h"
+#include "enums.h"
+
+/* SF 2.01 section 8.5 page 58: these generators are ignored at preset level */
+static const U8 presetGenIgnored[GEN_LAST] = {
+	[GEN_STARTADDROFS] = 1,
+	[GEN_ENDADDROFS] = 1,
+	[GEN_STARTLOOPADDROFS] = 1,
+	[GEN_ENDLOOPADDROFS] = 1,
+	[GEN_STARTADDRCOARSEOFS] = 1,
+	[GEN_ENDADDRCOARSEOFS] = 1,
+	[GEN_STARTLOOPADDRCOARSEOFS] = 1,
+	[GEN_KEYNUM] = 1,
+	[GEN_VELOCITY] = 1,
+	[GEN_ENDLOOPADDRCOARSEOFS] = 1,
+	[GEN_SAMPLEMODE] = 1,
+	[GEN_EXCLUSIVECLASS] = 1,
+	[GEN_OVERRIDEROOTKEY] = 1,
+};
+
+/*
+ * presetModListAdd
+ *
+ * Appends the modulators of 'zoneP' to 'modList'.  With 'replace', an
+ * identical modulator already in the list is dropped first: a local zone
+ * modulator supersedes the global zone's (SF 2.01 section 9.5.1 page 69,
+ * bullets 3 and 8).  The list holds at most NUM_MOD entries.
+ */
+static S32 presetModListAdd (Modulator ** modList, S32 n, Zone * zoneP, S32 replace) {
+	Generator *genP, *genEndP = zoneP->genA + zoneP->nGens;
+	Modulator *modP, *modEndP;
+	S32 i, j;
+
+	for (genP = zoneP->genA; genP < genEndP; ++genP) {
+		modEndP = genP->modA + genP->nMods;
+		for (modP = genP->modA; modP < modEndP; ++modP) {
+			if (replace) {
+				for (i = j = 0; i < n; i++) {
+					if (!modTestIdentity (modP, modList[i]))
+						modList[j++] = modList[i];
+				}
+				n = j;
+			}
+			if (n < NUM_MOD)
+				modList[n++] = modP;
+		}
+	}
+	return n;
+}
+
+/*
+ * presetZoneBuild
+ *
+ * Flattens a preset zone / instrument zone pair.  This is the merging
+ * presetNoteon used to do on every note.
+ */
+static S32 presetZoneBuild (presetZoneT * zoneP, Zone * globalPzoneP, Zone * pzoneP,
+                            Zone * globalIzoneP, Zone * izoneP) {
+	Generator gen[GEN_LAST];
+	Modulator *modList[NUM_MOD];
+	Generator *genP, *genEndP;
+	S32 i, n, nMods;
+	U32 amount;
+
+	MEMSET (zoneP, 0, sizeof (presetZoneT));
+	zoneP->sampleP = izoneP->u.sampleP;
+	zoneP->keylo = pzoneP->keylo > izoneP->keylo ? pzoneP->keylo : izoneP->keylo;
+	zoneP->keyhi = pzoneP->keyhi < izoneP->keyhi ? pzoneP->keyhi : izoneP->keyhi;
+	zoneP->vello = pzoneP->vello > izoneP->vello ? pzoneP->vello : izoneP->vello;
+	zoneP->velhi = pzoneP->velhi < izoneP->velhi ? pzoneP->velhi : izoneP->velhi;
+
+	/* Instrument level, generators.  SF 2.01 section 9.4 'bullet' 4: a
+	 * generator in a local instrument zone supersedes a global instrument
+	 * zone generator.  Both cases supersede the default generator. */
+	n = 0;
+	genEndP = izoneP->genA + izoneP->nGens;
+	for (genP = izoneP->genA; genP < genEndP && n < GEN_LAST; ++genP) {
+		U8 genType = genP->genType;
+		if (genP->flags)
+			gen[n] = *genP;
+		else if (globalIzoneP != NULL && globalIzoneP->genA[genType].flags)
+			gen[n] = globalIzoneP->genA[genType];
+		else
+			continue;
+		gen[n].genType = genType;
+		gen[n].flags = (gen[n].val != 0);  // true evalutes to GEN_SET enum (1).
+		n++;
+	}
+	zoneP->nInstGens = n;
+	zoneP->instGenA = ARRAY (Generator, n > 0 ? n : 1);
+	if (zoneP->instGenA == NULL)
+		return FAILED;
+	MEMCPY (zoneP->instGenA, gen, n * sizeof (Generator));
+
+	/* Instrument modulators, global then local. */
+	nMods = 0;
+	if (globalIzoneP != NULL)
+		nMods = presetModListAdd (modList, nMods, globalIzoneP, 0);
+	nMods = presetModListAdd (modList, nMods, izoneP, 1);
+	zoneP->nInstMods = nMods;
+	zoneP->instModA = ARRAY (Modulator *, nMods > 0 ? nMods : 1);
+	if (zoneP->instModA == NULL)
+		return FAILED;
+	MEMCPY (zoneP->instModA, modList, nMods * sizeof (Modulator *));
+
+	/* Preset level, generators.  SF 2.01 section 9.4 'bullet' 9: a generator
+	 * in a local preset zone supersedes a global preset zone generator.  The
+	 * effect is -added- to the destination summing node. */
+	n = 0;
+	for (i = 0; i < GEN_LAST; i++) {
+		if (presetGenIgnored[i])
+			continue;
+		if (pzoneP->genA[i].flags)
+			amount = pzoneP->genA[i].val;
+		else if (globalPzoneP != NULL && globalPzoneP->genA[i].flags)
+			amount = globalPzoneP->genA[i].val;
+		else
+			continue;
+		if (amount == 0)
+			continue;
+		MEMSET (&gen[n], 0, sizeof (Generator));
+		gen[n].genType = i;
+		gen[n].val = amount;
+		n++;
+	}
+	zoneP->nPresetGens = n;
+	zoneP->presetGenA = ARRAY (Generator, n > 0 ? n : 1);
+	if (zoneP->presetGenA == NULL)
+		return FAILED;
+	MEMCPY (zoneP->presetGenA, gen, n * sizeof (Generator));
+
+	/* Preset modulators, global then local.  Disabled ones can be skipped. */
+	nMods = 0;
+	if (globalPzoneP != NULL)
+		nMods = presetModListAdd (modList, nMods, globalPzoneP, 0);
+	nMods = presetModListAdd (modList, nMods, pzoneP, 1);
+	for (i = n = 0; i < nMods; i++) {
+		if (modList[i]->amount != 0)
+			modList[n++] = modList[i];
+	}
+	zoneP->nPresetMods = n;
+	zoneP->presetModA = ARRAY (Modulator *, n > 0 ? n : 1);
+	if (zoneP->presetModA == NULL)
+		return FAILED;
+	MEMCPY (zoneP->presetModA, modList, n * sizeof (Modulator *));
+
+	return OK;
+}
+
+/*
+ * newPresetIndex
+ */
+PresetIndex *newPresetIndex (Preset * presetP) {
+	PresetIndex *indexP;
+	Zone *pzoneP, *pzoneEndP, *izoneP, *izoneEndP;
+	Instrument *instP;
+	presetZoneT *zoneP;
+	U8 velStart[129];
+	S32 i, key, vel, band, nPairs, nList;
+	presetCellT *cellP;
+
+	indexP = NEW (PresetIndex);
+	if (indexP == NULL)
+		return NULL;
+	MEMSET (indexP, 0, sizeof (PresetIndex));
+	indexP->presetP = presetP;
+
+	/* count the zone pairs that can sound at all */
+	nPairs = 0;
+	pzoneEndP = presetP->zoneA + presetP->nZones;
+	for (pzoneP = presetP->zoneA; pzoneP < pzoneEndP; ++pzoneP) {
+		instP = pzoneP->u.instP;
+		if (instP == NULL)
+			continue;
+		izoneEndP = instP->zoneA + instP->nZones;
+		for (izoneP = instP->zoneA; izoneP < izoneEndP; ++izoneP) {
+			if (izoneP->u.sampleP != NULL)
+				nPairs++;
+		}
+	}
+
+	indexP->zoneA = ARRAY (presetZoneT, nPairs > 0 ? nPairs : 1);
+	if (indexP->zoneA == NULL)
+		goto errorRecovery;
+
+	for (pzoneP = presetP->zoneA; pzoneP < pzoneEndP; ++pzoneP) {
+		instP = pzoneP->u.instP;
+		if (instP == NULL)
+			continue;
+		izoneEndP = instP->zoneA + instP->nZones;
+		for (izoneP = instP->zoneA; izoneP < izoneEndP; ++izoneP) {
+			if (izoneP->u.sampleP == NULL)
+				continue;
+			zoneP = &indexP->zoneA[indexP->nZones++];
+			if (presetZoneBuild (zoneP, presetP->globalZoneP, pzoneP,
+			                     instP->globalZoneP, izoneP) != OK)
+				goto errorRecovery;
+			/* empty intersection: never sounds */
+			if (zoneP->keylo > zoneP->keyhi || zoneP->vello > zoneP->velhi
+			    || zoneP->velhi > 127)
+				zoneP->keylo = 128;
+		}
+	}
+
+	/* velocity bands start at 0 and at every zone's vello and velhi + 1 */
+	MEMSET (velStart, 0, sizeof (velStart));
+	velStart[0] = 1;
+	for (i = 0; i < indexP->nZones; i++) {
+		zoneP = &indexP->zoneA[i];
+		if (zoneP->keylo > 127)
+			continue;
+		velStart[zoneP->vello] = 1;
+		velStart[zoneP->velhi + 1] = 1;
+	}
+	band = -1;
+	for (vel = 0; vel < 128; vel++) {
+		band += velStart[vel];
+		indexP->velBand[vel] = band;
+	}
+	indexP->nVelBands = band + 1;
+
+	indexP->cellA = ARRAY (presetCellT, 128 * indexP->nVelBands);
+	if (indexP->cellA == NULL)
+		goto errorRecovery;
+
+	/* Two passes over the cells: count, then fill.  A band is matched by
+	 * its lowest velocity, every velocity in it hits the same zones. */
+	nList = 0;
+	for (key = 0; key < 128; key++) {
+		for (vel = 0; vel < 128; vel++) {
+			if (!velStart[vel])
+				continue;
+			cellP = presetIndexCell_ (indexP, key, vel);
+			cellP->first = nList;
+			cellP->n = 0;
+			for (i = 0; i < indexP->nZones; i++) {
+				zoneP = &indexP->zoneA[i];
+				if (key >= zoneP->keylo && key <= zoneP->keyhi
+				    && vel >= zoneP->vello && vel <= zoneP->velhi)
+					cellP->n++;
+			}
+			nList += cellP->n;
+		}
+	}
+
+	indexP->zoneList = ARRAY (U32, nList > 0 ? nList : 1);
+	if (indexP->zoneList == NULL)
+		goto errorRecovery;
+
+	nList = 0;
+	for (key = 0; key < 128; key++) {
+		for (vel = 0; vel < 128; vel++) {
+			if (!velStart[vel])
+				continue;
+			for (i = 0; i < indexP->nZones; i++) {
+				zoneP = &indexP->zoneA[i];
+				if (key >= zoneP->keylo && key <= zoneP->keyhi
+				    && vel >= zoneP->vello && vel <= zoneP->velhi)
+					indexP->zoneList[nList++] = i;
+			}
+		}
+	}
+
+	return indexP;
+
+errorRecovery:
+	deletePresetIndex (indexP);
+	return NULL;
+}
+
+/*
+ * deletePresetIndex
+ */
+void deletePresetIndex (PresetIndex * indexP) {
+	presetZoneT *zoneP;
+	S32 i;
+
+	if (indexP == NULL)
+		return;
+
+	if (indexP->zoneA != NULL) {
+		for (i = 0; i < indexP->nZones; i++) {
+			zoneP = &indexP->zoneA[i];
+			if (zoneP->instGenA != NULL)
+				FREE (zoneP->instGenA);
+			if (zoneP->presetGenA != NULL)
+				FREE (zoneP->presetGenA);
+			if (zoneP->instModA != NULL)
+				FREE (zoneP->instModA);
+			if (zoneP->presetModA != NULL)
+				FREE (zoneP->presetModA);
+		}
+		FREE (indexP->zoneA);
+	}
+	if (indexP->cellA != NULL)
+		FREE (indexP->cellA);
+	if (indexP->zoneList != NULL)
+		FREE (indexP->zoneList);
+	FREE (indexP);
+}
+
+#define presetIndexBucket_(_presetP) \
+	(((uintptr) (_presetP) / sizeof (Preset)) % PRESET_INDEX_BUCKETS)
+
+/*
+ * presetIndexFind
+ */
+PresetIndex *presetIndexFind (PresetIndex ** cache, Preset * presetP) {
+	PresetIndex *indexP;
+
+	if (presetP == NULL)
+		return NULL;
+	for (indexP = cache[presetIndexBucket_ (presetP)]; indexP != NULL; indexP = indexP->next) {
+		if (indexP->presetP == presetP)
+			return indexP;
+	}
+	return NULL;
+}
+
+/*
+ * presetIndexGet
+ */
+PresetIndex *presetIndexGet (PresetIndex ** cache, Preset * presetP) {
+	S32 bucket = presetIndexBucket_ (presetP);
+	PresetIndex *indexP;
+
+	if (presetP == NULL)
+		return NULL;
+
+	indexP = presetIndexFind (cache, presetP);
+	if (indexP != NULL)
+		return indexP;
+
+	indexP = newPresetIndex (presetP);
+	if (indexP != NULL) {
+		indexP->next = cache[bucket];
+		cache[bucket] = indexP;
+	}
+	return indexP;
+}
+
+/*
+ * presetIndexBuildAll
+ */
+S32 presetIndexBuildAll (PresetIndex ** cache, Soundfont * sfP) {
+	Bank *bankP, *bankEndP;
+	Preset *presetP, *presetEndP;
+
+	bankEndP = sfP->bankA + sfP->nBanks;
+	for (bankP = sfP->bankA; bankP < bankEndP; ++bankP) {
+		presetEndP = bankP->presetA + bankP->nPresets;
+		for (presetP = bankP->presetA; presetP < presetEndP; ++presetP) {
+			if (presetP->nZones > 0 && presetIndexGet (cache, presetP) == NULL)
+				return FAILED;
+		}
+	}
+	return OK;
+}
+
+/*
+ * presetIndexClear
+ */
+void presetIndexClear (PresetIndex ** cache) {
+	PresetIndex *indexP, *nextP;
+	S32 i;
+
+	for (i = 0; i < PRESET_INDEX_BUCKETS; i++) {
+		for (indexP = cache[i]; indexP != NULL; indexP = nextP) {
+			nextP = indexP->next;
+			deletePresetIndex (indexP);
+		}
+		cache[i] = NULL;
+	}
+}
+
+/*
+ * presetZoneApply
+ */
+void presetZoneApply (const presetZoneT * zoneP, Voice * voiceP) {
+	const Generator *genP, *genEndP;
+	Modulator **modPP, **modEndPP;
+
+	genEndP = zoneP->instGenA + zoneP->nInstGens;
+	for (genP = zoneP->instGenA; genP < genEndP; ++genP)
+		voiceP->gen[genP->genType] = *genP;
+
+	/* Instrument modulators -supersede- existing (default) modulators.
+	 * SF 2.01 page 69, 'bullet' 6 */
+	modEndPP = zoneP->instModA + zoneP->nInstMods;
+	for (modPP = zoneP->instModA; modPP < modEndPP; ++modPP)
+		voiceAddMod (voiceP, *modPP, VOICE_OVERWRITE);
+
+	genEndP = zoneP->presetGenA + zoneP->nPresetGens;
+	for (genP = zoneP->presetGenA; genP < genEndP; ++genP) {
+		voiceP->gen[genP->genType].val += genP->val;
+		voiceP->gen[genP->genType].flags = (voiceP->gen[genP->genType].val != 0);
+	}
+
+	/* Preset modulators -add- to existing instrument / default modulators.
+	 * SF2.01 page 70 first bullet on page */
+	modEndPP = zoneP->presetModA + zoneP->nPresetMods;
+	for (modPP = zoneP->presetModA; modPP < modEndPP; ++modPP)
+		voiceAddMod (voiceP, *modPP, VOICE_ADD);
+}
@@ -0,0 +1,522 @@
+#include <pthread.h>
+#include "fluidbean.h"
+#include "synth.h"
+#include "midi.h"
+#include "render_offline.h"
+
+/* frames per synthWriteS16 call; a multiple of BUFSIZE */
+#define RENDER_CHUNK 4096
+#if RENDER_CHUNK % BUFSIZE
+#error "RENDER_CHUNK must be a multiple of the block size"
+#endif
+
+/* Anything within the dither noise counts as silence. */
+#define RENDER_SILENCE 1
+
+/******************************************************
+ *
+ *     SMF parser
+ */
+
+typedef struct {
+	const U8 *p;
+	const U8 *end;
+} smfReaderT;
+
+/*
+ * smfVarLen
+ */
+static U32 smfVarLen (smfReaderT * r) {
+	U32 val = 0;
+	S32 i;
+
+	for (i = 0; i < 4 && r->p < r->end; i++) {
+		U8 c = *r->p++;
+		val = (val << 7) | (c & 0x7f);
+		if (!(c & 0x80))
+			break;
+	}
+	return val;
+}
+
+static U32 smfBe32 (const U8 * p) {
+	return ((U32) p[0] << 24) | ((U32) p[1] << 16) | ((U32) p[2] << 8) | p[3];
+}
+
+/*
+ * songAddEvent
+ */
+static midiSongEventT *songAddEvent (midiSongT * song, S32 * size) {
+	midiSongEventT *event;
+
+	if (song->nEvents == *size) {
+		S32 newSize = *size ? 2 * *size : 1024;
+		event = REALLOC (song->event, newSize * sizeof (midiSongEventT));
+		if (event == NULL)
+			return NULL;
+		song->event = event;
+		*size = newSize;
+	}
+	event = &song->event[song->nEvents];
+	MEMSET (event, 0, sizeof (midiSongEventT));
+	event->seq = song->nEvents++;
+	return event;
+}
+
+/*
+ * songParseTrack
+ *
+ * Appends the channel messages, tempo changes and the end of track of one
+ * MTrk chunk.  Sysex and the other meta events are skipped.
+ */
+static S32 songParseTrack (midiSongT * song, S32 * size, const U8 * data, U32 len) {
+	smfReaderT r = { data, data + len };
+	midiSongEventT *event;
+	U32 tick = 0;
+	U8 status = 0;
+	U8 type, c;
+	U32 n;
+
+	while (r.p < r.end) {
+		tick += smfVarLen (&r);
+		if (r.p >= r.end)
+			break;
+
+		c = *r.p;
+		if (c & 0x80) {
+			r.p++;
+			if (c < 0xf0)
+				status = c;									/* running status only for channel messages */
+		} else if (status == 0) {
+			return FAILED;								/* data byte without a status */
+		} else {
+			c = status;
+		}
+
+		if (c == 0xff) {								/* meta event */
+			if (r.p >= r.end)
+				return FAILED;
+			type = *r.p++;
+			n = smfVarLen (&r);
+			if (n > (U32) (r.end - r.p))
+				return FAILED;
+			if (type == MIDI_SET_TEMPO && n == 3) {
+				if ((event = songAddEvent (song, size)) == NULL)
+					return FAILED;
+				event->tick = tick;
+				event->type = MIDI_SET_TEMPO;
+				event->tempo = ((U32) r.p[0] << 16) | ((U32) r.p[1] << 8) | r.p[2];
+			}
+			r.p += n;
+			if (type == MIDI_EOT)
+				break;
+			continue;
+		}
+		if (c == 0xf0 || c == 0xf7) {		/* sysex */
+			n = smfVarLen (&r);
+			if (n > (U32) (r.end - r.p))
+				return FAILED;
+			r.p += n;
+			continue;
+		}
+		if (c >= 0xf0)										/* no other system messages in files */
+			return FAILED;
+
+		n = ((c & 0xf0) == PROGRAM_CHANGE || (c & 0xf0) == CHANNEL_PRESSURE) ? 1 : 2;
+		if (n > (U32) (r.end - r.p))
+			return FAILED;
+		if ((event = songAddEvent (song, size)) == NULL)
+			return FAILED;
+		event->tick = tick;
+		event->type = c & 0xf0;
+		event->chan = c & 0x0f;
+		event->p1 = r.p[0] & 0x7f;
+		event->p2 = n > 1 ? r.p[1] & 0x7f : 0;
+		r.p += n;
+	}
+
+	/* Tracks may stop short of EOT, or run on after the last note; either
+	 * way the song lasts at least this long. */
+	if ((event = songAddEvent (song, size)) == NULL)
+		return FAILED;
+	event->tick = tick;
+	event->type = MIDI_EOT;
+	return OK;
+}
+
+static int songEventCompare (const void *a, const void *b) {
+	const midiSongEventT *ea = (const midiSongEventT *) a;
+	const midiSongEventT *eb = (const midiSongEventT *) b;
+
+	if (ea->tick != eb->tick)
+		return ea->tick < eb->tick ? -1 : 1;
+	return ea->seq < eb->seq ? -1 : ea->seq > eb->seq;
+}
+
+/*
+ * songApplyTempoMap
+ *
+ * Converts ticks to output frames.  Every tempo change starts a new
+ * segment; the segment start is kept as a double so rounding never adds
+ * up over a long song.
+ */
+static void songApplyTempoMap (midiSongT * song) {
+	double segFrame = 0.0;
+	double framesPerTick;
+	U32 segTick = 0;
+	S32 smpte = song->division & 0x8000;
+	S32 i;
+
+	if (smpte) {
+		S32 fps = -(S8) (song->division >> 8);
+		double tps = (fps == 29 ? 29.97 : fps) * (song->division & 0xff);
+		framesPerTick = song->sampleRate / tps;
+	} else {
+		framesPerTick = 500000.0 * song->sampleRate / (1e6 * song->division);
+	}
+
+	song->lastFrame = 0;
+	for (i = 0; i < song->nEvents; i++) {
+		midiSongEventT *event = &song->event[i];
+		double frame = segFrame + (event->tick - segTick) * framesPerTick;
+
+		event->frame = (uint64) (frame + 0.5);
+		if (event->frame > song->lastFrame)
+			song->lastFrame = event->frame;
+
+		if (event->type == MIDI_SET_TEMPO && !smpte && event->tempo > 0) {
+			segFrame = frame;
+			segTick = event->tick;
+			framesPerTick = (double) event->tempo * song->sampleRate / (1e6 * song->division);
+		}
+	}
+}
+
+/*
+ * newMidiSong
+ */
+midiSongT *newMidiSong (const U8 * data, U32 len, U32 sampleRate) {
+	midiSongT *song;
+	const U8 *p = data;
+	const U8 *end = data + len;
+	U32 chunkLen;
+	S32 size = 0;
+
+	if (len < 14 || MEMCMP (data, "MThd", 4) != 0)
+		return NULL;
+	chunkLen = smfBe32 (data + 4);
+	if (chunkLen < 6 || chunkLen > len - 8)
+		return NULL;
+
+	song = NEW (midiSongT);
+	if (song == NULL)
+		return NULL;
+	MEMSET (song, 0, sizeof (midiSongT));
+	song->sampleRate = sampleRate;
+	song->division = ((U32) data[12] << 8) | data[13];
+	if (song->division == 0)
+		goto errorRecovery;
+
+	/* every MTrk chunk, whatever the header claims about the track count */
+	for (p += 8 + chunkLen; end - p >= 8; p += 8 + chunkLen) {
+		chunkLen = smfBe32 (p + 4);
+		if (chunkLen > (U32) (end - p - 8))
+			chunkLen = end - p - 8;				/* truncated file: take what's there */
+		if (MEMCMP (p, "MTrk", 4) == 0
+				&& songParseTrack (song, &size, p + 8, chunkLen) != OK)
+			goto errorRecovery;
+	}
+
+	qsort (song->event, song->nEvents, sizeof (midiSongEventT), songEventCompare);
+	songApplyTempoMap (song);
+	return song;
+
+errorRecovery:
+	deleteMidiSong (song);
+	return NULL;
+}
+
+/*
+ * midiSongLoad
+ */
+midiSongT *midiSongLoad (const char *path, U32 sampleRate) {
+	midiSongT *song = NULL;
+	FILE *file;
+	U8 *data;
+	long len;
+
+	file = FOPEN (path, "rb");
+	if (file == NULL)
+		return NULL;
+	if (FSEEK (file, 0, SEEK_END) != 0 || (len = FTELL (file)) <= 0
+			|| FSEEK (file, 0, SEEK_SET) != 0) {
+		FCLOSE (file);
+		return NULL;
+	}
+
+	data = ARRAY (U8, len);
+	if (data != NULL && FREAD (data, 1, len, file) == (size_t) len)
+		song = newMidiSong (data, (U32) len, sampleRate);
+
+	if (data != NULL)
+		FREE (data);
+	FCLOSE (file);
+	return song;
+}
+
+/*
+ * deleteMidiSong
+ */
+void deleteMidiSong (midiSongT * song) {
+	if (song == NULL)
+		return;
+	if (song->event != NULL)
+		FREE (song->event);
+	FREE (song);
+}
+
+/******************************************************
+ *
+ *     rendering
+ */
+
+static void put16 (U8 * p, U32 v) {
+	p[0] = v;
+	p[1] = v >> 8;
+}
+
+static void put32 (U8 * p, U32 v) {
+	put16 (p, v);
+	put16 (p + 2, v >> 16);
+}
+
+/*
+ * renderWavHeader
+ */
+static S32 renderWavHeader (FILE * out, U32 sampleRate, uint64 frames) {
+	U8 hdr[44];
+	uint64 dataLen = frames * 4;
+
+	if (dataLen > 0xffffffffULL - 36)
+		dataLen = 0xffffffffULL - 36;		/* unknown or too long: streaming convention */
+
+	MEMCPY (hdr, "RIFF", 4);
+	put32 (hdr + 4, 36 + dataLen);
+	MEMCPY (hdr + 8, "WAVEfmt ", 8);
+	put32 (hdr + 16, 16);
+	put16 (hdr + 20, 1);								/* PCM */
+	put16 (hdr + 22, 2);
+	put32 (hdr + 24, sampleRate);
+	put32 (hdr + 28, sampleRate * 4);
+	put16 (hdr + 32, 4);
+	put16 (hdr + 34, 16);
+	MEMCPY (hdr + 36, "data", 4);
+	put32 (hdr + 40, dataLen);
+
+	return fwrite (hdr, 1, sizeof (hdr), out) == sizeof (hdr) ? OK : FAILED;
+}
+
+/*
+ * renderSong
+ */
+S32 renderSong (Synthesizer * synth, midiSongT * song, FILE * out,
+								S32 format, uint64 * framesOut) {
+	S16 buf[2 * RENDER_CHUNK];
+	uint64 frame = 0;
+	uint64 chunkEnd, base;
+	uint64 tailEnd = song->lastFrame + (uint64) RENDER_MAX_TAIL_SECONDS * song->sampleRate;
+	midiSongEventT *event;
+	S32 ev = 0;
+	S32 len, i, peak;
+
+	/* start from a clean synth, including the block it had rendered ahead */
+	synthHandleEvent (synth, MIDI_SYSTEM_RESET, 0, 0, 0);
+	synthClearEvents (synth);
+	synth->cur = BUFSIZE;
+	synth->ditherIndex = 0;
+	base = synthGetFrameTime (synth);
+
+	if (format == RENDER_WAV && renderWavHeader (out, song->sampleRate, ~0ULL) != OK)
+		return FAILED;
+
+	for (;;) {
+		/* Queue everything that falls into this chunk; the synth applies each
+		 * event on its frame.  Chunks start and end on block boundaries, so
+		 * synthWriteS16 never renders ahead into a block whose events aren't
+		 * queued yet. */
+		chunkEnd = frame + RENDER_CHUNK;
+		while (ev < song->nEvents && song->event[ev].frame < chunkEnd) {
+			event = &song->event[ev];
+			/* tempo changes are already in the frame numbers */
+			if (event->type != MIDI_SET_TEMPO && event->type != MIDI_EOT
+					&& synthQueueEvent (synth, base + event->frame, event->type, event->chan,
+					                    event->p1, event->p2) != OK) {
+				/* queue full: render up to the block of this event first */
+				chunkEnd = event->frame - event->frame % BUFSIZE;
+				if (chunkEnd > frame)
+					break;
+				/* It's due in the next block.  Apply the events due on the
+				 * block's first frame now, as the block would, and retry. */
+				chunkEnd = frame + RENDER_CHUNK;
+				if (synthApplyEvents (synth, base + frame) > 0)
+					continue;
+				/* The queue holds more events than that inside the block; this
+				 * one can't go in before it renders and is applied after it. */
+				chunkEnd = frame + BUFSIZE;
+				break;
+			}
+			ev++;
+		}
+
+		if (ev == song->nEvents) {
+			if (frame >= tailEnd)
+				break;
+			if (chunkEnd > tailEnd)
+				chunkEnd = tailEnd;
+		}
+		len = (S32) (chunkEnd - frame);
+
+		synthWriteS16 (synth, len, buf, 0, 2, buf, 1, 2);
+		frame += len;
+
+		/* Past the last event, stop at the first silent chunk that has no
+		 * voices left (so the reverb and chorus tails have died as well). */
+		peak = 0;
+		if (ev == song->nEvents && synth->nActiveVoices == 0) {
+			for (i = 0; i < 2 * len && peak <= RENDER_SILENCE; i++)
+				peak = abs (buf[i]);
+		}
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+		for (i = 0; i < 2 * len; i++)
+			buf[i] = (S16) __builtin_bswap16 ((U16) buf[i]);
+#endif
+		if (fwrite (buf, 4, len, out) != (size_t) len)
+			return FAILED;
+
+		if (ev == song->nEvents && synth->nActiveVoices == 0 && peak <= RENDER_SILENCE)
+			break;
+	}
+
+	/* patch the sizes in; a pipe keeps the streaming header */
+	if (format == RENDER_WAV && fseek (out, 0, SEEK_SET) == 0) {
+		if (renderWavHeader (out, song->sampleRate, frame) != OK)
+			return FAILED;
+		fseek (out, 0, SEEK_END);
+	}
+
+	if (framesOut != NULL)
+		*framesOut = frame;
+	return ferror (out) ? FAILED : OK;
+}
+
+/******************************************************
+ *
+ *     batch rendering
+ */
+
+typedef struct {
+	renderJobT *jobs;
+	S32 nJobs;
+	S32 next;													/* atomic: next unclaimed job */
+} renderBatchT;
+
+typedef struct {
+	renderBatchT *batch;
+	Synthesizer *synth;
+	pthread_t thread;
+} renderBatchWorkerT;
+
+/*
+ * renderJob
+ */
+static void renderJob (Synthesizer * synth, renderJobT * job) {
+	midiSongT *song;
+	FILE *out;
+
+	job->status = FAILED;
+	job->frames = 0;
+
+	song = midiSongLoad (job->midiPath, (U32) synth->sampleRate);
+	if (song == NULL)
+		return;
+
+	out = FOPEN (job->outPath, "wb");
+	if (out != NULL) {
+		job->status = renderSong (synth, song, out, job->format, &job->frames);
+		if (FCLOSE (out) != 0)
+			job->status = FAILED;
+	}
+	deleteMidiSong (song);
+}
+
+/*
+ * renderBatchWorker
+ */
+static void *renderBatchWorker (void *data) {
+	renderBatchWorkerT *worker = (renderBatchWorkerT *) data;
+	renderBatchT *batch = worker->batch;
+	S32 i;
+
+	while ((i = __atomic_fetch_add (&batch->next, 1, __ATOMIC_RELAXED)) < batch->nJobs)
+		renderJob (worker->synth, &batch->jobs[i]);
+	return NULL;
+}
+
+/*
+ * renderBatch
+ */
+S32 renderBatch (Soundfont * sf, renderJobT * jobs, S32 nJobs, S32 nThreads) {
+	renderBatchT batch = { jobs, nJobs, 0 };
+	renderBatchWorkerT *worker;
+	S32 nWorkers = 0;
+	S32 nStarted = 0;
+	S32 i, status = OK;
+
+	if (nThreads > nJobs)
+		nThreads = nJobs;
+	if (nThreads < 1)
+		nThreads = 1;
+
+	for (i = 0; i < nJobs; i++)
+		jobs[i].status = FAILED;
+
+	worker = ARRAY (renderBatchWorkerT, nThreads);
+	if (worker == NULL)
+		return FAILED;
+
+	/* newSynth initialises shared tables on first use, so the synths are
+	 * made here rather than on the worker threads */
+	for (; nWorkers < nThreads; nWorkers++) {
+		worker[nWorkers].batch = &batch;
+		worker[nWorkers].synth = newSynth ();
+		if (worker[nWorkers].synth == NULL)
+			break;
+		worker[nWorkers].synth->soundfontP = sf;
+		synthUpdatePresets (worker[nWorkers].synth);
+	}
+
+	if (nWorkers == 1) {
+		renderBatchWorker (&worker[0]);
+	} else {
+		for (; nStarted < nWorkers; nStarted++) {
+			if (pthread_create (&worker[nStarted].thread, NULL, renderBatchWorker,
+			                    &worker[nStarted]) != 0)
+				break;
+		}
+		if (nStarted == 0 && nWorkers > 0)
+			renderBatchWorker (&worker[0]);
+		for (i = 0; i < nStarted; i++)
+			pthread_join (worker[i].thread, NULL);
+	}
+
+	for (i = 0; i < nWorkers; i++)
+		deleteSynth (worker[i].synth);
+	FREE (worker);
+
+	for (i = 0; i < nJobs; i++) {
+		if (jobs[i].status != OK)
+			status = FAILED;
+	}
+	return status;
+}
@@ -0,0 +1,296 @@
+#include <pthread.h>
+#include <semaphore.h>
+#include "fluidbean.h"
+#include "synth.h"
+#include "voice.h"
+#include "render_pool.h"
+
+/* polls of the job word before an idle worker goes to sleep (a few 10 us) */
+#define RENDER_SPIN_LIMIT 20000
+
+#if defined(__x86_64__) || defined(__i386__)
+#define renderRelax_() __builtin_ia32_pause ()
+#elif defined(__aarch64__)
+#define renderRelax_() __asm__ __volatile__ ("yield")
+#else
+#define renderRelax_()
+#endif
+
+/* The job word: block generation, number of groups and the next unclaimed
+ * group, all in one 64 bit atomic.  A worker that wakes up late can't claim
+ * a group of the wrong block, because the generation is part of every CAS. */
+#define jobGen_(_j)     ((U32) ((_j) >> 32))
+#define jobGroups_(_j)  ((U32) ((_j) >> 16) & 0xffff)
+#define jobNext_(_j)    ((U32) (_j) & 0xffff)
+#define jobMake_(_gen, _groups, _next) \
+	(((uint64) (_gen) << 32) | ((uint64) (_groups) << 16) | (uint64) (_next))
+
+typedef struct {
+	struct _renderPool *pool;
+	pthread_t thread;
+	sem_t wake;
+	S32 sleeping;											/* atomic: set before sem_wait */
+} renderWorkerT;
+
+struct _renderPool {
+	S32 nWorkers;
+	renderWorkerT *worker;
+
+	/* private mix buffers, one block per group:
+	 * left[nbuf][BUFSIZE], right[nbuf][BUFSIZE],
+	 * reverb[nFxBuses][BUFSIZE], chorus[nFxBuses][BUFSIZE] */
+	S32 nbuf;
+	S32 nFxBuses;
+	S32 maxGroups;
+	S32 groupStride;
+	void *groupMem;
+	busT *groupBuf;
+	U32 *groupFxBuses;								/* per group: the buses it sent to */
+
+	/* the current span; written by the audio thread before the job word */
+	struct _Synthesizer *synth;
+	S32 start;
+	S32 n;
+
+	uint64 job;												/* atomic */
+	S32 groupsDone;										/* atomic */
+	S32 quit;
+};
+
+/*
+ * renderGroup
+ */
+static void renderGroup (renderPoolT * pool, U32 g) {
+	struct _Synthesizer *synth = pool->synth;
+	busT *left = pool->groupBuf + g * pool->groupStride;
+	busT *right = left + pool->nbuf * BUFSIZE;
+	busT *reverb = right + pool->nbuf * BUFSIZE;
+	busT *chorus = reverb + pool->nFxBuses * BUFSIZE;
+	S32 i, auchan, b;
+	S32 last = (g + 1) * RENDER_GROUP_VOICES;
+	U32 used = 0;
+	Voice *voice;
+	voiceBatchT batch;
+
+	if (last > synth->nActiveVoices)
+		last = synth->nActiveVoices;
+
+	/* only the span is written and summed; the sends only if used */
+	for (i = 0; i < 2 * pool->nbuf; i++)
+		MEMSET (left + i * BUFSIZE + pool->start, 0, pool->n * sizeof (busT));
+
+	voiceBatchBegin (&batch, pool->start, pool->n);
+	for (i = g * RENDER_GROUP_VOICES; i < last; i++) {
+		voice = synth->activeVoice[i];
+		if (_PLAYING (voice)) {
+			/* same output and bus mapping as synthRenderSpan */
+			auchan = voice->chan % synth->audioGroups;
+			b = voice->channel->fxBus;
+			if (!(used & (1u << b))) {
+				MEMSET (reverb + b * BUFSIZE + pool->start, 0, pool->n * sizeof (busT));
+				MEMSET (chorus + b * BUFSIZE + pool->start, 0, pool->n * sizeof (busT));
+				used |= 1u << b;
+			}
+			voiceBatchWrite (&batch, voice,
+			                 left + auchan * BUFSIZE, right + auchan * BUFSIZE,
+			                 synth->withReverb ? reverb + b * BUFSIZE : NULL,
+			                 synth->withChorus ? chorus + b * BUFSIZE : NULL);
+		}
+	}
+	voiceBatchFlush (&batch);
+	pool->groupFxBuses[g] = used;
+
+	__atomic_fetch_add (&pool->groupsDone, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * renderClaimGroups
+ *
+ * Renders groups of block 'gen' until there are none left to claim.
+ */
+static void renderClaimGroups (renderPoolT * pool, U32 gen) {
+	uint64 job = __atomic_load_n (&pool->job, __ATOMIC_ACQUIRE);
+
+	while (jobGen_ (job) == gen && jobNext_ (job) < jobGroups_ (job)) {
+		if (__atomic_compare_exchange_n (&pool->job, &job, job + 1, 0,
+		                                 __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			renderGroup (pool, jobNext_ (job));
+			job = __atomic_load_n (&pool->job, __ATOMIC_ACQUIRE);
+		}
+	}
+}
+
+/*
+ * renderWorker
+ */
+static void *renderWorker (void *data) {
+	renderWorkerT *worker = (renderWorkerT *) data;
+	renderPoolT *pool = worker->pool;
+	U32 seen = 0;
+	U32 gen;
+	S32 spins;
+
+	for (;;) {
+		/* wait for the next block: spin first, then sleep */
+		for (spins = 0; spins < RENDER_SPIN_LIMIT; spins++) {
+			gen = jobGen_ (__atomic_load_n (&pool->job, __ATOMIC_ACQUIRE));
+			if (gen != seen || __atomic_load_n (&pool->quit, __ATOMIC_ACQUIRE))
+				break;
+			renderRelax_ ();
+		}
+		if (gen == seen && !__atomic_load_n (&pool->quit, __ATOMIC_ACQUIRE)) {
+			__atomic_store_n (&worker->sleeping, 1, __ATOMIC_SEQ_CST);
+			gen = jobGen_ (__atomic_load_n (&pool->job, __ATOMIC_SEQ_CST));
+			/* If a block came in meanwhile, take the flag back.  If the audio
+			 * thread took it first, it has posted (or will), so eat the post. */
+			if (gen == seen || !__atomic_exchange_n (&worker->sleeping, 0, __ATOMIC_SEQ_CST)) {
+				while (sem_wait (&worker->wake) != 0)
+					;
+			}
+			continue;
+		}
+		if (__atomic_load_n (&pool->quit, __ATOMIC_ACQUIRE))
+			break;
+
+		seen = gen;
+		renderClaimGroups (pool, gen);
+	}
+	return NULL;
+}
+
+/*
+ * newRenderPool
+ */
+renderPoolT *newRenderPool (S32 nThreads, S32 nbuf, S32 nFxBuses, S32 maxVoices) {
+	renderPoolT *pool;
+	S32 i;
+
+	pool = NEW (renderPoolT);
+	if (pool == NULL)
+		return NULL;
+	MEMSET (pool, 0, sizeof (renderPoolT));
+
+	pool->nbuf = nbuf;
+	pool->nFxBuses = nFxBuses;
+	pool->maxGroups = (maxVoices + RENDER_GROUP_VOICES - 1) / RENDER_GROUP_VOICES;
+	pool->groupStride = (2 * nbuf + 2 * nFxBuses) * BUFSIZE;
+	pool->groupMem = MALLOC (pool->maxGroups * pool->groupStride * sizeof (busT) + 64);
+	pool->groupFxBuses = ARRAY (U32, pool->maxGroups);
+	if (pool->groupMem == NULL || pool->groupFxBuses == NULL
+			|| pool->maxGroups > 0xffff || nFxBuses > 32)
+		goto errorRecovery;
+	pool->groupBuf = (busT *) (((uintptr) pool->groupMem + 63) & ~(uintptr) 63);
+
+	pool->worker = ARRAY (renderWorkerT, nThreads > 1 ? nThreads - 1 : 1);
+	if (pool->worker == NULL)
+		goto errorRecovery;
+
+	for (i = 0; i < nThreads - 1; i++) {
+		renderWorkerT *worker = &pool->worker[i];
+		worker->pool = pool;
+		worker->sleeping = 0;
+		if (sem_init (&worker->wake, 0, 0) != 0)
+			goto errorRecovery;
+		if (pthread_create (&worker->thread, NULL, renderWorker, worker) != 0) {
+			sem_destroy (&worker->wake);
+			goto errorRecovery;
+		}
+		pool->nWorkers++;
+	}
+	return pool;
+
+errorRecovery:
+	deleteRenderPool (pool);
+	return NULL;
+}
+
+/*
+ * deleteRenderPool
+ */
+void deleteRenderPool (renderPoolT * pool) {
+	S32 i;
+
+	if (pool == NULL)
+		return;
+
+	__atomic_store_n (&pool->quit, 1, __ATOMIC_SEQ_CST);
+	for (i = 0; i < pool->nWorkers; i++)
+		sem_post (&pool->worker[i].wake);
+	for (i = 0; i < pool->nWorkers; i++) {
+		pthread_join (pool->worker[i].thread, NULL);
+		sem_destroy (&pool->worker[i].wake);
+	}
+
+	if (pool->worker != NULL)
+		FREE (pool->worker);
+	if (pool->groupMem != NULL)
+		FREE (pool->groupMem);
+	if (pool->groupFxBuses != NULL)
+		FREE (pool->groupFxBuses);
+	FREE (pool);
+}
+
+/*
+ * renderPoolWrite
+ */
+void renderPoolWrite (renderPoolT * pool, struct _Synthesizer * synth,
+											S32 start, S32 n) {
+	U32 gen = jobGen_ (__atomic_load_n (&pool->job, __ATOMIC_RELAXED)) + 1;
+	S32 nGroups = (synth->nActiveVoices + RENDER_GROUP_VOICES - 1) / RENDER_GROUP_VOICES;
+	S32 g, b, k;
+	S32 end = start + n;
+	busT *src;
+	U32 used;
+	synthFxBusT *bus;
+
+	if (nGroups == 0)
+		return;
+	if (nGroups > pool->maxGroups)			/* can't happen: activeVoice holds at most nvoice */
+		nGroups = pool->maxGroups;
+
+	pool->synth = synth;
+	pool->start = start;
+	pool->n = n;
+	__atomic_store_n (&pool->groupsDone, 0, __ATOMIC_RELAXED);
+	__atomic_store_n (&pool->job, jobMake_ (gen, nGroups, 0), __ATOMIC_SEQ_CST);
+
+	/* one group is faster to do than to hand out */
+	if (nGroups > 1) {
+		for (k = 0; k < pool->nWorkers; k++) {
+			if (__atomic_exchange_n (&pool->worker[k].sleeping, 0, __ATOMIC_SEQ_CST))
+				sem_post (&pool->worker[k].wake);
+		}
+	}
+
+	renderClaimGroups (pool, gen);
+	while (__atomic_load_n (&pool->groupsDone, __ATOMIC_ACQUIRE) < nGroups)
+		renderRelax_ ();
+
+	/* sum the groups, always in the same order */
+	for (g = 0; g < nGroups; g++) {
+		src = pool->groupBuf + g * pool->groupStride;
+		for (b = 0; b < pool->nbuf; b++, src += BUFSIZE) {
+			for (k = start; k < end; k++)
+				synth->leftBuf[b][k] += src[k];
+		}
+		for (b = 0; b < pool->nbuf; b++, src += BUFSIZE) {
+			for (k = start; k < end; k++)
+				synth->rightBuf[b][k] += src[k];
+		}
+		used = pool->groupFxBuses[g];
+		for (b = 0; used != 0; b++, used >>= 1) {
+			if (!(used & 1))
+				continue;
+			bus = &synth->fxBus[b];
+			bus->used = 1;
+			if (synth->withReverb) {
+				for (k = start; k < end; k++)
+					bus->reverbBuf[k] += src[b * BUFSIZE + k];
+			}
+			if (synth->withChorus) {
+				for (k = start; k < end; k++)
+					bus->chorusBuf[k] += src[(pool->nFxBuses + b) * BUFSIZE + k];
+			}
+		}
+	}
+}
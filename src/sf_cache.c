@@ -0,0 +1,239 @@
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "fluidbean.h"
+#include "soundfont.h"
+#include "sf_load.h"
+#include "sf_cache.h"
+
+typedef struct _sfCacheEntry {
+	uint64 hash;											/* of the whole file */
+	dev_t dev;												/* the file it was loaded from, to skip the hash */
+	ino_t ino;
+	off_t size;
+	time_t mtime;
+	Soundfont *sfP;
+	S32 refs;													/* atomic; once 0 it stays 0 */
+	uint64 retired;										/* atomic: epoch of the last release, 0 while referenced */
+	struct _sfCacheEntry *next;
+} sfCacheEntryT;
+
+static pthread_mutex_t sfCacheLock = PTHREAD_MUTEX_INITIALIZER;
+static sfCacheEntryT *sfCacheEntries;
+static sfCacheReaderT *sfCacheReaders;
+static uint64 sfCacheEpoch = 1;					/* atomic */
+
+#define sfCacheRotl_(_x, _r) (((_x) << (_r)) | ((_x) >> (64 - (_r))))
+
+/*
+ * sfCacheHash
+ *
+ * 64 bit content hash, four independent lanes so it runs at memory speed.
+ */
+static uint64 sfCacheHash (const U8 * p, size_t n) {
+	const uint64 k1 = 0x9e3779b185ebca87ULL, k2 = 0xc2b2ae3d27d4eb4fULL;
+	uint64 h[4] = { k1, k2, ~k1, ~k2 }, w[4], last = 0, x;
+	size_t i;
+	S32 j;
+
+	for (i = 0; i + 32 <= n; i += 32) {
+		MEMCPY (w, p + i, 32);
+		for (j = 0; j < 4; j++)
+			h[j] = sfCacheRotl_ (h[j] ^ (w[j] * k2), 31) * k1;
+	}
+	MEMCPY (&last, p + i, n - i < 8 ? n - i : 8);
+	for (x = n, j = 0; j < 4; j++)
+		x = sfCacheRotl_ (x ^ (h[j] * k2), 27) * k1;
+	x ^= last * k2;
+	if (n - i > 8) {
+		for (i += 8; i < n; i++)
+			x = (x ^ p[i]) * k1;
+	}
+	x ^= x >> 33;
+	x *= k2;
+	x ^= x >> 29;
+	return x;
+}
+
+/*
+ * sfCacheGet
+ *
+ * A reference to 'entry' unless its last one is gone already: a retired
+ * font is never handed out again, its file gets loaded anew.
+ */
+static S32 sfCacheGet (sfCacheEntryT * entry) {
+	S32 refs = __atomic_load_n (&entry->refs, __ATOMIC_ACQUIRE);
+
+	while (refs > 0) {
+		if (__atomic_compare_exchange_n (&entry->refs, &refs, refs + 1, 0,
+		                                 __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			return OK;
+	}
+	return FAILED;
+}
+
+/*
+ * sfCacheAcquire
+ */
+Soundfont *sfCacheAcquire (const char *path) {
+	sfCacheEntryT *entry;
+	Soundfont *sfP = NULL;
+	struct stat st;
+	void *mapP = MAP_FAILED;
+	uint64 hash;
+	int fd;
+
+	fd = open (path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	if (fstat (fd, &st) != 0 || st.st_size < 12 || (uint64) st.st_size >= ((uint64) 1 << 32) + 8) {
+		close (fd);
+		return NULL;
+	}
+
+	pthread_mutex_lock (&sfCacheLock);
+
+	/* the same file again */
+	for (entry = sfCacheEntries; entry != NULL; entry = entry->next) {
+		if (entry->dev == st.st_dev && entry->ino == st.st_ino && entry->size == st.st_size
+				&& entry->mtime == st.st_mtime && sfCacheGet (entry) == OK) {
+			sfP = entry->sfP;
+			goto done;
+		}
+	}
+
+	mapP = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (mapP == MAP_FAILED)
+		goto done;
+	hash = sfCacheHash (mapP, st.st_size);
+
+	/* the same content under another name */
+	for (entry = sfCacheEntries; entry != NULL; entry = entry->next) {
+		if (entry->hash == hash && entry->size == st.st_size && sfCacheGet (entry) == OK) {
+			munmap (mapP, st.st_size);
+			sfP = entry->sfP;
+			goto done;
+		}
+	}
+
+	entry = NEW (sfCacheEntryT);
+	if (entry == NULL)
+		goto errorRecovery;
+	MEMSET (entry, 0, sizeof (sfCacheEntryT));
+	entry->sfP = sfLoadMap (mapP, st.st_size);
+	if (entry->sfP == NULL) {
+		FREE (entry);
+		goto errorRecovery;
+	}
+	((sfFileT *) entry->sfP)->ownerP = entry;
+	entry->hash = hash;
+	entry->dev = st.st_dev;
+	entry->ino = st.st_ino;
+	entry->size = st.st_size;
+	entry->mtime = st.st_mtime;
+	entry->refs = 1;
+	entry->next = sfCacheEntries;
+	sfCacheEntries = entry;
+	sfP = entry->sfP;
+	goto done;
+
+errorRecovery:
+	munmap (mapP, st.st_size);
+done:
+	pthread_mutex_unlock (&sfCacheLock);
+	close (fd);
+	return sfP;
+}
+
+/*
+ * sfCacheRef
+ */
+void sfCacheRef (Soundfont * sfP) {
+	sfCacheEntryT *entry = ((sfFileT *) sfP)->ownerP;
+
+	__atomic_add_fetch (&entry->refs, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * sfCacheRelease
+ */
+void sfCacheRelease (Soundfont * sfP) {
+	sfCacheEntryT *entry;
+
+	if (sfP == NULL)
+		return;
+	entry = ((sfFileT *) sfP)->ownerP;
+	if (__atomic_sub_fetch (&entry->refs, 1, __ATOMIC_ACQ_REL) == 0)
+		__atomic_store_n (&entry->retired, __atomic_add_fetch (&sfCacheEpoch, 1, __ATOMIC_ACQ_REL),
+		                  __ATOMIC_RELEASE);
+}
+
+/*
+ * sfCacheCollect
+ */
+void sfCacheCollect (void) {
+	sfCacheEntryT *entry, **prevP;
+	sfCacheReaderT *readerP;
+	uint64 minEpoch = ~(uint64) 0, epoch, retired;
+
+	pthread_mutex_lock (&sfCacheLock);
+
+	for (readerP = sfCacheReaders; readerP != NULL; readerP = readerP->next) {
+		epoch = __atomic_load_n (&readerP->epoch, __ATOMIC_ACQUIRE);
+		if (epoch < minEpoch)
+			minEpoch = epoch;
+	}
+
+	prevP = &sfCacheEntries;
+	while ((entry = *prevP) != NULL) {
+		retired = __atomic_load_n (&entry->retired, __ATOMIC_ACQUIRE);
+		if (retired == 0 || retired > minEpoch) {
+			prevP = &entry->next;
+			continue;
+		}
+		*prevP = entry->next;
+		sfUnload (entry->sfP);
+		FREE (entry);
+	}
+
+	pthread_mutex_unlock (&sfCacheLock);
+}
+
+/*
+ * sfCacheRegisterReader
+ */
+void sfCacheRegisterReader (sfCacheReaderT * readerP) {
+	pthread_mutex_lock (&sfCacheLock);
+	readerP->epoch = __atomic_load_n (&sfCacheEpoch, __ATOMIC_ACQUIRE);
+	readerP->next = sfCacheReaders;
+	sfCacheReaders = readerP;
+	pthread_mutex_unlock (&sfCacheLock);
+}
+
+/*
+ * sfCacheUnregisterReader
+ *
+ * Safe to call for a reader that was never registered.
+ */
+void sfCacheUnregisterReader (sfCacheReaderT * readerP) {
+	sfCacheReaderT **prevP;
+
+	pthread_mutex_lock (&sfCacheLock);
+	for (prevP = &sfCacheReaders; *prevP != NULL; prevP = &(*prevP)->next) {
+		if (*prevP == readerP) {
+			*prevP = readerP->next;
+			break;
+		}
+	}
+	pthread_mutex_unlock (&sfCacheLock);
+}
+
+/*
+ * sfCacheQuiesce
+ */
+void sfCacheQuiesce (sfCacheReaderT * readerP) {
+	__atomic_store_n (&readerP->epoch, __atomic_load_n (&sfCacheEpoch, __ATOMIC_ACQUIRE),
+	                  __ATOMIC_RELEASE);
+}
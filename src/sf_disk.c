@@ -0,0 +1,486 @@
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "fluidbean.h"
+#include "sf_disk.h"
+
+enum sfDiskState {
+	SF_DISK_COLD,											/* not in memory */
+	SF_DISK_QUEUED,										/* on the request stack or pending */
+	SF_DISK_IN												/* read */
+};
+
+static pthread_mutex_t sfDiskLock = PTHREAD_MUTEX_INITIALIZER;
+static sem_t sfDiskWake;
+static S32 sfDiskRunning;								/* the lock's */
+static sfDiskFontT *sfDiskFonts;					/* the lock's */
+static sfDiskChunkT *sfDiskRequests;			/* atomic: pushed by sfDiskReady */
+static sfDiskChunkT *sfDiskPending;				/* the lock's: the requests in order */
+static sfDiskChunkT *sfDiskPendingTail;
+static sfDiskChunkT *sfDiskCached;				/* the lock's: the evictable chunks */
+static size_t sfDiskBudget = SF_DISK_BUDGET;	/* atomic */
+static uint64 sfDiskTick;									/* atomic */
+static sfDiskStatsT sfDiskCounters;				/* atomic fields, but budgetBytes */
+
+#define sfDiskCount_(_field, _n) \
+	__atomic_add_fetch (&sfDiskCounters._field, (_n), __ATOMIC_RELAXED)
+
+/*
+ * sfDiskPage
+ */
+static size_t sfDiskPage (void) {
+	long page = sysconf (_SC_PAGESIZE);
+
+	return page > 0 ? (size_t) page : 4096;
+}
+
+#define sfDiskRound_(_n, _page) (((_n) + (_page) - 1) & ~((_page) - 1))
+
+/*
+ * sfDiskFirst
+ *
+ * The first frame of chunk 'c'.
+ */
+static U32 sfDiskFirst (const sfDiskChunkT * c) {
+	return (U32) (c - c->sampleP->chunkA) * SF_DISK_CHUNK;
+}
+
+/*
+ * sfDiskFrames
+ */
+static U32 sfDiskFrames (const sfDiskChunkT * c) {
+	U32 left = c->sampleP->frames - sfDiskFirst (c);
+
+	return left < SF_DISK_CHUNK ? left : SF_DISK_CHUNK;
+}
+
+/*
+ * sfDiskRead
+ *
+ * Reads chunk 'c' from the file into its sample's slice.  What can't be
+ * read stays silent.
+ */
+static S32 sfDiskRead (sfDiskChunkT * c) {
+	sfDiskSampleT *s = c->sampleP;
+	U8 *dst = (U8 *) (s->pcmP + sfDiskFirst (c));
+	size_t left = (size_t) sfDiskFrames (c) * sizeof (S16);
+	off_t offset = s->fontP->smplOffset + ((uint64) s->fileStart + sfDiskFirst (c)) * sizeof (S16);
+	ssize_t n;
+
+	while (left > 0) {
+		n = pread (s->fontP->fd, dst, left, offset);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return FAILED;
+		dst += n;
+		offset += n;
+		left -= n;
+	}
+	return OK;
+}
+
+/*
+ * sfDiskEvict
+ *
+ * Gives the pages of chunk 'c' back.  Fails if a voice holds it, or
+ * starts to while this runs: the hold increments users before it reads
+ * ready, this clears ready before it reads users, so one of the two sees
+ * the other.  Only the pages wholly in the chunk go, its neighbours may
+ * share the others.
+ */
+static S32 sfDiskEvict (sfDiskChunkT * c) {
+	sfDiskSampleT *s = c->sampleP;
+	size_t page = sfDiskPage ();
+	uintptr from = (uintptr) (s->pcmP + sfDiskFirst (c));
+	uintptr to = (uintptr) (s->pcmP + sfDiskFirst (c) + sfDiskFrames (c));
+
+	if (__atomic_load_n (&c->users, __ATOMIC_RELAXED) > 0)
+		return FAILED;
+	__atomic_store_n (&c->ready, 0, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n (&c->users, __ATOMIC_SEQ_CST) > 0) {
+		__atomic_store_n (&c->ready, 1, __ATOMIC_SEQ_CST);
+		return FAILED;
+	}
+	/* the slice's last page is the sample's alone */
+	from = sfDiskRound_ (from, page);
+	to = sfDiskFirst (c) + sfDiskFrames (c) == s->frames ? sfDiskRound_ (to, page) : to & ~(page - 1);
+	if (from < to)
+		madvise ((void *) from, to - from, MADV_DONTNEED);
+	__atomic_store_n (&c->state, SF_DISK_COLD, __ATOMIC_SEQ_CST);
+
+	return OK;
+}
+
+/*
+ * sfDiskMakeRoom
+ *
+ * Evicts the least recently held chunks until 'cost' more bytes fit the
+ * budget, or only held chunks are left.
+ */
+static void sfDiskMakeRoom (size_t cost) {
+	sfDiskChunkT *c, **prevP, **victimP;
+	uint64 oldest;
+
+	while (__atomic_load_n (&sfDiskCounters.cachedBytes, __ATOMIC_RELAXED) + cost
+				 > __atomic_load_n (&sfDiskBudget, __ATOMIC_RELAXED)) {
+		victimP = NULL;
+		oldest = ~(uint64) 0;
+		for (prevP = &sfDiskCached; (c = *prevP) != NULL; prevP = &c->cacheNext) {
+			if (__atomic_load_n (&c->users, __ATOMIC_RELAXED) == 0
+					&& __atomic_load_n (&c->lastUse, __ATOMIC_RELAXED) < oldest) {
+				oldest = __atomic_load_n (&c->lastUse, __ATOMIC_RELAXED);
+				victimP = prevP;
+			}
+		}
+		if (victimP == NULL)
+			return;
+		c = *victimP;
+		if (sfDiskEvict (c) != OK)
+			continue;
+		*victimP = c->cacheNext;
+		sfDiskCount_ (cachedBytes, -(uint64) sfDiskFrames (c) * sizeof (S16));
+		sfDiskCount_ (evictions, 1);
+	}
+}
+
+/*
+ * sfDiskLoad
+ *
+ * Reads a requested chunk.
+ */
+static void sfDiskLoad (sfDiskChunkT * c) {
+	size_t cost = (size_t) sfDiskFrames (c) * sizeof (S16);
+
+	sfDiskMakeRoom (cost);
+	sfDiskRead (c);
+
+	__atomic_store_n (&c->ready, 1, __ATOMIC_SEQ_CST);
+	__atomic_store_n (&c->state, SF_DISK_IN, __ATOMIC_SEQ_CST);
+	c->cacheNext = sfDiskCached;
+	sfDiskCached = c;
+	sfDiskCount_ (cachedBytes, cost);
+	sfDiskCount_ (reads, 1);
+}
+
+/*
+ * sfDiskDrain
+ *
+ * Moves the requests pushed since the last call to the pending list.
+ */
+static void sfDiskDrain (void) {
+	sfDiskChunkT *c, *next, *first = NULL;
+
+	/* the stack has the newest first */
+	c = __atomic_exchange_n (&sfDiskRequests, NULL, __ATOMIC_ACQUIRE);
+	for (; c != NULL; c = next) {
+		next = c->queueNext;
+		c->queueNext = first;
+		first = c;
+	}
+	if (first == NULL)
+		return;
+	if (sfDiskPendingTail != NULL)
+		sfDiskPendingTail->queueNext = first;
+	else
+		sfDiskPending = first;
+	for (c = first; c->queueNext != NULL; c = c->queueNext)
+		;
+	sfDiskPendingTail = c;
+}
+
+/*
+ * sfDiskStep
+ *
+ * Reads the oldest request.  Returns 0 if there was none.
+ */
+static S32 sfDiskStep (void) {
+	sfDiskChunkT *c;
+
+	sfDiskDrain ();
+	if ((c = sfDiskPending) == NULL)
+		return 0;
+	sfDiskPending = c->queueNext;
+	if (sfDiskPending == NULL)
+		sfDiskPendingTail = NULL;
+	sfDiskLoad (c);
+	return 1;
+}
+
+/*
+ * sfDiskRun
+ *
+ * The I/O thread.
+ */
+static void *sfDiskRun (void *arg) {
+	S32 busy = 0;
+
+	(void) arg;
+	for (;;) {
+		if (!busy) {
+			while (sem_wait (&sfDiskWake) != 0)
+				;
+		}
+		pthread_mutex_lock (&sfDiskLock);
+		busy = sfDiskStep ();
+		pthread_mutex_unlock (&sfDiskLock);
+	}
+	return NULL;
+}
+
+/*
+ * sfDiskResident
+ *
+ * Whether chunk k of 's' holds part of its head or loop.  The loop gets
+ * the frames around it the interpolators read as well.
+ */
+static S32 sfDiskResident (const sfDiskSampleT * s, U32 k) {
+	U32 first = k * SF_DISK_CHUNK, last = first + SF_DISK_CHUNK - 1;
+
+	if (first < s->headFrames)
+		return 1;
+	return s->loopStart < s->loopEnd && first <= s->loopEnd + 3 && last + 3 >= s->loopStart;
+}
+
+/*
+ * sfDiskAdd
+ */
+S32 sfDiskAdd (sfDiskFontT * fontP) {
+	size_t page = sfDiskPage (), size = 0;
+	uint64 residentBytes = 0;
+	sfDiskSampleT *s;
+	sfDiskChunkT *c;
+	pthread_t thread;
+	U32 i, k, nChunks = 0;
+	U8 *pcmP;
+
+	for (i = 0; i < fontP->nSamples; i++) {
+		size += sfDiskRound_ ((size_t) fontP->sampleA[i].frames * sizeof (S16), page);
+		nChunks += (fontP->sampleA[i].frames + SF_DISK_CHUNK - 1) / SF_DISK_CHUNK;
+	}
+	if (size == 0)
+		return FAILED;
+	fontP->chunkA = ARRAY (sfDiskChunkT, nChunks);
+	if (fontP->chunkA == NULL)
+		return FAILED;
+	MEMSET (fontP->chunkA, 0, nChunks * sizeof (sfDiskChunkT));
+
+	/* address space only, until a chunk is read into it */
+	fontP->mapP = mmap (NULL, size, PROT_READ | PROT_WRITE,
+	                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (fontP->mapP == MAP_FAILED) {
+		FREE (fontP->chunkA);
+		return FAILED;
+	}
+	fontP->mapSize = size;
+	pcmP = fontP->mapP;
+	c = fontP->chunkA;
+	for (i = 0; i < fontP->nSamples; i++) {
+		s = &fontP->sampleA[i];
+		s->fontP = fontP;
+		s->pcmP = (S16 *) pcmP;
+		pcmP += sfDiskRound_ ((size_t) s->frames * sizeof (S16), page);
+		s->chunkA = c;
+		s->nChunks = (s->frames + SF_DISK_CHUNK - 1) / SF_DISK_CHUNK;
+		c += s->nChunks;
+	}
+
+	/* the heads and loops, now: the first notes don't wait for the disk */
+	for (i = 0; i < fontP->nSamples; i++) {
+		s = &fontP->sampleA[i];
+		for (k = 0; k < s->nChunks; k++) {
+			c = &s->chunkA[k];
+			c->sampleP = s;
+			if (!sfDiskResident (s, k))
+				continue;
+			if (sfDiskRead (c) != OK)
+				goto errorRecovery;
+			c->resident = 1;
+			c->ready = 1;
+			c->state = SF_DISK_IN;
+			residentBytes += (uint64) sfDiskFrames (c) * sizeof (S16);
+		}
+	}
+
+	pthread_mutex_lock (&sfDiskLock);
+	if (!sfDiskRunning) {
+		if (sem_init (&sfDiskWake, 0, 0) != 0) {
+			pthread_mutex_unlock (&sfDiskLock);
+			goto errorRecovery;
+		}
+		if (pthread_create (&thread, NULL, sfDiskRun, NULL) != 0) {
+			sem_destroy (&sfDiskWake);
+			pthread_mutex_unlock (&sfDiskLock);
+			goto errorRecovery;
+		}
+		pthread_detach (thread);
+		sfDiskRunning = 1;
+	}
+	fontP->next = sfDiskFonts;
+	sfDiskFonts = fontP;
+	sfDiskCount_ (residentBytes, residentBytes);
+	pthread_mutex_unlock (&sfDiskLock);
+
+	return OK;
+
+errorRecovery:
+	munmap (fontP->mapP, fontP->mapSize);
+	FREE (fontP->chunkA);
+	return FAILED;
+}
+
+/*
+ * sfDiskRemove
+ */
+void sfDiskRemove (sfDiskFontT * fontP) {
+	sfDiskChunkT *c, **prevP;
+	sfDiskFontT **fontPP;
+	uint64 residentBytes = 0;
+	U32 i, k;
+
+	pthread_mutex_lock (&sfDiskLock);
+
+	/* nothing of the font may be left on the I/O thread's lists */
+	sfDiskDrain ();
+	sfDiskPendingTail = NULL;
+	for (prevP = &sfDiskPending; (c = *prevP) != NULL;) {
+		if (c->sampleP->fontP == fontP) {
+			*prevP = c->queueNext;
+			continue;
+		}
+		sfDiskPendingTail = c;
+		prevP = &c->queueNext;
+	}
+	for (prevP = &sfDiskCached; (c = *prevP) != NULL;) {
+		if (c->sampleP->fontP == fontP) {
+			*prevP = c->cacheNext;
+			sfDiskCount_ (cachedBytes, -(uint64) sfDiskFrames (c) * sizeof (S16));
+			continue;
+		}
+		prevP = &c->cacheNext;
+	}
+	for (i = 0; i < fontP->nSamples; i++) {
+		for (k = 0; k < fontP->sampleA[i].nChunks; k++) {
+			c = &fontP->sampleA[i].chunkA[k];
+			if (c->resident)
+				residentBytes += (uint64) sfDiskFrames (c) * sizeof (S16);
+		}
+	}
+	sfDiskCount_ (residentBytes, -residentBytes);
+
+	for (fontPP = &sfDiskFonts; *fontPP != NULL; fontPP = &(*fontPP)->next) {
+		if (*fontPP == fontP) {
+			*fontPP = fontP->next;
+			break;
+		}
+	}
+
+	pthread_mutex_unlock (&sfDiskLock);
+
+	munmap (fontP->mapP, fontP->mapSize);
+	FREE (fontP->chunkA);
+	close (fontP->fd);
+}
+
+/*
+ * sfDiskConfig
+ */
+void sfDiskConfig (size_t budget) {
+	__atomic_store_n (&sfDiskBudget, budget, __ATOMIC_RELAXED);
+}
+
+/*
+ * sfDiskStats
+ */
+void sfDiskStats (sfDiskStatsT * statsP) {
+	statsP->reads = __atomic_load_n (&sfDiskCounters.reads, __ATOMIC_RELAXED);
+	statsP->evictions = __atomic_load_n (&sfDiskCounters.evictions, __ATOMIC_RELAXED);
+	statsP->underruns = __atomic_load_n (&sfDiskCounters.underruns, __ATOMIC_RELAXED);
+	statsP->residentBytes = __atomic_load_n (&sfDiskCounters.residentBytes, __ATOMIC_RELAXED);
+	statsP->cachedBytes = __atomic_load_n (&sfDiskCounters.cachedBytes, __ATOMIC_RELAXED);
+	statsP->budgetBytes = __atomic_load_n (&sfDiskBudget, __ATOMIC_RELAXED);
+}
+
+/*
+ * sfDiskRequest
+ *
+ * Queues chunk 'c' for reading, unless it is queued or read already.
+ */
+static void sfDiskRequest (sfDiskChunkT * c) {
+	sfDiskChunkT *head;
+	S32 cold = SF_DISK_COLD;
+
+	if (!__atomic_compare_exchange_n (&c->state, &cold, SF_DISK_QUEUED, 0,
+	                                  __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+		return;
+	head = __atomic_load_n (&sfDiskRequests, __ATOMIC_RELAXED);
+	do
+		c->queueNext = head;
+	while (!__atomic_compare_exchange_n (&sfDiskRequests, &head, c, 0,
+	                                     __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+	sem_post (&sfDiskWake);
+}
+
+/*
+ * sfDiskHold
+ */
+static void sfDiskHold (sfDiskSampleT * s, U32 k) {
+	sfDiskChunkT *c;
+
+	if (k >= s->nChunks)
+		return;
+	c = &s->chunkA[k];
+	__atomic_add_fetch (&c->users, 1, __ATOMIC_SEQ_CST);
+	__atomic_store_n (&c->lastUse, __atomic_add_fetch (&sfDiskTick, 1, __ATOMIC_RELAXED),
+	                  __ATOMIC_RELAXED);
+	if (!__atomic_load_n (&c->ready, __ATOMIC_SEQ_CST))
+		sfDiskRequest (c);
+}
+
+/*
+ * sfDiskRelease
+ */
+void sfDiskRelease (sfDiskSampleT * s, U32 * heldP) {
+	U32 k;
+
+	if (*heldP == SF_DISK_NONE)
+		return;
+	for (k = *heldP; k < *heldP + 2 && k < s->nChunks; k++)
+		__atomic_sub_fetch (&s->chunkA[k].users, 1, __ATOMIC_RELEASE);
+	*heldP = SF_DISK_NONE;
+}
+
+/*
+ * sfDiskReady
+ *
+ * A block reaching past the voice's two chunks (pitched up thousands of
+ * times) reads the next ones without holding them: if they get evicted
+ * under it, it plays silence, the mapping stays.
+ */
+S32 sfDiskReady (sfDiskSampleT * s, U32 * heldP, U32 first, U32 last) {
+	U32 lo = first / SF_DISK_CHUNK, k;
+	sfDiskChunkT *c;
+
+	/* the new chunks are held before the old ones go, so the one the voice
+	 * moves into, held as its next, stays in */
+	if (*heldP != lo) {
+		sfDiskHold (s, lo);
+		sfDiskHold (s, lo + 1);
+		sfDiskRelease (s, heldP);
+		*heldP = lo;
+	}
+	if (last >= s->frames)
+		last = s->frames - 1;
+	for (k = lo; k <= last / SF_DISK_CHUNK; k++) {
+		c = &s->chunkA[k];
+		if (!__atomic_load_n (&c->ready, __ATOMIC_SEQ_CST)) {
+			/* not read yet, or evicted the moment the voice held it */
+			sfDiskRequest (c);
+			sfDiskCount_ (underruns, 1);
+			return FAILED;
+		}
+	}
+	return OK;
+}
@@ -0,0 +1,760 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "fluidbean.h"
+#include "soundfont.h"
+#include "sf_load.h"
+#include "synth.h"
+#include "enums.h"
+
+#define SF_PRESETS 128										/* programs per bank */
+
+/* pdta record sizes, SF 2.01 section 7 */
+#define SF_PHDR_SIZE 38
+#define SF_BAG_SIZE 4
+#define SF_MOD_SIZE 10
+#define SF_GEN_SIZE 4
+#define SF_INST_SIZE 22
+#define SF_SHDR_SIZE 46
+
+/* sfSampleType bits */
+#define SF_SAMPLE_COMPRESSED 0x10
+#define SF_SAMPLE_ROM 0x8000
+
+#define sfLe16_(_p) ((U16) ((_p)[0] | ((_p)[1] << 8)))
+
+static U32 sfLe32 (const U8 * p) {
+	return p[0] | ((U32) p[1] << 8) | ((U32) p[2] << 16) | ((U32) p[3] << 24);
+}
+
+/* the bag, generator and modulator records of the presets or instruments */
+typedef struct {
+	const U8 *bag;
+	const U8 *gen;
+	const U8 *mod;
+	U32 nBags;												/* records, the terminal one included */
+	U32 nGens;
+	U32 nMods;
+} sfZoneListT;
+
+typedef struct {
+	const U8 *phdr;
+	const U8 *inst;
+	const U8 *shdr;
+	U32 nPhdr;												/* records, the terminal one included */
+	U32 nInst;
+	U32 nShdr;
+	sfZoneListT pzones;
+	sfZoneListT izones;
+	const S16 *smpl;
+	U32 smplFrames;
+	U32 smplSize;											/* bytes, for the SF3 samples' offsets */
+
+	/* counted in the first pass... */
+	U32 nZones;
+	U32 nGens;
+	U32 nMods;
+	U32 nStreams;
+	U32 nDisks;
+	/* ...and filled in the second, NULL while counting */
+	Zone *zoneP;
+	Generator *genP;
+	Modulator *modP;
+	Instrument *instA;
+	Sample *sampleA;
+	sfStreamSampleT *streamA;
+	sfStreamSampleT *streamP;
+	sfDiskSampleT *diskA;
+	sfDiskSampleT *diskP;
+
+	S32 streaming;										/* sfLoadStreaming: PCM samples are read from the file */
+	U32 headFrames;
+} sfParserT;
+
+/*
+ * sfChunk
+ *
+ * Finds chunk 'id' among the chunks in [p, end).
+ */
+static const U8 *sfChunk (const U8 * p, const U8 * end, const char *id, U32 * sizeP) {
+	U32 size;
+
+	while (end - p >= 8) {
+		size = sfLe32 (p + 4);
+		if (size > (U32) (end - p - 8))
+			return NULL;
+		if (!MEMCMP (p, id, 4)) {
+			*sizeP = size;
+			return p + 8;
+		}
+		p += 8 + size + (size & 1);
+	}
+	return NULL;
+}
+
+/*
+ * sfList
+ *
+ * Finds the LIST chunk of type 'type' and returns its sub-chunks.
+ */
+static const U8 *sfList (const U8 * p, const U8 * end, const char *type, U32 * sizeP) {
+	const U8 *list;
+	U32 size;
+
+	while ((list = sfChunk (p, end, "LIST", &size)) != NULL) {
+		if (size >= 4 && !MEMCMP (list, type, 4)) {
+			*sizeP = size - 4;
+			return list + 4;
+		}
+		p = list + size + (size & 1);
+	}
+	return NULL;
+}
+
+/*
+ * sfRecords
+ */
+static const U8 *sfRecords (const U8 * p, const U8 * end, const char *id, U32 recSize, U32 * nP) {
+	U32 size;
+
+	p = sfChunk (p, end, id, &size);
+	if (p == NULL || size % recSize != 0 || size < recSize)
+		return NULL;
+	*nP = size / recSize;
+	return p;
+}
+
+/*
+ * sfParseChunks
+ */
+static S32 sfParseChunks (sfParserT * p, const U8 * data, const U8 * end) {
+	const U8 *list, *listEnd, *chunk;
+	U32 size;
+
+	if (end - data < 12 || MEMCMP (data, "RIFF", 4) || MEMCMP (data + 8, "sfbk", 4))
+		return FAILED;
+	size = sfLe32 (data + 4);
+	if (size < (U32) (end - data - 8))
+		end = data + 8 + size;
+
+	/* the PCM is used in place, it has to be S16 aligned */
+	list = sfList (data + 12, end, "sdta", &size);
+	if (list == NULL)
+		return FAILED;
+	chunk = sfChunk (list, list + size, "smpl", &size);
+	if (chunk == NULL || ((uintptr) chunk & 1))
+		return FAILED;
+	p->smpl = (const S16 *) chunk;
+	p->smplFrames = size / 2;
+	p->smplSize = size;
+
+	list = sfList (data + 12, end, "pdta", &size);
+	if (list == NULL)
+		return FAILED;
+	listEnd = list + size;
+	p->phdr = sfRecords (list, listEnd, "phdr", SF_PHDR_SIZE, &p->nPhdr);
+	p->pzones.bag = sfRecords (list, listEnd, "pbag", SF_BAG_SIZE, &p->pzones.nBags);
+	p->pzones.mod = sfRecords (list, listEnd, "pmod", SF_MOD_SIZE, &p->pzones.nMods);
+	p->pzones.gen = sfRecords (list, listEnd, "pgen", SF_GEN_SIZE, &p->pzones.nGens);
+	p->inst = sfRecords (list, listEnd, "inst", SF_INST_SIZE, &p->nInst);
+	p->izones.bag = sfRecords (list, listEnd, "ibag", SF_BAG_SIZE, &p->izones.nBags);
+	p->izones.mod = sfRecords (list, listEnd, "imod", SF_MOD_SIZE, &p->izones.nMods);
+	p->izones.gen = sfRecords (list, listEnd, "igen", SF_GEN_SIZE, &p->izones.nGens);
+	p->shdr = sfRecords (list, listEnd, "shdr", SF_SHDR_SIZE, &p->nShdr);
+	if (p->phdr == NULL || p->pzones.bag == NULL || p->pzones.mod == NULL
+			|| p->pzones.gen == NULL || p->inst == NULL || p->izones.bag == NULL
+			|| p->izones.mod == NULL || p->izones.gen == NULL || p->shdr == NULL)
+		return FAILED;
+
+	return OK;
+}
+
+/*
+ * sfBagRange
+ *
+ * The generator and modulator records of bag 'b', which isn't the terminal one.
+ */
+static void sfBagRange (const sfZoneListT * l, U32 b, U32 * g0, U32 * g1, U32 * m0, U32 * m1) {
+	const U8 *bag = l->bag + b * SF_BAG_SIZE;
+
+	*g0 = sfLe16_ (bag);
+	*m0 = sfLe16_ (bag + 2);
+	*g1 = sfLe16_ (bag + SF_BAG_SIZE);
+	*m1 = sfLe16_ (bag + SF_BAG_SIZE + 2);
+	if (*g1 > l->nGens - 1)
+		*g1 = l->nGens - 1;
+	if (*g0 > *g1)
+		*g0 = *g1;
+	if (*m1 > l->nMods - 1)
+		*m1 = l->nMods - 1;
+	if (*m0 > *m1)
+		*m0 = *m1;
+}
+
+/*
+ * sfZoneTerminal
+ *
+ * The amount of the zone's instrument / sample generator, -1 if it has none.
+ */
+static S32 sfZoneTerminal (const sfZoneListT * l, U32 b, U16 terminal) {
+	U32 g, g0, g1, m0, m1;
+	const U8 *r;
+
+	sfBagRange (l, b, &g0, &g1, &m0, &m1);
+	for (g = g0; g < g1; g++) {
+		r = l->gen + g * SF_GEN_SIZE;
+		if (sfLe16_ (r) == terminal)
+			return sfLe16_ (r + 2);
+	}
+	return -1;
+}
+
+/*
+ * sfModDest
+ *
+ * The generator a modulator record modulates, -1 if it's one this synth
+ * can't use: linked to another modulator or with an undefined source type.
+ */
+static S32 sfModDest (const U8 * r) {
+	U16 dest = sfLe16_ (r + 2);
+
+	if (dest >= GEN_PITCH || (sfLe16_ (r) >> 10) > 3 || (sfLe16_ (r + 6) >> 10) > 3)
+		return -1;
+	return dest;
+}
+
+/*
+ * sfModXform
+ *
+ * sfModSrcOper's type, polarity, direction and CC flag as a xformType.
+ */
+static U8 sfModXform (U16 src) {
+	return ((src >> 10) << 2) | ((src & 0x200) ? MOD_BIPOLAR : MOD_UNIPOLAR)
+		| ((src & 0x100) ? MOD_NEGATIVE : MOD_POSITIVE) | ((src & 0x80) ? MOD_CC : MOD_GC);
+}
+
+/*
+ * sfZoneBuild
+ *
+ * Counts the generators and modulators of bag 'b' (zoneP NULL), or builds
+ * the zone from it.  Generators after the terminal one are ignored.
+ */
+static void sfZoneBuild (sfParserT * p, const sfZoneListT * l, U32 b, U16 terminal,
+                         S32 dense, Zone * zoneP) {
+	U8 set[GEN_LAST], nDestMods[GEN_LAST];
+	S16 amount[GEN_LAST];
+	Generator *byType[GEN_LAST];
+	Generator *genP;
+	Modulator *modP;
+	U32 g, g0, g1, m, m0, m1;
+	S32 i, dest, nGens = 0, nMods = 0;
+	U16 oper, src;
+	const U8 *r;
+
+	sfBagRange (l, b, &g0, &g1, &m0, &m1);
+	MEMSET (set, 0, sizeof (set));
+	MEMSET (nDestMods, 0, sizeof (nDestMods));
+	if (zoneP != NULL) {
+		MEMSET (zoneP, 0, sizeof (Zone));
+		zoneP->keyhi = 127;
+		zoneP->velhi = 127;
+	}
+
+	for (g = g0; g < g1; g++) {
+		r = l->gen + g * SF_GEN_SIZE;
+		oper = sfLe16_ (r);
+		if (oper == terminal)
+			break;
+		if (oper == GEN_KEYRANGE || oper == GEN_VELRANGE) {
+			if (zoneP == NULL)
+				continue;
+			if (oper == GEN_KEYRANGE) {
+				zoneP->keylo = r[2];
+				zoneP->keyhi = r[3];
+			} else {
+				zoneP->vello = r[2];
+				zoneP->velhi = r[3];
+			}
+			continue;
+		}
+		if (oper >= GEN_PITCH || oper == GEN_INSTRUMENT || oper == GEN_SAMPLEID)
+			continue;
+		set[oper] = 1;
+		amount[oper] = (S16) sfLe16_ (r + 2);
+	}
+
+	for (m = m0; m < m1; m++) {
+		dest = sfModDest (l->mod + m * SF_MOD_SIZE);
+		if (dest >= 0 && nDestMods[dest] < 255) {
+			nDestMods[dest]++;
+			nMods++;
+		}
+	}
+
+	for (i = 0; i < GEN_LAST; i++) {
+		if (dense || set[i] || nDestMods[i])
+			nGens++;
+	}
+	if (zoneP == NULL) {
+		p->nGens += nGens;
+		p->nMods += nMods;
+		return;
+	}
+
+	/* generators by type, each followed by its modulators' slots */
+	zoneP->nGens = nGens;
+	zoneP->genA = p->genP;
+	zoneP->loopType = set[GEN_SAMPLEMODE] ? amount[GEN_SAMPLEMODE] & 3 : 0;
+	for (i = 0; i < GEN_LAST; i++) {
+		if (!(dense || set[i] || nDestMods[i]))
+			continue;
+		genP = p->genP++;
+		MEMSET (genP, 0, sizeof (Generator));
+		genP->genType = i;
+		genP->flags = set[i] ? GEN_SET : GEN_UNUSED;
+		genP->val = set[i] ? (U32) (S32) amount[i] : 0;
+		genP->modA = p->modP;
+		p->modP += nDestMods[i];
+		byType[i] = genP;
+	}
+
+	for (m = m0; m < m1; m++) {
+		r = l->mod + m * SF_MOD_SIZE;
+		dest = sfModDest (r);
+		if (dest < 0 || byType[dest]->nMods == nDestMods[dest])
+			continue;
+		modP = &byType[dest]->modA[byType[dest]->nMods++];
+		MEMSET (modP, 0, sizeof (Modulator));
+		src = sfLe16_ (r);
+		modP->src1 = src & 0x7f;
+		modP->xformType1 = sfModXform (src);
+		src = sfLe16_ (r + 6);
+		modP->src2 = src & 0x7f;
+		modP->xformType2 = sfModXform (src);
+		modP->dest = dest;
+		modP->amount = (U32) (S32) (S16) sfLe16_ (r + 4);
+	}
+}
+
+/*
+ * sfZones
+ *
+ * Counts or builds the zones of one preset or instrument, bags [first,
+ * last) of 'l'.  The first zone is the global one if it has no terminal
+ * generator; other zones without one are ignored (SF 2.01 section 7.3).
+ */
+static void sfZones (sfParserT * p, const sfZoneListT * l, U32 first, U32 last,
+                     U16 terminal, Instrument * instP) {
+	S32 term, global, nLocal = 0;
+	Zone *zoneP;
+	U32 b;
+
+	if (last > l->nBags - 1)
+		last = l->nBags - 1;
+
+	for (b = first; b < last && nLocal < 255; b++) {
+		term = sfZoneTerminal (l, b, terminal);
+		global = (term < 0);
+		if (global && b != first)
+			continue;
+		if (!global)
+			nLocal++;
+
+		/* the synth indexes preset zones and global zones by generator type */
+		if (p->zoneP == NULL) {
+			p->nZones++;
+			sfZoneBuild (p, l, b, terminal, global || terminal == GEN_INSTRUMENT, NULL);
+			continue;
+		}
+		zoneP = p->zoneP++;
+		sfZoneBuild (p, l, b, terminal, global || terminal == GEN_INSTRUMENT, zoneP);
+
+		if (global) {
+			instP->globalZoneP = zoneP;
+			continue;
+		}
+		if (instP->zoneA == NULL)
+			instP->zoneA = zoneP;
+		instP->nZones++;
+		if (terminal == GEN_INSTRUMENT)
+			zoneP->u.instP = (U32) term < p->nInst - 1 ? &p->instA[term] : NULL;
+		else if ((U32) term < p->nShdr - 1
+						 && (p->sampleA[term].pcmDataP != NULL || p->sampleA[term].streamP != NULL
+								 || p->sampleA[term].diskP != NULL))
+			zoneP->u.sampleP = &p->sampleA[term];
+	}
+}
+
+/*
+ * sfSampleOgg
+ *
+ * A SF3 sample: start and end are the byte range of its Ogg Vorbis stream
+ * in smpl, the loop points are relative to its decoded frames.  It gets
+ * its pcmDataP from sfStreamAdd.
+ */
+static void sfSampleOgg (sfParserT * p, const U8 * r, Sample * sampleP) {
+	U32 start = sfLe32 (r + 20);
+	U32 end = sfLe32 (r + 24);
+	sfStreamSampleT *s;
+	U32 frames;
+
+	if (start >= end || end > p->smplSize)
+		return;
+	frames = sfStreamLength ((const U8 *) p->smpl + start, end - start);
+	if (frames == 0)
+		return;
+
+	s = p->streamP++;
+	MEMSET (s, 0, sizeof (sfStreamSampleT));
+	s->oggP = (const U8 *) p->smpl + start;
+	s->oggSize = end - start;
+	s->frames = frames;
+	s->rate = sfLe32 (r + 36);
+	sampleP->startIdx = 0;
+	sampleP->endIdx = frames - 1;
+	sampleP->streamP = s;
+}
+
+/*
+ * sfSampleDisk
+ *
+ * A PCM sample read from the file as it's played: its frames are
+ * [start, end) of smpl.  Indices are relative to start, the loop is
+ * clamped into the sample.  It gets its pcmDataP from sfDiskAdd.
+ */
+static void sfSampleDisk (sfParserT * p, const U8 * r, U32 start, U32 end, Sample * sampleP) {
+	U32 loopStart = sfLe32 (r + 28);
+	U32 loopEnd = sfLe32 (r + 32);
+	sfDiskSampleT *s;
+
+	loopStart = loopStart < start ? start : loopStart > end ? end : loopStart;
+	loopEnd = loopEnd < loopStart ? loopStart : loopEnd > end ? end : loopEnd;
+
+	s = p->diskP++;
+	MEMSET (s, 0, sizeof (sfDiskSampleT));
+	s->fileStart = start;
+	s->frames = end - start;
+	s->headFrames = p->headFrames < s->frames ? p->headFrames : s->frames;
+	s->loopStart = loopStart - start;
+	s->loopEnd = loopEnd - start;
+	sampleP->startIdx = 0;
+	sampleP->endIdx = s->frames - 1;
+	sampleP->diskP = s;
+}
+
+/*
+ * sfSample
+ */
+static void sfSample (sfParserT * p, U32 i, Sample * sampleP) {
+	const U8 *r = p->shdr + i * SF_SHDR_SIZE;
+	U32 start = sfLe32 (r + 20);
+	U32 end = sfLe32 (r + 24);
+	U16 type = sfLe16_ (r + 44);
+
+	MEMSET (sampleP, 0, sizeof (Sample));
+	if (type & SF_SAMPLE_ROM)
+		return;
+	if (type & SF_SAMPLE_COMPRESSED)
+		sfSampleOgg (p, r, sampleP);
+	else if (start < end && end <= p->smplFrames && p->streaming)
+		sfSampleDisk (p, r, start, end, sampleP);
+	else if (start < end && end <= p->smplFrames) {
+		sampleP->startIdx = start;
+		sampleP->endIdx = end - 1;			/* the last sample frame */
+		sampleP->pcmDataP = (S16 *) p->smpl;
+	}
+	if (sampleP->pcmDataP == NULL && sampleP->streamP == NULL && sampleP->diskP == NULL)
+		return;
+
+	sampleP->origPitch = r[40] <= 127 ? r[40] : 60;
+	sampleP->origPitchAdj = (signed char) r[41];
+	if (sampleP->diskP != NULL) {
+		sampleP->loopStartIdx = sampleP->diskP->loopStart;
+		sampleP->loopEndIdx = sampleP->diskP->loopEnd;
+		return;
+	}
+	sampleP->loopStartIdx = sfLe32 (r + 28);
+	sampleP->loopEndIdx = sfLe32 (r + 32);
+}
+
+/*
+ * sfPresets
+ *
+ * Counts the preset zones, or builds the presets into 'presetA' (see
+ * sfBuild).  A (bank, program) the file has twice keeps the first.
+ */
+static void sfPresets (sfParserT * p, U8 * bankUsed, Preset ** presetA) {
+	U32 taken[DRUM_INST_BANK + 1][SF_PRESETS / 32];
+	const U8 *r;
+	U32 i, bank, prog;
+
+	MEMSET (taken, 0, sizeof (taken));
+	for (i = 0; i < p->nPhdr - 1; i++) {
+		r = p->phdr + i * SF_PHDR_SIZE;
+		prog = sfLe16_ (r + 20);
+		bank = sfLe16_ (r + 22);
+		if (bank > DRUM_INST_BANK || prog >= SF_PRESETS || (taken[bank][prog / 32] & (1u << (prog % 32))))
+			continue;
+		taken[bank][prog / 32] |= 1u << (prog % 32);
+		bankUsed[bank] = 1;
+		sfZones (p, &p->pzones, sfLe16_ (r + 24), sfLe16_ (r + SF_PHDR_SIZE + 24), GEN_INSTRUMENT,
+		         presetA != NULL ? &presetA[bank][prog] : NULL);
+	}
+}
+
+/*
+ * sfBuild
+ *
+ * Sizes the arena, then fills it.  Banks the file doesn't use share one
+ * array of empty presets.
+ */
+static sfFileT *sfBuild (sfParserT * p) {
+	U8 bankUsed[DRUM_INST_BANK + 1];
+	Preset *presetA[DRUM_INST_BANK + 1];
+	Preset *nextPresetsP;
+	sfFileT *fileP;
+	Bank *bankA;
+	U8 *arenaP;
+	U32 i, nBanksUsed = 0;
+	size_t size;
+
+	/* first pass: count */
+	MEMSET (bankUsed, 0, sizeof (bankUsed));
+	sfPresets (p, bankUsed, NULL);
+	for (i = 0; i < p->nInst - 1; i++)
+		sfZones (p, &p->izones, sfLe16_ (p->inst + i * SF_INST_SIZE + 20),
+		         sfLe16_ (p->inst + (i + 1) * SF_INST_SIZE + 20), GEN_SAMPLEID, NULL);
+	for (i = 0; i <= DRUM_INST_BANK; i++)
+		nBanksUsed += bankUsed[i];
+	for (i = 0; i < p->nShdr - 1; i++) {
+		switch (sfLe16_ (p->shdr + i * SF_SHDR_SIZE + 44) & (SF_SAMPLE_COMPRESSED | SF_SAMPLE_ROM)) {
+		case SF_SAMPLE_COMPRESSED:
+			p->nStreams++;
+			break;
+		case 0:
+			p->nDisks += p->streaming;
+			break;
+		}
+	}
+
+	/* Largest alignment first: everything but the Modulators holds pointers. */
+	size = sizeof (sfFileT)
+		+ (DRUM_INST_BANK + 1) * sizeof (Bank)
+		+ (nBanksUsed + 1) * SF_PRESETS * sizeof (Preset)
+		+ (p->nInst - 1) * sizeof (Instrument)
+		+ p->nZones * sizeof (Zone)
+		+ p->nGens * sizeof (Generator)
+		+ (p->nShdr - 1) * sizeof (Sample)
+		+ p->nStreams * sizeof (sfStreamSampleT)
+		+ p->nDisks * sizeof (sfDiskSampleT)
+		+ p->nMods * sizeof (Modulator);
+	arenaP = MALLOC (size);
+	if (arenaP == NULL)
+		return NULL;
+	MEMSET (arenaP, 0, size);
+
+	fileP = (sfFileT *) arenaP;
+	arenaP += sizeof (sfFileT);
+	bankA = (Bank *) arenaP;
+	arenaP += (DRUM_INST_BANK + 1) * sizeof (Bank);
+	nextPresetsP = (Preset *) arenaP;
+	arenaP += (nBanksUsed + 1) * SF_PRESETS * sizeof (Preset);
+	p->instA = (Instrument *) arenaP;
+	arenaP += (p->nInst - 1) * sizeof (Instrument);
+	p->zoneP = (Zone *) arenaP;
+	arenaP += p->nZones * sizeof (Zone);
+	p->genP = (Generator *) arenaP;
+	arenaP += p->nGens * sizeof (Generator);
+	p->sampleA = (Sample *) arenaP;
+	arenaP += (p->nShdr - 1) * sizeof (Sample);
+	p->streamA = p->streamP = (sfStreamSampleT *) arenaP;
+	arenaP += p->nStreams * sizeof (sfStreamSampleT);
+	p->diskA = p->diskP = (sfDiskSampleT *) arenaP;
+	arenaP += p->nDisks * sizeof (sfDiskSampleT);
+	p->modP = (Modulator *) arenaP;
+
+	fileP->sf.nBanks = DRUM_INST_BANK + 1;
+	fileP->sf.bankA = bankA;
+	for (i = 0; i <= DRUM_INST_BANK; i++) {
+		bankA[i].nPresets = SF_PRESETS;
+		bankA[i].presetA = nextPresetsP;
+		if (bankUsed[i])
+			nextPresetsP += SF_PRESETS;
+		presetA[i] = bankA[i].presetA;
+	}
+	/* nextPresetsP is the empty array now */
+	for (i = 0; i <= DRUM_INST_BANK; i++) {
+		if (!bankUsed[i])
+			bankA[i].presetA = presetA[i] = nextPresetsP;
+	}
+
+	/* second pass: fill, the samples first, zones point at them */
+	for (i = 0; i < p->nShdr - 1; i++)
+		sfSample (p, i, &p->sampleA[i]);
+	for (i = 0; i < p->nInst - 1; i++)
+		sfZones (p, &p->izones, sfLe16_ (p->inst + i * SF_INST_SIZE + 20),
+		         sfLe16_ (p->inst + (i + 1) * SF_INST_SIZE + 20), GEN_SAMPLEID, &p->instA[i]);
+	sfPresets (p, bankUsed, presetA);
+
+	return fileP;
+}
+
+/*
+ * sfOpen
+ *
+ * sfLoadMap, and for sfLoadStreaming with 'fd' the file's descriptor.
+ * The font takes fd over if it streams any sample.
+ */
+static Soundfont *sfOpen (void *mapP, size_t mapSize, int fd, U32 headFrames) {
+	sfParserT parser;
+	sfFileT *fileP;
+	U32 i;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	/* the little endian PCM is played in place */
+	return NULL;
+#endif
+
+	MEMSET (&parser, 0, sizeof (parser));
+	parser.streaming = (fd >= 0);
+	parser.headFrames = headFrames;
+	if (sfParseChunks (&parser, mapP, (const U8 *) mapP + mapSize) != OK)
+		return NULL;
+	fileP = sfBuild (&parser);
+	if (fileP == NULL)
+		return NULL;
+	fileP->mapP = mapP;
+	fileP->mapSize = mapSize;
+
+	/* SF3: the samples are decoded into the stream's mapping */
+	fileP->stream.sampleA = parser.streamA;
+	fileP->stream.nSamples = parser.streamP - parser.streamA;
+	if (fileP->stream.nSamples > 0 && sfStreamAdd (&fileP->stream) != OK)
+		goto errorRecovery;
+
+	/* streamed PCM: read into the disk font's mapping */
+	fileP->disk.sampleA = parser.diskA;
+	fileP->disk.nSamples = parser.diskP - parser.diskA;
+	if (fileP->disk.nSamples > 0) {
+		fileP->disk.fd = fd;
+		fileP->disk.smplOffset = (const U8 *) parser.smpl - (const U8 *) mapP;
+		if (sfDiskAdd (&fileP->disk) != OK) {
+			if (fileP->stream.nSamples > 0)
+				sfStreamRemove (&fileP->stream);
+			goto errorRecovery;
+		}
+	}
+
+	for (i = 0; i < parser.nShdr - 1; i++) {
+		if (parser.sampleA[i].streamP != NULL)
+			parser.sampleA[i].pcmDataP = parser.sampleA[i].streamP->pcmP;
+		else if (parser.sampleA[i].diskP != NULL)
+			parser.sampleA[i].pcmDataP = parser.sampleA[i].diskP->pcmP;
+	}
+
+	return &fileP->sf;
+
+errorRecovery:
+	FREE (fileP);
+	return NULL;
+}
+
+/*
+ * sfLoadMap
+ */
+Soundfont *sfLoadMap (void *mapP, size_t mapSize) {
+	return sfOpen (mapP, mapSize, -1, 0);
+}
+
+/*
+ * sfMapFile
+ *
+ * Opens and maps 'path'.  Returns the descriptor, -1 if that fails.
+ */
+static int sfMapFile (const char *path, void **mapPP, size_t * sizeP) {
+	struct stat st;
+	int fd;
+
+	fd = open (path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	*mapPP = MAP_FAILED;
+	if (fstat (fd, &st) == 0 && st.st_size >= 12 && (uint64) st.st_size < ((uint64) 1 << 32) + 8)
+		*mapPP = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (*mapPP == MAP_FAILED) {
+		close (fd);
+		return -1;
+	}
+	*sizeP = st.st_size;
+	return fd;
+}
+
+/*
+ * sfLoad
+ */
+Soundfont *sfLoad (const char *path) {
+	Soundfont *sfP;
+	size_t mapSize;
+	void *mapP;
+	int fd;
+
+	fd = sfMapFile (path, &mapP, &mapSize);
+	if (fd < 0)
+		return NULL;
+	close (fd);
+
+	sfP = sfLoadMap (mapP, mapSize);
+	if (sfP == NULL)
+		munmap (mapP, mapSize);
+	return sfP;
+}
+
+/*
+ * sfLoadStreaming
+ */
+Soundfont *sfLoadStreaming (const char *path, U32 headFrames) {
+	Soundfont *sfP;
+	size_t mapSize;
+	void *mapP;
+	int fd;
+
+	fd = sfMapFile (path, &mapP, &mapSize);
+	if (fd < 0)
+		return NULL;
+
+	sfP = sfOpen (mapP, mapSize, fd, headFrames);
+	if (sfP == NULL) {
+		munmap (mapP, mapSize);
+		close (fd);
+	} else if (((sfFileT *) sfP)->disk.nSamples == 0)
+		close (fd);										/* nothing to stream: all SF3 */
+	return sfP;
+}
+
+/*
+ * sfDecodeAll
+ */
+S32 sfDecodeAll (Soundfont * sfP, S32 nThreads) {
+	sfFileT *fileP = (sfFileT *) sfP;
+
+	if (fileP->stream.nSamples == 0)
+		return OK;
+	return sfStreamDecodeAll (&fileP->stream, nThreads);
+}
+
+/*
+ * sfUnload
+ */
+void sfUnload (Soundfont * sfP) {
+	sfFileT *fileP = (sfFileT *) sfP;
+
+	if (sfP == NULL)
+		return;
+	if (fileP->stream.nSamples > 0)
+		sfStreamRemove (&fileP->stream);
+	if (fileP->disk.nSamples > 0)
+		sfDiskRemove (&fileP->disk);
+	munmap (fileP->mapP, fileP->mapSize);
+	FREE (fileP);
+}
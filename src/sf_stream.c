@@ -0,0 +1,573 @@
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "fluidbean.h"
+#include "sf_stream.h"
+#define STB_VORBIS_HEADER_ONLY						/* synth.c has the decoder */
+#include "stbVorbis.c"
+
+enum sfStreamState {
+	SF_STREAM_COLD,										/* at most the head is decoded */
+	SF_STREAM_QUEUED,									/* on the request stack or pending */
+	SF_STREAM_CACHED									/* decoded whole */
+};
+
+#define SF_STREAM_SCRATCH 4096						/* frames decoded at a time when skipping */
+
+static pthread_mutex_t sfStreamLock = PTHREAD_MUTEX_INITIALIZER;
+static sem_t sfStreamWake;
+static S32 sfStreamRunning;							/* the lock's */
+static sfStreamFontT *sfStreamFonts;				/* the lock's */
+static sfStreamSampleT *sfStreamRequests;		/* atomic: pushed by sfStreamPin */
+static sfStreamSampleT *sfStreamPending;		/* the lock's: the requests in order */
+static sfStreamSampleT *sfStreamPendingTail;
+static sfStreamSampleT *sfStreamCached;		/* the lock's: the evictable samples */
+static size_t sfStreamBudget = SF_STREAM_BUDGET;	/* atomic */
+static U32 sfStreamPrerollMs = SF_STREAM_PREROLL_MS;	/* atomic */
+static uint64 sfStreamTick;								/* atomic */
+static sfStreamStatsT sfStreamCounters;		/* atomic fields, but budgetBytes */
+
+#define sfStreamCount_(_field, _n) \
+	__atomic_add_fetch (&sfStreamCounters._field, (_n), __ATOMIC_RELAXED)
+
+/*
+ * sfStreamPage
+ */
+static size_t sfStreamPage (void) {
+	long page = sysconf (_SC_PAGESIZE);
+
+	return page > 0 ? (size_t) page : 4096;
+}
+
+#define sfStreamRound_(_n, _page) (((_n) + (_page) - 1) & ~((_page) - 1))
+
+/*
+ * sfStreamHeadFrames
+ *
+ * The frames the head of 's' has with the current preroll time.
+ */
+static U32 sfStreamHeadFrames (const sfStreamSampleT * s) {
+	uint64 frames = (uint64) s->rate * __atomic_load_n (&sfStreamPrerollMs, __ATOMIC_RELAXED) / 1000;
+
+	return frames < s->frames ? (U32) frames : s->frames;
+}
+
+/*
+ * sfStreamCost
+ *
+ * The bytes 's' takes when it's cached, past the pages its head keeps.
+ */
+static size_t sfStreamCost (const sfStreamSampleT * s) {
+	size_t page = sfStreamPage ();
+	size_t keep = sfStreamRound_ ((size_t) s->head * sizeof (S16), page);
+	size_t size = sfStreamRound_ ((size_t) s->frames * sizeof (S16), page);
+
+	return size > keep ? size - keep : 0;
+}
+
+/*
+ * sfStreamLength
+ */
+U32 sfStreamLength (const U8 * oggP, U32 size) {
+	uint64 granule;
+	U32 i, j;
+
+	if (size < 27 || MEMCMP (oggP, "OggS", 4))
+		return 0;
+	/* the granule position of the last page is the stream's length; a page
+	 * no packet ends on has none (-1) */
+	for (i = size - 27 + 1; i-- > 0;) {
+		if (oggP[i] != 'O' || MEMCMP (oggP + i, "OggS", 4) || oggP[i + 4] != 0)
+			continue;
+		for (granule = 0, j = 8; j-- > 0;)
+			granule = (granule << 8) | oggP[i + 6 + j];
+		if (granule == ~(uint64) 0)
+			continue;
+		return granule < ((uint64) 1 << 31) ? (U32) granule : 0;
+	}
+	return 0;
+}
+
+/*
+ * sfStreamDecode
+ *
+ * Decodes frames [from, to) of 's' into its slice.  The frames before
+ * 'from' are decoded again, but not written: voices may be playing them.
+ * What doesn't decode stays silent.
+ */
+static S32 sfStreamDecode (sfStreamSampleT * s, U32 from, U32 to) {
+	short scratch[SF_STREAM_SCRATCH];
+	stbVorbis *vorbisP;
+	U32 pos = 0;
+	int err, n;
+
+	vorbisP = stbVorbisOpenMemory (s->oggP, s->oggSize, &err, NULL);
+	if (vorbisP == NULL)
+		return FAILED;
+	while (pos < to) {
+		if (pos < from)
+			n = stbVorbisGetSamplesShortInterleaved (vorbisP, 1, scratch,
+			                                         from - pos < SF_STREAM_SCRATCH ? from - pos : SF_STREAM_SCRATCH);
+		else
+			n = stbVorbisGetSamplesShortInterleaved (vorbisP, 1, (short *) s->pcmP + pos, to - pos);
+		if (n <= 0)
+			break;
+		pos += n;
+	}
+	stbVorbisClose (vorbisP);
+
+	return pos < to ? FAILED : OK;
+}
+
+/*
+ * sfStreamEvict
+ *
+ * Gives the pages of 's' back, but for its head.  Fails if a voice pins
+ * it, or starts to while this runs: the pin increments users before it
+ * reads ready, this lowers ready before it reads users, so one of the
+ * two sees the other.
+ */
+static S32 sfStreamEvict (sfStreamSampleT * s) {
+	size_t page = sfStreamPage ();
+	size_t keep = sfStreamRound_ ((size_t) s->head * sizeof (S16), page);
+
+	if (__atomic_load_n (&s->users, __ATOMIC_RELAXED) > 0)
+		return FAILED;
+	__atomic_store_n (&s->ready, s->head, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n (&s->users, __ATOMIC_SEQ_CST) > 0) {
+		__atomic_store_n (&s->ready, s->frames, __ATOMIC_SEQ_CST);
+		return FAILED;
+	}
+	madvise ((U8 *) s->pcmP + keep, sfStreamCost (s), MADV_DONTNEED);
+	__atomic_store_n (&s->state, SF_STREAM_COLD, __ATOMIC_SEQ_CST);
+
+	return OK;
+}
+
+/*
+ * sfStreamMakeRoom
+ *
+ * Evicts the least recently pinned samples until 'cost' more bytes fit
+ * the budget, or only pinned samples are left.
+ */
+static void sfStreamMakeRoom (size_t cost) {
+	sfStreamSampleT *s, **prevP, **victimP;
+	uint64 oldest;
+
+	while (__atomic_load_n (&sfStreamCounters.cachedBytes, __ATOMIC_RELAXED) + cost
+				 > __atomic_load_n (&sfStreamBudget, __ATOMIC_RELAXED)) {
+		victimP = NULL;
+		oldest = ~(uint64) 0;
+		for (prevP = &sfStreamCached; (s = *prevP) != NULL; prevP = &s->cacheNext) {
+			if (__atomic_load_n (&s->users, __ATOMIC_RELAXED) == 0
+					&& __atomic_load_n (&s->lastUse, __ATOMIC_RELAXED) < oldest) {
+				oldest = __atomic_load_n (&s->lastUse, __ATOMIC_RELAXED);
+				victimP = prevP;
+			}
+		}
+		if (victimP == NULL)
+			return;
+		s = *victimP;
+		if (sfStreamEvict (s) != OK)
+			continue;
+		*victimP = s->cacheNext;
+		sfStreamCount_ (cachedBytes, -(uint64) sfStreamCost (s));
+		sfStreamCount_ (evictions, 1);
+	}
+}
+
+/*
+ * sfStreamWhole
+ *
+ * Decodes the rest of a requested sample.
+ */
+static void sfStreamWhole (sfStreamSampleT * s) {
+	U32 head;
+
+	/* sfStreamDecodeAll got to it first */
+	if (__atomic_load_n (&s->ready, __ATOMIC_RELAXED) == s->frames)
+		return;
+
+	/* the head is part of it, and kept from now on */
+	head = sfStreamHeadFrames (s);
+	if (s->head < head) {
+		sfStreamCount_ (headBytes, (uint64) (head - s->head) * sizeof (S16));
+		s->head = head;
+	}
+	sfStreamMakeRoom (sfStreamCost (s));
+	sfStreamDecode (s, __atomic_load_n (&s->ready, __ATOMIC_RELAXED), s->frames);
+
+	__atomic_store_n (&s->ready, s->frames, __ATOMIC_SEQ_CST);
+	__atomic_store_n (&s->state, SF_STREAM_CACHED, __ATOMIC_SEQ_CST);
+	if (sfStreamCost (s) > 0) {
+		s->cacheNext = sfStreamCached;
+		sfStreamCached = s;
+		sfStreamCount_ (cachedBytes, sfStreamCost (s));
+	}
+}
+
+/*
+ * sfStreamHead
+ */
+static void sfStreamHead (sfStreamSampleT * s) {
+	U32 head = sfStreamHeadFrames (s);
+
+	/* no preroll, or sfStreamWhole has seen to it */
+	if (s->head >= head || __atomic_load_n (&s->state, __ATOMIC_SEQ_CST) != SF_STREAM_COLD)
+		return;
+	sfStreamDecode (s, s->head, head);
+	sfStreamCount_ (headBytes, (uint64) (head - s->head) * sizeof (S16));
+	s->head = head;
+	__atomic_store_n (&s->ready, head, __ATOMIC_SEQ_CST);
+}
+
+/*
+ * sfStreamDrain
+ *
+ * Moves the requests pushed since the last call to the pending list.
+ */
+static void sfStreamDrain (void) {
+	sfStreamSampleT *s, *next, *first = NULL;
+
+	/* the stack has the newest first */
+	s = __atomic_exchange_n (&sfStreamRequests, NULL, __ATOMIC_ACQUIRE);
+	for (; s != NULL; s = next) {
+		next = s->queueNext;
+		s->queueNext = first;
+		first = s;
+	}
+	if (first == NULL)
+		return;
+	if (sfStreamPendingTail != NULL)
+		sfStreamPendingTail->queueNext = first;
+	else
+		sfStreamPending = first;
+	for (s = first; s->queueNext != NULL; s = s->queueNext)
+		;
+	sfStreamPendingTail = s;
+}
+
+/*
+ * sfStreamStep
+ *
+ * One piece of work: a requested sample if there is one, else a head.
+ * Returns 0 if there was nothing to do.
+ */
+static S32 sfStreamStep (void) {
+	sfStreamFontT *fontP;
+	sfStreamSampleT *s;
+
+	sfStreamDrain ();
+	if ((s = sfStreamPending) != NULL) {
+		sfStreamPending = s->queueNext;
+		if (sfStreamPending == NULL)
+			sfStreamPendingTail = NULL;
+		sfStreamWhole (s);
+		return 1;
+	}
+	for (fontP = sfStreamFonts; fontP != NULL; fontP = fontP->next) {
+		if (fontP->prerolled < fontP->nSamples) {
+			sfStreamHead (&fontP->sampleA[fontP->prerolled++]);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/*
+ * sfStreamRun
+ *
+ * The decoder thread.
+ */
+static void *sfStreamRun (void *arg) {
+	S32 busy = 0;
+
+	(void) arg;
+	for (;;) {
+		if (!busy) {
+			while (sem_wait (&sfStreamWake) != 0)
+				;
+		}
+		pthread_mutex_lock (&sfStreamLock);
+		busy = sfStreamStep ();
+		pthread_mutex_unlock (&sfStreamLock);
+	}
+	return NULL;
+}
+
+/*
+ * sfStreamAdd
+ */
+S32 sfStreamAdd (sfStreamFontT * fontP) {
+	size_t page = sfStreamPage (), size = 0;
+	pthread_t thread;
+	U8 *pcmP;
+	U32 i;
+
+	for (i = 0; i < fontP->nSamples; i++)
+		size += sfStreamRound_ ((size_t) fontP->sampleA[i].frames * sizeof (S16), page);
+	if (size == 0)
+		return FAILED;
+
+	/* address space only, until the decoder writes to it */
+	fontP->mapP = mmap (NULL, size, PROT_READ | PROT_WRITE,
+	                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (fontP->mapP == MAP_FAILED)
+		return FAILED;
+	fontP->mapSize = size;
+	pcmP = fontP->mapP;
+	for (i = 0; i < fontP->nSamples; i++) {
+		fontP->sampleA[i].fontP = fontP;
+		fontP->sampleA[i].pcmP = (S16 *) pcmP;
+		pcmP += sfStreamRound_ ((size_t) fontP->sampleA[i].frames * sizeof (S16), page);
+	}
+	fontP->prerolled = 0;
+
+	pthread_mutex_lock (&sfStreamLock);
+	if (!sfStreamRunning) {
+		if (sem_init (&sfStreamWake, 0, 0) != 0)
+			goto errorRecovery;
+		if (pthread_create (&thread, NULL, sfStreamRun, NULL) != 0) {
+			sem_destroy (&sfStreamWake);
+			goto errorRecovery;
+		}
+		pthread_detach (thread);
+		sfStreamRunning = 1;
+	}
+	fontP->next = sfStreamFonts;
+	sfStreamFonts = fontP;
+	pthread_mutex_unlock (&sfStreamLock);
+
+	sem_post (&sfStreamWake);
+	return OK;
+
+errorRecovery:
+	pthread_mutex_unlock (&sfStreamLock);
+	munmap (fontP->mapP, fontP->mapSize);
+	return FAILED;
+}
+
+/*
+ * sfStreamRemove
+ */
+void sfStreamRemove (sfStreamFontT * fontP) {
+	sfStreamSampleT *s, **prevP;
+	sfStreamFontT **fontPP;
+	uint64 headBytes = 0;
+	U32 i;
+
+	pthread_mutex_lock (&sfStreamLock);
+
+	/* nothing of the font may be left on the decoder's lists */
+	sfStreamDrain ();
+	sfStreamPendingTail = NULL;
+	for (prevP = &sfStreamPending; (s = *prevP) != NULL;) {
+		if (s->fontP == fontP) {
+			*prevP = s->queueNext;
+			continue;
+		}
+		sfStreamPendingTail = s;
+		prevP = &s->queueNext;
+	}
+	for (prevP = &sfStreamCached; (s = *prevP) != NULL;) {
+		if (s->fontP == fontP) {
+			*prevP = s->cacheNext;
+			sfStreamCount_ (cachedBytes, -(uint64) sfStreamCost (s));
+			continue;
+		}
+		prevP = &s->cacheNext;
+	}
+	for (i = 0; i < fontP->nSamples; i++)
+		headBytes += (uint64) fontP->sampleA[i].head * sizeof (S16);
+	sfStreamCount_ (headBytes, -headBytes);
+
+	for (fontPP = &sfStreamFonts; *fontPP != NULL; fontPP = &(*fontPP)->next) {
+		if (*fontPP == fontP) {
+			*fontPP = fontP->next;
+			break;
+		}
+	}
+
+	pthread_mutex_unlock (&sfStreamLock);
+
+	munmap (fontP->mapP, fontP->mapSize);
+}
+
+/* sfStreamDecodeAll's work list */
+typedef struct {
+	sfStreamSampleT **sampleA;				/* largest first */
+	U32 nSamples;
+	U32 next;													/* atomic */
+	S32 status;												/* atomic */
+} sfStreamBatchT;
+
+/*
+ * sfStreamBatchCompare
+ */
+static int sfStreamBatchCompare (const void *a, const void *b) {
+	U32 sizeA = (*(sfStreamSampleT * const *) a)->oggSize;
+	U32 sizeB = (*(sfStreamSampleT * const *) b)->oggSize;
+
+	return sizeA < sizeB ? 1 : sizeA > sizeB ? -1 : 0;
+}
+
+/*
+ * sfStreamBatchWorker
+ */
+static void *sfStreamBatchWorker (void *data) {
+	sfStreamBatchT *batch = (sfStreamBatchT *) data;
+	sfStreamSampleT *s;
+	U32 i;
+
+	while ((i = __atomic_fetch_add (&batch->next, 1, __ATOMIC_RELAXED)) < batch->nSamples) {
+		s = batch->sampleA[i];
+		if (sfStreamDecode (s, __atomic_load_n (&s->ready, __ATOMIC_RELAXED), s->frames) != OK)
+			__atomic_store_n (&batch->status, FAILED, __ATOMIC_RELAXED);
+	}
+	return NULL;
+}
+
+/*
+ * sfStreamDecodeAll
+ */
+S32 sfStreamDecodeAll (sfStreamFontT * fontP, S32 nThreads) {
+	sfStreamBatchT batch = { NULL, 0, 0, OK };
+	sfStreamSampleT *s, **prevP;
+	pthread_t *thread;
+	S32 nStarted = 0;
+	U32 i;
+
+	if (nThreads < 1)
+		nThreads = (S32) sysconf (_SC_NPROCESSORS_ONLN);
+	if (nThreads < 1)
+		nThreads = 1;
+	batch.sampleA = ARRAY (sfStreamSampleT *, fontP->nSamples);
+	thread = ARRAY (pthread_t, nThreads);
+	if (batch.sampleA == NULL || thread == NULL) {
+		FREE (batch.sampleA);
+		FREE (thread);
+		return FAILED;
+	}
+
+	/* the decoder thread stays out of the way until the font is done */
+	pthread_mutex_lock (&sfStreamLock);
+
+	/* cached samples are resident already, they just leave the cache */
+	for (prevP = &sfStreamCached; (s = *prevP) != NULL;) {
+		if (s->fontP == fontP) {
+			*prevP = s->cacheNext;
+			sfStreamCount_ (cachedBytes, -(uint64) sfStreamCost (s));
+			continue;
+		}
+		prevP = &s->cacheNext;
+	}
+	for (i = 0; i < fontP->nSamples; i++) {
+		s = &fontP->sampleA[i];
+		if (__atomic_load_n (&s->ready, __ATOMIC_SEQ_CST) < s->frames)
+			batch.sampleA[batch.nSamples++] = s;
+	}
+	/* the longest decodes go first, so no thread is left with one at the end */
+	qsort (batch.sampleA, batch.nSamples, sizeof (sfStreamSampleT *), sfStreamBatchCompare);
+
+	if (nThreads > (S32) batch.nSamples)
+		nThreads = batch.nSamples;
+	for (; nStarted < nThreads - 1; nStarted++) {
+		if (pthread_create (&thread[nStarted], NULL, sfStreamBatchWorker, &batch) != 0)
+			break;
+	}
+	sfStreamBatchWorker (&batch);
+	for (i = 0; i < (U32) nStarted; i++)
+		pthread_join (thread[i], NULL);
+
+	/* all of it is the head now: never evicted, never prerolled */
+	for (i = 0; i < fontP->nSamples; i++) {
+		s = &fontP->sampleA[i];
+		sfStreamCount_ (headBytes, (uint64) (s->frames - s->head) * sizeof (S16));
+		s->head = s->frames;
+		__atomic_store_n (&s->ready, s->frames, __ATOMIC_SEQ_CST);
+		__atomic_store_n (&s->state, SF_STREAM_CACHED, __ATOMIC_SEQ_CST);
+	}
+	fontP->prerolled = fontP->nSamples;
+
+	pthread_mutex_unlock (&sfStreamLock);
+
+	FREE (batch.sampleA);
+	FREE (thread);
+	return batch.status;
+}
+
+/*
+ * sfStreamConfig
+ */
+void sfStreamConfig (size_t budget, U32 prerollMs) {
+	__atomic_store_n (&sfStreamBudget, budget, __ATOMIC_RELAXED);
+	__atomic_store_n (&sfStreamPrerollMs, prerollMs, __ATOMIC_RELAXED);
+}
+
+/*
+ * sfStreamStats
+ */
+void sfStreamStats (sfStreamStatsT * statsP) {
+	statsP->hits = __atomic_load_n (&sfStreamCounters.hits, __ATOMIC_RELAXED);
+	statsP->misses = __atomic_load_n (&sfStreamCounters.misses, __ATOMIC_RELAXED);
+	statsP->evictions = __atomic_load_n (&sfStreamCounters.evictions, __ATOMIC_RELAXED);
+	statsP->stalls = __atomic_load_n (&sfStreamCounters.stalls, __ATOMIC_RELAXED);
+	statsP->cachedBytes = __atomic_load_n (&sfStreamCounters.cachedBytes, __ATOMIC_RELAXED);
+	statsP->budgetBytes = __atomic_load_n (&sfStreamBudget, __ATOMIC_RELAXED);
+	statsP->headBytes = __atomic_load_n (&sfStreamCounters.headBytes, __ATOMIC_RELAXED);
+}
+
+/*
+ * sfStreamRequest
+ *
+ * Queues 's' for decoding, unless it is queued or decoded already.
+ */
+static void sfStreamRequest (sfStreamSampleT * s) {
+	sfStreamSampleT *head;
+	S32 cold = SF_STREAM_COLD;
+
+	if (!__atomic_compare_exchange_n (&s->state, &cold, SF_STREAM_QUEUED, 0,
+	                                  __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+		return;
+	head = __atomic_load_n (&sfStreamRequests, __ATOMIC_RELAXED);
+	do
+		s->queueNext = head;
+	while (!__atomic_compare_exchange_n (&sfStreamRequests, &head, s, 0,
+	                                     __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+	sem_post (&sfStreamWake);
+}
+
+/*
+ * sfStreamPin
+ */
+void sfStreamPin (sfStreamSampleT * s) {
+	__atomic_add_fetch (&s->users, 1, __ATOMIC_SEQ_CST);
+	__atomic_store_n (&s->lastUse, __atomic_add_fetch (&sfStreamTick, 1, __ATOMIC_RELAXED),
+	                  __ATOMIC_RELAXED);
+	if (__atomic_load_n (&s->ready, __ATOMIC_SEQ_CST) == s->frames) {
+		sfStreamCount_ (hits, 1);
+		return;
+	}
+	sfStreamCount_ (misses, 1);
+	sfStreamRequest (s);
+}
+
+/*
+ * sfStreamUnpin
+ */
+void sfStreamUnpin (sfStreamSampleT * s) {
+	__atomic_sub_fetch (&s->users, 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * sfStreamReady
+ */
+S32 sfStreamReady (sfStreamSampleT * s, U32 lastIdx) {
+	if (lastIdx < __atomic_load_n (&s->ready, __ATOMIC_ACQUIRE))
+		return OK;
+	/* evicted the moment the voice pinned it: ask again */
+	sfStreamRequest (s);
+	sfStreamCount_ (stalls, 1);
+	return FAILED;
+}
@@ -546,6 +546,7 @@ enum STBVorbisError
    #include <string.h>
    #include <assert.h>
    #include <math.h>
+   #include <pthread.h>
 #else // STB_VORBIS_NO_CRT
    #define NULL 0
    #define malloc(s)   0
@@ -937,7 +938,8 @@ static void setupTempFree(vorb *f, void *p, int sz)
 #define CRC32_POLY    0x04c11db7   // from spec
 
 static uint32 crcTable[256];
-static void crc32_init(void)
+static pthread_once_t crcTableOnce = PTHREAD_ONCE_INIT;
+static void crc32_build(void)
 {
    int i,j;
    uint32 s;
@@ -948,6 +950,12 @@ static void crc32_init(void)
    }
 }
 
+// decoders may be opened on several threads at once (see sf_stream.c)
+static void crc32_init(void)
+{
+   pthread_once(&crcTableOnce, crc32_build);
+}
+
 STB_FORCEINLINE uint32 crc32_update(uint32 crc, uint8 byte)
 {
    return (crc << 8) ^ crcTable[byte ^ (crc >> 24)];
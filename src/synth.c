@@ -10,10 +10,11 @@
 #include "midi.h"
 #include "mod.h"
 #include "gen.h"
+#include "preset_index.h"
 
 
 int synthProgramSelect2 (Synthesizer * synth, int chan, char *sfontName, U32 bankNum, U32 presetNum);
-int synthSetGen2 (Synthesizer * synth, int chan, int genId, float value, int absolute, int normalized);
+int synthSetGen2 (Synthesizer * synth, int chan, int genId, U32 value, int absolute, int normalized);
 void synthSetReverb (Synthesizer * synth, double roomsize, double damping, double width, double level);
 int synthBankSelect (Synthesizer * synth, int chan, U32 bank);
 int deleteSynth (Synthesizer * synth);
@@ -25,9 +26,34 @@ int synthTuneNotes (Synthesizer * synth, int bank, int prog, int len, int *key,
 int synthActivateOctaveTuning (Synthesizer * synth, int bank, int prog, const char *name, const double *pitch, int apply);
 int synthActivateTuning (Synthesizer * synth, int chan, int bank, int prog, int apply);
 int synthWriteS16 (Synthesizer * synth, int len, void *lout, int loff, int lincr, void *rout, int roff, int rincr);
-int presetNoteon (Preset *presetP, Synthesizer * synth, int chan, int key, int vel);
+int presetNoteon (PresetIndex *indexP, Synthesizer * synth, int chan, int key, int vel);
+static PresetIndex *synthChannelPresetIndex (Synthesizer * synth, Channel * channel);
+static int synthNoteoffLocal (Synthesizer * synth, int chan, int key);
+static int synthKeyPressureLocal (Synthesizer * synth, int chan, int key, int val);
+static int synthChannelPressureLocal (Synthesizer * synth, int chan, int val);
+static int synthPitchBendLocal (Synthesizer * synth, int chan, int val);
+static int synthProgramChangeLocal (Synthesizer * synth, int chan, int prognum);
+static void deleteCmdQueue (synthCmdQueueT * queue);
+static synthSysexT *synthCmdQueueSlot (synthCmdQueueT * queue);
+static int synthCmdQueuePushSlot (synthCmdQueueT * queue, U8 type, U8 chan, U8 p2);
+static int synthSetGenLocal (Synthesizer * synth, int chan, int genId, S16 value);
+static int synthSetGen2Local (Synthesizer * synth, int chan, int genId, S16 value, int absolute);
+static int synthSetChannelFxBusLocal (Synthesizer * synth, int chan, int bus);
+static int synthProgramSelectLocal (Synthesizer * synth, int chan, U32 sfontId, U32 bankNum, U32 presetNum);
+static int synthCreateKeyTuningLocal (Synthesizer * synth, int bank, int prog, const char *name, double *pitch);
+static int synthCreateOctaveTuningLocal (Synthesizer * synth, int bank, int prog, const char *name, const double *pitch);
+static int synthTuneNotesLocal (Synthesizer * synth, int bank, int prog, int len, U8 * key, double *pitch);
+static int synthSelectTuningLocal (Synthesizer * synth, int chan, int bank, int prog);
+static int synthResetTuningLocal (Synthesizer * synth, int chan);
+static void synthSwapSoundfont (Synthesizer * synth);
+static void synthSetChannelPresets (Synthesizer * synth);
+static void deleteFontSwap (synthFontSwapT * swapP);
+static void synthCollectFontSwaps (Synthesizer * synth);
 static tuningT *synthCreateTuning (Synthesizer * synth, int bank, int prog, const char *name);
 
+/* the commands whose p1 is a payload slot */
+#define synthCmdHasSlot_(_type) ((_type) == MIDI_SYSEX || ((_type) >= SYNTH_CMD_SET_GEN && (_type) < NOTE_OFF))
+
 /* GLOBAL */
 /* has the synth module been initialized? */
 static int synthInitialized = 0;
@@ -206,21 +232,27 @@ static revmodelPresetsT revmodelPreset[] = {
 
 /*************** INITIALIZATION & UTILITIES */
 struct _SynthSettings synthSettings = {
-  0,  // flags
-  "", // midi port name (limited to 100 characters)
-  {256, 16, 4096},        // polyphony
-  {16, 16, 256},          // # midi channels
-  {1, 1, 1},              // gain
-  {1, 1, 256},            // # audio channels
-  {1, 1, 256},            // # audio groups
-  {2, 2, 2},              // # effects channels
-  {44100, 22050, 96000},  // sample rate
-  {10, 0, 65535}          // min note length
+  .flags                 = 0,
+  .midiPortName          = "",                   // limited to 100 characters
+  .synthPolyphony        = {256, 16, 4096},
+  .synthNMidiChannels    = {16, 16, 256},
+  .synthGain             = {1, 1, 1},
+  .synthNAudioChannels   = {1, 1, 256},
+  .synthNAudioGroups     = {1, 1, 256},
+  .synthNEffectsChannels = {2, 2, 2},
+  .synthSampleRate       = {44100, 22050, 96000},
+  .synthMinNoteLen       = {10, 0, 65535},       // ms
+  .synthRenderThreads    = {0, 0, 64},
+  .synthNFxBuses         = {1, 1, 16},
+  .synthCullDb           = {-96, -144, -20},     // dBFS
+  .synthVoiceBudget      = {0, 0, 4096}          // 0: no limit
 };
 
 #define DITHER_SIZE 48000
 #define DITHER_CHANNELS 2
 
+#define VOICE_POOL_ALIGN 64    /* a cache line */
+
 static S16 randTable[DITHER_CHANNELS][DITHER_SIZE];
 
 void initDither (void) {
@@ -246,8 +278,7 @@ void initDither (void) {
  */
 static void synthInit () {
 	synthInitialized++;
-	conversionConfig();
-	//dspFloatConfig();
+	dspFloatConfig();
 	//sysConfig();
 	initDither();
 }
@@ -268,6 +299,7 @@ Synthesizer *newSynth () {
 	if (synth == NULL) 
 		return NULL;
 	MEMSET (synth, 0, sizeof (Synthesizer));
+	sfCacheRegisterReader (&synth->sfReader);
 
 	synth->settingsP            = &synthSettings;
 	synth->withReverb           = synthSettings.flags & REVERB_IS_ACTIVE;
@@ -291,6 +323,12 @@ Synthesizer *newSynth () {
   clipSetting_(synth->audioChannels,   synthSettings.synthNAudioChannels);
   clipSetting_(synth->audioGroups,     synthSettings.synthNAudioGroups);
   clipSetting_(synth->effectsChannels, synthSettings.synthNEffectsChannels);
+  clipSetting_(synthSettings.synthNFxBuses.val, synthSettings.synthNFxBuses);
+	synth->nFxBuses = synthSettings.synthNFxBuses.val;
+  clipSetting_(synthSettings.synthCullDb.val, synthSettings.synthCullDb);
+  clipSetting_(synthSettings.synthVoiceBudget.val, synthSettings.synthVoiceBudget);
+	synth->cullAmp = (realT) pow (10.0, synthSettings.synthCullDb.val / 20.0);
+	synth->voiceBudget = synthSettings.synthVoiceBudget.val;
 
 	/* The number of buffers is determined by the higher number of nr
 	 * groups / nr audio channels.  If LADSPA is unused, they should be
@@ -322,17 +360,46 @@ Synthesizer *newSynth () {
 		}
 	}
 
-	/* allocate all synthesis processes */
+	/* allocate all synthesis processes in one block; generators and
+	 * modulators go to their own pools, see voice.h */
 	synth->nvoice = synth->polyphony;
 	synth->voice = ARRAY (Voice *, synth->nvoice);
-	if (synth->voice == NULL) {
+	synth->activeVoice = ARRAY (Voice *, synth->nvoice);
+	synth->voicePoolMem = MALLOC (synth->nvoice * sizeof (Voice) + VOICE_POOL_ALIGN);
+	synth->genPool = ARRAY (Generator, synth->nvoice * GEN_LAST);
+	synth->modPool = ARRAY (Modulator, synth->nvoice * NUM_MOD);
+	synth->modIndexPool = ARRAY (voiceModIndexT, synth->nvoice);
+	synth->budgetScratch = ARRAY (Voice *, synth->nvoice);
+	synth->filterTab = MALLOC (FILTER_TAB_ROWS * sizeof (*synth->filterTab));
+	if (synth->voice == NULL || synth->activeVoice == NULL || synth->voicePoolMem == NULL
+			|| synth->genPool == NULL || synth->modPool == NULL || synth->modIndexPool == NULL
+			|| synth->budgetScratch == NULL || synth->filterTab == NULL) {
 		goto errorRecovery;
 	}
+	voiceFilterTabFill (synth->filterTab, synth->sampleRate, &synth->filterTabMaxCents);
+	synth->voicePool = (Voice *) (((uintptr) synth->voicePoolMem + VOICE_POOL_ALIGN - 1)
+	                              & ~(uintptr) (VOICE_POOL_ALIGN - 1));
+	synth->nActiveVoices = 0;
+	synth->voiceMgr = newVoiceMgr (synth->nvoice, synth->midiChannels);
+	if (synth->voiceMgr == NULL)
+		goto errorRecovery;
 	for (i = 0; i < synth->nvoice; i++) {
-		synth->voice[i] = newVoice (synth->sampleRate);
-		if (synth->voice[i] == NULL) {
+		synth->voice[i] = &synth->voicePool[i];
+		voiceConstruct (synth->voice[i], &synth->genPool[i * GEN_LAST],
+		                &synth->modPool[i * NUM_MOD], &synth->modIndexPool[i], synth->sampleRate);
+		synth->voice[i]->mgr = synth->voiceMgr;
+	}
+	/* voice[0] comes off the free list first */
+	for (i = synth->nvoice - 1; i >= 0; i--)
+		voiceMgrFree (synth->voiceMgr, synth->voice[i]);
+
+	/* threaded voice rendering, if asked for */
+	clipSetting_(synthSettings.synthRenderThreads.val, synthSettings.synthRenderThreads);
+	if (synthSettings.synthRenderThreads.val > 0) {
+		synth->renderPool = newRenderPool (synthSettings.synthRenderThreads.val,
+		                                   synth->nbuf, synth->nFxBuses, synth->nvoice);
+		if (synth->renderPool == NULL)
 			goto errorRecovery;
-		}
 	}
 
 	/* Allocate the sample buffers */
@@ -343,19 +410,19 @@ Synthesizer *newSynth () {
 
 	/* Left and right audio buffers */
 
-	synth->leftBuf = ARRAY (S16*, synth->nbuf);
-	synth->rightBuf = ARRAY (S16*, synth->nbuf);
+	synth->leftBuf = ARRAY (busT*, synth->nbuf);
+	synth->rightBuf = ARRAY (busT*, synth->nbuf);
 
 	if ((synth->leftBuf == NULL) || (synth->rightBuf == NULL)) 
 		goto errorRecovery;
 
-	MEMSET (synth->leftBuf, 0, synth->nbuf * sizeof (S16*));
-	MEMSET (synth->rightBuf, 0, synth->nbuf * sizeof (S16*));
+	MEMSET (synth->leftBuf, 0, synth->nbuf * sizeof (busT*));
+	MEMSET (synth->rightBuf, 0, synth->nbuf * sizeof (busT*));
 
 	for (i = 0; i < synth->nbuf; i++) {
 
-		synth->leftBuf[i] = ARRAY (S16, BUFSIZE);
-		synth->rightBuf[i] = ARRAY (S16, BUFSIZE);
+		synth->leftBuf[i] = ARRAY (busT, BUFSIZE);
+		synth->rightBuf[i] = ARRAY (busT, BUFSIZE);
 
 		if ((synth->leftBuf[i] == NULL) || (synth->rightBuf[i] == NULL)) 
 			goto errorRecovery;
@@ -363,18 +430,18 @@ Synthesizer *newSynth () {
 
 	/* Effects audio buffers */
 
-	synth->fxLeftBuf = ARRAY (S16 *, synth->effectsChannels);
-	synth->fxRightBuf = ARRAY (S16 *, synth->effectsChannels);
+	synth->fxLeftBuf = ARRAY (busT *, synth->effectsChannels);
+	synth->fxRightBuf = ARRAY (busT *, synth->effectsChannels);
 
 	if ((synth->fxLeftBuf == NULL) || (synth->fxRightBuf == NULL)) 
 		goto errorRecovery;
 
-	MEMSET (synth->fxLeftBuf, 0, 2 * sizeof (S16 *));
-	MEMSET (synth->fxRightBuf, 0, 2 * sizeof (S16 *));
+	MEMSET (synth->fxLeftBuf, 0, 2 * sizeof (busT *));
+	MEMSET (synth->fxRightBuf, 0, 2 * sizeof (busT *));
 
 	for (i = 0; i < synth->effectsChannels; i++) {
-		synth->fxLeftBuf[i] = ARRAY (S16, BUFSIZE);
-		synth->fxRightBuf[i] = ARRAY (S16, BUFSIZE);
+		synth->fxLeftBuf[i] = ARRAY (busT, BUFSIZE);
+		synth->fxRightBuf[i] = ARRAY (busT, BUFSIZE);
 
 		if ((synth->fxLeftBuf[i] == NULL) || (synth->fxRightBuf[i] == NULL)) 
 			goto errorRecovery;
@@ -384,10 +451,33 @@ Synthesizer *newSynth () {
 	synth->cur = BUFSIZE;
 	synth->ditherIndex = 0;
 
-	/* allocate the reverb module */
-	synth->reverb = newRevmodel ();
-	if (synth->reverb == NULL) 
+	synth->blockFrame = 0;
+	synth->eventQueue = ARRAY (synthEventT, SYNTH_EVENT_QUEUE_SIZE);
+	if (synth->eventQueue == NULL)
 		goto errorRecovery;
+	synthClearEvents (synth);
+	if (synthNewCmdQueue (synth) == NULL)
+		goto errorRecovery;
+
+	/* allocate the effect buses: reverb and chorus modules and their sends */
+	synth->fxBus = ARRAY (synthFxBusT, synth->nFxBuses);
+	if (synth->fxBus == NULL) 
+		goto errorRecovery;
+	MEMSET (synth->fxBus, 0, synth->nFxBuses * sizeof (synthFxBusT));
+
+	for (i = 0; i < synth->nFxBuses; i++) {
+		synthFxBusT *bus = &synth->fxBus[i];
+
+		bus->reverb = newRevmodel (synth->sampleRate);
+		bus->chorus = newChorus (synth->sampleRate);
+		bus->reverbBuf = ARRAY (busT, BUFSIZE);
+		bus->chorusBuf = ARRAY (busT, BUFSIZE);
+		if (bus->reverb == NULL || bus->chorus == NULL
+				|| bus->reverbBuf == NULL || bus->chorusBuf == NULL) 
+			goto errorRecovery;
+		MEMSET (bus->reverbBuf, 0, BUFSIZE * sizeof (busT));
+		MEMSET (bus->chorusBuf, 0, BUFSIZE * sizeof (busT));
+	}
 
 	synthSetReverb (synth,
 													REVERB_DEFAULT_ROOMSIZE,
@@ -395,11 +485,6 @@ Synthesizer *newSynth () {
 													REVERB_DEFAULT_WIDTH,
 													REVERB_DEFAULT_LEVEL);
 
-	/* allocate the chorus module */
-	synth->chorus = newChorus (synth->sampleRate);
-	if (synth->chorus == NULL) 
-		goto errorRecovery;
-
 	if (synthSettings.flags & DRUM_CHANNEL_IS_ACTIVE)
 		synthBankSelect (synth, 9, DRUM_INST_BANK);
 
@@ -420,13 +505,55 @@ errorRecovery:
  */
 void synthSetSampleRate (Synthesizer * synth, float sampleRate) {
 	int i;
-	for (i = 0; i < synth->nvoice; i++) {
-		deleteVoice (synth->voice[i]);
-		synth->voice[i] = newVoice (synth->sampleRate);
+	synthFxBusT *bus;
+	revmodelT *reverb;
+	Chorus *chorus;
+
+	/* let go of the samples the voices hold before they are rebuilt */
+	for (i = 0; i < synth->nActiveVoices; i++) {
+		if (_PLAYING (synth->activeVoice[i]) || synth->activeVoice[i]->sampleP != NULL)
+			voiceOff (synth->activeVoice[i]);
 	}
 
-	deleteChorus (synth->chorus);
-	synth->chorus = newChorus (synth->sampleRate);
+	synth->sampleRate = sampleRate;
+	voiceFilterTabFill (synth->filterTab, synth->sampleRate, &synth->filterTabMaxCents);
+	voiceMgrReset (synth->voiceMgr);
+	for (i = 0; i < synth->nvoice; i++) {
+		voiceConstruct (synth->voice[i], &synth->genPool[i * GEN_LAST],
+		                &synth->modPool[i * NUM_MOD], &synth->modIndexPool[i], synth->sampleRate);
+		synth->voice[i]->mgr = synth->voiceMgr;
+	}
+	/* voice[0] comes off the free list first, as in newSynth */
+	for (i = synth->nvoice - 1; i >= 0; i--)
+		voiceMgrFree (synth->voiceMgr, synth->voice[i]);
+	synth->nActiveVoices = 0;
+
+	/* the effects are sized for the sample rate; keep their settings */
+	for (i = 0; i < synth->nFxBuses; i++) {
+		bus = &synth->fxBus[i];
+
+		chorus = newChorus (synth->sampleRate);
+		if (chorus != NULL) {
+			chorusSetNr (chorus, chorusGetNr (bus->chorus));
+			chorusSetLevel (chorus, chorusGetLevel (bus->chorus));
+			chorusSetSpeed_Hz (chorus, chorusGetSpeed_Hz (bus->chorus));
+			chorusSetDepthMs (chorus, chorusGetDepthMs (bus->chorus));
+			chorusSetType (chorus, chorusGetType (bus->chorus));
+			chorusUpdate (chorus);
+			deleteChorus (bus->chorus);
+			bus->chorus = chorus;
+		}
+
+		reverb = newRevmodel (synth->sampleRate);
+		if (reverb != NULL) {
+			revmodelSetroomsize (reverb, revmodelGetroomsize (bus->reverb));
+			revmodelSetdamp (reverb, revmodelGetdamp (bus->reverb));
+			revmodelSetwidth (reverb, revmodelGetwidth (bus->reverb));
+			revmodelSetlevel (reverb, revmodelGetlevel (bus->reverb));
+			deleteRevmodel (bus->reverb);
+			bus->reverb = reverb;
+		}
+	}
 }
 
 /*
@@ -435,6 +562,7 @@ void synthSetSampleRate (Synthesizer * synth, float sampleRate) {
 int deleteSynth (Synthesizer * synth) {
 	int i, k;
 	bankOffsetT *bankOffset;
+	synthFontSwapT *swapP;
 
 	if (synth == NULL) {
 		return OK;
@@ -443,9 +571,9 @@ int deleteSynth (Synthesizer * synth) {
 	synth->state = SYNTH_STOPPED;
 
 	/* turn off all voices, needed to unload SoundFont data */
-	if (synth->voice != NULL) {
+	if (synth->voice != NULL && synth->voicePoolMem != NULL) {
 		for (i = 0; i < synth->nvoice; i++) {
-			if (synth->voice[i] && _PLAYING(synth->voice[i]))
+			if (_PLAYING(synth->voice[i]))
 				voiceOff (synth->voice[i]);
 		}
 	}
@@ -459,14 +587,61 @@ int deleteSynth (Synthesizer * synth) {
 		FREE (synth->channel);
 	}
 
+	if (synth->renderPool != NULL) {
+		deleteRenderPool (synth->renderPool);
+	}
+
+	deleteVoiceMgr (synth->voiceMgr);
+
+	if (synth->eventQueue != NULL) {
+		FREE (synth->eventQueue);
+	}
+
+	for (i = 0; i < synth->nCmdQueues; i++) {
+		if (synth->cmdQueue[i] != NULL)
+			deleteCmdQueue (synth->cmdQueue[i]);
+	}
+
+	presetIndexClear (synth->presetIndex);
+
+	/* the voices are off, drop every cached font this synth holds */
+	sfCacheUnregisterReader (&synth->sfReader);
+	swapP = __atomic_exchange_n (&synth->nextFontSwapP, NULL, __ATOMIC_ACQ_REL);
+	if (swapP != NULL) {
+		sfCacheRelease (swapP->sfP);
+		deleteFontSwap (swapP);
+	}
+	synthCollectFontSwaps (synth);
+	for (i = 0; i < synth->nRetiredSoundfonts; i++)
+		sfCacheRelease (synth->retiredSoundfontP[i]);
+	if (synth->soundfontCached)
+		sfCacheRelease (synth->soundfontP);
+	sfCacheCollect ();
+
 	if (synth->voice != NULL) {
-		for (i = 0; i < synth->nvoice; i++) {
-			if (synth->voice[i] != NULL) {
-				deleteVoice (synth->voice[i]);
-			}
-		}
 		FREE (synth->voice);
 	}
+	if (synth->activeVoice != NULL) {
+		FREE (synth->activeVoice);
+	}
+	if (synth->voicePoolMem != NULL) {
+		FREE (synth->voicePoolMem);
+	}
+	if (synth->genPool != NULL) {
+		FREE (synth->genPool);
+	}
+	if (synth->modPool != NULL) {
+		FREE (synth->modPool);
+	}
+	if (synth->modIndexPool != NULL) {
+		FREE (synth->modIndexPool);
+	}
+	if (synth->budgetScratch != NULL) {
+		FREE (synth->budgetScratch);
+	}
+	if (synth->filterTab != NULL) {
+		FREE (synth->filterTab);
+	}
 
 	/* free all the sample buffers */
 	if (synth->leftBuf != NULL) {
@@ -505,14 +680,19 @@ int deleteSynth (Synthesizer * synth) {
 		FREE (synth->fxRightBuf);
 	}
 
-	/* release the reverb module */
-	if (synth->reverb != NULL) {
-		deleteRevmodel (synth->reverb);
-	}
-
-	/* release the chorus module */
-	if (synth->chorus != NULL) {
-		deleteChorus (synth->chorus);
+	/* release the effect buses */
+	if (synth->fxBus != NULL) {
+		for (i = 0; i < synth->nFxBuses; i++) {
+			deleteRevmodel (synth->fxBus[i].reverb);
+			deleteChorus (synth->fxBus[i].chorus);
+			if (synth->fxBus[i].reverbBuf != NULL) {
+				FREE (synth->fxBus[i].reverbBuf);
+			}
+			if (synth->fxBus[i].chorusBuf != NULL) {
+				FREE (synth->fxBus[i].chorusBuf);
+			}
+		}
+		FREE (synth->fxBus);
 	}
 
 	/* free the tunings, if any */
@@ -553,9 +733,9 @@ char *synthError (Synthesizer * synth) {
 }
 
 /*
- * synthNoteon
+ * synthNoteonLocal
  */
-int synthNoteon (Synthesizer * synth, U8 chan, U8 key, U8 vel) {
+static int synthNoteonLocal (Synthesizer * synth, U8 chan, U8 key, U8 vel) {
 	Channel *channel;
 
 	/* check the ranges of the arguments */
@@ -565,13 +745,13 @@ int synthNoteon (Synthesizer * synth, U8 chan, U8 key, U8 vel) {
 
 	/* notes with velocity zero go to noteoff  */
 	if (vel == 0) {
-		return synthNoteoff (synth, chan, key);
+		return synthNoteoffLocal (synth, chan, key);
 	}
 
 	channel = synth->channel[chan];
 
 	/* make sure this channel has a preset */
-	if (channel->presetP == NULL) {
+	if (synthChannelPresetIndex (synth, channel) == NULL) {
 		return FAILED;
 	}
 
@@ -579,19 +759,25 @@ int synthNoteon (Synthesizer * synth, U8 chan, U8 key, U8 vel) {
 	   advance it to the release phase. */
 	synthReleaseVoiceOnSameNote (synth, chan, key);
 
-	return presetNoteon(channel->presetP, 0, chan, key, vel);
+	/* all voices of this note-on share its id */
+	synth->storeid = synth->noteid++;
+
+	return presetNoteon(channel->presetIndexP, synth, chan, key, vel);
 }
 
 /*
- * synthNoteoff
+ * synthNoteoffLocal
  */
-int synthNoteoff (Synthesizer * synth, int chan, int key) {
-	int i;
+static int synthNoteoffLocal (Synthesizer * synth, int chan, int key) {
 	Voice *voice;
 	int status = FAILED;
 
-	for (i = 0; i < synth->polyphony; i++) {
-		voice = synth->voice[i];
+	if ((chan < 0) || (chan >= synth->midiChannels) || (key < 0) || (key >= 128)) {
+		return FAILED;
+	}
+
+	/* only the voices started on this channel and key */
+	for (voice = voiceMgrKeyVoices (synth->voiceMgr, chan, key); voice != NULL; voice = voice->keyNext) {
 		if (_ON (voice) && (voice->chan == chan) && (voice->key == key)) {
 			voiceNoteoff (voice);
 			status = OK;
@@ -610,8 +796,8 @@ int synthDampVoices (Synthesizer * synth, int chan) {
 /*   mutexLock(synth->busy); /\* Don't interfere with the audio thread *\/ */
 /*   mutexUnlock(synth->busy); */
 
-	for (i = 0; i < synth->polyphony; i++) {
-		voice = synth->voice[i];
+	for (i = 0; i < synth->nActiveVoices; i++) {
+		voice = synth->activeVoice[i];
 		if ((voice->chan == chan) && _SUSTAINED (voice)) {
 /*        printf("turned off sustained note: chan=%d, key=%d, vel=%d\n", voice->chan, voice->key, voice->vel); */
 			voiceNoteoff (voice);
@@ -622,9 +808,9 @@ int synthDampVoices (Synthesizer * synth, int chan) {
 }
 
 /*
- * synthCc
+ * synthCcLocal
  */
-int synthCc (Synthesizer * synth, int chan, int num, int val) {
+static int synthCcLocal (Synthesizer * synth, int chan, int num, int val) {
 /*   mutexLock(synth->busy); /\* Don't interfere with the audio thread *\/ */
 /*   mutexUnlock(synth->busy); */
 
@@ -638,10 +824,13 @@ int synthCc (Synthesizer * synth, int chan, int num, int val) {
 	if ((val < 0) || (val >= 128)) {
 		return FAILED;
 	}
+
+	channelCc (synth->channel[chan], num, val);
+	return OK;
 }
 
 /*
- * synthCc
+ * synthGetCc
  */
 int synthGetCc (Synthesizer * synth, int chan, int num, int *pval) {
 	/* check the ranges of the arguments */
@@ -671,6 +860,11 @@ int synthGetCc (Synthesizer * synth, int chan, int num, int *pval) {
  *   command (useful for checking if a SYSEX message would be handled)
  * @return OK on success, FAILED otherwise
  * @since 1.1.0
+ *
+ * A message that changes the tuning is checked here and queued on
+ * cmdQueue[0] (see synthCmdQueuePushSysex), the renderer applies it at
+ * the next block; FAILED if the ring is full.  Dump requests only fill
+ * in 'response' and are answered here.
  */
 /* SYSEX format (0xF0 and 0xF7 not passed to this function):
  * Non-realtime:    0xF0 0x7E <DeviceId> [BODY] 0xF7
@@ -709,13 +903,21 @@ synthSysex (Synthesizer * synth, const char *data, int len,
 			&& data[2] == MIDI_SYSEX_MIDI_TUNING_ID)
 		//&& (data[1] == synth->deviceId || data[1] == MIDI_SYSEX_DEVICE_ID_ALL) -> we don't handle device id
 	{
-		int result;
-		//synthApiEnter(synth); -> we don't handle mutex
-		result = synthSysexMidiTuning (synth, data, len, response,
-																						responseLen, availResponse,
-																						handled, dryrun);
+		int known = 0;
+
+		if (dryrun || data[3] == MIDI_SYSEX_TUNING_BULK_DUMP_REQ
+				|| data[3] == MIDI_SYSEX_TUNING_BULK_DUMP_REQ_BANK)
+			return synthSysexMidiTuning (synth, data, len, response, responseLen, availResponse,
+			                             handled, dryrun);
 
-		return result;
+		/* a change: checked here, applied by the renderer */
+		synthSysexMidiTuning (synth, data, len, NULL, NULL, 0, &known, 1);
+		if (!known)
+			return OK;
+		if (synthCmdQueuePushSysex (synth->cmdQueue[0], data, len) != OK)
+			return FAILED;
+		if (handled)
+			*handled = 1;							//TRUE
 	}
 	return OK;
 }
@@ -725,10 +927,10 @@ static int
 synthSysexMidiTuning (Synthesizer * synth, const char *data,
 															 int len, char *response, int *responseLen,
 															 int availResponse, int *handled, int dryrun) {
-	int realtime, msgid;
+	int msgid;
 	int bank = 0, prog, channels;
 	double tunedata[128];
-	int keys[128];
+	U8 keys[128];
 	char name[17];
 	int note, frac, frac2;
 	uint8 chksum;
@@ -736,7 +938,6 @@ synthSysexMidiTuning (Synthesizer * synth, const char *data,
 	const char *dataptr;
 	char *resptr;
 
-	realtime = data[0] == MIDI_SYSEX_UNIV_REALTIME;
 	msgid = data[3];
 
 	switch (msgid) {
@@ -858,8 +1059,7 @@ synthSysexMidiTuning (Synthesizer * synth, const char *data,
 		}
 
 		if (index > 0) {
-			if (synthTuneNotes (synth, bank, prog, index, keys, tunedata,
-																	realtime) == FAILED)
+			if (synthTuneNotesLocal (synth, bank, prog, index, keys, tunedata) == FAILED)
 				return FAILED;
 		}
 
@@ -901,15 +1101,13 @@ synthSysexMidiTuning (Synthesizer * synth, const char *data,
 			}
 		}
 
-		if (synthActivateOctaveTuning (synth, 0, 0, "SYSEX",
-																						tunedata,
-																						realtime) == FAILED)
+		if (synthCreateOctaveTuningLocal (synth, 0, 0, "SYSEX", tunedata) == FAILED)
 			return FAILED;
 
 		if (channels) {
 			for (i = 0; i < 16; i++) {
 				if (channels & (1 << i))
-					synthActivateTuning (synth, i, 0, 0, realtime);
+					synthSelectTuningLocal (synth, i, 0, 0);
 			}
 		}
 
@@ -930,8 +1128,8 @@ int synthAllNotesOff (Synthesizer * synth, int chan) {
 	int i;
 	Voice *voice;
 
-	for (i = 0; i < synth->polyphony; i++) {
-		voice = synth->voice[i];
+	for (i = 0; i < synth->nActiveVoices; i++) {
+		voice = synth->activeVoice[i];
 		if (_PLAYING (voice) && (voice->chan == chan)) {
 			voiceNoteoff (voice);
 		}
@@ -948,8 +1146,8 @@ int synthAllSoundsOff (Synthesizer * synth, int chan) {
 	int i;
 	Voice *voice;
 
-	for (i = 0; i < synth->polyphony; i++) {
-		voice = synth->voice[i];
+	for (i = 0; i < synth->nActiveVoices; i++) {
+		voice = synth->activeVoice[i];
 		if (_PLAYING (voice) && (voice->chan == chan)) {
 			voiceOff (voice);
 		}
@@ -958,17 +1156,17 @@ int synthAllSoundsOff (Synthesizer * synth, int chan) {
 }
 
 /*
- * synthSystemReset
+ * synthSystemResetLocal
  *
  * Purpose:
  * Respond to the MIDI command 'system reset' (0xFF, big red 'panic' button)
  */
-int synthSystemReset (Synthesizer * synth) {
+static int synthSystemResetLocal (Synthesizer * synth) {
 	int i;
 	Voice *voice;
 
-	for (i = 0; i < synth->polyphony; i++) {
-		voice = synth->voice[i];
+	for (i = 0; i < synth->nActiveVoices; i++) {
+		voice = synth->activeVoice[i];
 		if (_PLAYING (voice)) 
 			voiceOff (voice);
 	}
@@ -976,12 +1174,394 @@ int synthSystemReset (Synthesizer * synth) {
 	for (i = 0; i < synth->midiChannels; i++) 
 		channelReset (synth->channel[i]);
 
-	chorusReset (synth->chorus);
-	revmodelReset (synth->reverb);
+	for (i = 0; i < synth->nFxBuses; i++) {
+		chorusReset (synth->fxBus[i].chorus);
+		revmodelReset (synth->fxBus[i].reverb);
+	}
+
+	return OK;
+}
+
+/*
+ * synthHandleEvent
+ *
+ * Applies one channel message now.  NOTE_ON with velocity 0 is a note-off.
+ */
+int synthHandleEvent (Synthesizer * synth, U8 type, U8 chan, U8 p1, U8 p2) {
+	switch (type) {
+	case NOTE_ON:
+		if (p2 != 0)
+			return synthNoteonLocal (synth, chan, p1, p2);
+		/* fall through */
+	case NOTE_OFF:
+		return synthNoteoffLocal (synth, chan, p1);
+	case KEY_PRESSURE:
+		return synthKeyPressureLocal (synth, chan, p1, p2);
+	case CONTROL_CHANGE:
+		return synthCcLocal (synth, chan, p1, p2);
+	case PROGRAM_CHANGE:
+		return synthProgramChangeLocal (synth, chan, p1);
+	case CHANNEL_PRESSURE:
+		return synthChannelPressureLocal (synth, chan, p1);
+	case PITCH_BEND:
+		return synthPitchBendLocal (synth, chan, p1 | (p2 << 7));
+	case MIDI_SYSTEM_RESET:
+		return synthSystemResetLocal (synth);
+	case SYNTH_CMD_FX_BUS:
+		return synthSetChannelFxBusLocal (synth, chan, p1);
+	case SYNTH_CMD_SELECT_TUNING:
+		return synthSelectTuningLocal (synth, chan, p1, p2);
+	case SYNTH_CMD_RESET_TUNING:
+		return synthResetTuningLocal (synth, chan);
+	default:
+		return FAILED;
+	}
+}
+
+/*
+ * synthGetFrameTime
+ *
+ * The absolute frame the next call to synthWriteS16 starts with.
+ */
+uint64 synthGetFrameTime (Synthesizer * synth) {
+	return synth->blockFrame - (BUFSIZE - synth->cur);
+}
+
+/*
+ * synthQueueEvent
+ *
+ * Inserted in frame order; events with the same frame keep the order they
+ * were queued in.  FAILED if the queue is full.
+ */
+int synthQueueEvent (Synthesizer * synth, uint64 frame, U8 type, U8 chan, U8 p1, U8 p2) {
+	synthEventT *event;
+	int i;
+
+	if (synth->eventTail == SYNTH_EVENT_QUEUE_SIZE) {
+		if (synth->eventHead == 0)
+			return FAILED;
+		MEMMOVE (synth->eventQueue, synth->eventQueue + synth->eventHead,
+		         (synth->eventTail - synth->eventHead) * sizeof (synthEventT));
+		synth->eventTail -= synth->eventHead;
+		synth->eventHead = 0;
+	}
+
+	/* usually in order already, so this is an append */
+	for (i = synth->eventTail; i > synth->eventHead && synth->eventQueue[i - 1].frame > frame; i--)
+		synth->eventQueue[i] = synth->eventQueue[i - 1];
+
+	event = &synth->eventQueue[i];
+	event->frame = frame;
+	event->type = type;
+	event->chan = chan;
+	event->p1 = p1;
+	event->p2 = p2;
+	synth->eventTail++;
+	return OK;
+}
+
+/*
+ * synthApplyEvents
+ *
+ * Applies the queued events due at or before 'frame' and returns how many
+ * there were.  synthOneBlock does this at every span; renderSong makes room
+ * in a full queue with it.
+ */
+int synthApplyEvents (Synthesizer * synth, uint64 frame) {
+	synthEventT event;
+	int n = 0;
+
+	while (synth->eventHead < synth->eventTail) {
+		event = synth->eventQueue[synth->eventHead];
+		if (event.frame > frame)
+			break;
+		synth->eventHead++;
+		synthHandleEvent (synth, event.type, event.chan, event.p1, event.p2);
+		n++;
+	}
+	if (synth->eventHead == synth->eventTail)
+		synth->eventHead = synth->eventTail = 0;
+	return n;
+}
+
+/*
+ * synthClearEvents
+ */
+void synthClearEvents (Synthesizer * synth) {
+	synth->eventHead = 0;
+	synth->eventTail = 0;
+}
+
+/*
+ * synthNewCmdQueue
+ *
+ * Returns a ring for one more control thread, or NULL if there are
+ * SYNTH_MAX_CMD_QUEUES already.  It belongs to the synth and goes away
+ * with it.  Any thread may call it: the slot is taken with a CAS on
+ * nCmdQueues and the ring published in it after, so readers skip a slot
+ * that is still NULL.
+ */
+synthCmdQueueT *synthNewCmdQueue (Synthesizer * synth) {
+	synthCmdQueueT *queue;
+	S32 n = __atomic_load_n (&synth->nCmdQueues, __ATOMIC_RELAXED);
+
+	if (n >= SYNTH_MAX_CMD_QUEUES)
+		return NULL;
+
+	queue = NEW (synthCmdQueueT);
+	if (queue == NULL)
+		return NULL;
+	MEMSET (queue, 0, sizeof (synthCmdQueueT));
+	queue->cmd = ARRAY (synthEventT, SYNTH_CMD_QUEUE_SIZE);
+	queue->sysex = ARRAY (synthSysexT, SYNTH_SYSEX_SLOTS);
+	if (queue->cmd == NULL || queue->sysex == NULL) {
+		deleteCmdQueue (queue);
+		return NULL;
+	}
+
+	do {
+		if (n >= SYNTH_MAX_CMD_QUEUES) {
+			deleteCmdQueue (queue);
+			return NULL;
+		}
+	} while (!__atomic_compare_exchange_n (&synth->nCmdQueues, &n, n + 1, 0,
+																				 __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+	/* the renderer picks it up at its next block */
+	__atomic_store_n (&synth->cmdQueue[n], queue, __ATOMIC_RELEASE);
+	return queue;
+}
+
+/*
+ * deleteCmdQueue
+ */
+static void deleteCmdQueue (synthCmdQueueT * queue) {
+	if (queue->cmd != NULL)
+		FREE (queue->cmd);
+	if (queue->sysex != NULL)
+		FREE (queue->sysex);
+	FREE (queue);
+}
+
+/*
+ * synthCmdQueuePush
+ *
+ * Producer side.  FAILED if the ring is full.
+ */
+int synthCmdQueuePush (synthCmdQueueT * queue, uint64 frame, U8 type, U8 chan, U8 p1, U8 p2) {
+	U32 tail = queue->tail;
+	U32 depth = tail - __atomic_load_n (&queue->head, __ATOMIC_ACQUIRE);
+	synthEventT *cmd;
+
+	if (depth >= SYNTH_CMD_QUEUE_SIZE) {
+		__atomic_fetch_add (&queue->overflows, 1, __ATOMIC_RELAXED);
+		return FAILED;
+	}
+
+	cmd = &queue->cmd[tail & (SYNTH_CMD_QUEUE_SIZE - 1)];
+	cmd->frame = frame;
+	cmd->type = type;
+	cmd->chan = chan;
+	cmd->p1 = p1;
+	cmd->p2 = p2;
+	__atomic_store_n (&queue->tail, tail + 1, __ATOMIC_RELEASE);
+
+	if (depth + 1 > queue->maxDepth)
+		__atomic_store_n (&queue->maxDepth, depth + 1, __ATOMIC_RELAXED);
+	return OK;
+}
+
+/*
+ * synthCmdQueuePushSysex
+ *
+ * Producer side: queues a copy of the sysex message [data, data + len)
+ * for the next block.  FAILED if it's too long or the ring is full.
+ */
+int synthCmdQueuePushSysex (synthCmdQueueT * queue, const char *data, int len) {
+	synthSysexT *sysexP;
+
+	if (len <= 0 || len > SYNTH_SYSEX_MAX)
+		return FAILED;
+	sysexP = synthCmdQueueSlot (queue);
+	if (sysexP == NULL)
+		return FAILED;
+	MEMCPY (sysexP->u.data, data, len);
+	sysexP->len = len;
+	return synthCmdQueuePushSlot (queue, MIDI_SYSEX, 0, 0);
+}
+
+/*
+ * synthCmdQueueSlot
+ *
+ * Producer side: the next free payload slot, for the caller to fill in
+ * before synthCmdQueuePushSlot.  NULL if they're all taken.
+ */
+static synthSysexT *synthCmdQueueSlot (synthCmdQueueT * queue) {
+	U32 slot = queue->sysexTail;
+
+	if (slot - __atomic_load_n (&queue->sysexHead, __ATOMIC_ACQUIRE) >= SYNTH_SYSEX_SLOTS) {
+		__atomic_fetch_add (&queue->overflows, 1, __ATOMIC_RELAXED);
+		return NULL;
+	}
+	return &queue->sysex[slot % SYNTH_SYSEX_SLOTS];
+}
+
+/*
+ * synthCmdQueuePushSlot
+ *
+ * Producer side: queues the command that takes the slot from
+ * synthCmdQueueSlot.  The slot is published with it.
+ */
+static int synthCmdQueuePushSlot (synthCmdQueueT * queue, U8 type, U8 chan, U8 p2) {
+	U32 slot = queue->sysexTail;
+
+	if (synthCmdQueuePush (queue, 0, type, chan, slot % SYNTH_SYSEX_SLOTS, p2) != OK)
+		return FAILED;
+	queue->sysexTail = slot + 1;
+	return OK;
+}
+
+/*
+ * synthHandleSlotCmd
+ *
+ * Consumer side: applies a command whose arguments are in a payload slot.
+ */
+static int synthHandleSlotCmd (Synthesizer * synth, synthEventT * cmd, synthSysexT * sysexP) {
+	switch (cmd->type) {
+	case MIDI_SYSEX:
+		return synthSysexMidiTuning (synth, sysexP->u.data, sysexP->len, NULL, NULL, 0, NULL, 0);
+	case SYNTH_CMD_SET_GEN:
+		return synthSetGenLocal (synth, cmd->chan, sysexP->u.gen.genId, sysexP->u.gen.value);
+	case SYNTH_CMD_SET_GEN2:
+		return synthSetGen2Local (synth, cmd->chan, sysexP->u.gen.genId, sysexP->u.gen.value,
+		                          sysexP->u.gen.absolute);
+	case SYNTH_CMD_PROGRAM_SELECT:
+		return synthProgramSelectLocal (synth, cmd->chan, sysexP->u.program.sfontId,
+		                                sysexP->u.program.bank, sysexP->u.program.prog);
+	case SYNTH_CMD_KEY_TUNING:
+		return synthCreateKeyTuningLocal (synth, sysexP->u.tuning.bank, sysexP->u.tuning.prog,
+		                                  sysexP->u.tuning.name,
+		                                  sysexP->len > 0 ? sysexP->u.tuning.pitch : NULL);
+	case SYNTH_CMD_OCTAVE_TUNING:
+		return synthCreateOctaveTuningLocal (synth, sysexP->u.tuning.bank, sysexP->u.tuning.prog,
+		                                     sysexP->u.tuning.name, sysexP->u.tuning.pitch);
+	case SYNTH_CMD_TUNE_NOTES:
+		return synthTuneNotesLocal (synth, sysexP->u.tuning.bank, sysexP->u.tuning.prog,
+		                            sysexP->len, sysexP->u.tuning.key, sysexP->u.tuning.pitch);
+	default:
+		return FAILED;
+	}
+}
+
+/*
+ * synthDrainCmdQueues
+ *
+ * Consumer side, at the start of every block.  Commands that are due are
+ * applied now, later ones go into the event queue for their frame.
+ */
+static void synthDrainCmdQueues (Synthesizer * synth) {
+	S32 i, n = __atomic_load_n (&synth->nCmdQueues, __ATOMIC_ACQUIRE);
+	synthCmdQueueT *queue;
+	synthSysexT *sysexP;
+	synthEventT *cmd;
+	U32 head, tail;
+
+	for (i = 0; i < n; i++) {
+		queue = __atomic_load_n (&synth->cmdQueue[i], __ATOMIC_ACQUIRE);
+		if (queue == NULL)
+			continue;
+		head = queue->head;
+		tail = __atomic_load_n (&queue->tail, __ATOMIC_ACQUIRE);
+		for (; head != tail; head++) {
+			cmd = &queue->cmd[head & (SYNTH_CMD_QUEUE_SIZE - 1)];
+			/* the payload slot is needed back, it applies now */
+			if (synthCmdHasSlot_ (cmd->type)) {
+				sysexP = &queue->sysex[cmd->p1];
+				synthHandleSlotCmd (synth, cmd, sysexP);
+				__atomic_store_n (&queue->sysexHead, queue->sysexHead + 1, __ATOMIC_RELEASE);
+				continue;
+			}
+			if (cmd->frame <= synth->blockFrame
+					|| synthQueueEvent (synth, cmd->frame, cmd->type, cmd->chan, cmd->p1, cmd->p2) != OK)
+				synthHandleEvent (synth, cmd->type, cmd->chan, cmd->p1, cmd->p2);
+		}
+		__atomic_store_n (&queue->head, head, __ATOMIC_RELEASE);
+	}
+}
 
+/*
+ * synthGetCmdQueueStats
+ *
+ * Commands waiting in ring 'num', the most that ever waited, and how many
+ * were dropped.  Any pointer may be NULL.
+ */
+int synthGetCmdQueueStats (Synthesizer * synth, int num, U32 * depth, U32 * maxDepth, U32 * overflows) {
+	synthCmdQueueT *queue;
+
+	if (num < 0 || num >= __atomic_load_n (&synth->nCmdQueues, __ATOMIC_ACQUIRE))
+		return FAILED;
+
+	queue = __atomic_load_n (&synth->cmdQueue[num], __ATOMIC_ACQUIRE);
+	if (queue == NULL)
+		return FAILED;
+	if (depth != NULL)
+		*depth = __atomic_load_n (&queue->tail, __ATOMIC_ACQUIRE)
+			- __atomic_load_n (&queue->head, __ATOMIC_ACQUIRE);
+	if (maxDepth != NULL)
+		*maxDepth = __atomic_load_n (&queue->maxDepth, __ATOMIC_RELAXED);
+	if (overflows != NULL)
+		*overflows = __atomic_load_n (&queue->overflows, __ATOMIC_RELAXED);
 	return OK;
 }
 
+/*
+ * synthPost
+ *
+ * The channel calls: range checks here, the work happens in the
+ * synth*Local functions once the renderer drains cmdQueue[0].
+ */
+static int synthPost (Synthesizer * synth, int type, int chan, int p1, int p2) {
+	if (chan < 0 || chan >= synth->midiChannels)
+		return FAILED;
+	if (p1 < 0 || p1 > 127 || p2 < 0 || p2 > 127)
+		return FAILED;
+	return synthCmdQueuePush (synth->cmdQueue[0], 0, type, chan, p1, p2);
+}
+
+int synthNoteon (Synthesizer * synth, U8 chan, U8 key, U8 vel) {
+	return synthPost (synth, NOTE_ON, chan, key, vel);
+}
+
+int synthNoteoff (Synthesizer * synth, int chan, int key) {
+	return synthPost (synth, NOTE_OFF, chan, key, 0);
+}
+
+int synthCc (Synthesizer * synth, int chan, int num, int val) {
+	return synthPost (synth, CONTROL_CHANGE, chan, num, val);
+}
+
+int synthKeyPressure (Synthesizer * synth, int chan, int key, int val) {
+	return synthPost (synth, KEY_PRESSURE, chan, key, val);
+}
+
+int synthChannelPressure (Synthesizer * synth, int chan, int val) {
+	return synthPost (synth, CHANNEL_PRESSURE, chan, val, 0);
+}
+
+int synthPitchBend (Synthesizer * synth, int chan, int val) {
+	if (val < 0 || val > 0x3fff)
+		return FAILED;
+	return synthPost (synth, PITCH_BEND, chan, val & 0x7f, val >> 7);
+}
+
+int synthProgramChange (Synthesizer * synth, int chan, int prognum) {
+	return synthPost (synth, PROGRAM_CHANGE, chan, prognum, 0);
+}
+
+int synthSystemReset (Synthesizer * synth) {
+	return synthPost (synth, MIDI_SYSTEM_RESET, 0, 0, 0);
+}
+
 /*
  * synthModulateVoices
  *
@@ -995,8 +1575,8 @@ int synthModulateVoices (Synthesizer * synth, int chan, int isCc, int ctrl) {
 /*   mutexLock(synth->busy); /\* Don't interfere with the audio thread *\/ */
 /*   mutexUnlock(synth->busy); */
 
-	for (i = 0; i < synth->polyphony; i++) {
-		voice = synth->voice[i];
+	for (i = 0; i < synth->nActiveVoices; i++) {
+		voice = synth->activeVoice[i];
 		if (voice->chan == chan) 
 			voiceModulate (voice, isCc, ctrl);
 	}
@@ -1014,14 +1594,61 @@ int synthModulateVoicesAll (Synthesizer * synth, int chan) {
 	int i;
 	Voice *voice;
 
-	for (i = 0; i < synth->polyphony; i++) {
-		voice = synth->voice[i];
+	for (i = 0; i < synth->nActiveVoices; i++) {
+		voice = synth->activeVoice[i];
 		if (voice->chan == chan) 
 			voiceModulateAll (voice);
 	}
 	return OK;
 }
 
+/*
+ * synthModulatePending
+ *
+ * Applies the controller changes the channels collected since the last
+ * span (see channelModulateLater), with the controllers' current values.
+ * Each voice recomputes every generator the changed controllers reach
+ * once, however many messages came in.
+ */
+static void synthModulatePending (Synthesizer * synth) {
+	int i, w;
+	Voice *voice;
+	Channel *chanP;
+	U32 src[8];
+
+	if (!synth->modPending)
+		return;
+	synth->modPending = 0;
+
+	for (i = 0; i < synth->nActiveVoices; i++) {
+		voice = synth->activeVoice[i];
+		if (voice->chan >= synth->midiChannels)
+			continue;
+		chanP = synth->channel[voice->chan];
+		if (!chanP->modAnyPending)
+			continue;
+
+		if (chanP->modAllPending) {
+			voiceModulateAll (voice);
+			continue;
+		}
+		for (w = 0; w < 8; w++)
+			src[w] = chanP->modPending[w];
+		if (chanP->keyPressurePending[voice->key >> 5] & (1u << (voice->key & 31)))
+			src[MOD_KEYPRESSURE >> 5] |= 1u << (MOD_KEYPRESSURE & 31);
+		voiceModulateSources (voice, src);
+	}
+
+	for (i = 0; i < synth->midiChannels; i++) {
+		chanP = synth->channel[i];
+		if (chanP->modAnyPending) {
+			MEMSET (chanP->modPending, 0, sizeof (chanP->modPending));
+			MEMSET (chanP->keyPressurePending, 0, sizeof (chanP->keyPressurePending));
+			chanP->modAllPending = chanP->modAnyPending = 0;
+		}
+	}
+}
+
 /**
  * Set the MIDI channel pressure controller value.
  * @param synth Synth instance
@@ -1032,7 +1659,7 @@ int synthModulateVoicesAll (Synthesizer * synth, int chan) {
  * Assign to the MIDI channel pressure controller value on a specific MIDI channel
  * in real time.
  */
-int synthChannelPressure (Synthesizer * synth, int chan, int val) {
+static int synthChannelPressureLocal (Synthesizer * synth, int chan, int val) {
 
 /*   mutexLock(synth->busy); /\* Don't interfere with the audio thread *\/ */
 /*   mutexUnlock(synth->busy); */
@@ -1056,7 +1683,7 @@ int synthChannelPressure (Synthesizer * synth, int chan, int val) {
  * @param val MIDI key pressure value (0-127)
  * @return OK on success, FAILED otherwise
  */
-int synthKeyPressure (Synthesizer * synth, int chan, int key, int val) {
+static int synthKeyPressureLocal (Synthesizer * synth, int chan, int key, int val) {
 	int result = OK;
 	if (key < 0 || key > 127) {
 		return FAILED;
@@ -1066,31 +1693,18 @@ int synthKeyPressure (Synthesizer * synth, int chan, int key, int val) {
 	}
 
 	channelSetKeyPressure (synth->channel[chan], key, val);
-
-	// synthUpdateKeyPressure_LOCAL
-	{
-		Voice *voice;
-		int i;
-
-		for (i = 0; i < synth->polyphony; i++) {
-			voice = synth->voice[i];
-
-			if (voice->chan == chan && voice->key == key) {
-				result = voiceModulate (voice, 0, MOD_KEYPRESSURE);
-				if (result != OK)
-					break;
-			}
-		}
-	}
+	/* the key's voices pick it up in synthModulatePending */
+	channelKeyPressureLater (synth->channel[chan], key);
 
 	return result;
 }
 
-int synthPitchBend (Synthesizer * synth, int chan, int val) {
+static int synthPitchBendLocal (Synthesizer * synth, int chan, int val) {
 /*   mutexLock(synth->busy); /\* Don't interfere with the audio thread *\/ */
 /*   mutexUnlock(synth->busy); */
 	if ((chan < 0) || (chan >= synth->midiChannels)) {
 		return FAILED;
+	}
 	channelPitchBend (synth->channel[chan], val);
 	return OK;
 }
@@ -1109,7 +1723,7 @@ int synthGetPitchWheelSens (Synthesizer * synth, int chan, int *pval) {
 	return OK;
 }
 
-int synthProgramChange (Synthesizer * synth, int chan, int prognum) {
+static int synthProgramChangeLocal (Synthesizer * synth, int chan, int prognum) {
 	Preset *preset = NULL;
 	Channel *channel;
 	U32 banknum;
@@ -1157,6 +1771,7 @@ int synthProgramChange (Synthesizer * synth, int chan, int prognum) {
 	}
 
   channel->presetP = preset;
+	synthChannelPresetIndex (synth, channel);
 
 	return OK;
 }
@@ -1199,23 +1814,45 @@ int synthGetProgram (Synthesizer * synth, int chan, U32 *sfontId, U32 *bankNum,
 
 /*
  * synthProgramSelect
+ *
+ * Queued; the preset is looked up in the font the synth has when it
+ * applies.
  */
 int
 synthProgramSelect (Synthesizer * synth,
 														int chan,
 														U32 sfontId,
 														U32 bankNum, U32 presetNum) {
-	Preset *preset = NULL;
-	Channel *channel;
+	synthSysexT *sysexP;
 
 	if ((chan < 0) || (chan >= synth->midiChannels)) {
 		return FAILED;
 	}
-	channel = synth->channel[chan];
+	if (bankNum > DRUM_INST_BANK || presetNum >= 128)
+		return FAILED;
 
-  preset = &synth->soundfontP->bankA[bankNum].presetA[presetNum];
-	if (preset == NULL) 
+	sysexP = synthCmdQueueSlot (synth->cmdQueue[0]);
+	if (sysexP == NULL)
 		return FAILED;
+	sysexP->u.program.sfontId = sfontId;
+	sysexP->u.program.bank = bankNum;
+	sysexP->u.program.prog = presetNum;
+	return synthCmdQueuePushSlot (synth->cmdQueue[0], SYNTH_CMD_PROGRAM_SELECT, chan, 0);
+}
+
+/*
+ * synthProgramSelectLocal
+ */
+static int synthProgramSelectLocal (Synthesizer * synth, int chan, U32 sfontId, U32 bankNum, U32 presetNum) {
+	Preset *preset = NULL;
+	Channel *channel;
+
+	if (synth->soundfontP == NULL || bankNum >= synth->soundfontP->nBanks
+			|| presetNum >= synth->soundfontP->bankA[bankNum].nPresets)
+		return FAILED;
+	channel = synth->channel[chan];
+
+  preset = &synth->soundfontP->bankA[bankNum].presetA[presetNum];
 
 	/* inform the channel of the new bank and program number */
   channel->sfontnum = sfontId;
@@ -1223,6 +1860,7 @@ synthProgramSelect (Synthesizer * synth,
   channel->prognum = presetNum;
 
 	channel->presetP = preset;
+	synthChannelPresetIndex (synth, channel);
 
 	return OK;
 }
@@ -1231,15 +1869,45 @@ synthProgramSelect (Synthesizer * synth,
  * synthUpdatePresets
  */
 void synthUpdatePresets (Synthesizer * synth) {
+	/* the soundfont may have changed under the cached indices */
+	presetIndexClear (synth->presetIndex);
+	if (synth->soundfontP != NULL)
+		presetIndexBuildAll (synth->presetIndex, synth->soundfontP);
+	synthSetChannelPresets (synth);
+}
+
+/*
+ * synthSetChannelPresets
+ *
+ * Points every channel at its bank and program in synth->soundfontP.
+ */
+static void synthSetChannelPresets (Synthesizer * synth) {
 	int chan;
 	Channel *channel;
 
 	for (chan = 0; chan < synth->midiChannels; chan++) {
 		channel = synth->channel[chan];
     channel->presetP = &synth->soundfontP->bankA[channel->banknum].presetA[channel->prognum];
+		channel->presetIndexP = NULL;
+		synthChannelPresetIndex (synth, channel);
 	}
 }
 
+/*
+ * synthChannelPresetIndex
+ *
+ * Returns the zone index of the channel's preset, NULL if it has none.
+ * The indices are built with the font (synthUpdatePresets,
+ * synthSetSoundfont), so this is only a lookup, at the program change.
+ */
+static PresetIndex *synthChannelPresetIndex (Synthesizer * synth, Channel * channel) {
+	if (channel->presetP == NULL)
+		return NULL;
+	if (channel->presetIndexP == NULL || channel->presetIndexP->presetP != channel->presetP)
+		channel->presetIndexP = presetIndexFind (synth->presetIndex, channel->presetP);
+	return channel->presetIndexP;
+}
+
 
 /*
  * synthSetGain
@@ -1250,8 +1918,8 @@ void synthSetGain (Synthesizer * synth, float gain) {
 	clip (gain, 0.0f, 10.0f);
 	synth->gain = gain;
 
-	for (i = 0; i < synth->polyphony; i++) {
-		Voice *voice = synth->voice[i];
+	for (i = 0; i < synth->nActiveVoices; i++) {
+		Voice *voice = synth->activeVoice[i];
 		if (_PLAYING (voice)) {
 			voiceSetGain (voice, gain);
 		}
@@ -1333,10 +2001,8 @@ int synthSetReverbPreset (Synthesizer * synth, int num) {
 	int i = 0;
 	while (revmodelPreset[i].name != NULL) {
 		if (i == num) {
-			revmodelSetroomsize (synth->reverb, revmodelPreset[i].roomsize);
-			revmodelSetdamp (synth->reverb, revmodelPreset[i].damp);
-			revmodelSetwidth (synth->reverb, revmodelPreset[i].width);
-			revmodelSetlevel (synth->reverb, revmodelPreset[i].level);
+			synthSetReverb (synth, revmodelPreset[i].roomsize, revmodelPreset[i].damp,
+			                revmodelPreset[i].width, revmodelPreset[i].level);
 			return OK;
 		}
 		i++;
@@ -1351,10 +2017,27 @@ void synthSetReverb (Synthesizer * synth, double roomsize, double damping, doubl
 /*   mutexLock(synth->busy); /\* Don't interfere with the audio thread *\/ */
 /*   mutexUnlock(synth->busy); */
 
-	revmodelSetroomsize (synth->reverb, roomsize);
-	revmodelSetdamp (synth->reverb, damping);
-	revmodelSetwidth (synth->reverb, width);
-	revmodelSetlevel (synth->reverb, level);
+	int i;
+
+	for (i = 0; i < synth->nFxBuses; i++)
+		synthSetBusReverb (synth, i, roomsize, damping, width, level);
+}
+
+/*
+ * synthSetBusReverb
+ */
+int synthSetBusReverb (Synthesizer * synth, int bus, double roomsize,
+                       double damping, double width, double level) {
+	revmodelT *reverb;
+
+	if (bus < 0 || bus >= synth->nFxBuses)
+		return FAILED;
+	reverb = synth->fxBus[bus].reverb;
+	revmodelSetroomsize (reverb, roomsize);
+	revmodelSetdamp (reverb, damping);
+	revmodelSetwidth (reverb, width);
+	revmodelSetlevel (reverb, level);
+	return OK;
 }
 
 /*
@@ -1366,12 +2049,57 @@ synthSetChorus (Synthesizer * synth, int nr, double level,
 /*   mutexLock(synth->busy); /\* Don't interfere with the audio thread *\/ */
 /*   mutexUnlock(synth->busy); */
 
-	chorusSetNr (synth->chorus, nr);
-	chorusSetLevel (synth->chorus, (realT) level);
-	chorusSetSpeed_Hz (synth->chorus, (realT) speed);
-	chorusSetDepthMs (synth->chorus, (realT) depthMs);
-	chorusSetType (synth->chorus, type);
-	chorusUpdate (synth->chorus);
+	int i;
+
+	for (i = 0; i < synth->nFxBuses; i++)
+		synthSetBusChorus (synth, i, nr, level, speed, depthMs, type);
+}
+
+/*
+ * synthSetBusChorus
+ */
+int synthSetBusChorus (Synthesizer * synth, int bus, int nr, double level,
+                       double speed, double depthMs, int type) {
+	Chorus *chorus;
+
+	if (bus < 0 || bus >= synth->nFxBuses)
+		return FAILED;
+	chorus = synth->fxBus[bus].chorus;
+	chorusSetNr (chorus, nr);
+	chorusSetLevel (chorus, (realT) level);
+	chorusSetSpeed_Hz (chorus, (realT) speed);
+	chorusSetDepthMs (chorus, (realT) depthMs);
+	chorusSetType (chorus, type);
+	return chorusUpdate (chorus);
+}
+
+/*
+ * synthSetChannelFxBus
+ *
+ * Voices that are already playing move along with their channel, at the
+ * next block.
+ */
+int synthSetChannelFxBus (Synthesizer * synth, int chan, int bus) {
+	if (bus < 0 || bus >= synth->nFxBuses)
+		return FAILED;
+	return synthPost (synth, SYNTH_CMD_FX_BUS, chan, bus, 0);
+}
+
+/*
+ * synthSetChannelFxBusLocal
+ */
+static int synthSetChannelFxBusLocal (Synthesizer * synth, int chan, int bus) {
+	synth->channel[chan]->fxBus = (U8) bus;
+	return OK;
+}
+
+/*
+ * synthGetChannelFxBus
+ */
+int synthGetChannelFxBus (Synthesizer * synth, int chan) {
+	if (chan < 0 || chan >= synth->midiChannels)
+		return FAILED;
+	return synth->channel[chan]->fxBus;
 }
 
 /******************************************************
@@ -1423,6 +2151,27 @@ synthSetChorus (Synthesizer * synth, int nr, double level,
 
 ***************************************************/
 
+/*
+ *  synthBusToS16
+ *
+ *  Converts 'len' mix bus samples to 16 bit with digital clipping, but
+ *  without dither. With a S16 bus this is just a copy.
+ */
+static void synthBusToS16 (busT *in, S16 *out, int len) {
+#if defined(WITH_S16_BUS)
+	MEMCPY (out, in, len * sizeof (S16));
+#else
+	int i;
+	float sample;
+
+	for (i = 0; i < len; i++) {
+		sample = in[i] * BUS_TO_S16;
+		clip (sample, -32768.0f, 32767.0f);
+		out[i] = (S16) sample;
+	}
+#endif
+}
+
 /*
  *  synthNwriteS16
  */
@@ -1430,9 +2179,9 @@ int
 synthNwriteS16 (Synthesizer * synth, int len,
 									S16 **left, S16 **right,
 									S16 **fxLeft, S16 **fxRight) {
-	S16 **leftIn = synth->leftBuf;
-	S16 **rightIn = synth->rightBuf;
-	int i, num, available, count, bytes;
+	busT **leftIn = synth->leftBuf;
+	busT **rightIn = synth->rightBuf;
+	int i, num, available, count;
 
 	/* make sure we're playing */
 	if (synth->state != SYNTH_PLAYING) {
@@ -1446,11 +2195,10 @@ synthNwriteS16 (Synthesizer * synth, int len,
 		available = BUFSIZE - synth->cur;
 
 		num = (available > len) ? len : available;
-		bytes = num * sizeof (S16);
 
 		for (i = 0; i < synth->audioChannels; i++) {
-			MEMCPY (left[i], leftIn[i] + synth->cur, bytes);
-			MEMCPY (right[i], rightIn[i] + synth->cur, bytes);
+			synthBusToS16 (leftIn[i] + synth->cur, left[i], num);
+			synthBusToS16 (rightIn[i] + synth->cur, right[i], num);
 		}
 		count += num;
 		num += synth->cur;					/* if we're now done, num becomes the new synth->cur below */
@@ -1461,11 +2209,10 @@ synthNwriteS16 (Synthesizer * synth, int len,
 		synthOneBlock (synth, 1);
 
 		num = (BUFSIZE > len - count) ? len - count : BUFSIZE;
-		bytes = num * sizeof (S16);
 
 		for (i = 0; i < synth->audioChannels; i++) {
-			MEMCPY (left[i] + count, leftIn[i], bytes);
-			MEMCPY (right[i] + count, rightIn[i], bytes);
+			synthBusToS16 (leftIn[i], left[i] + count, num);
+			synthBusToS16 (rightIn[i], right[i] + count, num);
 		}
 
 		count += num;
@@ -1482,24 +2229,169 @@ synthNwriteS16 (Synthesizer * synth, int len,
 int
 synthProcess (Synthesizer * synth, int len,
 							int nin, S16 **in, int nout, S16 **out) {
+	/* at most 256 audio channels (U8), no allocation per call */
+	S16 *left[256], *right[256];
+	int i;
+
 	if (nout == 2) {
 		return synthWriteS16 (synth, len, out[0], 0, 1, out[1], 0, 1);
 	} else {
-		S16 **left, **right;
-		int i;
-		left = ARRAY (S16*, nout / 2);
-		right = ARRAY (S16*, nout / 2);
-		for (i = 0; i < nout / 2; i++) {
+		for (i = 0; i < nout / 2 && i < 256; i++) {
 			left[i] = out[2 * i];
 			right[i] = out[2 * i + 1];
 		}
 		synthNwriteS16 (synth, len, left, right, NULL, NULL);
-		FREE (left);
-		FREE (right);
 		return 0;
 	}
 }
 
+/*
+ *  synthBusToFloat
+ *
+ *  Mix bus samples to full scale +-1.0 floats.  With a float bus this is
+ *  just a copy.
+ */
+static void synthBusToFloat (busT *in, float *out, int len) {
+#if defined(WITH_S16_BUS)
+	int i;
+
+	for (i = 0; i < len; i++)
+		out[i] = in[i] * (1.0f / 32768.0f);
+#else
+	MEMCPY (out, in, len * sizeof (float));
+#endif
+}
+
+/*
+ *  synthCopyGroups
+ *
+ *  Copies frames [from, from + len) of the synth's own block to frame
+ *  'to' of the caller's group buffers.
+ */
+static void synthCopyGroups (Synthesizer * synth, int from, int to, int len,
+                             float **left, float **right,
+                             float **fxLeft, float **fxRight) {
+	int i;
+
+	for (i = 0; i < synth->nbuf; i++) {
+		synthBusToFloat (synth->leftBuf[i] + from, left[i] + to, len);
+		synthBusToFloat (synth->rightBuf[i] + from, right[i] + to, len);
+	}
+	if (fxLeft != NULL && fxRight != NULL) {
+		for (i = 0; i < 2; i++) {
+			synthBusToFloat (synth->fxLeftBuf[i] + from, fxLeft[i] + to, len);
+			synthBusToFloat (synth->fxRightBuf[i] + from, fxRight[i] + to, len);
+		}
+	}
+}
+
+/*
+ *  synthRenderGroups
+ *
+ *  Renders 'len' frames of every output group into the caller's planar
+ *  float buffers: left[i] / right[i] for i < synth->nbuf, and if both
+ *  fxLeft and fxRight are given, the reverb ([0]) and chorus ([1]) returns,
+ *  which are otherwise mixed into group 0.
+ *
+ *  Whole blocks are rendered in place: the synth's buffers are pointed into
+ *  the caller's for the duration of the block, so the voices mix straight
+ *  into them.  Only a partial block at either end, when 'len' isn't a
+ *  multiple of BUFSIZE, goes through the synth's own block (and the rest of
+ *  that block is left for the next call, as with synthWriteS16).
+ */
+int synthRenderGroups (Synthesizer * synth, int len,
+                       float **left, float **right,
+                       float **fxLeft, float **fxRight) {
+	int num, count = 0;
+	int doNotMixFxToOut = fxLeft != NULL && fxRight != NULL;
+#if !defined(WITH_S16_BUS)
+	busT **leftBuf = synth->leftBuf;
+	busT **rightBuf = synth->rightBuf;
+	busT **fxLeftBuf = synth->fxLeftBuf;
+	busT **fxRightBuf = synth->fxRightBuf;
+	busT *leftIn[256], *rightIn[256], *fxLeftIn[2], *fxRightIn[2];
+	int i;
+#endif
+
+	/* make sure we're playing */
+	if (synth->state != SYNTH_PLAYING) {
+		return 0;
+	}
+
+	/* First, take what's still available in the buffer */
+	if (synth->cur < BUFSIZE) {
+		num = BUFSIZE - synth->cur;
+		if (num > len)
+			num = len;
+		synthCopyGroups (synth, synth->cur, 0, num, left, right, fxLeft, fxRight);
+		synth->cur += num;
+		count = num;
+	}
+
+#if !defined(WITH_S16_BUS)
+	/* Then whole blocks, in place */
+	if (len - count >= BUFSIZE) {
+		synth->leftBuf = leftIn;
+		synth->rightBuf = rightIn;
+		if (doNotMixFxToOut) {
+			synth->fxLeftBuf = fxLeftIn;
+			synth->fxRightBuf = fxRightIn;
+		}
+
+		while (len - count >= BUFSIZE) {
+			for (i = 0; i < synth->nbuf; i++) {
+				leftIn[i] = left[i] + count;
+				rightIn[i] = right[i] + count;
+			}
+			if (doNotMixFxToOut) {
+				for (i = 0; i < 2; i++) {
+					fxLeftIn[i] = fxLeft[i] + count;
+					fxRightIn[i] = fxRight[i] + count;
+				}
+			}
+			synthOneBlock (synth, doNotMixFxToOut);
+			count += BUFSIZE;
+		}
+
+		synth->leftBuf = leftBuf;
+		synth->rightBuf = rightBuf;
+		synth->fxLeftBuf = fxLeftBuf;
+		synth->fxRightBuf = fxRightBuf;
+	}
+#endif
+
+	/* Then the rest, through the synth's block */
+	while (count < len) {
+		synthOneBlock (synth, doNotMixFxToOut);
+		num = (BUFSIZE > len - count) ? len - count : BUFSIZE;
+		synthCopyGroups (synth, 0, count, num, left, right, fxLeft, fxRight);
+		synth->cur = num;
+		count += num;
+	}
+
+	return 0;
+}
+
+/*
+ *  synthBorrowBlock
+ *
+ *  Renders the next block and lends out the synth's own buffers: *left
+ *  and *right get synth->nbuf group blocks of BUFSIZE frames, valid until
+ *  the next call that renders.  Drops what an earlier synthWriteS16 left
+ *  in the block.
+ */
+int synthBorrowBlock (Synthesizer * synth, int doNotMixFxToOut,
+                      busT *** left, busT *** right) {
+	if (synth->state != SYNTH_PLAYING) {
+		return FAILED;
+	}
+	synthOneBlock (synth, doNotMixFxToOut);
+	synth->cur = BUFSIZE;
+	*left = synth->leftBuf;
+	*right = synth->rightBuf;
+	return OK;
+}
+
 /*
  *  synthWriteS16
  */
@@ -1507,10 +2399,10 @@ int synthWriteS16 (Synthesizer * synth, int len, void *lout, int loff, int lincr
 	int i, j, k, cur;
 	S16 *leftOut = (S16*) lout;
 	S16 *rightOut = (S16*) rout;
-	S16 *leftIn = synth->leftBuf[0];
-	S16 *rightIn = synth->rightBuf[0];
-	S16 leftSample;
-	S16 rightSample;
+	busT *leftIn = synth->leftBuf[0];
+	busT *rightIn = synth->rightBuf[0];
+	float leftSample;
+	float rightSample;
 	int di = synth->ditherIndex;
 
 	/* make sure we're playing */
@@ -1528,8 +2420,9 @@ int synthWriteS16 (Synthesizer * synth, int len, void *lout, int loff, int lincr
 			cur = 0;
 		}
 
-		leftSample = leftIn[cur] * 32766.0f + randTable[0][di];
-		rightSample = rightIn[cur] * 32766.0f + randTable[1][di];
+		/* the one and only bus -> S16 conversion */
+		leftSample = leftIn[cur] * BUS_TO_S16 + randTable[0][di];
+		rightSample = rightIn[cur] * BUS_TO_S16 + randTable[1][di];
 
 		di++;
 		if (di >= DITHER_SIZE)
@@ -1571,8 +2464,8 @@ void synthDitherS16 (int *ditherIndex, int len, float *lin, float *rin,
 	int i, j, k;
 	S16 *leftOut = (S16 *) lout;
 	S16 *rightOut = (S16 *) rout;
-	S16 leftSample;
-	S16 rightSample;
+	float leftSample;
+	float rightSample;
 	int di = *ditherIndex;
 
 	for (i = 0, j = loff, k = roff; i < len; i++, j += lincr, k += rincr) {
@@ -1601,41 +2494,239 @@ void synthDitherS16 (int *ditherIndex, int len, float *lin, float *rin,
 }
 
 /*
- *  synthOneBlock
+ * synthBudgetSelect
+ *
+ * Partial selection (Wirth's quickselect): reorders voiceA[0, n) so that
+ * none of voiceA[k, n) is more important than any of voiceA[0, k).
+ * Linear on average; neither side ends up sorted.
  */
-int synthOneBlock (Synthesizer * synth, int doNotMixFxToOut) {
-	int i, auchan;
+static void synthBudgetSelect (Voice ** voiceA, int n, int k) {
+	int lo = 0, hi = n - 1, i, j;
+	sint64 pivot;
+	Voice *tmp;
+
+	while (lo < hi) {
+		pivot = voiceA[lo + (hi - lo) / 2]->prio;
+		i = lo;
+		j = hi;
+		while (i <= j) {
+			while (voiceA[i]->prio > pivot)
+				i++;
+			while (voiceA[j]->prio < pivot)
+				j--;
+			if (i <= j) {
+				tmp = voiceA[i];
+				voiceA[i++] = voiceA[j];
+				voiceA[j--] = tmp;
+			}
+		}
+		/* [lo, j] >= pivot >= [i, hi], and anything between is the pivot */
+		if (k <= j)
+			hi = j;
+		else if (k >= i)
+			lo = i;
+		else
+			break;
+	}
+}
+
+/*
+ * synthApplyVoiceBudget
+ *
+ * With more playing voices than synth->voiceBudget, flags the least
+ * important ones (by the voice manager's stealing priority) to be culled
+ * for this block.  Voices started during the block are always rendered.
+ */
+static void synthApplyVoiceBudget (Synthesizer * synth) {
+	int i, n = 0;
 	Voice *voice;
-	S16 *leftBuf;
-	S16 *rightBuf;
-	S16 *reverbBuf;
-	S16 *chorusBuf;
-	int byteSize = BUFSIZE * sizeof (S16);  // 64 * 4?
 
-/*   mutexLock(synth->busy); /\* Here comes the audio thread. Lock the synth. *\/ */
+	if (synth->voiceBudget <= 0 && synth->nOverBudget == 0)
+		return;
 
-	/* clean the audio buffers */
-  // MB TODO: look at how this is defined so you can memset it in one fell swoop. This is lame.
-	for (i = 0; i < synth->nbuf; i++) {
-		MEMSET (synth->leftBuf[i], 0, byteSize);
-		MEMSET (synth->rightBuf[i], 0, byteSize);
+	for (i = 0; i < synth->nActiveVoices; i++) {
+		voice = synth->activeVoice[i];
+		voice->overBudget = 0;
+		if (_PLAYING (voice))
+			synth->budgetScratch[n++] = voice;
 	}
+	synth->nOverBudget = 0;
+	if (synth->voiceBudget <= 0 || n <= synth->voiceBudget)
+		return;
 
-	for (i = 0; i < synth->effectsChannels; i++) {
-		MEMSET (synth->fxLeftBuf[i], 0, byteSize);
-		MEMSET (synth->fxRightBuf[i], 0, byteSize);
+	synthBudgetSelect (synth->budgetScratch, n, synth->voiceBudget);
+	for (i = synth->voiceBudget; i < n; i++)
+		synth->budgetScratch[i]->overBudget = 1;
+	synth->nOverBudget = n - synth->voiceBudget;
+}
+
+/*
+ * synthSetCullThreshold
+ */
+int synthSetCullThreshold (Synthesizer * synth, int db) {
+	if (db < synthSettings.synthCullDb.min || db > synthSettings.synthCullDb.max)
+		return FAILED;
+	synth->cullAmp = (realT) pow (10.0, db / 20.0);
+	return OK;
+}
+
+/*
+ * synthSetVoiceBudget
+ */
+int synthSetVoiceBudget (Synthesizer * synth, int budget) {
+	if (budget < synthSettings.synthVoiceBudget.min || budget > synthSettings.synthVoiceBudget.max)
+		return FAILED;
+	synth->voiceBudget = budget;
+	return OK;
+}
+
+/*
+ * synthGetCullStats
+ */
+void synthGetCullStats (Synthesizer * synth, U32 * rendered, U32 * culledQuiet, U32 * culledBudget) {
+	if (rendered != NULL)
+		*rendered = __atomic_load_n (&synth->cullStats[VOICE_CULL_NONE], __ATOMIC_RELAXED);
+	if (culledQuiet != NULL)
+		*culledQuiet = __atomic_load_n (&synth->cullStats[VOICE_CULL_QUIET], __ATOMIC_RELAXED);
+	if (culledBudget != NULL)
+		*culledBudget = __atomic_load_n (&synth->cullStats[VOICE_CULL_BUDGET], __ATOMIC_RELAXED);
+}
+
+/*
+ * synthSetSoundfont
+ */
+int synthSetSoundfont (Synthesizer * synth, Soundfont * sfP) {
+	synthFontSwapT *swapP;
+
+	if (sfP == NULL)
+		return FAILED;
+	synthCollectFontSwaps (synth);
+
+	swapP = NEW (synthFontSwapT);
+	if (swapP == NULL)
+		return FAILED;
+	MEMSET (swapP, 0, sizeof (synthFontSwapT));
+	swapP->sfP = sfP;
+	/* every preset, so the renderer only exchanges the buckets */
+	if (presetIndexBuildAll (swapP->presetIndex, sfP) != OK) {
+		deleteFontSwap (swapP);
+		return FAILED;
+	}
+
+	/* a font that was never taken is replaced */
+	swapP = __atomic_exchange_n (&synth->nextFontSwapP, swapP, __ATOMIC_ACQ_REL);
+	if (swapP != NULL) {
+		sfCacheRelease (swapP->sfP);
+		deleteFontSwap (swapP);
+	}
+	sfCacheCollect ();
+	return OK;
+}
+
+/*
+ * deleteFontSwap
+ */
+static void deleteFontSwap (synthFontSwapT * swapP) {
+	presetIndexClear (swapP->presetIndex);
+	FREE (swapP);
+}
+
+/*
+ * synthCollectFontSwaps
+ *
+ * Control thread: frees the swaps the renderer took, with the indices they
+ * brought back.
+ */
+static void synthCollectFontSwaps (Synthesizer * synth) {
+	synthFontSwapT *swapP, *nextP;
+
+	swapP = __atomic_exchange_n (&synth->doneFontSwapP, NULL, __ATOMIC_ACQUIRE);
+	for (; swapP != NULL; swapP = nextP) {
+		nextP = swapP->next;
+		deleteFontSwap (swapP);
+	}
+}
+
+/*
+ * synthSwapSoundfont
+ *
+ * Renderer, at the start of a block.  Drops the retired fonts no voice
+ * plays any more and switches to the font synthSetSoundfont handed over,
+ * if there's a free retired slot for the current one.  The indices come
+ * built with the font; the replaced ones are handed back, not freed here.
+ */
+static void synthSwapSoundfont (Synthesizer * synth) {
+	synthFontSwapT *swapP;
+	PresetIndex *indexP;
+	Voice *voice;
+	S32 i, j, inUse;
+
+	sfCacheQuiesce (&synth->sfReader);
+
+	for (j = 0; j < synth->nRetiredSoundfonts; j++) {
+		/* the voices started before the swap have lower ids */
+		inUse = 0;
+		for (i = 0; i < synth->nActiveVoices && !inUse; i++) {
+			voice = synth->activeVoice[i];
+			inUse = !_AVAILABLE (voice) && (S32) (voice->id - synth->retiredNoteid[j]) < 0;
+		}
+		if (inUse)
+			continue;
+		sfCacheRelease (synth->retiredSoundfontP[j]);
+		synth->retiredSoundfontP[j] = synth->retiredSoundfontP[--synth->nRetiredSoundfonts];
+		synth->retiredNoteid[j] = synth->retiredNoteid[synth->nRetiredSoundfonts];
+		j--;
+	}
+
+	if (__atomic_load_n (&synth->nextFontSwapP, __ATOMIC_ACQUIRE) == NULL
+			|| synth->nRetiredSoundfonts == SYNTH_RETIRED_FONTS)
+		return;
+	swapP = __atomic_exchange_n (&synth->nextFontSwapP, NULL, __ATOMIC_ACQ_REL);
+
+	if (synth->soundfontP != NULL && synth->soundfontCached) {
+		synth->retiredSoundfontP[synth->nRetiredSoundfonts] = synth->soundfontP;
+		synth->retiredNoteid[synth->nRetiredSoundfonts] = synth->noteid;
+		synth->nRetiredSoundfonts++;
 	}
+	synth->soundfontP = swapP->sfP;
+	synth->soundfontCached = 1;
 
-	/* Set up the reverb / chorus buffers only, when the effect is
-	 * enabled on synth level.  Nonexisting buffers are detected in the
-	 * DSP loop. Not sending the reverb / chorus signal saves some time
-	 * in that case. */
-	reverbBuf = synth->withReverb ? synth->fxLeftBuf[0] : NULL;
-	chorusBuf = synth->withChorus ? synth->fxLeftBuf[1] : NULL;
+	/* the new font's indices come in, the old ones go back to be freed */
+	for (i = 0; i < PRESET_INDEX_BUCKETS; i++) {
+		indexP = synth->presetIndex[i];
+		synth->presetIndex[i] = swapP->presetIndex[i];
+		swapP->presetIndex[i] = indexP;
+	}
+	synthSetChannelPresets (synth);
+
+	swapP->sfP = NULL;
+	swapP->next = __atomic_load_n (&synth->doneFontSwapP, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n (&synth->doneFontSwapP, &swapP->next, swapP, 1,
+	                                     __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+		;
+}
+
+/*
+ *  synthRenderSpan
+ *
+ *  Renders frames [start, start + n) of the current block.
+ */
+static void synthRenderSpan (Synthesizer * synth, int start, int n) {
+	int i, auchan;
+	Voice *voice;
+	synthFxBusT *bus;
+	voiceBatchT batch;
 
 	/* call all playing synthesis processes */
-	for (i = 0; i < synth->polyphony; i++) {
-		voice = synth->voice[i];
+	if (synth->renderPool != NULL) {
+		renderPoolWrite (synth->renderPool, synth, start, n);
+		return;
+	}
+
+	voiceBatchBegin (&batch, start, n);
+
+	for (i = 0; i < synth->nActiveVoices; i++) {
+		voice = synth->activeVoice[i];
 
 		if (_PLAYING (voice)) {
 			/* The output associated with a MIDI channel is wrapped around
@@ -1652,45 +2743,130 @@ int synthOneBlock (Synthesizer * synth, int doNotMixFxToOut) {
 			 */
 			auchan = voice->chan;
 			auchan %= synth->audioGroups;
-			leftBuf = synth->leftBuf[auchan];
-			rightBuf = synth->rightBuf[auchan];
 
-			voiceWrite (voice, leftBuf, rightBuf, reverbBuf, chorusBuf);
+			bus = &synth->fxBus[voice->channel->fxBus];
+			bus->used = 1;
+
+			voiceBatchWrite (&batch, voice, synth->leftBuf[auchan], synth->rightBuf[auchan],
+			                 synth->withReverb ? bus->reverbBuf : NULL,
+			                 synth->withChorus ? bus->chorusBuf : NULL);
 		}
 	}
+	voiceBatchFlush (&batch);
+}
 
-	/* if multi channel output, don't mix the output of the chorus and
-	   reverb in the final output. The effects outputs are send
-	   separately. */
+/*
+ *  synthOneBlock
+ */
+int synthOneBlock (Synthesizer * synth, int doNotMixFxToOut) {
+	int i, nActive, start, end;
+	U32 cullStats[3];
+	Voice *voice;
+	synthFxBusT *bus;
+	busT *fxLeft[2], *fxRight[2];
+	int byteSize = BUFSIZE * sizeof (busT);
 
-	if (doNotMixFxToOut) {
+/*   mutexLock(synth->busy); /\* Here comes the audio thread. Lock the synth. *\/ */
 
-		/* send to reverb */
-		if (reverbBuf) {
-			revmodelProcessreplace (synth->reverb, reverbBuf,
-																		 synth->fxLeftBuf[0],
-																		 synth->fxRightBuf[0]);
+	/* clean the audio buffers */
+  // MB TODO: look at how this is defined so you can memset it in one fell swoop. This is lame.
+	for (i = 0; i < synth->nbuf; i++) {
+		MEMSET (synth->leftBuf[i], 0, byteSize);
+		MEMSET (synth->rightBuf[i], 0, byteSize);
+	}
+
+	for (i = 0; i < synth->effectsChannels; i++) {
+		MEMSET (synth->fxLeftBuf[i], 0, byteSize);
+		MEMSET (synth->fxRightBuf[i], 0, byteSize);
+	}
+
+	/* only the buses that were sent to in the last block have to be
+	 * cleared.  The voices only get reverb / chorus sends, when the
+	 * effect is enabled on synth level; not sending the signal saves
+	 * some time in that case. */
+	for (i = 0; i < synth->nFxBuses; i++) {
+		bus = &synth->fxBus[i];
+		if (bus->used) {
+			MEMSET (bus->reverbBuf, 0, byteSize);
+			MEMSET (bus->chorusBuf, 0, byteSize);
+			bus->used = 0;
 		}
+	}
 
-		/* send to chorus */
-		if (chorusBuf) {
-			chorusProcessreplace (synth->chorus, chorusBuf,
-																	 synth->fxLeftBuf[1],
-																	 synth->fxRightBuf[1]);
+	/* a new soundfont before the commands that may play it */
+	synthSwapSoundfont (synth);
+
+	/* what the control threads sent since the last block */
+	synthDrainCmdQueues (synth);
+
+	/* which voices the budget leaves out of this block */
+	synthApplyVoiceBudget (synth);
+
+	/* Render the block in spans that end where the next queued event is
+	 * due.  Without events inside the block that's a single span. */
+	for (start = 0; start < BUFSIZE; start = end) {
+		synthApplyEvents (synth, synth->blockFrame + start);
+
+		end = BUFSIZE;
+		if (synth->eventHead < synth->eventTail
+				&& synth->eventQueue[synth->eventHead].frame < synth->blockFrame + BUFSIZE)
+			end = (int) (synth->eventQueue[synth->eventHead].frame - synth->blockFrame);
+
+		/* controller messages up to here, coalesced */
+		synthModulatePending (synth);
+		synthRenderSpan (synth, start, end - start);
+	}
+
+	/* Compact the active list: voices that were found idle (or finished in
+	 * this block) drop out, synthStartVoice appends them again when reused. */
+	nActive = 0;
+	cullStats[0] = cullStats[1] = cullStats[2] = 0;
+	for (i = 0; i < synth->nActiveVoices; i++) {
+		voice = synth->activeVoice[i];
+		if (_PLAYING (voice) || voice->culled != VOICE_CULL_NONE)
+			cullStats[voice->culled]++;
+		voice->culled = VOICE_CULL_NONE;
+		if (_PLAYING (voice)) {
+			synth->activeVoice[nActive++] = voice;
+		} else {
+			voice->active = 0;
+			voiceMgrUnlink (synth->voiceMgr, voice);
+			voiceMgrFree (synth->voiceMgr, voice);
 		}
+	}
+	synth->nActiveVoices = nActive;
+	for (i = 0; i < 3; i++)
+		__atomic_store_n (&synth->cullStats[i], cullStats[i], __ATOMIC_RELAXED);
+
+	/* reorder the voices whose envelope moved on in this block */
+	voiceMgrFlush (synth->voiceMgr);
 
+	/* if multi channel output, don't mix the output of the chorus and
+	   reverb in the final output. The effects outputs are send
+	   separately. */
+	if (doNotMixFxToOut) {
+		fxLeft[0] = synth->fxLeftBuf[0];
+		fxRight[0] = synth->fxRightBuf[0];
+		fxLeft[1] = synth->fxLeftBuf[1];
+		fxRight[1] = synth->fxRightBuf[1];
 	} else {
+		fxLeft[0] = fxLeft[1] = synth->leftBuf[0];
+		fxRight[0] = fxRight[1] = synth->rightBuf[0];
+	}
+
+	/* A bus without sends in this block may still be ringing out; it only
+	 * drops out once its effects went idle. */
+	for (i = 0; i < synth->nFxBuses; i++) {
+		bus = &synth->fxBus[i];
 
 		/* send to reverb */
-		if (reverbBuf) {
-			revmodelProcessmix (synth->reverb, reverbBuf,
-																 synth->leftBuf[0], synth->rightBuf[0]);
+		if (synth->withReverb && (bus->used || !revmodelIdle (bus->reverb))) {
+			revmodelProcessmix (bus->reverb, bus->reverbBuf, fxLeft[0], fxRight[0]);
 		}
 
 		/* send to chorus */
-		if (chorusBuf) {
-			chorusProcessmix (synth->chorus, chorusBuf,
-															 synth->leftBuf[0], synth->rightBuf[0]);
+		if (synth->withChorus && (bus->used || !chorusIdle (bus->chorus))) {
+			chorusProcessmix (bus->chorus, bus->chorusBuf, fxLeft[1], fxRight[1]);
 		}
 	}
 
@@ -1703,6 +2879,7 @@ int synthOneBlock (Synthesizer * synth, int doNotMixFxToOut) {
 #endif
 
 	synth->ticks += BUFSIZE;
+	synth->blockFrame += BUFSIZE;
 
 	return 0;
 }
@@ -1711,79 +2888,25 @@ int synthOneBlock (Synthesizer * synth, int doNotMixFxToOut) {
 /*
  * synthFreeVoiceByKill
  *
- * selects a voice for killing. the selection algorithm is a refinement
- * of the algorithm previously in synthAllocVoice.
+ * selects a voice for killing: the lowest priority voice, see
+ * voiceMgrPrio.
  */
 Voice *synthFreeVoiceByKill (Synthesizer * synth) {
-	int i;
-	U32 bestPrio = 999999.;
-	U32 thisVoicePrio;
 	Voice *voice;
-	int bestVoiceIndex = -1;
-
-/*   mutexLock(synth->busy); /\* Don't interfere with the audio thread *\/ */
-/*   mutexUnlock(synth->busy); */
-
-	for (i = 0; i < synth->polyphony; i++) {
-
-		voice = synth->voice[i];
 
-		/* safeguard against an available voice. */
-		if (_AVAILABLE (voice)) {
-			return voice;
-		}
-
-		/* Determine, how 'important' a voice is.
-		 * Start with an arbitrary number */
-		thisVoicePrio = 10000.;
-
-		/* Is this voice on the drum channel?
-		 * Then it is very important.
-		 * Also, forget about the released-note condition:
-		 * Typically, drum notes are triggered only very briefly, they run most
-		 * of the time in release phase.
-		 */
-		if (_RELEASED (voice)) {
-			/* The key for this voice has been released. Consider it much less important
-			 * than a voice, which is still held.
-			 */
-			thisVoicePrio -= 2000.;
-		}
-
-		if (_SUSTAINED (voice)) {
-			/* The sustain pedal is held down on this channel.
-			 * Consider it less important than non-sustained channels.
-			 * This decision is somehow subjective. But usually the sustain pedal
-			 * is used to play 'more-voices-than-fingers', so it shouldn't hurt
-			 * if we kill one voice.
-			 */
-			thisVoicePrio -= 1000;
-		}
-
-		/* We are not enthusiastic about releasing voices, which have just been started.
-		 * Otherwise hitting a chord may result in killing notes belonging to that very same
-		 * chord.
-		 * So subtract the age of the voice from the priority - an older voice is just a little
-		 * bit less important than a younger voice.
-		 * This is a number between roughly 0 and 100.*/
-		thisVoicePrio -= (synth->noteid - voice->id);
-
-		/* take a rough estimate of loudness into account. Louder voices are more important. */
-		if (voice->volenvSection != VOICE_ENVATTACK) {
-			thisVoicePrio += voice->volenvVal * 1000.;
-		}
-
-		/* check if this voice has less priority than the previous candidate. */
-		if (thisVoicePrio < bestPrio)
-			bestVoiceIndex = i, bestPrio = thisVoicePrio;
-	}
-
-	if (bestVoiceIndex < 0) {
+	/* the voice manager keeps the started voices ordered by priority,
+	 * voices that are already off first */
+	voice = voiceMgrVictim (synth->voiceMgr);
+	if (voice == NULL) {
 		return NULL;
 	}
 
-	voice = synth->voice[bestVoiceIndex];
-	voiceOff (voice);
+	if (!_AVAILABLE (voice)) {
+		voiceOff (voice);
+	}
+	/* It stays in synth->activeVoice; only the manager forgets about it
+	 * until synthStartVoice. */
+	voiceMgrUnlink (synth->voiceMgr, voice);
 
 	return voice;
 }
@@ -1794,20 +2917,17 @@ Voice *synthFreeVoiceByKill (Synthesizer * synth) {
 Voice *synthAllocVoice (Synthesizer * synth,
 																				Sample * sample, int chan,
 																				int key, int vel) {
-	int i, k;
 	Voice *voice = NULL;
 	Channel *channel = NULL;
 
-/*   mutexLock(synth->busy); /\* Don't interfere with the audio thread *\/ */
-/*   mutexUnlock(synth->busy); */
+	if (chan >= 0 && chan < synth->midiChannels) {
+		channel = synth->channel[chan];
+	} else {
+		return NULL;
+	}
 
 	/* check if there's an available synthesis process */
-	for (i = 0; i < synth->polyphony; i++) {
-		if (_AVAILABLE (synth->voice[i])) {
-			voice = synth->voice[i];
-			break;
-		}
-	}
+	voice = voiceMgrAlloc (synth->voiceMgr);
 
 	/* No success yet? Then stop a running voice. */
 	if (voice == NULL) {
@@ -1818,15 +2938,12 @@ Voice *synthAllocVoice (Synthesizer * synth,
 		return NULL;
 	}
 
-	if (chan >= 0) {
-		channel = synth->channel[chan];
-	} else {
-		return NULL;
-	}
-
 	if (voiceInit (voice, sample, channel, key, vel,
 												synth->storeid, synth->ticks,
 												synth->gain) != OK) {
+		/* a stolen voice is still listed and comes back when the block ends */
+		if (!voice->active)
+			voiceMgrFree (synth->voiceMgr, voice);
 		return NULL;
 	}
 
@@ -1859,7 +2976,7 @@ void synthKillByExclusiveClass (Synthesizer * synth, Voice * newVoice) {
       class exclClass.
   */
 
-	int i;
+	Voice *existingVoice, *nextVoice;
 	int exclClass = _GEN (newVoice, GEN_EXCLUSIVECLASS);
 
 	/* Check if the voice belongs to an exclusive class. In that case,
@@ -1871,31 +2988,26 @@ void synthKillByExclusiveClass (Synthesizer * synth, Voice * newVoice) {
 	}
 
 	/* Kill all notes on the same channel with the same exclusive class */
+	if (exclClass >= 128) {
+		return;
+	}
 
-	for (i = 0; i < synth->polyphony; i++) {
-		Voice *existingVoice = synth->voice[i];
+	for (existingVoice = voiceMgrClassVoices (synth->voiceMgr, newVoice->chan, exclClass);
+			 existingVoice != NULL; existingVoice = nextVoice) {
+		nextVoice = existingVoice->classNext;
 
 		/* Existing voice does not play? Leave it alone. */
 		if (!_PLAYING (existingVoice)) {
 			continue;
 		}
 
-		/* An exclusive class is valid for a whole channel (or preset).
-		 * Is the voice on a different channel? Leave it alone. */
-		if (existingVoice->chan != newVoice->chan) {
-			continue;
-		}
-
-		/* Existing voice has a different (or no) exclusive class? Leave it alone. */
-		if ((int) _GEN (existingVoice, GEN_EXCLUSIVECLASS) != exclClass) {
-			continue;
-		}
-
 		/* Existing voice is a voice process belonging to this noteon
 		 * event (for example: stereo sample)?  Leave it alone. */
 		if (existingVoice->id == newVoice->id) 
 			continue;
 
+		/* killed once is enough: it also drops its exclusive class */
+		voiceMgrUnlinkClass (synth->voiceMgr, existingVoice);
 		voiceKillExcl (existingVoice);
 	};
 };
@@ -1913,14 +3025,21 @@ void synthStartVoice (Synthesizer * synth, Voice * voice) {
 	/* Start the new voice */
 
 	voiceStart (voice);
+
+	/* and hand it to the block loop */
+	if (!voice->active) {
+		voice->active = 1;
+		synth->activeVoice[synth->nActiveVoices++] = voice;
+	}
+	voiceMgrStart (synth->voiceMgr, voice, (int) _GEN (voice, GEN_EXCLUSIVECLASS));
 }
 
 /* * synthGetVoicelist */
 void synthGetVoicelist (Synthesizer * synth, Voice * buf[], int bufsize, int ID) {
 	int i;
 	int count = 0;
-	for (i = 0; i < synth->polyphony; i++) {
-		Voice *voice = synth->voice[i];
+	for (i = 0; i < synth->nActiveVoices; i++) {
+		Voice *voice = synth->activeVoice[i];
 		if (count >= bufsize) 
 			return;
 
@@ -1946,14 +3065,13 @@ void synthGetVoicelist (Synthesizer * synth, Voice * buf[], int bufsize, int ID)
 void
 synthReleaseVoiceOnSameNote (Synthesizer * synth, int chan,
 																				int key) {
-	int i;
 	Voice *voice;
 
-/*   mutexLock(synth->busy); /\* Don't interfere with the audio thread *\/ */
-/*   mutexUnlock(synth->busy); */
+	if ((chan < 0) || (chan >= synth->midiChannels) || (key < 0) || (key >= 128)) {
+		return;
+	}
 
-	for (i = 0; i < synth->polyphony; i++) {
-		voice = synth->voice[i];
+	for (voice = voiceMgrKeyVoices (synth->voiceMgr, chan, key); voice != NULL; voice = voice->keyNext) {
 		if (_PLAYING (voice)
 				&& (voice->chan == chan)
 				&& (voice->key == key)
@@ -2022,10 +3140,52 @@ tuningT *synthCreateTuning (Synthesizer * synth, int bank, int prog, const char
 	return synth->tuning[bank][prog];
 }
 
+/*
+ * synthQueueTuning
+ *
+ * Takes a payload slot for a tuning command and fills in the tuning;
+ * NULL if the arguments are out of range or the slots are all taken.
+ */
+static synthSysexT *synthQueueTuning (Synthesizer * synth, int bank, int prog, const char *name) {
+	synthSysexT *sysexP;
+
+	if (!(bank >= 0 && bank < 128))
+		return NULL;
+	if (!(prog >= 0 && prog < 128))
+		return NULL;
+	if (!(name != NULL))
+		return NULL;
+
+	sysexP = synthCmdQueueSlot (synth->cmdQueue[0]);
+	if (sysexP == NULL)
+		return NULL;
+	sysexP->len = 0;
+	sysexP->u.tuning.bank = bank;
+	sysexP->u.tuning.prog = prog;
+	strncpy (sysexP->u.tuning.name, name, SYNTH_TUNING_NAME - 1);	//STRNCPY
+	sysexP->u.tuning.name[SYNTH_TUNING_NAME - 1] = 0;
+	return sysexP;
+}
+
 int
 synthCreateKeyTuning (Synthesizer * synth,
 															 int bank, int prog,
 															 const char *name, double *pitch) {
+	synthSysexT *sysexP = synthQueueTuning (synth, bank, prog, name);
+
+	if (sysexP == NULL)
+		return FAILED;
+	if (pitch) {
+		MEMCPY (sysexP->u.tuning.pitch, pitch, 128 * sizeof (double));
+		sysexP->len = 128;
+	}
+	return synthCmdQueuePushSlot (synth->cmdQueue[0], SYNTH_CMD_KEY_TUNING, 0, 0);
+}
+
+/*
+ * synthCreateKeyTuningLocal
+ */
+static int synthCreateKeyTuningLocal (Synthesizer * synth, int bank, int prog, const char *name, double *pitch) {
 	tuningT *tuning =
 		synthCreateTuning (synth, bank, prog, name);
 	if (tuning == NULL) {
@@ -2042,19 +3202,26 @@ int
 synthCreateOctaveTuning (Synthesizer * synth,
 																	int bank, int prog,
 																	const char *name, const double *pitch) {
-	tuningT *tuning;
+	synthSysexT *sysexP;
 
 	if (!(synth != NULL))
 		return FAILED;				//returnValIfFail
-	if (!(bank >= 0 && bank < 128))
-		return FAILED;				//returnValIfFail
-	if (!(prog >= 0 && prog < 128))
-		return FAILED;				//returnValIfFail
-	if (!(name != NULL))
-		return FAILED;				//returnValIfFail
 	if (!(pitch != NULL))
 		return FAILED;				//returnValIfFail
 
+	sysexP = synthQueueTuning (synth, bank, prog, name);
+	if (sysexP == NULL)
+		return FAILED;
+	MEMCPY (sysexP->u.tuning.pitch, pitch, 12 * sizeof (double));
+	return synthCmdQueuePushSlot (synth->cmdQueue[0], SYNTH_CMD_OCTAVE_TUNING, 0, 0);
+}
+
+/*
+ * synthCreateOctaveTuningLocal
+ */
+static int synthCreateOctaveTuningLocal (Synthesizer * synth, int bank, int prog, const char *name, const double *pitch) {
+	tuningT *tuning;
+
 	tuning = synthCreateTuning (synth, bank, prog, name);
 	if (tuning == NULL) {
 		return FAILED;
@@ -2083,26 +3250,46 @@ int synthActivateOctaveTuning (Synthesizer * synth, int bank, int prog, const ch
 
 
 int synthTuneNotes (Synthesizer * synth, int bank, int prog, int len, int *key, double *pitch, int apply) {
-	tuningT *tuning;
+	synthSysexT *sysexP;
 	int i;
 
 	if (!(synth != NULL))
 		return FAILED;				//returnValIfFail
-	if (!(bank >= 0 && bank < 128))
-		return FAILED;				//returnValIfFail
-	if (!(prog >= 0 && prog < 128))
-		return FAILED;				//returnValIfFail
-	if (!(len > 0))
+	if (!(len > 0 && len <= 128))
 		return FAILED;				//returnValIfFail
 	if (!(key != NULL))
 		return FAILED;				//returnValIfFail
 	if (!(pitch != NULL))
 		return FAILED;				//returnValIfFail
+	for (i = 0; i < len; i++) {
+		if (!(key[i] >= 0 && key[i] < 128))
+			return FAILED;			//returnValIfFail
+	}
+
+	sysexP = synthQueueTuning (synth, bank, prog, "Unnamed");
+	if (sysexP == NULL)
+		return FAILED;
+	for (i = 0; i < len; i++)
+		sysexP->u.tuning.key[i] = key[i];
+	MEMCPY (sysexP->u.tuning.pitch, pitch, len * sizeof (double));
+	sysexP->len = len;
+	return synthCmdQueuePushSlot (synth->cmdQueue[0], SYNTH_CMD_TUNE_NOTES, 0, 0);
+}
+
+/*
+ * synthTuneNotesLocal
+ *
+ * A tuning that doesn't exist yet is made, as "Unnamed".
+ */
+static int synthTuneNotesLocal (Synthesizer * synth, int bank, int prog, int len, U8 * key, double *pitch) {
+	tuningT *tuning = NULL;
+	int i;
 
-	tuning = synth->tuning[bank][prog];
+	if (synth->tuning != NULL && synth->tuning[bank] != NULL)
+		tuning = synth->tuning[bank][prog];
 
 	if (!tuning)
-		tuning = newTuning ("Unnamed", bank, prog);
+		tuning = synthCreateTuning (synth, bank, prog, "Unnamed");
 
 	if (tuning == NULL) {
 		return FAILED;
@@ -2115,9 +3302,12 @@ int synthTuneNotes (Synthesizer * synth, int bank, int prog, int len, int *key,
 	return OK;
 }
 
+/*
+ * synthSelectTuning
+ *
+ * Queued; FAILED at the next block if the tuning doesn't exist by then.
+ */
 int synthSelectTuning (Synthesizer * synth, int chan, int bank, int prog) {
-	tuningT *tuning;
-
 	if (!(synth != NULL))
 		return FAILED;				//returnValIfFail
 	if (!(bank >= 0 && bank < 128))
@@ -2125,12 +3315,22 @@ int synthSelectTuning (Synthesizer * synth, int chan, int bank, int prog) {
 	if (!(prog >= 0 && prog < 128))
 		return FAILED;				//returnValIfFail
 
-	tuning = synth->tuning[bank][prog];
+	return synthPost (synth, SYNTH_CMD_SELECT_TUNING, chan, bank, prog);
+}
 
-	if (tuning == NULL) {
+/*
+ * synthSelectTuningLocal
+ */
+static int synthSelectTuningLocal (Synthesizer * synth, int chan, int bank, int prog) {
+	tuningT *tuning = NULL;
+
+	/* the sysex octave tunings name 16 channels */
+	if (chan >= synth->midiChannels)
 		return FAILED;
-	}
-	if ((chan < 0) || (chan >= synth->midiChannels)) {
+	if (synth->tuning != NULL && synth->tuning[bank] != NULL)
+		tuning = synth->tuning[bank][prog];
+
+	if (tuning == NULL) {
 		return FAILED;
 	}
 
@@ -2157,9 +3357,13 @@ int synthActivateTuning (Synthesizer * synth, int chan, int bank, int prog, int
 }
 
 int synthResetTuning (Synthesizer * synth, int chan) {
-	if ((chan < 0) || (chan >= synth->midiChannels)) 
-		return FAILED;
+	return synthPost (synth, SYNTH_CMD_RESET_TUNING, chan, 0, 0);
+}
 
+/*
+ * synthResetTuningLocal
+ */
+static int synthResetTuningLocal (Synthesizer * synth, int chan) {
   synth->channel[chan]->tuning = NULL;
 	//channelSetTuning (synth->channel[chan], NULL);
 
@@ -2206,11 +3410,25 @@ int synthTuningIterationNext (Synthesizer * synth, int *bank, int *prog) {
 }
 
 int synthSetGen (Synthesizer * synth, int chan, int genId, S16 value) {
+	synthSysexT *sysexP;
+
 	if ((chan < 0) || (chan >= synth->midiChannels)) 
 		return FAILED;
 	if ((genId < 0) || (genId >= GEN_LAST)) 
 		return FAILED;
 
+	sysexP = synthCmdQueueSlot (synth->cmdQueue[0]);
+	if (sysexP == NULL)
+		return FAILED;
+	sysexP->u.gen.genId = genId;
+	sysexP->u.gen.value = value;
+	return synthCmdQueuePushSlot (synth->cmdQueue[0], SYNTH_CMD_SET_GEN, chan, 0);
+}
+
+/*
+ * synthSetGenLocal
+ */
+static int synthSetGenLocal (Synthesizer * synth, int chan, int genId, S16 value) {
   synth->channel[chan]->genAbs[genId] = value;
 
 	Voice *voice;
@@ -2245,14 +3463,29 @@ int synthSetGen (Synthesizer * synth, int chan, int genId, S16 value) {
     scaled and shifted to the range defined in the SoundFont
     specifications.
 
+    The change is queued and applies at the next block.
  */
 int synthSetGen2 (Synthesizer * synth, int chan, int genId, U32 value, int absolute, int normalized) {
+	synthSysexT *sysexP;
+
 	if ((chan < 0) || (chan >= synth->midiChannels)) 
 		return FAILED;
 	if ((genId < 0) || (genId >= GEN_LAST)) 
 		return FAILED;
 
-	S16 v = (normalized) ? genScale (genId, value) : value;
+	sysexP = synthCmdQueueSlot (synth->cmdQueue[0]);
+	if (sysexP == NULL)
+		return FAILED;
+	sysexP->u.gen.genId = genId;
+	sysexP->u.gen.value = (normalized) ? genScale (genId, value) : value;
+	sysexP->u.gen.absolute = absolute != 0;
+	return synthCmdQueuePushSlot (synth->cmdQueue[0], SYNTH_CMD_SET_GEN2, chan, 0);
+}
+
+/*
+ * synthSetGen2Local
+ */
+static int synthSetGen2Local (Synthesizer * synth, int chan, int genId, S16 v, int absolute) {
 	channelSetGen (synth->channel[chan], genId, v, absolute);
 
 	Voice *voice;
@@ -2298,8 +3531,8 @@ int synthStop (Synthesizer * synth, U32 id) {
 	int status = FAILED;
 	int count = 0;
 
-	for (i = 0; i < synth->polyphony; i++) {
-		voice = synth->voice[i];
+	for (i = 0; i < synth->nActiveVoices; i++) {
+		voice = synth->activeVoice[i];
 
 		if (_ON (voice) && (voice->id == id)) {
 			count++;
@@ -2311,204 +3544,29 @@ int synthStop (Synthesizer * synth, U32 id) {
 	return status;
 }
 
-#define keyVelAreInRange_(zoneP, key, vel) \
-  (key) >= zoneP->keylo && (key) <= zoneP->keyhi && \
-  (vel) >= zoneP->vello && (vel) <= zoneP->velhi
-
-int presetNoteon (Preset *presetP, Synthesizer * synth, int chan, int key, int vel) {
-  Modulator *modP, *modEndP;
-  Zone *pzoneP, *globalPresetZone;
-  Instrument *instP;
-  Zone *izoneP, *globalIzoneP;
-  Sample *sampleP;
+/*
+ * presetNoteon
+ *
+ * Starts a voice for every zone pair of the preset that covers key and
+ * velocity.  The zones are looked up and premerged in the preset's index
+ * (see preset_index.h), so this is a table lookup and a copy per voice.
+ */
+int presetNoteon (PresetIndex *indexP, Synthesizer * synth, int chan, int key, int vel) {
+  presetCellT *cellP = presetIndexCell_(indexP, key, vel);
+  U32 *zoneIdxP = indexP->zoneList + cellP->first;
+  U32 *zoneIdxEndP = zoneIdxP + cellP->n;
+  presetZoneT *zoneP;
   Voice *voiceP;
-  Modulator *modList[NUM_MOD]; /* list for 'sorting' preset modulators */
-  Generator *genP, *genEndP;
-  int modListCount;
-  int i;
-
-  globalPresetZone = presetP->globalZoneP;
-
-  /* run thru all the zones of this preset */
-  Zone *pzoneEndP = presetP->zoneA + presetP->nZones;
-  for (Zone *pzoneP = presetP->zoneA; pzoneP < pzoneEndP; ++pzoneP) {
-    /* check if the note falls into the key and velocity range of this preset */
-    if (keyVelAreInRange_(pzoneP, key, vel)) {
-      instP = pzoneP->u.instP;
-      globalIzoneP = instP->globalZoneP;
-
-      /* run thru all the zones of this instrument */
-      Zone *izoneEndP = instP->zoneA + instP->nZones;
-      for (izoneP = instP->zoneA; izoneP < izoneEndP; ++izoneP) {
-        /* make sure this instrument zone has a valid sample */
-        sampleP = izoneP->u.sampleP;
-        /* check if the note falls into the key and velocity range of this instrument */
-        if (keyVelAreInRange_(izoneP, key, vel) && sampleP != NULL) {
-          /* this is a good zone. allocate a new synthesis process and initialize it */
-          voiceP = synthAllocVoice (synth, sampleP, chan, key, vel);
-          if (voiceP == NULL) 
-            return FAILED;
-          /* Instrument level, generators */
-          genEndP = izoneP->genA + izoneP->nGens;
-          for (genP = izoneP->genA; genP < genEndP; ++genP) {
-            /* SF 2.01 section 9.4 'bullet' 4:
-             *
-             *A generator in a local instrument zone supersedes a
-             *global instrument zone generator.  Both cases supersede
-             *the default generator -> voiceGenSet */
-            U8 genType = genP->genType;
-            if (genP->flags) 
-              voiceP->gen[genType] = *genP;
-            else if ((globalIzoneP != NULL) && (globalIzoneP->genA[genType].flags)) 
-              voiceP->gen[genType] = globalIzoneP->genA[genType];
-            voiceP->gen[genType].flags = (voiceP->gen[genType].val != 0);  // true evalutes to GEN_SET enum (1).
-          }                     /* for all generators */
-
-          /* global instrument zone, modulators: Put them all into a list. */
-          modListCount = 0;
-          if (globalIzoneP) {
-            Generator *genEndP = globalIzoneP->genA + globalIzoneP->nGens;
-            for (Generator *genP = globalIzoneP->genA; genP < genEndP; ++genP) {
-              memcpy(&modList[modListCount], genP->modA, sizeof(Modulator) * genP->nMods);
-              modListCount += genP->nMods;
-            }
-          }
-
-          /* local instrument zone, modulators.
-           *Replace modulators with the same definition in the list:
-           *SF 2.01 page 69, 'bullet' 8
-           */
-          genEndP = izoneP->genA + izoneP->nGens;
-          for (Generator *genP = izoneP->genA; genP < genEndP; ++genP) {
-            Modulator *modEndP = genP->modA + genP->nMods;
-            for (Modulator *modP = genP->modA; modP < modEndP; ++modP) {
-              /* 'Identical' modulators will be deleted by setting their
-               * list entry to NULL.  The list length is known, NULL
-               * entries will be ignored later.  SF2.01 section 9.5.1
-               * page 69, 'bullet' 3 defines 'identical'.  */
-
-              // MB test for identity another, faster way
-              for (i = 0; i < modListCount; i++) 
-                if (modList[i] && modTestIdentity (modP, modList[i])) 
-                  modList[i] = NULL;
-
-            /* Finally add the new modulator to to the list. */
-              modList[modListCount++] = modP;
-            }
-          }
-          /* Add instrument modulators (global / local) to the voiceP. */
-          for (i = 0; i < modListCount; i++) {
-            modP = modList[i];
-            if (modP != NULL)   /* disabled modulators CANNOT be skipped. */
-
-              /* Instrument modulators -supersede- existing (default)
-               *modulators.  SF 2.01 page 69, 'bullet' 6 */
-              voiceAddMod (voiceP, modP, VOICE_OVERWRITE);
-          }
-
-          /* Preset level, generators */
-          for (i = 0; i < GEN_LAST; i++) {
-
-            /* SF 2.01 section 8.5 page 58: If some generators are
-             *encountered at preset level, they should be ignored */
-            if ((i != GEN_STARTADDROFS)
-                && (i != GEN_ENDADDROFS)
-                && (i != GEN_STARTLOOPADDROFS)
-                && (i != GEN_ENDLOOPADDROFS)
-                && (i != GEN_STARTADDRCOARSEOFS)
-                && (i != GEN_ENDADDRCOARSEOFS)
-                && (i != GEN_STARTLOOPADDRCOARSEOFS)
-                && (i != GEN_KEYNUM)
-                && (i != GEN_VELOCITY)
-                && (i != GEN_ENDLOOPADDRCOARSEOFS)
-                && (i != GEN_SAMPLEMODE)
-                && (i != GEN_EXCLUSIVECLASS)
-                && (i != GEN_OVERRIDEROOTKEY)) {
-
-              /* SF 2.01 section 9.4 'bullet' 9: A generator in a
-               *local preset zone supersedes a global preset zone
-               *generator.  The effect is -added- to the destination
-               *summing node -> voiceGenIncr */
-
-              if (pzoneP->genA[i].flags) {
-                voiceP->gen[i].val += pzoneP->genA[i].val;
-              } else if ((globalPresetZone != NULL)
-                         && globalPresetZone->genA[i].flags) {
-                voiceP->gen[i].val += globalPresetZone->genA[i].val;
-              } else {
-                /* The generator has not been defined in this preset
-                 *Do nothing, leave it unchanged.
-                 */
-              }
-              voiceP->gen[i].flags = (voiceP->gen[i].val != 0);  // true evalutes to GEN_SET enum (1).
-            }                   /* if available at preset level */
-          }                     /* for all generators */
-
-
-          /* Global preset zone, modulators: put them all into a list. */
-          modListCount = 0;
-          if (globalPresetZone) {
-            Generator *genEndP = globalPresetZone->genA + 
-                                 globalPresetZone->nGens;
-            for (Generator *genP = globalPresetZone->genA;
-                genP < genEndP;
-                ++genP) {
-              Modulator *modEndP = genP->modA + genP->nMods;
-              for (Modulator *modP = genP->modA;
-                   modP < modEndP;
-                   ++modP)
-                modList[modListCount++] = modP;
-            }
-          }
-
-          /* Process the modulators of the local preset zone.  Kick
-           *out all identical modulators from the global preset zone
-           *(SF 2.01 page 69, second-last bullet) */
-
-          Generator *genEndP = pzoneP->genA + 
-                                 pzoneP->nGens;
-          for (Generator *genP = pzoneP->genA;
-                genP < genEndP;
-                ++genP) {
-              Modulator *modEndP = genP->modA + genP->nMods;
-              for (Modulator *modP = genP->modA;
-                   modP < modEndP;
-                   ++modP)
-                for (i = 0; i < modListCount; i++) 
-                  if (modList[i] && modTestIdentity (modP, modList[i])) 
-                    modList[i] = NULL;
-                /* Finally add the new modulator to the list. */
-                modList[modListCount++] = modP;
-            }
-          }
-
-          /* Add preset modulators (global / local) to the voiceP. */
-          Modulator **modEndPP = modList + modListCount;
-          U32 nModsActuallyUsed = 0;
-          for (Modulator **modPP = modList;
-              modPP < modEndPP;
-              ++modPP) {
-            if ((*modPP != NULL) && ((*modPP)->amount != 0)) {  /* disabled modulators can be skipped. */
-              /* Preset modulators -add- to existing instrument /
-               *default modulators.  SF2.01 page 70 first bullet on page */
-              voiceAddMod (voiceP, (*modPP), VOICE_ADD);
-              ++nModsActuallyUsed;
-            }
-          }
-          voiceP->nMods = nModsActuallyUsed;
-
-          /* add the synthesis process to the synthesis loop. */
-          synthStartVoice (synth, voiceP);
-
-          /* Store the ID of the first voiceP that was created by this noteon event.
-           *Exclusive class may only terminate older voices.
-           *That avoids killing voices, which have just been created.
-           *(a noteon event can create several voice processes with the same exclusive
-           *class - for example when using stereo samples)
-           */
-        }
-      }  // if note/vel falls in izone's range
-    }  // if note/vel falls in pzone's range
+
+  for (; zoneIdxP < zoneIdxEndP; ++zoneIdxP) {
+    zoneP = &indexP->zoneA[*zoneIdxP];
+    /* this is a good zone. allocate a new synthesis process and initialize it */
+    voiceP = synthAllocVoice (synth, zoneP->sampleP, chan, key, vel);
+    if (voiceP == NULL)
+      return FAILED;
+    presetZoneApply (zoneP, voiceP);
+    /* add the synthesis process to the synthesis loop. */
+    synthStartVoice (synth, voiceP);
   }
 
   return OK;
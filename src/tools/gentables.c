@@ -0,0 +1,179 @@
+/* gentables - prints the synth's lookup tables as C source.
+ *
+ * Run by the build (see CMakeLists.txt):  gentables > tables.c
+ *
+ * The math is what conversionConfig and dspFloatConfig used to do at
+ * startup; see tables.h for what the tables are for.
+ */
+#define GENTABLES
+#include <stdio.h>
+#include <math.h>
+#include "phase.h"
+#include "tables.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+#ifndef PI
+#define PI                          3.141592654
+#endif
+
+/*
+ * printValues
+ */
+static void printValues (const double *v, int n) {
+	int i;
+
+	for (i = 0; i < n; i++)
+		printf ("%s%.17g,", (i % 4 == 0) ? "\n\t" : " ", v[i]);
+}
+
+/*
+ * printTable
+ *
+ * Prints a one dimensional table of 'n' values.
+ */
+static void printTable (const char *type, const char *name, const char *dims,
+                        const char *attr, const double *v, int n) {
+	printf ("const %s %s%s%s = {", type, name, dims, attr);
+	printValues (v, n);
+	printf ("\n};\n\n");
+}
+
+/*
+ * printRows
+ *
+ * Prints 'rows' rows of 'width' values, each padded with 'pad' zeros.
+ */
+static void printRows (const char *type, const char *name, const char *attr,
+                       const double *v, int rows, int width, int pad) {
+	int r, k, isFloat = type[0] == 'f';
+
+	printf ("const %s %s[%d][%d]%s = {\n", type, name, rows, width + pad, attr);
+	for (r = 0; r < rows; r++) {
+		printf ("\t{");
+		for (k = 0; k < width + pad; k++)
+			if (isFloat)		/* round like the old (float) casts, not on parsing */
+				printf ("%s%.9g", k ? ", " : "", k < width ? (float) v[r * width + k] : 0.0f);
+			else
+				printf ("%s%.17g", k ? ", " : "", k < width ? v[r * width + k] : 0.0);
+		printf ("},\n");
+	}
+	printf ("};\n\n");
+}
+
+static double ct2hzV[CENTS_HZ_SIZE];
+static double ct2hzOctV[CENTS_HZ_OCTAVES];
+static double cb2ampV[CB_AMP_SIZE + 1];
+static double atten2ampV[ATTEN_AMP_SIZE + 1];
+static double concaveV[128];
+static double convexV[128];
+static double panV[PAN_SIZE];
+static double linearV[INTERP_MAX * 2];
+static double coeff4V[INTERP_MAX * 4];
+static double sinc7V[INTERP_MAX * SINC_INTERP_ORDER];
+
+int main (void) {
+	int i, i2;
+	double x, v, iShifted;
+
+	for (i = 0; i < CENTS_HZ_SIZE; i++) 
+		ct2hzV[i] = pow (2.0, (double) i / 1200.0);
+	for (i = 0; i < CENTS_HZ_OCTAVES; i++)
+		ct2hzOctV[i] = ldexp (6.875, i);
+
+	/* centibels to amplitude conversion
+	 * Note: SF2.01 section 8.1.3: Initial attenuation range is
+	 * between 0 and 144 dB. Therefore a negative attenuation is
+	 * not allowed.
+	 */
+	for (i = 0; i < CB_AMP_SIZE; i++)
+		cb2ampV[i] = pow (10.0, (double) i / -200.0);
+	cb2ampV[CB_AMP_SIZE] = 0.0;
+
+	/* NOTE: EMU8k and EMU10k devices don't conform to the SoundFont
+	 * specification in regards to volume attenuation.  The below calculation
+	 * is an approx. equation for generating a table equivelant to the
+	 * cbToAmpTable[] in tables.c of the TiMidity++ source, which I'm told
+	 * was generated from device testing.  By the spec this should be centibels.
+	 */
+	for (i = 0; i < ATTEN_AMP_SIZE; i++) 
+		atten2ampV[i] = pow (10.0, (double) i / ATTEN_POWER_FACTOR);
+	atten2ampV[ATTEN_AMP_SIZE] = 0.0;
+
+	/* concave / convex unipolar positive transform curves (see mod.c
+	   modGetValue cases 4 and 8) */
+	concaveV[0] = 0.0;
+	concaveV[127] = 1.0;
+	convexV[0] = 0;
+	convexV[127] = 1.0;
+
+	/* There seems to be an error in the specs. The equations are
+	   implemented according to the pictures on SF2.01 page 73. */
+	for (i = 1; i < 127; i++) {
+		x = -20.0 / 96.0 * log ((i * i) / (127.0 * 127.0)) / log (10.0);
+		convexV[i] = 1.0 - x;
+		concaveV[127 - i] = x;
+	}
+
+	/* pan */
+	x = PI / 2.0 / (PAN_SIZE - 1.0);
+	for (i = 0; i < PAN_SIZE; i++) 
+		panV[i] = sin (i * x);
+
+	/* Initialize the coefficients for the interpolation. The math comes
+	 * from a mail, posted by Olli Niemitalo to the music-dsp mailing
+	 * list (I found it in the music-dsp archives
+	 * http://www.smartelectronix.com/musicdsp/).  */
+	for (i = 0; i < INTERP_MAX; i++) {
+		x = (double) i / (double) INTERP_MAX;
+
+		coeff4V[i * 4 + 0] = x * (-0.5 + x * (1 - 0.5 * x));
+		coeff4V[i * 4 + 1] = 1.0 + x * x * (1.5 * x - 2.5);
+		coeff4V[i * 4 + 2] = x * (0.5 + x * (2.0 - 1.5 * x));
+		coeff4V[i * 4 + 3] = 0.5 * x * x * (x - 1.0);
+
+		linearV[i * 2 + 0] = 1.0 - x;
+		linearV[i * 2 + 1] = x;
+	}
+
+	/* i: Offset in terms of whole samples, i2: in terms of fractional
+	 * samples ('subsamples') */
+	for (i = 0; i < SINC_INTERP_ORDER; i++) {
+		for (i2 = 0; i2 < INTERP_MAX; i2++) {
+			/* center on middle of table */
+			iShifted = (double) i - ((double) SINC_INTERP_ORDER / 2.0)
+				+ (double) i2 / (double) INTERP_MAX;
+
+			/* sinc(0) cannot be calculated straightforward (limit needed for 0/0) */
+			if (fabs (iShifted) > 0.000001) {
+				v = sin (iShifted * M_PI) / (M_PI * iShifted);
+				/* Hamming window */
+				v *= 0.5 * (1.0 + cos (2.0 * M_PI * iShifted / (double) SINC_INTERP_ORDER));
+			} else
+				v = 1.0;
+
+			sinc7V[(INTERP_MAX - i2 - 1) * SINC_INTERP_ORDER + i] = v;
+		}
+	}
+
+	printf ("/* Generated by src/tools/gentables.c, do not edit. */\n\n");
+	printf ("#include \"tables.h\"\n\n");
+
+	printTable ("realT", "ct2hzTab", "[CENTS_HZ_SIZE]", "", ct2hzV, CENTS_HZ_SIZE);
+	printTable ("realT", "ct2hzOctaveTab", "[CENTS_HZ_OCTAVES]", "", ct2hzOctV, CENTS_HZ_OCTAVES);
+	printTable ("realT", "cb2ampTab", "[CB_AMP_SIZE + 1]", "", cb2ampV, CB_AMP_SIZE + 1);
+	printTable ("realT", "atten2ampTab", "[ATTEN_AMP_SIZE + 1]", "", atten2ampV, ATTEN_AMP_SIZE + 1);
+	printTable ("realT", "concaveTab", "[128]", "", concaveV, 128);
+	printTable ("realT", "convexTab", "[128]", "", convexV, 128);
+	printTable ("realT", "panTab", "[PAN_SIZE]", "", panV, PAN_SIZE);
+
+	printRows ("realT", "interpCoeffLinear", "", linearV, INTERP_MAX, 2, 0);
+	printRows ("realT", "interpCoeff", "", coeff4V, INTERP_MAX, 4, 0);
+	printRows ("realT", "sincTable7", "", sinc7V, INTERP_MAX, SINC_INTERP_ORDER, 0);
+	printRows ("float", "interpCoeffLinearF", " __attribute__ ((aligned (32)))", linearV, INTERP_MAX, 2, 0);
+	printRows ("float", "interpCoeffF", " __attribute__ ((aligned (32)))", coeff4V, INTERP_MAX, 4, 0);
+	printRows ("float", "sincTable7F", " __attribute__ ((aligned (32)))", sinc7V, INTERP_MAX, SINC_INTERP_ORDER, 1);
+
+	return 0;
+}
@@ -5,6 +5,8 @@
 #include "synth.h"
 #include "sys.h"
 #include "soundfont.h"
+#include "sf_stream.h"
+#include "sf_disk.h"
 #include "gen.h"
 #include "mod.h"
 #include "midi.h"
@@ -27,27 +29,43 @@
 /* min vol envelope release (to stop clicks) in SoundFont timecents */
 #define MIN_VOLENVRELEASE -7200.0f	/* ~16ms */
 
-//removed inline
-static void voiceEffects (Voice * voice, int count,
-																 S16 * dspLeftBuf,
-																 S16 * dspRightBuf,
-																 S16 * dspReverbBuf,
-																 S16 * dspChorusBuf);
+static FORCE_INLINE void voiceEffects (Voice * voice, int count,
+																 busT * dspLeftBuf,
+																 busT * dspRightBuf,
+																 busT * dspReverbBuf,
+																 busT * dspChorusBuf);
+static FORCE_INLINE void voiceMix (Voice * voice, int count, busT * dspBuf,
+															busT * dspLeftBuf,
+															busT * dspRightBuf,
+															busT * dspReverbBuf,
+															busT * dspChorusBuf);
+static void voiceModIndexBuild (Voice * voice);
+
 /*
- * newVoice
+ * voiceConstruct
+ *
+ * Sets up a voice slot in the synth's voice pool.  'gen', 'mod' and
+ * 'modIndex' are the voice's GEN_LAST generators, NUM_MOD modulators and
+ * modulator index in the cold pools.
  */
-Voice *newVoice (realT outputRate) {
-	Voice *voice;
-	voice = NEW (Voice);
-	if (voice == NULL) 
-		return NULL;
+void voiceConstruct (Voice * voice, Generator * gen, Modulator * mod,
+                     voiceModIndexT * modIndex, realT outputRate) {
+	MEMSET (voice, 0, sizeof (Voice));
+	MEMSET (modIndex, 0, sizeof (voiceModIndexT));
+	voice->gen = gen;
+	voice->mod = mod;
+	voice->modIndex = modIndex;
 	voice->status = VOICE_CLEAN;
 	voice->chan = NO_CHANNEL;
 	voice->key = 0;
 	voice->vel = 0;
 	voice->channel = NULL;
 	voice->sampleP = NULL;
+	voice->diskChunk = SF_DISK_NONE;
 	voice->outputRate = outputRate;
+	voice->heapIdx = -1;
+	voice->keySlot = -1;
+	voice->classSlot = -1;
 
 	/* The 'sustain' and 'finished' segments of the volume / modulation
 	 * envelope are constant. They are never affected by any modulator
@@ -76,19 +94,6 @@ Voice *newVoice (realT outputRate) {
 	voice->modenvData[VOICE_ENVFINISHED].incr = 0.0f;
 	voice->modenvData[VOICE_ENVFINISHED].min = -1.0f;
 	voice->modenvData[VOICE_ENVFINISHED].max = 1.0f;
-
-	return voice;
-}
-
-/*
- * deleteVoice
- */
-int deleteVoice (Voice * voice) {
-	if (voice == NULL) {
-		return OK;
-	}
-	FREE (voice);
-	return OK;
 }
 
 /* voiceInit
@@ -107,13 +112,22 @@ int voiceInit (Voice * voice, Sample * sample, Channel * channel, int key, int v
 	voice->vel = (unsigned char) vel;
 	voice->channel = channel;
 	voice->sampleP = sample;
+	if (sample != NULL && sample->streamP != NULL)
+		sfStreamPin (sample->streamP);	/* starts decoding it, if need be */
+	voice->diskChunk = SF_DISK_NONE;	/* held from its first block */
 	voice->startTime = startTime;
+	voice->nMods = 0;						/* synthAllocVoice adds the default modulators */
+	MEMSET (voice->modIndex, 0, sizeof (voiceModIndexT));	/* built by voiceStart */
 	voice->ticks = 0;
 	voice->noteoffTicks = 0;
 	voice->hasLooped = 0;				/* Will be set during voiceWrite when the 2nd loop point is reached */
 	voice->lastFres = -1;				/* The filter coefficients have to be calculated later in the DSP loop. */
 	voice->filterStartup = 1;		/* Set the filter immediately, don't fade between old and new settings */
 	voice->interpMethod = voice->channel->interpMethod;
+	voice->blockState = VOICE_BLOCK_PENDING;
+	voice->paramsDirty = 1;
+	voice->overBudget = 0;
+	voice->culled = VOICE_CULL_NONE;
 
 	/* vol env initialization */
 	voice->volenvCount = 0;
@@ -194,35 +208,18 @@ realT voiceGenValue (Voice * voice, int num) {
 
 
 /*
- * voiceWrite
- *
- * This is where it all happens. This function is called by the
- * synthesizer to generate the sound samples. The synthesizer passes
- * four audio buffers: left, right, reverb out, and chorus out.
+ * voiceStepBlock
  *
- * The biggest part of this function sets the correct values for all
- * the dsp parameters (all the control data boil down to only a few
- * dsp parameters). The dsp routine is #included in several places (dspCore.c).
+ * Advances the envelopes and LFOs by one block.  Runs once per block, at
+ * the first span the voice renders; a note-off inside the block only
+ * switches the sections and has the parameters recalculated (see
+ * voiceNoteoff).  FAILED if the voice is finished.
  */
-// MB: Hmmm, okay... So what does dsp do then? 
-int voiceWrite (Voice * voice, S16 * dspLeftBuf, S16 * dspRightBuf, S16 * dspReverbBuf, S16 * dspChorusBuf) {
-	realT fres;
-	realT targetAmp;			/* target amplitude */
-	int count;
-
-	S16 dspBuf[BUFSIZE];
+static int voiceStepBlock (Voice * voice) {
 	envDataT *envData;
 	realT x;
+	S32 volenvSection = voice->volenvSection;
 
-
-  // presetNoteon() sets voice->status to VOICE_ON after copying gens and mods over.
-  // The _PLAYING macro checks that here. If it's not on, ignore it. Also has to have a sample of course!
-	if (!_PLAYING(voice))
-		return OK;
-	if (voice->sampleP == NULL) {
-		voiceOff(voice);
-		return OK;
-	}
   // If voice has been playing and it's run out of ticks, kill it.
 	if (voice->noteoffTicks != 0 && voice->ticks >= voice->noteoffTicks) 
 		voiceNoteoff(voice);
@@ -254,9 +251,13 @@ int voiceWrite (Voice * voice, S16 * dspLeftBuf, S16 * dspRightBuf, S16 * dspRev
 	voice->volenvVal = x;
 	voice->volenvCount++;
 
+	/* the stealing priority goes by the envelope section */
+	if (voice->volenvSection != volenvSection)
+		voiceMgrTouch (voice);
+
 	if (voice->volenvSection == VOICE_ENVFINISHED) {
 		voiceOff (voice);
-		return OK;
+		return FAILED;
 	}
 
 	envData = &voice->modenvData[voice->modenvSection];
@@ -307,14 +308,73 @@ int voiceWrite (Voice * voice, S16 * dspLeftBuf, S16 * dspRightBuf, S16 * dspRev
 		}
 	}
 
+	voice->blockState = VOICE_BLOCK_RENDER;
+	voice->paramsDirty = 1;
+	return OK;
+}
+
+/*
+ * voiceFilterTabFill
+ *
+ * Fills a FILTER_TAB_ROWS coefficient table for 'outputRate'.  I removed
+ * the optimization of turning the filter off when the resonance frequence
+ * is above the maximum frequency. Instead, the filter frequency is set to
+ * a maximum of 0.45 times the sampling rate. For a 44100 kHz sampling
+ * rate, this amounts to 19845 Hz. The reason is that there were problems
+ * with anti-aliasing when the synthesizer was run at lower sampling
+ * rates. Thanks to Stephan Tassart for pointing me to this bug. By
+ * turning the filter on and clipping the maximum filter frequency at
+ * 0.45*srate, the filter is used as an anti-aliasing filter.
+ *
+ * 'maxCents' gets the cutoff, in cents, where that limit starts; nothing
+ * changes above it.
+ */
+void voiceFilterTabFill (realT (*tab)[2], realT outputRate, realT * maxCents) {
+	S32 i;
+	double fres, omega, limit = 0.45 * outputRate;
+
+	/* Rows past the limit aren't clamped, so interpolating in the row just
+	 * below it stays smooth; the voices never look beyond 'maxCents'. */
+	for (i = 0; i < FILTER_TAB_ROWS; i++) {
+		fres = ct2hzReal (FILTER_TAB_MIN_CENTS + i * FILTER_TAB_STEP);
+		omega = 2.0 * M_PI * (fres / outputRate);
+		tab[i][0] = (realT) sin (omega);
+		tab[i][1] = (realT) cos (omega);
+	}
+
+	/* ct2hzReal: 6.875 Hz is -300 cents */
+	*maxCents = (realT) (1200.0 * log2 (limit / 6.875) - 300.0);
+	if (*maxCents > FILTER_TAB_MAX_CENTS)
+		*maxCents = FILTER_TAB_MAX_CENTS;
+}
+
+/*
+ * voiceCalcBlockParams
+ *
+ * Turns the control data into the few dsp parameters: amplitude ramp,
+ * phase increment and filter coefficients.  Runs after voiceStepBlock and
+ * again at any span that starts after the voice was modulated, so a
+ * controller change takes effect on the frame it was queued for.  The
+ * amplitude ramp ends at the end of the block, 'remaining' frames away.
+ */
+static void voiceCalcBlockParams (Voice * voice, int remaining) {
+	Synthesizer *synth;
+	realT fres;
+	realT targetAmp;			/* target amplitude */
+	realT outGain;				/* synth gain and pan, see Culling */
+
+	voice->paramsDirty = 0;
+
   // Amplitude
 	/* calculate final amplitude
 	 * - initial gain
 	 * - amplitude envelope
 	 */
 
-	if (voice->volenvSection == VOICE_ENVDELAY)
-		goto postProcess;					/* The volume amplitude is in hold phase. No sound is produced. */
+	if (voice->volenvSection == VOICE_ENVDELAY) {
+		voice->blockState = VOICE_BLOCK_SILENT;	/* The volume amplitude is in hold phase. No sound is produced. */
+		return;
+	}
 
 	if (voice->volenvSection == VOICE_ENVATTACK) {
 		/* the envelope is in the attack section: ramp linearly to max value.
@@ -361,16 +421,19 @@ int voiceWrite (Voice * voice, S16 * dspLeftBuf, S16 * dspRightBuf, S16 * dspRev
 		 * can safely turn off the voice. Duh. */
 		if (ampMax < amplitudeThatReachesNoiseFloor) {
 			voiceOff (voice);
-			goto postProcess;
+			voice->blockState = VOICE_BLOCK_SILENT;
+			return;
 		}
 	}
 
-	/* Volume increment to go from voice->amp to targetAmp in BUFSIZE steps */
-	voice->ampIncr = (targetAmp - voice->amp) / BUFSIZE;
+	/* Volume increment to go from voice->amp to targetAmp by the end of the block */
+	voice->ampIncr = (targetAmp - voice->amp) / remaining;
 
 	/* no volume and not changing? - No need to process */
-	if ((voice->amp == 0.0f) && (voice->ampIncr == 0.0f))
-		goto postProcess;
+	if ((voice->amp == 0.0f) && (voice->ampIncr == 0.0f)) {
+		voice->blockState = VOICE_BLOCK_SILENT;
+		return;
+	}
 
 	/* Calculate the number of samples, that the DSP loop advances
 	 * through the original waveform with each step in the output
@@ -385,27 +448,34 @@ int voiceWrite (Voice * voice, S16 * dspLeftBuf, S16 * dspRightBuf, S16 * dspRev
 	if (voice->phaseIncr == 0)
 		voice->phaseIncr = 1;
 
+	/* Culling: a voice that stays below the synth's threshold for the whole
+	 * block, or that the voice budget left out, isn't rendered.  voiceWrite
+	 * only moves its playback pointer and amplitude on (dspFloatSkip), the
+	 * envelopes and LFOs keep stepping as usual.  The attack section is
+	 * never culled for being quiet; it's about to get louder.  The
+	 * threshold is dBFS, so the level is what reaches the louder side of
+	 * the dry mix, after the synth gain and the pan. */
+	synth = voice->channel->synth;
+	outGain = (voice->ampLeft > voice->ampRight ? voice->ampLeft : voice->ampRight) / BUS_NORM;
+	if (voice->overBudget
+			|| (voice->volenvSection != VOICE_ENVATTACK
+					&& voice->amp * outGain < synth->cullAmp && targetAmp * outGain < synth->cullAmp)) {
+		voice->culled = voice->overBudget ? VOICE_CULL_BUDGET : VOICE_CULL_QUIET;
+		/* no stale filter history ringing out when it comes back */
+		voice->hist1 = voice->hist2 = 0;
+		voice->blockState = VOICE_BLOCK_CULLED;
+		return;
+	}
+
 	/*************** resonant filter ******************/
 
-	/* calculate the frequency of the resonant filter in Hz */
-	fres = ct2hz (voice->fres
-              + voice->modlfoVal * voice->modlfoToFc
-              + voice->modenvVal * voice->modenvToFc);
-
-	/* I removed the optimization of turning the filter off when the
-	 * resonance frequence is above the maximum frequency. Instead, the
-	 * filter frequency is set to a maximum of 0.45 times the sampling
-	 * rate. For a 44100 kHz sampling rate, this amounts to 19845
-	 * Hz. The reason is that there were problems with anti-aliasing when the
-	 * synthesizer was run at lower sampling rates. Thanks to Stephan
-	 * Tassart for pointing me to this bug. By turning the filter on and
-	 * clipping the maximum filter frequency at 0.45*srate, the filter
-	 * is used as an anti-aliasing filter. */
-
-	if (fres > 0.45f * voice->outputRate)
-		fres = 0.45f * voice->outputRate;
-	else if (fres < 5)
-		fres = 5;
+	/* the cutoff of the resonant filter in cents, within what the
+	 * coefficient table covers */
+	fres = voice->fres
+		+ voice->modlfoVal * voice->modlfoToFc
+		+ voice->modenvVal * voice->modenvToFc;
+	fres = fres > FILTER_TAB_MIN_CENTS ? fres : FILTER_TAB_MIN_CENTS;
+	fres = fres < synth->filterTabMaxCents ? fres : synth->filterTabMaxCents;
 
 	/* if filter enabled and there is a significant frequency change.. */
 	if ((fabs (fres - voice->lastFres) > 0.01)) {
@@ -422,12 +492,17 @@ int voiceWrite (Voice * voice, S16 * dspLeftBuf, S16 * dspRightBuf, S16 * dspRev
 		 * the result of the bilinear transform on an analogue filter
 		 * prototype. To quote, `BLT frequency warping has been taken
 		 * into account for both significant frequency relocation and for
-		 * bandwidth readjustment'. */
-
-		realT omega =
-			(realT) (2.0 * M_PI * (fres / ((float) voice->outputRate)));
-		realT sinCoeff = (realT) sin (omega);
-		realT cosCoeff = (realT) cos (omega);
+		 * bandwidth readjustment'.
+		 *
+		 * sin and cos of omega come from the synth's table (see
+		 * voiceFilterTabFill), interpolated between its rows. */
+
+		realT x = (fres - FILTER_TAB_MIN_CENTS) * (1.0f / FILTER_TAB_STEP);
+		S32 row = (S32) x;
+		realT frac = x - row;
+		const realT *tab = synth->filterTab[row], *next = synth->filterTab[row + 1];
+		realT sinCoeff = tab[0] + frac * (next[0] - tab[0]);
+		realT cosCoeff = tab[1] + frac * (next[1] - tab[1]);
 		realT alphaCoeff = sinCoeff / (2.0f * voice->qLin);
 		realT a0_inv = 1.0f / (1.0f + alphaCoeff);
 
@@ -479,14 +554,124 @@ int voiceWrite (Voice * voice, S16 * dspLeftBuf, S16 * dspRightBuf, S16 * dspRev
 		voice->lastFres = fres;
 	}
 
+	voice->blockState = VOICE_BLOCK_RENDER;
+}
+
+/*
+ * voiceCheckSampleSanity
+ *
+ * Keeps the modulated sample and loop points inside the sample and, on
+ * the voice's first block, puts the playback pointer on the start.
+ */
+void voiceCheckSampleSanity (Voice * voice) {
+	S32 first = voice->sampleP->startIdx;
+	S32 last = voice->sampleP->endIdx;
+
+	voice->start = voice->start < first ? first : voice->start > last ? last : voice->start;
+	voice->end = voice->end < voice->start ? voice->start : voice->end > last ? last : voice->end;
+	voice->loopstart = voice->loopstart < voice->start ? voice->start : voice->loopstart;
+	voice->loopend = voice->loopend > voice->end + 1 ? voice->end + 1 : voice->loopend;
+	/* no usable loop left: the interpolators would spin on it */
+	if (voice->loopend - voice->loopstart < 2) {
+		voice->loopstart = voice->start;
+		voice->loopend = voice->end + 1;
+	}
+
+	if (voice->checkSampleSanityFlag & SAMPLESANITY_STARTUP)
+		phaseSetInt (voice->phase, voice->start);
+	voice->checkSampleSanityFlag = 0;
+}
+
+/*
+ * voiceLastIdx
+ *
+ * The last frame the next n output frames read.  The interpolators look
+ * up to 3 frames ahead and never past the loop end while looping, or
+ * past the end.
+ */
+static U32 voiceLastIdx (Voice * voice, int n) {
+	uint64 lastIdx = phaseIndex (voice->phase) + (uint64) (voice->phaseIncr * n) + 4;
+	int looping;
+
+	looping = _SAMPLEMODE (voice) == LOOP_DURING_RELEASE
+		|| (_SAMPLEMODE (voice) == LOOP_UNTIL_RELEASE
+				&& voice->volenvSection < VOICE_ENVRELEASE);
+	if (looping && lastIdx > (uint64) voice->loopend)
+		lastIdx = voice->loopend;
+	if (lastIdx > (uint64) voice->end)
+		lastIdx = voice->end;
+
+	return (U32) lastIdx;
+}
+
+/*
+ * voiceSampleReady
+ *
+ * For a streamed sample: whether the frames the next n output frames
+ * read are decoded (SF3) or read from the disk.  The interpolators look
+ * up to 3 frames back as well.
+ */
+static int voiceSampleReady (Voice * voice, int n) {
+	U32 first = phaseIndex (voice->phase);
+
+	if (voice->sampleP->streamP != NULL)
+		return sfStreamReady (voice->sampleP->streamP, voiceLastIdx (voice, n));
+	first = first > 3 ? first - 3 : 0;
+	return sfDiskReady (voice->sampleP->diskP, &voice->diskChunk, first, voiceLastIdx (voice, n));
+}
+
+/*
+ * voiceRender
+ *
+ * The per-voice half of voiceWrite: the control data is updated by
+ * voiceStepBlock / voiceCalcBlockParams and the interpolation runs into
+ * 'dspBuf'.  Returns the number of frames there, 0 if there is nothing to
+ * mix.  Fewer than n means the sample ended; the voice is off then.
+ */
+static int voiceRender (Voice * voice, int start, int n, busT * dspBuf) {
+	int count = 0;
+
+  // presetNoteon() sets voice->status to VOICE_ON after copying gens and mods over.
+  // The _PLAYING macro checks that here. If it's not on, ignore it. Also has to have a sample of course!
+	if (!_PLAYING(voice))
+		return 0;
+	if (voice->sampleP == NULL) {
+		voiceOff(voice);
+		return 0;
+	}
+	if (voice->checkSampleSanityFlag)
+		voiceCheckSampleSanity (voice);
+
+	if (voice->blockState == VOICE_BLOCK_PENDING && voiceStepBlock (voice) != OK)
+		return 0;
+	if (voice->paramsDirty)
+		voiceCalcBlockParams (voice, BUFSIZE - start);
+	if (voice->blockState == VOICE_BLOCK_SILENT || !_PLAYING (voice))
+		goto postProcess;
+
+	/* culled: keep the playback pointer where the rendered voice would be */
+	if (voice->blockState == VOICE_BLOCK_CULLED) {
+		voice->dspCount = n;
+		if (dspFloatSkip (voice) < n)
+			voiceOff (voice);
+		goto postProcess;
+	}
+
+	/* waiting for the decoder or the disk: silent, the pointer stays where it is */
+	if ((voice->sampleP->streamP != NULL || voice->sampleP->diskP != NULL)
+			&& voiceSampleReady (voice, n) != OK) {
+		voice->amp += voice->ampIncr * n;
+		goto postProcess;
+	}
 
   /*********************** run the dsp chain ************************
    * The sample is mixed with the output buffer.
-   * The buffer has to be filled from 0 to BUFSIZE-1.
+   * The buffer has to be filled from 0 to n-1.
    * Depending on the position in the loop and the loop size, this
    * may require several runs. */
 
 	voice->dspBuf = dspBuf;
+	voice->dspCount = n;
 
 	switch (voice->interpMethod) {
 	case INTERP_NONE:
@@ -504,20 +689,331 @@ int voiceWrite (Voice * voice, S16 * dspLeftBuf, S16 * dspRightBuf, S16 * dspRev
 		break;
 	}
 
-	if (count > 0)
-		voiceEffects (voice, count, dspLeftBuf, dspRightBuf,
-												 dspReverbBuf, dspChorusBuf);
-
 	/* turn off voice if short count (sample ended and not looping) */
-	if (count < BUFSIZE) {
+	if (count < n) {
 		voiceOff (voice);
 	}
 
 postProcess:
-	voice->ticks += BUFSIZE;
+	/* a voice started inside the block has only played part of it */
+	voice->ticks += n;
+	if (start + n == BUFSIZE)
+		voice->blockState = VOICE_BLOCK_PENDING;
+	return count;
+}
+
+/*
+ * voiceWrite
+ *
+ * This is where it all happens. This function is called by the
+ * synthesizer to generate the sound samples. The synthesizer passes
+ * four audio buffers: left, right, reverb out, and chorus out.
+ *
+ * Only frames [start, start + n) of the block buffers are written; the
+ * synth splits a block at queued events (see synthEventT).  The render
+ * loops go through voiceBatchWrite instead, this is the one-voice version.
+ */
+int voiceWrite (Voice * voice, int start, int n, busT * dspLeftBuf, busT * dspRightBuf, busT * dspReverbBuf, busT * dspChorusBuf) {
+	int count;
+
+	busT dspBuf[BUFSIZE];
+
+	count = voiceRender (voice, start, n, dspBuf);
+
+	/* A whole block gets its own copy of the filter and pan loops, with the
+	 * trip count known at compile time; spans and sample ends take the other. */
+	if (count == BUFSIZE)
+		voiceEffects (voice, BUFSIZE, dspLeftBuf, dspRightBuf,
+												 dspReverbBuf, dspChorusBuf);
+	else if (count > 0)
+		voiceEffects (voice, count, dspLeftBuf + start, dspRightBuf + start,
+												 dspReverbBuf ? dspReverbBuf + start : NULL,
+												 dspChorusBuf ? dspChorusBuf + start : NULL);
 	return OK;
 }
 
+/*
+ * voiceBatchBegin
+ */
+void voiceBatchBegin (voiceBatchT * batch, int start, int n) {
+	batch->start = start;
+	batch->count = n;
+	batch->n = 0;
+}
+
+/*
+ * voiceBatchWrite
+ */
+int voiceBatchWrite (voiceBatchT * batch, Voice * voice, busT * dspLeftBuf, busT * dspRightBuf, busT * dspReverbBuf, busT * dspChorusBuf) {
+	int j = batch->n, start = batch->start, count;
+
+	count = voiceRender (voice, start, batch->count, batch->buf[j]);
+	if (count <= 0)
+		return OK;
+
+	dspLeftBuf += start;
+	dspRightBuf += start;
+	if (dspReverbBuf != NULL)
+		dspReverbBuf += start;
+	if (dspChorusBuf != NULL)
+		dspChorusBuf += start;
+
+	/* the sample ended inside the span; the lanes all run the whole span.
+	 * The voices before it are mixed first, to keep the voice order, and
+	 * the flush clears its lane. */
+	if (count < batch->count) {
+		busT dspBuf[BUFSIZE];
+
+		if (batch->n > 0) {
+			MEMCPY (dspBuf, batch->buf[j], count * sizeof (busT));
+			voice->dspBuf = dspBuf;
+			voiceBatchFlush (batch);
+		}
+		voiceEffects (voice, count, dspLeftBuf, dspRightBuf, dspReverbBuf, dspChorusBuf);
+		return OK;
+	}
+
+	batch->voice[j] = voice;
+	batch->left[j] = dspLeftBuf;
+	batch->right[j] = dspRightBuf;
+	batch->reverb[j] = dspReverbBuf;
+	batch->chorus[j] = dspChorusBuf;
+	if (++batch->n == VOICE_LANES)
+		voiceBatchFlush (batch);
+	return OK;
+}
+
+/*
+ * voiceBatchFilter
+ *
+ * voiceEffects' filter loops with one voice per lane.  A lane's coefficient
+ * ramp stops after its own filterCoeffIncrCount frames: its increments are
+ * zeroed from then on, so the others can go on ramping.
+ */
+static void voiceBatchFilter (voiceBatchT * batch) {
+	voiceLanesT *lane = batch->lane;
+	voiceLanesT h1, h2, a1, a2, b02, b1, a1i, a2i, b02i, b1i, c;
+	int incrCount[VOICE_LANES];
+	int j, k, n = batch->count, ramp = 0, stopAt = n + 1;
+	Voice *voice;
+
+	/* the empty lanes filter silence with an all-zero filter */
+	for (j = 0; j < VOICE_LANES; j++) {
+		if (j < batch->n) {
+			voice = batch->voice[j];
+			h1[j] = voice->hist1;
+			h2[j] = voice->hist2;
+			a1[j] = voice->a1;
+			a2[j] = voice->a2;
+			b02[j] = voice->b02;
+			b1[j] = voice->b1;
+			a1i[j] = voice->a1_incr;
+			a2i[j] = voice->a2_incr;
+			b02i[j] = voice->b02_incr;
+			b1i[j] = voice->b1_incr;
+			incrCount[j] = voice->filterCoeffIncrCount > 0 ? voice->filterCoeffIncrCount : 0;
+		} else {
+			h1[j] = h2[j] = a1[j] = a2[j] = b02[j] = b1[j] = 0;
+			incrCount[j] = 0;
+			MEMSET (batch->buf[j], 0, n * sizeof (busT));
+		}
+		if (incrCount[j] > 0) {
+			ramp = 1;
+			if (incrCount[j] < stopAt)
+				stopAt = incrCount[j];
+		}
+	}
+
+	/* samples in time, voices across the lanes */
+	for (k = 0; k < n; k++)
+		for (j = 0; j < VOICE_LANES; j++)
+			lane[k][j] = batch->buf[j][k];
+
+	if (ramp) {
+		for (j = 0; j < VOICE_LANES; j++) {
+			if (incrCount[j] == 0)
+				a1i[j] = a2i[j] = b02i[j] = b1i[j] = 0;
+		}
+		for (k = 0; k < n; k++) {
+			/* The filter is implemented in Direct-II form. */
+			c = lane[k] - a1 * h1 - a2 * h2;
+			lane[k] = b02 * (c + h2) + b1 * h1;
+			h2 = h1;
+			h1 = c;
+
+			a1 += a1i;
+			a2 += a2i;
+			b02 += b02i;
+			b1 += b1i;
+			if (k + 1 == stopAt) {
+				stopAt = n + 1;
+				for (j = 0; j < VOICE_LANES; j++) {
+					if (incrCount[j] == k + 1)
+						a1i[j] = a2i[j] = b02i[j] = b1i[j] = 0;
+					else if (incrCount[j] > k + 1 && incrCount[j] < stopAt)
+						stopAt = incrCount[j];
+				}
+			}
+		}
+	} else {
+		for (k = 0; k < n; k++) {
+			c = lane[k] - a1 * h1 - a2 * h2;
+			lane[k] = b02 * (c + h2) + b1 * h1;
+			h2 = h1;
+			h1 = c;
+		}
+	}
+
+	for (j = 0; j < batch->n; j++) {
+		for (k = 0; k < n; k++)
+			batch->buf[j][k] = lane[k][j];
+
+		voice = batch->voice[j];
+		voice->hist1 = h1[j];
+		voice->hist2 = h2[j];
+		voice->a1 = a1[j];
+		voice->a2 = a2[j];
+		voice->b02 = b02[j];
+		voice->b1 = b1[j];
+		voice->filterCoeffIncrCount = incrCount[j] > n ? incrCount[j] - n : 0;
+	}
+}
+
+/*
+ * voiceBatchMixLanes
+ *
+ * Adds the lanes 'lanes' of the batch, times their 'gain', to 'dspBuf', one
+ * voice after the other as voiceMix would.
+ */
+static void voiceBatchMixLanes (voiceBatchT * batch, busT * dspBuf, const realT * gain,
+																const int *lanes, int nLanes) {
+	int k, m, n = batch->count;
+	busT v;
+
+	for (k = 0; k < n; k++) {
+		v = dspBuf[k];
+		for (m = 0; m < nLanes; m++)
+			v += gain[lanes[m]] * batch->buf[lanes[m]][k];
+		dspBuf[k] = v;
+	}
+}
+
+/*
+ * voiceBatchFlush
+ */
+void voiceBatchFlush (voiceBatchT * batch) {
+	realT gainLeft[VOICE_LANES], gainRight[VOICE_LANES];
+	realT gainReverb[VOICE_LANES], gainChorus[VOICE_LANES];
+	int left[VOICE_LANES], right[VOICE_LANES], reverb[VOICE_LANES], chorus[VOICE_LANES];
+	int nLeft = 0, nRight = 0, nReverb = 0, nChorus = 0;
+	int j, n = batch->count, shared = 1;
+	Voice *voice;
+
+	if (batch->n == 0)
+		return;
+
+	voiceBatchFilter (batch);
+
+	for (j = 1; j < batch->n; j++) {
+		if (batch->left[j] != batch->left[0] || batch->right[j] != batch->right[0]
+				|| batch->reverb[j] != batch->reverb[0] || batch->chorus[j] != batch->chorus[0])
+			shared = 0;
+	}
+
+	if (!shared) {
+		for (j = 0; j < batch->n; j++)
+			voiceMix (batch->voice[j], n, batch->buf[j], batch->left[j], batch->right[j],
+								batch->reverb[j], batch->chorus[j]);
+		batch->n = 0;
+		return;
+	}
+
+	/* All lanes go to the same buffers: one pass over each.  Every frame
+	 * gets the voices added in lane order and skips the same ones voiceMix
+	 * skips, so the sums are the same as mixing voice by voice. */
+	for (j = 0; j < batch->n; j++) {
+		voice = batch->voice[j];
+		if ((-0.5 < voice->pan) && (voice->pan < 0.5)) {
+			gainLeft[j] = gainRight[j] = voice->ampLeft;
+			left[nLeft++] = j;
+			right[nRight++] = j;
+		} else {
+			gainLeft[j] = voice->ampLeft;
+			gainRight[j] = voice->ampRight;
+			if (voice->ampLeft != 0.0)
+				left[nLeft++] = j;
+			if (voice->ampRight != 0.0)
+				right[nRight++] = j;
+		}
+		gainReverb[j] = voice->ampReverb;
+		gainChorus[j] = voice->ampChorus;
+		if (voice->ampReverb != 0.0)
+			reverb[nReverb++] = j;
+		if (voice->ampChorus != 0)
+			chorus[nChorus++] = j;
+	}
+
+	if (nLeft > 0)
+		voiceBatchMixLanes (batch, batch->left[0], gainLeft, left, nLeft);
+	if (nRight > 0)
+		voiceBatchMixLanes (batch, batch->right[0], gainRight, right, nRight);
+	if (batch->reverb[0] != NULL && nReverb > 0)
+		voiceBatchMixLanes (batch, batch->reverb[0], gainReverb, reverb, nReverb);
+	if (batch->chorus[0] != NULL && nChorus > 0)
+		voiceBatchMixLanes (batch, batch->chorus[0], gainChorus, chorus, nChorus);
+	batch->n = 0;
+}
+
+/*
+ * voiceMix
+ *
+ * The second half of voiceEffects: pans the filtered 'dspBuf' to the
+ * outputs and sends it to the effects.
+ */
+static FORCE_INLINE void voiceMix (Voice * voice, int count, busT * dspBuf,
+										 busT *dspLeftBuf,
+										 busT *dspRightBuf,
+										 busT *dspReverbBuf,
+										 busT *dspChorusBuf) {
+	int dspI;
+	busT v;
+
+	/* pan (Copy the signal to the left and right output buffer) The voice
+	 * panning generator has a range of -500 .. 500.  If it is centered,
+	 * it's close to 0.  voice->ampLeft and voice->ampRight are then the
+	 * same, and we can save one multiplication per voice and sample.
+	 */
+	if ((-0.5 < voice->pan) && (voice->pan < 0.5)) {
+		/* The voice is centered. Use voice->ampLeft twice. */
+		for (dspI = 0; dspI < count; dspI++) {
+			v = voice->ampLeft * dspBuf[dspI];
+			dspLeftBuf[dspI] += v;
+			dspRightBuf[dspI] += v;
+		}
+	} else {											/* The voice is not centered. Stereo samples have one side zero. */
+		if (voice->ampLeft != 0.0) {
+			for (dspI = 0; dspI < count; dspI++)
+				dspLeftBuf[dspI] += voice->ampLeft * dspBuf[dspI];
+		}
+
+		if (voice->ampRight != 0.0) {
+			for (dspI = 0; dspI < count; dspI++)
+				dspRightBuf[dspI] += voice->ampRight * dspBuf[dspI];
+		}
+	}
+
+	/* reverb send. Buffer may be NULL. */
+	if ((dspReverbBuf != NULL) && (voice->ampReverb != 0.0)) {
+		for (dspI = 0; dspI < count; dspI++)
+			dspReverbBuf[dspI] += voice->ampReverb * dspBuf[dspI];
+	}
+
+	/* chorus send. Buffer may be NULL. */
+	if ((dspChorusBuf != NULL) && (voice->ampChorus != 0)) {
+		for (dspI = 0; dspI < count; dspI++)
+			dspChorusBuf[dspI] += voice->ampChorus * dspBuf[dspI];
+	}
+}
 
 /* Purpose:
  *
@@ -549,32 +1045,31 @@ postProcess:
  * - dspHist2: same
  *
  */
-static void voiceEffects (
+static FORCE_INLINE void voiceEffects (
                      Voice * voice, int count,
-										 S16 *dspLeftBuf,
-										 S16 *dspRightBuf,
-										 S16 *dspReverbBuf,
-										 S16 *dspChorusBuf) {
+										 busT *dspLeftBuf,
+										 busT *dspRightBuf,
+										 busT *dspReverbBuf,
+										 busT *dspChorusBuf) {
 	/* IIR filter sample history */
-	S16 dspHist1 = voice->hist1;
-	S16 dspHist2 = voice->hist2;
+	realT dspHist1 = voice->hist1;
+	realT dspHist2 = voice->hist2;
 
 	/* IIR filter coefficients */
-	S16 dspA1 = voice->a1;
-	S16 dspA2 = voice->a2;
-	S16 dspB02 = voice->b02;
-	S16 dspB1 = voice->b1;
-	S16 dspA1_incr = voice->a1_incr;
-	S16 dspA2_incr = voice->a2_incr;
-	S16 dspB02_incr = voice->b02_incr;
-	S16 dspB1_incr = voice->b1_incr;
+	realT dspA1 = voice->a1;
+	realT dspA2 = voice->a2;
+	realT dspB02 = voice->b02;
+	realT dspB1 = voice->b1;
+	realT dspA1_incr = voice->a1_incr;
+	realT dspA2_incr = voice->a2_incr;
+	realT dspB02_incr = voice->b02_incr;
+	realT dspB1_incr = voice->b1_incr;
 	int dspFilterCoeffIncrCount = voice->filterCoeffIncrCount;
 
-	S16 *dspBuf = voice->dspBuf;
+	busT *dspBuf = voice->dspBuf;
 
-	S16 dspCenternode;
+	realT dspCenternode;
 	int dspI;
-	S16 v;
 
 	/* filter (implement the voice filter according to SoundFont standard) */
 	/* Two versions of the filter loop. One, while the filter is
@@ -611,42 +1106,6 @@ static void voiceEffects (
 		}
 	}
 
-	/* pan (Copy the signal to the left and right output buffer) The voice
-	 * panning generator has a range of -500 .. 500.  If it is centered,
-	 * it's close to 0.  voice->ampLeft and voice->ampRight are then the
-	 * same, and we can save one multiplication per voice and sample.
-	 */
-	if ((-0.5 < voice->pan) && (voice->pan < 0.5)) {
-		/* The voice is centered. Use voice->ampLeft twice. */
-		for (dspI = 0; dspI < count; dspI++) {
-			v = voice->ampLeft * dspBuf[dspI];
-			dspLeftBuf[dspI] += v;
-			dspRightBuf[dspI] += v;
-		}
-	} else {											/* The voice is not centered. Stereo samples have one side zero. */
-		if (voice->ampLeft != 0.0) {
-			for (dspI = 0; dspI < count; dspI++)
-				dspLeftBuf[dspI] += voice->ampLeft * dspBuf[dspI];
-		}
-
-		if (voice->ampRight != 0.0) {
-			for (dspI = 0; dspI < count; dspI++)
-				dspRightBuf[dspI] += voice->ampRight * dspBuf[dspI];
-		}
-	}
-
-	/* reverb send. Buffer may be NULL. */
-	if ((dspReverbBuf != NULL) && (voice->ampReverb != 0.0)) {
-		for (dspI = 0; dspI < count; dspI++)
-			dspReverbBuf[dspI] += voice->ampReverb * dspBuf[dspI];
-	}
-
-	/* chorus send. Buffer may be NULL. */
-	if ((dspChorusBuf != NULL) && (voice->ampChorus != 0)) {
-		for (dspI = 0; dspI < count; dspI++)
-			dspChorusBuf[dspI] += voice->ampChorus * dspBuf[dspI];
-	}
-
 	voice->hist1 = dspHist1;
 	voice->hist2 = dspHist2;
 	voice->a1 = dspA1;
@@ -654,6 +1113,8 @@ static void voiceEffects (
 	voice->b02 = dspB02;
 	voice->b1 = dspB1;
 	voice->filterCoeffIncrCount = dspFilterCoeffIncrCount;
+
+	voiceMix (voice, count, dspBuf, dspLeftBuf, dspRightBuf, dspReverbBuf, dspChorusBuf);
 }
 
 /* voiceStart */
@@ -661,6 +1122,7 @@ void voiceStart (Voice * voice) {
 	/* The maximum volume of the loop is calculated and cached once for each
 	 * sample with its nominal loop settings. This happens, when the sample is used
 	 * for the first time.*/
+	voiceModIndexBuild (voice);
 	voiceCalculateRuntimeSynthesisParameters (voice);
 	/* Force setting of the phase at the first DSP loop run
 	 * This cannot be done earlier, because it depends on modulators.*/
@@ -896,15 +1358,17 @@ void voiceUpdateParam (Voice * voice, int gen) {
 	// Alternate attenuation scale used by EMU10K1 cards when setting the attenuation at the preset or instrument level within the SoundFont bank.
 	static const float ALT_ATTENUATION_SCALE = 0.4;
 
+	voice->paramsDirty = 1;
+
 	switch (gen) {
 
 	case GEN_PAN:
 		/* range checking is done in the pan function */
 		voice->pan = _GEN (voice, GEN_PAN);
 		voice->ampLeft =
-			pan (voice->pan, 1) * voice->synthGain / 32768.0f;
+			pan (voice->pan, 1) * voice->synthGain * BUS_NORM;
 		voice->ampRight =
-			pan (voice->pan, 0) * voice->synthGain / 32768.0f;
+			pan (voice->pan, 0) * voice->synthGain * BUS_NORM;
 		break;
 
 	case GEN_ATTENUATION:
@@ -936,14 +1400,14 @@ void voiceUpdateParam (Voice * voice, int gen) {
 		/* The generator unit is 'tenths of a percent'. */
 		voice->reverbSend = _GEN (voice, GEN_REVERBSEND) / 1000.0f;
 		clip (voice->reverbSend, 0.0, 1.0);
-		voice->ampReverb = voice->reverbSend * voice->synthGain / 32768.0f;
+		voice->ampReverb = voice->reverbSend * voice->synthGain * BUS_NORM;
 		break;
 
 	case GEN_CHORUSSEND:
 		/* The generator unit is 'tenths of a percent'. */
 		voice->chorusSend = _GEN (voice, GEN_CHORUSSEND) / 1000.0f;
 		clip (voice->chorusSend, 0.0, 1.0);
-		voice->ampChorus = voice->chorusSend * voice->synthGain / 32768.0f;
+		voice->ampChorus = voice->chorusSend * voice->synthGain * BUS_NORM;
 		break;
 
 	case GEN_OVERRIDEROOTKEY:
@@ -1307,6 +1771,102 @@ void voiceUpdateParam (Voice * voice, int gen) {
 	}															/* switch gen */
 }
 
+/*
+ * voiceModIndexBuild
+ *
+ * Fills in voice->modIndex from the voice's final modulator list (see
+ * voiceModIndexT).  At most NUM_MOD modulators and two sources each, so
+ * the dedup and the insertion sort stay small.
+ */
+static void voiceModIndexBuild (Voice * voice) {
+	voiceModIndexT *idx = voice->modIndex;
+	Modulator *mod;
+	U8 group[GEN_LAST];								/* generator -> group + 1 */
+	U8 count[NUM_MOD];
+	U8 src[2], flags[2];
+	S32 i, k, e, d, key, firstEdge;
+
+	MEMSET (idx, 0, sizeof (voiceModIndexT));
+	MEMSET (group, 0, sizeof (group));
+
+	/* group the modulators by destination, in list order */
+	for (i = 0; i < voice->nMods; i++) {
+		d = voice->mod[i].dest;
+		if (d >= GEN_LAST)
+			continue;
+		if (group[d] == 0) {
+			idx->dest[idx->nDests] = d;
+			count[idx->nDests] = 0;
+			group[d] = ++idx->nDests;
+		}
+		count[group[d] - 1]++;
+	}
+	idx->destFirst[0] = 0;
+	for (d = 0; d < idx->nDests; d++) {
+		idx->destFirst[d + 1] = idx->destFirst[d] + count[d];
+		count[d] = idx->destFirst[d];
+	}
+	for (i = 0; i < voice->nMods; i++) {
+		d = voice->mod[i].dest;
+		if (d < GEN_LAST)
+			idx->byDest[count[group[d] - 1]++] = i;
+	}
+
+	/* one edge per (source, group) */
+	for (d = 0; d < idx->nDests; d++) {
+		firstEdge = idx->nEdges;
+		for (i = idx->destFirst[d]; i < idx->destFirst[d + 1]; i++) {
+			mod = &voice->mod[idx->byDest[i]];
+			src[0] = mod->src1;
+			flags[0] = mod->xformType1;
+			src[1] = mod->src2;
+			flags[1] = mod->xformType2;
+			for (k = 0; k < 2; k++) {
+				if (src[k] > 127)				/* no controller has that number */
+					continue;
+				key = ((flags[k] & MOD_CC) ? 128 : 0) + src[k];
+				for (e = firstEdge; e < idx->nEdges && idx->edgeSrc[e] != key; e++);
+				if (e < idx->nEdges)
+					continue;
+				idx->edgeSrc[e] = key;
+				idx->edgeDest[e] = d;
+				idx->nEdges++;
+				idx->srcMask[key >> 5] |= 1u << (key & 31);
+			}
+		}
+	}
+
+	/* sort by source, keeping the group order within a source */
+	for (i = 1; i < idx->nEdges; i++) {
+		key = idx->edgeSrc[i];
+		d = idx->edgeDest[i];
+		for (e = i; e > 0 && idx->edgeSrc[e - 1] > key; e--) {
+			idx->edgeSrc[e] = idx->edgeSrc[e - 1];
+			idx->edgeDest[e] = idx->edgeDest[e - 1];
+		}
+		idx->edgeSrc[e] = key;
+		idx->edgeDest[e] = d;
+	}
+}
+
+/*
+ * voiceModUpdateDest
+ *
+ * Sums the modulators of group 'd' into their generator and recalculates
+ * the parameters derived from it.
+ */
+static void voiceModUpdateDest (Voice * voice, S32 d) {
+	voiceModIndexT *idx = voice->modIndex;
+	S32 i, gen = idx->dest[d];
+	realT modval = 0.0;
+
+	for (i = idx->destFirst[d]; i < idx->destFirst[d + 1]; i++)
+		modval += modGetValue (&voice->mod[idx->byDest[i]], voice->channel, voice);
+
+	voice->gen[gen].mod = modval;
+	voiceUpdateParam (voice, gen);
+}
+
 /**
  * voiceModulate
  *
@@ -1318,9 +1878,8 @@ void voiceUpdateParam (Voice * voice, int gen) {
  *
  * The update is done in three steps:
  *
- * - first, we look for all the modulators that have the changed
- * controller as a source. This will yield a list of generators that
- * will be changed because of the controller event.
+ * - first, we look for all the generators that have a modulator with the
+ * changed controller as a source. voice->modIndex lists them, each once.
  *
  * - For every changed generator, calculate its new value. This is the
  * sum of its original value plus the values of al the attached
@@ -1335,85 +1894,63 @@ void voiceUpdateParam (Voice * voice, int gen) {
  * @param ctrl the control number
  * */
 int voiceModulate (Voice * voice, int cc, int ctrl) {  
-	int i, k;
-	Modulator *mod;
-	int gen;
-	realT modval;
+	voiceModIndexT *idx = voice->modIndex;
+	S32 e, key;
 
+	if (ctrl < 0 || ctrl > 127)
+		return OK;
+	key = (cc ? 128 : 0) + ctrl;
 
-	for (i = 0; i < voice->nMods; i++) {
-
-		mod = &voice->mod[i];
+	/* step 1: nothing on this voice listens to the controller */
+	if ((idx->srcMask[key >> 5] & (1u << (key & 31))) == 0)
+		return OK;
 
-		/* step 1: find all the modulators that have the changed controller
-		 * as input source. */
-		if (modHasSource (mod, cc, ctrl)) {
+	/* steps 2 and 3, once for every generator the controller reaches */
+	for (e = 0; e < idx->nEdges && idx->edgeSrc[e] < key; e++);
+	for (; e < idx->nEdges && idx->edgeSrc[e] == key; e++)
+		voiceModUpdateDest (voice, idx->edgeDest[e]);
 
-			gen = mod->dest;
-			modval = 0.0;
+	return OK;
+}
 
-			/* step 2: for every changed modulator, calculate the modulation
-			 * value of its associated generator */
-			for (k = 0; k < voice->nMods; k++) {
-				if (modHasDest (&voice->mod[k], gen)) {
-					modval += modGetValue (&voice->mod[k], voice->channel, voice);
-				}
-			}
+/*
+ * voiceModulateSources
+ */
+int voiceModulateSources (Voice * voice, const U32 * srcMask) {
+	voiceModIndexT *idx = voice->modIndex;
+	uint64 groups = 0;
+	S32 e, d, w;
 
-      voice->gen[gen].mod = modval;
+	for (w = 0; w < 8 && (srcMask[w] & idx->srcMask[w]) == 0; w++);
+	if (w == 8)
+		return OK;
 
-			/* step 3: now that we have the new value of the generator,
-			 * recalculate the parameter values that are derived from the
-			 * generator */
-			voiceUpdateParam (voice, gen);
-		}
+	/* nDests <= NUM_MOD == 64 */
+	for (e = 0; e < idx->nEdges; e++) {
+		if (srcMask[idx->edgeSrc[e] >> 5] & (1u << (idx->edgeSrc[e] & 31)))
+			groups |= (uint64) 1 << idx->edgeDest[e];
+	}
+	while (groups != 0) {
+		d = __builtin_ctzll (groups);
+		groups &= groups - 1;
+		voiceModUpdateDest (voice, d);
 	}
 	return OK;
 }
 
-
-
 /**
  * voiceModulateAll
  *
  * Update all the modulators. This function is called after a
- * ALL_CTRL_OFF MIDI message has been received (CC 121).
+ * ALL_CTRL_OFF MIDI message has been received (CC 121).  Every modulated
+ * generator is recalculated once.
  *
  */
 int voiceModulateAll (Voice * voice) {
-	Modulator *mod;
-	int i, k, gen;
-	realT modval;
-
-	/* Loop through all the modulators.
+	S32 d;
 
-	   FIXME: we should loop through the set of generators instead of
-	   the set of modulators. We risk to call 'voiceUpdateParam'
-	   several times for the same generator if several modulators have
-	   that generator as destination. It's not an error, just a wast of
-	   energy (think polution, global warming, unhappy musicians,
-	   ...) */
-
-	for (i = 0; i < voice->nMods; i++) {
-
-		mod = &voice->mod[i];
-		gen = mod->dest;
-		modval = 0.0;
-
-		/* Accumulate the modulation values of all the modulators with
-		 * destination generator 'gen' */
-		for (k = 0; k < voice->nMods; k++) {
-			if (modHasDest (&voice->mod[k], gen)) {
-				modval += modGetValue (&voice->mod[k], voice->channel, voice);
-			}
-		}
-
-		voice->gen[gen].mod = modval;
-
-		/* Update the parameter values that are depend on the generator
-		 * 'gen' */
-		voiceUpdateParam (voice, gen);
-	}
+	for (d = 0; d < voice->modIndex->nDests; d++)
+		voiceModUpdateDest (voice, d);
 
 	return OK;
 }
@@ -1457,7 +1994,15 @@ int voiceNoteoff (Voice * voice) {
 		voice->volenvCount = 0;
 		voice->modenvSection = VOICE_ENVRELEASE;
 		voice->modenvCount = 0;
+		/* the release section takes over on this frame: the parameters
+		 * are recalculated from it.  The block's envelope and LFO step is
+		 * done already, the release steps on from the next block. */
+		if (voice->blockState != VOICE_BLOCK_PENDING) {
+			voice->blockState = VOICE_BLOCK_RENDER;
+			voice->paramsDirty = 1;
+		}
 	}
+	voiceMgrTouch (voice);
 
 	return OK;
 }
@@ -1500,6 +2045,7 @@ int voiceKillExcl (Voice * voice) {
 	/* Speed up the modulation envelope */
 	voiceGenSet (voice, GEN_MODENVRELEASE, -200);
 	voiceUpdateParam (voice, GEN_MODENVRELEASE);
+	voiceMgrTouch (voice);
 
 	return OK;
 }
@@ -1518,10 +2064,16 @@ int voiceOff (Voice * voice) {
 	voice->modenvSection = VOICE_ENVFINISHED;
 	voice->modenvCount = 0;
 	voice->status = VOICE_OFF;
+	voiceMgrTouch (voice);
 
 	/* Decrement the reference count of the sample. */
-	if (voice->sampleP) 
+	if (voice->sampleP) {
+		if (voice->sampleP->streamP != NULL)
+			sfStreamUnpin (voice->sampleP->streamP);
+		if (voice->sampleP->diskP != NULL)
+			sfDiskRelease (voice->sampleP->diskP, &voice->diskChunk);
 		voice->sampleP = NULL;
+	}
 
 	return OK;
 }
@@ -1666,10 +2218,10 @@ int voiceSetGain (Voice * voice, realT gain) {
 	}
 
 	voice->synthGain = gain;
-	voice->ampLeft = pan (voice->pan, 1) * gain / 32768.0f;
-	voice->ampRight = pan (voice->pan, 0) * gain / 32768.0f;
-	voice->ampReverb = voice->reverbSend * gain / 32768.0f;
-	voice->ampChorus = voice->chorusSend * gain / 32768.0f;
+	voice->ampLeft = pan (voice->pan, 1) * gain * BUS_NORM;
+	voice->ampRight = pan (voice->pan, 0) * gain * BUS_NORM;
+	voice->ampReverb = voice->reverbSend * gain * BUS_NORM;
+	voice->ampChorus = voice->chorusSend * gain * BUS_NORM;
 
 	return OK;
 }
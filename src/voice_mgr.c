@@ -0,0 +1,281 @@
+#include "fluidbean.h"
+#include "voice.h"
+#include "voice_mgr.h"
+
+/* voices that are already off go first */
+#define VOICE_PRIO_OFF (-((sint64) 1 << 62))
+
+/*
+ * voiceMgrPrio
+ *
+ * How 'important' a voice is; the refinement of the old allocator's
+ * estimate that synthFreeVoiceByKill used to run over every voice.  The
+ * loudness is taken when the envelope section changes, not every block.
+ */
+static sint64 voiceMgrPrio (Voice * voice) {
+	sint64 prio;
+
+	if (_AVAILABLE (voice))
+		return VOICE_PRIO_OFF;
+
+	/* Start with an arbitrary number */
+	prio = 10000;
+
+	/* The key for this voice has been released. Consider it much less
+	 * important than a voice, which is still held. */
+	if (_RELEASED (voice))
+		prio -= 2000;
+
+	/* The sustain pedal is held down on this channel.  Usually it's used
+	 * to play 'more-voices-than-fingers', so it shouldn't hurt if we kill
+	 * one of these. */
+	if (_SUSTAINED (voice))
+		prio -= 1000;
+
+	/* An older voice is just a little bit less important than a younger one,
+	 * so a chord doesn't kill its own notes.  The ids grow with every
+	 * note-on; the old synth->noteid - id has the same ordering. */
+	prio += voice->id;
+
+	/* louder voices are more important */
+	if (voice->volenvSection != VOICE_ENVATTACK)
+		prio += (sint64) (voice->volenvVal * 1000.);
+
+	return prio;
+}
+
+/*
+ * heapSwap_
+ */
+#define heapSwap_(_mgr, _i, _j) { \
+	Voice *tmp_ = (_mgr)->heap[_i]; \
+	(_mgr)->heap[_i] = (_mgr)->heap[_j]; \
+	(_mgr)->heap[_j] = tmp_; \
+	(_mgr)->heap[_i]->heapIdx = (_i); \
+	(_mgr)->heap[_j]->heapIdx = (_j); \
+}
+
+/*
+ * voiceMgrSift
+ *
+ * Restores the heap order around entry i after its priority changed.
+ */
+static void voiceMgrSift (voiceMgrT * mgr, S32 i) {
+	S32 parent, child;
+
+	while (i > 0) {
+		parent = (i - 1) / 2;
+		if (mgr->heap[parent]->prio <= mgr->heap[i]->prio)
+			break;
+		heapSwap_ (mgr, i, parent);
+		i = parent;
+	}
+
+	for (;;) {
+		child = 2 * i + 1;
+		if (child >= mgr->nHeap)
+			break;
+		if (child + 1 < mgr->nHeap && mgr->heap[child + 1]->prio < mgr->heap[child]->prio)
+			child++;
+		if (mgr->heap[i]->prio <= mgr->heap[child]->prio)
+			break;
+		heapSwap_ (mgr, i, child);
+		i = child;
+	}
+}
+
+/*
+ * newVoiceMgr
+ */
+voiceMgrT *newVoiceMgr (S32 nvoice, S32 midiChannels) {
+	voiceMgrT *mgr;
+
+	mgr = NEW (voiceMgrT);
+	if (mgr == NULL)
+		return NULL;
+	MEMSET (mgr, 0, sizeof (voiceMgrT));
+
+	mgr->nvoice = nvoice;
+	mgr->nSlots = midiChannels * 128;
+	mgr->freeVoice = ARRAY (Voice *, nvoice);
+	mgr->heap = ARRAY (Voice *, nvoice);
+	mgr->dirty = ARRAY (Voice *, nvoice);
+	mgr->keyList = ARRAY (Voice *, mgr->nSlots);
+	mgr->classList = ARRAY (Voice *, mgr->nSlots);
+	if (mgr->freeVoice == NULL || mgr->heap == NULL || mgr->dirty == NULL
+			|| mgr->keyList == NULL || mgr->classList == NULL) {
+		deleteVoiceMgr (mgr);
+		return NULL;
+	}
+	MEMSET (mgr->keyList, 0, mgr->nSlots * sizeof (Voice *));
+	MEMSET (mgr->classList, 0, mgr->nSlots * sizeof (Voice *));
+
+	return mgr;
+}
+
+/*
+ * deleteVoiceMgr
+ */
+void deleteVoiceMgr (voiceMgrT * mgr) {
+	if (mgr == NULL)
+		return;
+	if (mgr->freeVoice != NULL)
+		FREE (mgr->freeVoice);
+	if (mgr->heap != NULL)
+		FREE (mgr->heap);
+	if (mgr->dirty != NULL)
+		FREE (mgr->dirty);
+	if (mgr->keyList != NULL)
+		FREE (mgr->keyList);
+	if (mgr->classList != NULL)
+		FREE (mgr->classList);
+	FREE (mgr);
+}
+
+/*
+ * voiceMgrReset
+ */
+void voiceMgrReset (voiceMgrT * mgr) {
+	mgr->nFree = 0;
+	mgr->nHeap = 0;
+	__atomic_store_n (&mgr->nDirty, 0, __ATOMIC_RELEASE);
+	MEMSET (mgr->keyList, 0, mgr->nSlots * sizeof (Voice *));
+	MEMSET (mgr->classList, 0, mgr->nSlots * sizeof (Voice *));
+}
+
+/*
+ * voiceMgrAlloc
+ */
+Voice *voiceMgrAlloc (voiceMgrT * mgr) {
+	if (mgr->nFree == 0)
+		return NULL;
+	return mgr->freeVoice[--mgr->nFree];
+}
+
+/*
+ * voiceMgrFree
+ */
+void voiceMgrFree (voiceMgrT * mgr, Voice * voice) {
+	if (mgr->nFree < mgr->nvoice)
+		mgr->freeVoice[mgr->nFree++] = voice;
+}
+
+/*
+ * voiceMgrStart
+ */
+void voiceMgrStart (voiceMgrT * mgr, Voice * voice, S32 exclClass) {
+	Voice **headP;
+
+	voiceMgrUnlink (mgr, voice);
+
+	if (voice->chan < mgr->nSlots / 128) {
+		voice->keySlot = voice->chan * 128 + voice->key;
+		headP = &mgr->keyList[voice->keySlot];
+		voice->keyPrev = NULL;
+		voice->keyNext = *headP;
+		if (*headP != NULL)
+			(*headP)->keyPrev = voice;
+		*headP = voice;
+
+		if (exclClass > 0 && exclClass < 128) {
+			voice->classSlot = voice->chan * 128 + exclClass;
+			headP = &mgr->classList[voice->classSlot];
+			voice->classPrev = NULL;
+			voice->classNext = *headP;
+			if (*headP != NULL)
+				(*headP)->classPrev = voice;
+			*headP = voice;
+		}
+	}
+
+	voice->prio = voiceMgrPrio (voice);
+	voice->heapIdx = mgr->nHeap;
+	mgr->heap[mgr->nHeap++] = voice;
+	voiceMgrSift (mgr, voice->heapIdx);
+}
+
+/*
+ * voiceMgrUnlinkClass
+ */
+void voiceMgrUnlinkClass (voiceMgrT * mgr, Voice * voice) {
+	if (voice->classSlot < 0)
+		return;
+	if (voice->classPrev != NULL)
+		voice->classPrev->classNext = voice->classNext;
+	else
+		mgr->classList[voice->classSlot] = voice->classNext;
+	if (voice->classNext != NULL)
+		voice->classNext->classPrev = voice->classPrev;
+	voice->classPrev = voice->classNext = NULL;
+	voice->classSlot = -1;
+}
+
+/*
+ * voiceMgrUnlink
+ */
+void voiceMgrUnlink (voiceMgrT * mgr, Voice * voice) {
+	S32 i = voice->heapIdx;
+
+	if (voice->keySlot >= 0) {
+		if (voice->keyPrev != NULL)
+			voice->keyPrev->keyNext = voice->keyNext;
+		else
+			mgr->keyList[voice->keySlot] = voice->keyNext;
+		if (voice->keyNext != NULL)
+			voice->keyNext->keyPrev = voice->keyPrev;
+		voice->keyPrev = voice->keyNext = NULL;
+		voice->keySlot = -1;
+	}
+	voiceMgrUnlinkClass (mgr, voice);
+
+	if (i >= 0) {
+		voice->heapIdx = -1;
+		if (i != --mgr->nHeap) {
+			mgr->heap[i] = mgr->heap[mgr->nHeap];
+			mgr->heap[i]->heapIdx = i;
+			voiceMgrSift (mgr, i);
+		}
+	}
+}
+
+/*
+ * voiceMgrTouch
+ *
+ * Render threads only ever get here for their own voices, and each voice
+ * goes onto the stack once until the next flush, so it can't overflow.
+ */
+void voiceMgrTouch (Voice * voice) {
+	voiceMgrT *mgr = voice->mgr;
+
+	if (mgr == NULL || voice->heapIdx < 0)
+		return;
+	if (__atomic_exchange_n (&voice->prioDirty, 1, __ATOMIC_ACQ_REL))
+		return;
+	mgr->dirty[__atomic_fetch_add (&mgr->nDirty, 1, __ATOMIC_ACQ_REL)] = voice;
+}
+
+/*
+ * voiceMgrFlush
+ */
+void voiceMgrFlush (voiceMgrT * mgr) {
+	S32 i, n = __atomic_load_n (&mgr->nDirty, __ATOMIC_ACQUIRE);
+	Voice *voice;
+
+	for (i = 0; i < n; i++) {
+		voice = mgr->dirty[i];
+		voice->prioDirty = 0;
+		if (voice->heapIdx >= 0) {
+			voice->prio = voiceMgrPrio (voice);
+			voiceMgrSift (mgr, voice->heapIdx);
+		}
+	}
+	__atomic_store_n (&mgr->nDirty, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * voiceMgrVictim
+ */
+Voice *voiceMgrVictim (voiceMgrT * mgr) {
+	voiceMgrFlush (mgr);
+	return mgr->nHeap > 0 ? mgr->heap[0] : NULL;
+}